@@ -0,0 +1,187 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+//
+// Checkpoint benchmark
+//
+// Runs a binary and stops it every given number of system calls. At the
+// first stop a full checkpoint is written to the image file, at the second
+// one an incremental one. Afterwards a new VM is restored from the image
+// and run to the next stop, which only reads the guest memory it uses.
+// Usage: bench_checkpoint [-s syscalls] image binary [binaryopts]
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/kvm.h>
+#include <elkvm/pager.h>
+
+static unsigned long syscalls_per_stop = 1000;
+static unsigned long syscalls_left = 0;
+static bool exited = false;
+
+static long
+stop_post_handler(Elkvm::VM* vm,
+                  const std::shared_ptr<Elkvm::VCPU>& vcpu __attribute__((unused)),
+                  int eventtype)
+{
+  if (eventtype != ELKVM_HYPERCALL_SYSCALL)
+    return 0;
+
+  if (--syscalls_left == 0) {
+    syscalls_left = syscalls_per_stop;
+    vm->stop();
+  }
+  return 0;
+}
+
+/* the guest exiting only ends run() */
+static void
+note_exit_group(int status __attribute__((unused)))
+{
+  exited = true;
+}
+
+static void usage(const char *name)
+{
+  std::cerr << "Usage: " << name
+            << " [-s syscalls] image binary [binaryopts]" << std::endl;
+}
+
+static long elapsed_us(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+static long allocated_kib(const char *path)
+{
+  struct stat st;
+  if (stat(path, &st)) {
+    return -1;
+  }
+  return st.st_blocks / 2;
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  while((opt = getopt(argc, argv, "+s:")) != -1) {
+    switch(opt) {
+      case 's':
+        syscalls_per_stop = strtoul(optarg, nullptr, 0);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if(optind + 1 >= argc || syscalls_per_stop == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  const char *image = argv[optind++];
+  syscalls_left = syscalls_per_stop;
+
+  Elkvm::elkvm_opts opts;
+  int err = elkvm_init(&opts, argc - optind, &argv[optind], environ);
+  if (err) {
+    ERROR() << "ERROR initializing ELKVM: " << strerror(-err);
+    return 1;
+  }
+  opts.mem_flags = ELKVM_MEM_LOG_DIRTY;
+
+  Elkvm::hypercall_handlers stop_handlers = {
+    .pre_handler = nullptr,
+    .post_handler = stop_post_handler
+  };
+  Elkvm::elkvm_handlers handlers = Elkvm::default_handlers;
+  handlers.exit_group = note_exit_group;
+
+  std::shared_ptr<Elkvm::VM> vm = elkvm_vm_create(&opts, argv[optind], 1,
+      &stop_handlers, &handlers);
+  if (vm == nullptr) {
+    ERROR() << "ERROR creating VM: " << strerror(errno);
+    return 1;
+  }
+
+  unlink(image);
+  const char *kind[] = { "full", "incremental" };
+  for(unsigned i = 0; i < 2; i++) {
+    err = vm->run();
+    if (err || exited) {
+      ERROR() << "ERROR: binary ended before checkpoint " << i;
+      return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    err = vm->checkpoint(image);
+    long us = elapsed_us(start);
+    if (err) {
+      ERROR() << "ERROR writing checkpoint: " << strerror(-err);
+      return 1;
+    }
+    std::cout << kind[i] << " checkpoint: " << us << " us, "
+              << allocated_kib(image) << " KiB allocated in the image"
+              << std::endl;
+  }
+
+  std::shared_ptr<Elkvm::VM> restored = elkvm_vm_create(&opts, argv[optind], 1,
+      &stop_handlers, &handlers);
+  if (restored == nullptr) {
+    ERROR() << "ERROR creating VM: " << strerror(errno);
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  err = restored->restore(image);
+  long us = elapsed_us(start);
+  if (err) {
+    ERROR() << "ERROR restoring checkpoint: " << strerror(-err);
+    return 1;
+  }
+  std::cout << "restore: " << us << " us" << std::endl;
+
+  start = std::chrono::steady_clock::now();
+  err = restored->run();
+  us = elapsed_us(start);
+  if (err) {
+    ERROR() << "ERROR running restored VM: " << strerror(-err);
+    return 1;
+  }
+  std::cout << "restored VM " << (exited ? "exited" : "stopped again")
+            << " after " << us << " us" << std::endl;
+
+  err = elkvm_cleanup(&opts);
+  if (err) {
+    ERROR() << "Error during cleanup: " << strerror(-err);
+    return 1;
+  }
+  return 0;
+}
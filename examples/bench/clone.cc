@@ -0,0 +1,206 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+//
+// VM clone benchmark
+//
+// Runs a binary up to a ready point (after the given number of system
+// calls, or until it exits), takes a snapshot and then measures how fast
+// copy-on-write clones can be created from it compared to creating a VM
+// from scratch. With -r one clone runs the binary to its end and is reset to
+// the snapshot again, as many times as given.
+// Usage: bench_clone [-s syscalls] [-n clones] [-r runs] binary [binaryopts]
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include <unistd.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/kvm.h>
+#include <elkvm/pager.h>
+#include <elkvm/snapshot.h>
+
+static unsigned long syscalls_left = 0;
+
+static long
+ready_post_handler(Elkvm::VM* vm,
+                   const std::shared_ptr<Elkvm::VCPU>& vcpu __attribute__((unused)),
+                   int eventtype)
+{
+  if (eventtype != ELKVM_HYPERCALL_SYSCALL || syscalls_left == 0)
+    return 0;
+
+  if (--syscalls_left == 0) {
+    vm->stop();
+  }
+  return 0;
+}
+
+/* the guest exiting only ends run(), the VM can be reset afterwards */
+static void
+keep_exit_group(int status __attribute__((unused)))
+{
+}
+
+static void usage(const char *name)
+{
+  std::cerr << "Usage: " << name
+            << " [-s syscalls] [-n clones] [-r runs] binary [binaryopts]"
+            << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned clones = 1000;
+  unsigned runs = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "+s:n:r:")) != -1) {
+    switch(opt) {
+      case 's':
+        syscalls_left = strtoul(optarg, nullptr, 0);
+        break;
+      case 'n':
+        clones = strtoul(optarg, nullptr, 0);
+        break;
+      case 'r':
+        runs = strtoul(optarg, nullptr, 0);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if(optind >= argc || clones == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  Elkvm::elkvm_opts opts;
+  int err = elkvm_init(&opts, argc - optind, &argv[optind], environ);
+  if (err) {
+    ERROR() << "ERROR initializing ELKVM: " << strerror(-err);
+    return 1;
+  }
+
+  if (runs) {
+    opts.mem_flags = ELKVM_MEM_LOG_DIRTY;
+  }
+
+  Elkvm::hypercall_handlers ready_handlers = {
+    .pre_handler = nullptr,
+    .post_handler = ready_post_handler
+  };
+  Elkvm::elkvm_handlers handlers = Elkvm::default_handlers;
+  handlers.exit_group = keep_exit_group;
+
+  std::shared_ptr<Elkvm::VM> vm = elkvm_vm_create(&opts, argv[optind], 1,
+      &ready_handlers, &handlers);
+  if (vm == nullptr) {
+    ERROR() << "ERROR creating VM: " << strerror(errno);
+    return 1;
+  }
+
+  if (syscalls_left) {
+    err = vm->run();
+    if (err) {
+      ERROR() << "ERROR running VM: " << strerror(-err);
+      return 1;
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::shared_ptr<Elkvm::Snapshot> snap = vm->snapshot();
+  auto end = std::chrono::steady_clock::now();
+  if (snap == nullptr) {
+    ERROR() << "ERROR taking snapshot: " << strerror(errno);
+    return 1;
+  }
+  std::cout << "snapshot: "
+            << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()
+            << " us" << std::endl;
+
+  start = std::chrono::steady_clock::now();
+  for(unsigned i = 0; i < clones; i++) {
+    std::shared_ptr<Elkvm::VM> clone = snap->clone();
+    if (clone == nullptr) {
+      ERROR() << "ERROR cloning VM: " << strerror(errno);
+      return 1;
+    }
+  }
+  end = std::chrono::steady_clock::now();
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+  std::cout << "clone: " << us / clones << " us per VM, "
+            << clones * 1000000.0 / us << " VMs/s" << std::endl;
+
+  if (runs) {
+    std::shared_ptr<Elkvm::VM> clone = snap->clone();
+    if (clone == nullptr) {
+      ERROR() << "ERROR cloning VM: " << strerror(errno);
+      return 1;
+    }
+
+    start = std::chrono::steady_clock::now();
+    for(unsigned i = 0; i < runs; i++) {
+      err = clone->run();
+      if (err) {
+        ERROR() << "ERROR running VM: " << strerror(-err);
+        return 1;
+      }
+      err = clone->reset(*snap);
+      if (err) {
+        ERROR() << "ERROR resetting VM: " << strerror(-err);
+        return 1;
+      }
+    }
+    end = std::chrono::steady_clock::now();
+    us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    std::cout << "run and reset: " << us / runs << " us per run, "
+              << runs * 1000000.0 / us << " runs/s" << std::endl;
+  }
+
+  /* fresh VMs stay in the global VM list, keep the count small */
+  unsigned fresh = clones < 20 ? clones : 20;
+  start = std::chrono::steady_clock::now();
+  for(unsigned i = 0; i < fresh; i++) {
+    std::shared_ptr<Elkvm::VM> cold = elkvm_vm_create(&opts, argv[optind]);
+    if (cold == nullptr) {
+      ERROR() << "ERROR creating VM: " << strerror(errno);
+      return 1;
+    }
+  }
+  end = std::chrono::steady_clock::now();
+  us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+  std::cout << "create: " << us / fresh << " us per VM, "
+            << fresh * 1000000.0 / us << " VMs/s" << std::endl;
+
+  snap = nullptr;
+  err = elkvm_cleanup(&opts);
+  if (err) {
+    ERROR() << "Error during cleanup: " << strerror(-err);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,175 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+//
+//
+// VM creation benchmark
+//
+// Creates a number of VMs, raw ones or of the given binary, and reports the
+// average time spent in each phase of the creation as measured by
+// VM::create_stats(). With -p the VMs are taken from a VMPool of the given
+// size instead, once it is filled, and the time per acquire() is reported.
+// Usage: bench_create [-n vms] [-p poolsize] [binary [binaryopts]]
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/kvm.h>
+#include <elkvm/vmpool.h>
+
+static void usage(const char *name)
+{
+  std::cerr << "Usage: " << name
+            << " [-n vms] [-p poolsize] [binary [binaryopts]]" << std::endl;
+}
+
+static void print_phase(const char *name, uint64_t ns, unsigned vms)
+{
+  std::cout << name << ": " << ns / vms / 1000.0 << " us" << std::endl;
+}
+
+static int bench_create(Elkvm::elkvm_opts *opts, const char *binary,
+                        unsigned vms)
+{
+  /* created VMs stay in the global VM list until elkvm_cleanup */
+  Elkvm::elkvm_create_stats sum;
+  memset(&sum, 0, sizeof(sum));
+  for(unsigned i = 0; i < vms; i++) {
+    std::shared_ptr<Elkvm::VM> vm = binary
+      ? elkvm_vm_create(opts, binary)
+      : elkvm_vm_create_raw(opts);
+    if (vm == nullptr) {
+      ERROR() << "ERROR creating VM: " << strerror(errno);
+      return 1;
+    }
+
+    const Elkvm::elkvm_create_stats &stats = vm->create_stats();
+    sum.vm += stats.vm;
+    sum.vcpus += stats.vcpus;
+    sum.binary += stats.binary;
+    sum.proxy_os += stats.proxy_os;
+    sum.total += stats.total;
+  }
+
+  print_phase("vm", sum.vm, vms);
+  print_phase("vcpus", sum.vcpus, vms);
+  if (binary) {
+    print_phase("binary", sum.binary, vms);
+  }
+  print_phase("proxy os", sum.proxy_os, vms);
+  print_phase("total", sum.total, vms);
+  return 0;
+}
+
+/* the pooled VMs keep the host process alive when the guest exits */
+static void
+keep_exit_group(int status __attribute__((unused)))
+{
+}
+
+static int bench_pool(Elkvm::elkvm_opts *opts, const char *binary,
+                      unsigned vms, unsigned size)
+{
+  Elkvm::elkvm_handlers handlers = Elkvm::default_handlers;
+  handlers.exit_group = keep_exit_group;
+
+  std::shared_ptr<Elkvm::VMPool> pool = Elkvm::VMPool::create(opts, size,
+      binary, &Elkvm::hypercall_null, &handlers);
+  if (pool == nullptr) {
+    ERROR() << "ERROR creating VM pool: " << strerror(errno);
+    return 1;
+  }
+  while (pool->available() < size) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  std::vector<std::shared_ptr<Elkvm::VM>> taken;
+  auto start = std::chrono::steady_clock::now();
+  for(unsigned i = 0; i < vms; i++) {
+    std::shared_ptr<Elkvm::VM> vm = pool->acquire();
+    if (vm == nullptr) {
+      ERROR() << "ERROR acquiring VM: " << strerror(errno);
+      return 1;
+    }
+    taken.push_back(vm);
+  }
+  auto end = std::chrono::steady_clock::now();
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+  std::cout << "acquire: " << ns.count() / vms / 1000.0 << " us" << std::endl;
+
+  for(auto &vm : taken) {
+    pool->release(vm);
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned vms = 20;
+  unsigned poolsize = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "+n:p:")) != -1) {
+    switch(opt) {
+      case 'n':
+        vms = strtoul(optarg, nullptr, 0);
+        break;
+      case 'p':
+        poolsize = strtoul(optarg, nullptr, 0);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if(vms == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  const char *binary = optind < argc ? argv[optind] : nullptr;
+
+  Elkvm::elkvm_opts opts;
+  int err = elkvm_init(&opts, argc - optind, &argv[optind], environ);
+  if (err) {
+    ERROR() << "ERROR initializing ELKVM: " << strerror(-err);
+    return 1;
+  }
+
+  err = poolsize ? bench_pool(&opts, binary, vms, poolsize)
+                 : bench_create(&opts, binary, vms);
+  if (err) {
+    return err;
+  }
+
+  err = elkvm_cleanup(&opts);
+  if (err) {
+    ERROR() << "Error during cleanup: " << strerror(-err);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// VM density benchmark
+//
+// Creates a number of VMs of the same binary with mergeable guest memory,
+// gives KSM some time to scan them and reports the pages shared per VM.
+// KSM has to be enabled (echo 1 > /sys/kernel/mm/ksm/run) and reading
+// the page flags needs root.
+// Usage: bench_density [vms] [seconds] binary [binaryopts]
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <unistd.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/kvm.h>
+#include <elkvm/pager.h>
+
+int main(int argc, char *argv[])
+{
+  if(argc < 4) {
+    std::cerr << "Usage: " << argv[0] << " [vms] [seconds] binary [binaryopts]"
+              << std::endl;
+    return 1;
+  }
+  unsigned vms = atoi(argv[1]);
+  unsigned seconds = atoi(argv[2]);
+
+  Elkvm::elkvm_opts opts;
+  int err = elkvm_init(&opts, argc - 3, &argv[3], environ);
+  if (err) {
+    ERROR() << "ERROR initializing ELKVM: " << strerror(-err);
+    return 1;
+  }
+  opts.mem_flags = ELKVM_MEM_MERGEABLE;
+
+  std::vector<std::shared_ptr<Elkvm::VM>> vm;
+  for(unsigned i = 0; i < vms; i++) {
+    vm.push_back(elkvm_vm_create(&opts, argv[3]));
+    if (vm.back() == nullptr) {
+      ERROR() << "ERROR creating VM: " << strerror(errno);
+      return 1;
+    }
+  }
+
+  sleep(seconds);
+
+  size_t total = 0;
+  for(unsigned i = 0; i < vms; i++) {
+    size_t pages;
+    err = vm[i]->merged_pages(&pages);
+    if (err) {
+      ERROR() << "ERROR reading merged pages: " << strerror(-err);
+      return 1;
+    }
+    std::cout << "VM " << i << ": " << pages << " pages shared" << std::endl;
+    total += pages;
+  }
+  std::cout << "total: " << total << " pages shared by " << vms << " VMs"
+            << std::endl;
+
+  err = elkvm_cleanup(&opts);
+  if (err) {
+    ERROR() << "Error during cleanup: " << strerror(-err);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,113 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+// Host page fault benchmark
+//
+// Runs a binary in a VM and reports the host page faults taken while it
+// runs, i.e. after the VM has been set up, and where its memory went.
+// With -p guest memory is populated up front, with -l it is locked as well.
+// Usage: bench_faults [-p] [-l] binary [binaryopts]
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/kvm.h>
+#include <elkvm/pager.h>
+
+int main(int argc, char *argv[])
+{
+  unsigned mem_flags = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "+pl")) != -1) {
+    switch(opt) {
+      case 'p':
+        mem_flags |= ELKVM_MEM_POPULATE;
+        break;
+      case 'l':
+        mem_flags |= ELKVM_MEM_POPULATE | ELKVM_MEM_LOCK;
+        break;
+      default:
+        std::cerr << "Usage: " << argv[0] << " [-p] [-l] binary [binaryopts]"
+                  << std::endl;
+        return 1;
+    }
+  }
+  if(optind >= argc) {
+    std::cerr << "Usage: " << argv[0] << " [-p] [-l] binary [binaryopts]"
+              << std::endl;
+    return 1;
+  }
+
+  Elkvm::elkvm_opts opts;
+  int err = elkvm_init(&opts, argc - optind, &argv[optind], environ);
+  if (err) {
+    ERROR() << "ERROR initializing ELKVM: " << strerror(-err);
+    return 1;
+  }
+  opts.mem_flags = mem_flags;
+
+  std::shared_ptr<Elkvm::VM> vm = elkvm_vm_create(&opts, argv[optind]);
+  if (vm == nullptr) {
+    ERROR() << "ERROR creating VM: " << strerror(errno);
+    return 1;
+  }
+
+  struct rusage before, after;
+  getrusage(RUSAGE_SELF, &before);
+  err = vm->run();
+  getrusage(RUSAGE_SELF, &after);
+  if (err) {
+    ERROR() << "ERROR running VM: " << strerror(-err);
+    return 1;
+  }
+
+  std::cout << "host page faults while running: "
+            << after.ru_minflt - before.ru_minflt << " minor, "
+            << after.ru_majflt - before.ru_majflt << " major" << std::endl;
+
+  auto stats = vm->memory_stats();
+  std::cout << "guest memory (KiB): "
+            << stats.total / 1024 << " total, "
+            << stats.resident / 1024 << " resident, "
+            << stats.page_tables / 1024 << " page tables, "
+            << stats.elf / 1024 << " ELF, "
+            << stats.heap / 1024 << " heap, "
+            << stats.stack / 1024 << " stack, "
+            << stats.system / 1024 << " system, "
+            << stats.slack / 1024 << " slack" << std::endl;
+
+  err = elkvm_cleanup(&opts);
+  if (err) {
+    ERROR() << "Error during cleanup: " << strerror(-err);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//
+// Guest I/O throughput benchmark
+//
+// Writes and reads back a file through the pwrite64 and pread64 handlers
+// with buffers in guest memory, once with the default handlers, once with
+// the io_uring handlers and once more with guest memory registered as
+// io_uring fixed buffers. The file is created in the given directory and
+// removed afterwards.
+// Usage: bench_io [directory] [file size in MiB]
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/io_uring.h>
+#include <elkvm/kvm.h>
+#include <elkvm/pager.h>
+#include <elkvm/region.h>
+#include <elkvm/region_manager.h>
+
+static const size_t max_block = 1024 * 1024;
+
+static double transfer(const Elkvm::elkvm_handlers &h, int fd, char *buf,
+    size_t block, size_t file_size, bool write) {
+  auto start = std::chrono::steady_clock::now();
+  for(size_t off = 0; off < file_size; off += block) {
+    long ret = write ? h.pwrite64(fd, buf, block, off)
+                     : h.pread64(fd, buf, block, off);
+    if(ret != static_cast<long>(block)) {
+      ERROR() << "ERROR short transfer: " << strerror(errno);
+      exit(1);
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  return file_size / std::chrono::duration<double>(end - start).count()
+    / (1024 * 1024);
+}
+
+static void run(const char *name, const Elkvm::elkvm_handlers &h, int fd,
+    char *buf, size_t file_size) {
+  for(size_t block = 4096; block <= max_block; block *= 16) {
+    double w = transfer(h, fd, buf, block, file_size, true);
+    double r = transfer(h, fd, buf, block, file_size, false);
+    std::cout << name << " " << block / 1024 << " KiB blocks: write "
+              << w << " MiB/s, read " << r << " MiB/s" << std::endl;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  std::string dir = argc > 1 ? argv[1] : "/tmp";
+  size_t file_size = (argc > 2 ? atol(argv[2]) : 256) * 1024 * 1024;
+
+  Elkvm::elkvm_opts opts;
+  int err = elkvm_init(&opts, argc, argv, environ);
+  if (err) {
+    ERROR() << "ERROR initializing ELKVM: " << strerror(-err);
+    return 1;
+  }
+
+  std::shared_ptr<Elkvm::VM> vm = elkvm_vm_create_raw(&opts);
+  if (vm == nullptr) {
+    ERROR() << "ERROR creating VM: " << strerror(errno);
+    return 1;
+  }
+
+  auto &rm = vm->get_region_manager();
+  auto region = rm->allocate_region(max_block, "I/O benchmark");
+  char *buf = static_cast<char *>(region->base_address());
+  memset(buf, 0xaa, max_block);
+
+  std::string path = dir + "/bench_io.XXXXXX";
+  int fd = mkstemp(&path[0]);
+  if (fd < 0) {
+    ERROR() << "ERROR creating " << path << ": " << strerror(errno);
+    return 1;
+  }
+  unlink(path.c_str());
+
+  if (Elkvm::thread_io_uring() == nullptr) {
+    std::cout << "no io_uring on this host, io_uring handlers fall back "
+              << "to plain system calls" << std::endl;
+  }
+
+  run("default", Elkvm::default_handlers, fd, buf, file_size);
+  run("io_uring", Elkvm::io_uring_handlers, fd, buf, file_size);
+  Elkvm::io_uring_use_memory(&rm->get_pager());
+  run("io_uring fixed", Elkvm::io_uring_handlers, fd, buf, file_size);
+  Elkvm::io_uring_use_memory(nullptr);
+  close(fd);
+
+  err = elkvm_cleanup(&opts);
+  if (err) {
+    ERROR() << "Error during cleanup: " << strerror(-err);
+    return 1;
+  }
+  return 0;
+}
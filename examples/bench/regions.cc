@@ -0,0 +1,117 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//
+// Parallel region allocation benchmark
+//
+// Every thread repeatedly allocates and frees small regions, as anonymous
+// mmap/munmap calls do, for 1 to 32 threads.
+// Usage: bench_regions [max threads] [allocations per thread]
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/kvm.h>
+#include <elkvm/pager.h>
+#include <elkvm/region.h>
+#include <elkvm/region_manager.h>
+
+/* number of regions each thread keeps alive at the same time */
+static const unsigned live_regions = 8;
+
+static void allocate(Elkvm::RegionManager &rm, unsigned seed,
+    unsigned long count) {
+  unsigned long x = seed * 2654435761UL + 1;
+  std::vector<std::shared_ptr<Elkvm::Region>> live(live_regions);
+
+  for(unsigned long i = 0; i < count; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    auto &slot = live[i % live_regions];
+    if(slot != nullptr) {
+      rm.free_region(slot);
+    }
+    size_t pages = 1 + (x % Elkvm::RegionManager::cache_pages);
+    slot = rm.allocate_region(pages * ELKVM_PAGESIZE, "bench region");
+  }
+
+  for(auto &r : live) {
+    if(r != nullptr) {
+      rm.free_region(r);
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned max_threads = argc > 1 ? atoi(argv[1]) : 32;
+  unsigned long count = argc > 2 ? atol(argv[2]) : 1000000;
+
+  Elkvm::elkvm_opts opts;
+  int err = elkvm_init(&opts, argc, argv, environ);
+  if (err) {
+    ERROR() << "ERROR initializing ELKVM: " << strerror(-err);
+    return 1;
+  }
+
+  std::shared_ptr<Elkvm::VM> vm = elkvm_vm_create_raw(&opts);
+  if (vm == nullptr) {
+    ERROR() << "ERROR creating VM: " << strerror(errno);
+    return 1;
+  }
+
+  Elkvm::RegionManager &rm = *vm->get_region_manager();
+  for(unsigned threads = 1; threads <= max_threads; threads *= 2) {
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned t = 0; t < threads; t++) {
+      workers.emplace_back(allocate, std::ref(rm), t, count);
+    }
+    for(auto &w : workers) {
+      w.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double secs = std::chrono::duration<double>(end - start).count();
+    std::cout << threads << " thread(s): "
+              << (threads * count) / secs / 1e6
+              << " M allocate/free pairs/s" << std::endl;
+  }
+
+  err = elkvm_cleanup(&opts);
+  if (err) {
+    ERROR() << "Error during cleanup: " << strerror(-err);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,179 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//
+// Loopback UDP throughput benchmark
+//
+// Sends datagrams from guest memory over a loopback UDP socket and
+// receives them into guest memory again, once per datagram with the
+// sendto and recvfrom handlers and once in batches with sendmmsg and
+// recvmmsg. Every handler call stands for one VM exit of a guest doing
+// the same.
+// Usage: bench_socket [datagrams] [datagram size] [batch size]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/kvm.h>
+#include <elkvm/region.h>
+#include <elkvm/region_manager.h>
+
+static int udp_socket(struct sockaddr_in *addr) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if(fd < 0) {
+    return -1;
+  }
+  /* large enough for a whole batch in flight */
+  int size = 8 * 1024 * 1024;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(*addr);
+  if(bind(fd, reinterpret_cast<struct sockaddr *>(addr), len)
+      || getsockname(fd, reinterpret_cast<struct sockaddr *>(addr), &len)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void report(const char *name, unsigned long count, size_t size,
+    unsigned long calls, std::chrono::steady_clock::time_point start) {
+  auto end = std::chrono::steady_clock::now();
+  double secs = std::chrono::duration<double>(end - start).count();
+  std::cout << name << ": " << count / secs / 1e3 << " K datagrams/s, "
+            << count * size / secs / (1024 * 1024) << " MiB/s, "
+            << calls << " handler calls" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long count = argc > 1 ? atol(argv[1]) : 1000000;
+  size_t size = argc > 2 ? atol(argv[2]) : 64;
+  unsigned batch = argc > 3 ? atoi(argv[3]) : 64;
+
+  Elkvm::elkvm_opts opts;
+  int err = elkvm_init(&opts, argc, argv, environ);
+  if (err) {
+    ERROR() << "ERROR initializing ELKVM: " << strerror(-err);
+    return 1;
+  }
+
+  std::shared_ptr<Elkvm::VM> vm = elkvm_vm_create_raw(&opts);
+  if (vm == nullptr) {
+    ERROR() << "ERROR creating VM: " << strerror(errno);
+    return 1;
+  }
+
+  auto &rm = vm->get_region_manager();
+  auto region = rm->allocate_region(2 * batch * size, "socket benchmark");
+  char *tx = static_cast<char *>(region->base_address());
+  char *rx = tx + batch * size;
+  memset(tx, 0xaa, batch * size);
+
+  struct sockaddr_in rx_addr, tx_addr;
+  int rx_fd = udp_socket(&rx_addr);
+  int tx_fd = udp_socket(&tx_addr);
+  if (rx_fd < 0 || tx_fd < 0 || connect(tx_fd,
+        reinterpret_cast<struct sockaddr *>(&rx_addr), sizeof(rx_addr))) {
+    ERROR() << "ERROR setting up sockets: " << strerror(errno);
+    return 1;
+  }
+
+  const Elkvm::elkvm_handlers &h = Elkvm::default_handlers;
+  unsigned long calls = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(unsigned long i = 0; i < count; i++) {
+    if(h.sendto(tx_fd, tx, size, 0, nullptr, 0) != static_cast<long>(size)
+        || h.recvfrom(rx_fd, rx, size, 0, nullptr, nullptr)
+          != static_cast<long>(size)) {
+      ERROR() << "ERROR transferring datagram: " << strerror(errno);
+      return 1;
+    }
+    calls += 2;
+  }
+  report("sendto/recvfrom", count, size, calls, start);
+
+  std::vector<struct iovec> tx_iov(batch), rx_iov(batch);
+  std::vector<struct mmsghdr> tx_msgs(batch), rx_msgs(batch);
+  for(unsigned i = 0; i < batch; i++) {
+    tx_iov[i].iov_base = tx + i * size;
+    tx_iov[i].iov_len = size;
+    rx_iov[i].iov_base = rx + i * size;
+    rx_iov[i].iov_len = size;
+    memset(&tx_msgs[i], 0, sizeof(tx_msgs[i]));
+    tx_msgs[i].msg_hdr.msg_iov = &tx_iov[i];
+    tx_msgs[i].msg_hdr.msg_iovlen = 1;
+    memset(&rx_msgs[i], 0, sizeof(rx_msgs[i]));
+    rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+    rx_msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  calls = 0;
+  start = std::chrono::steady_clock::now();
+  for(unsigned long done = 0; done < count; ) {
+    unsigned n = std::min<unsigned long>(batch, count - done);
+    long sent = h.sendmmsg(tx_fd, tx_msgs.data(), n, 0);
+    calls++;
+    if(sent <= 0) {
+      ERROR() << "ERROR sending datagrams: " << strerror(errno);
+      return 1;
+    }
+    for(long received = 0; received < sent; calls++) {
+      long r = h.recvmmsg(rx_fd, rx_msgs.data(), sent - received, 0, nullptr);
+      if(r <= 0) {
+        ERROR() << "ERROR receiving datagrams: " << strerror(errno);
+        return 1;
+      }
+      received += r;
+    }
+    done += sent;
+  }
+  report("sendmmsg/recvmmsg", count, size, calls, start);
+
+  close(tx_fd);
+  close(rx_fd);
+
+  err = elkvm_cleanup(&opts);
+  if (err) {
+    ERROR() << "Error during cleanup: " << strerror(-err);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,126 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//
+// Multi-threaded guest address translation benchmark
+//
+// Maps a guest buffer larger than the per-thread TLB and lets an increasing
+// number of threads translate random addresses in it with get_host_p().
+// Usage: bench_translate [max threads] [translations per thread]
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/kvm.h>
+#include <elkvm/pager.h>
+#include <elkvm/region.h>
+#include <elkvm/region_manager.h>
+
+static const guestptr_t bench_base = 0x10000000;
+static const size_t bench_size = 64 * 1024 * 1024;
+
+static void translate(const Elkvm::PagerX86_64 &pager, unsigned seed,
+    unsigned long count, unsigned long *misses) {
+  unsigned long x = seed * 2654435761UL + 1;
+  unsigned long bad = 0;
+  for(unsigned long i = 0; i < count; i++) {
+    /* xorshift, cheap enough to not dominate the measurement */
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    guestptr_t addr = bench_base + (x % bench_size);
+    if(pager.get_host_p(addr) == nullptr) {
+      bad++;
+    }
+  }
+  *misses = bad;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned max_threads = argc > 1 ? atoi(argv[1])
+                                  : std::thread::hardware_concurrency();
+  unsigned long count = argc > 2 ? atol(argv[2]) : 10000000;
+
+  Elkvm::elkvm_opts opts;
+  int err = elkvm_init(&opts, argc, argv, environ);
+  if (err) {
+    ERROR() << "ERROR initializing ELKVM: " << strerror(-err);
+    return 1;
+  }
+
+  std::shared_ptr<Elkvm::VM> vm = elkvm_vm_create_raw(&opts);
+  if (vm == nullptr) {
+    ERROR() << "ERROR creating VM: " << strerror(errno);
+    return 1;
+  }
+
+  auto &rm = vm->get_region_manager();
+  auto region = rm->allocate_region(bench_size, "translation benchmark");
+  region->set_guest_addr(bench_base);
+  err = rm->get_pager().map_region(region->base_address(), bench_base,
+      bench_size / ELKVM_PAGESIZE, PT_OPT_WRITE);
+  if (err) {
+    ERROR() << "ERROR mapping benchmark region: " << strerror(-err);
+    return 1;
+  }
+
+  const Elkvm::PagerX86_64 &pager = rm->get_pager();
+  for(unsigned threads = 1; threads <= max_threads; threads *= 2) {
+    std::vector<std::thread> workers;
+    std::vector<unsigned long> misses(threads);
+
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned t = 0; t < threads; t++) {
+      workers.emplace_back(translate, std::cref(pager), t, count, &misses[t]);
+    }
+    for(auto &w : workers) {
+      w.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double secs = std::chrono::duration<double>(end - start).count();
+    unsigned long failed = 0;
+    for(auto m : misses) {
+      failed += m;
+    }
+    std::cout << threads << " thread(s): "
+              << (threads * count) / secs / 1e6 << " M translations/s"
+              << (failed ? " (FAILED TRANSLATIONS!)" : "") << std::endl;
+  }
+
+  err = elkvm_cleanup(&opts);
+  if (err) {
+    ERROR() << "Error during cleanup: " << strerror(-err);
+    return 1;
+  }
+  return 0;
+}
@@ -45,10 +45,13 @@
 extern char **environ;
 Elkvm::elkvm_opts elkvm;
 bool inspect;
+unsigned mem_flags;
 
 void print_usage(char **argv) {
-  printf("Usage: %s [-d] binary [binaryopts]\n", argv[0]);
+  printf("Usage: %s [-d] [-l] [-m] binary [binaryopts]\n", argv[0]);
   printf("       %s [-d] -a <PID>\n", argv[0]);
+  printf("  -l   populate and lock all guest memory\n");
+  printf("  -m   let KSM merge guest memory with other VMs\n");
   exit(EXIT_FAILURE);
 }
 
@@ -80,6 +83,7 @@ std::shared_ptr<Elkvm::VM> run_new(int argc, char **argv, int myopts)
   int binargc = argc - myopts;
 
   initialize_elkvm(binargc, binargv, environ);
+  elkvm.mem_flags = mem_flags;
 
   std::shared_ptr<Elkvm::VM> vm = elkvm_vm_create(&elkvm, binary);
   if(vm == nullptr) {
@@ -402,7 +406,7 @@ int main(int argc, char **argv) {
   int attach_pid = -1;
   opterr = 0;
 
-  while((opt = getopt(argc, argv, "+a:dD")) != -1) {
+  while((opt = getopt(argc, argv, "+a:dDlm")) != -1) {
     switch(opt) {
       case 'd':
         debug = 1;
@@ -412,6 +416,14 @@ int main(int argc, char **argv) {
         gdb = 1;
         myopts++;
         break;
+      case 'l':
+        mem_flags |= ELKVM_MEM_POPULATE | ELKVM_MEM_LOCK;
+        myopts++;
+        break;
+      case 'm':
+        mem_flags |= ELKVM_MEM_MERGEABLE;
+        myopts++;
+        break;
       case 'a':
         attach_pid = strtol(optarg, 0, 10);
         myopts++;
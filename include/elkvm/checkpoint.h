@@ -0,0 +1,130 @@
+/* * libelkvm - A library that allows execution of an ELF binary inside a virtual
+ * machine without a full-scale operating system
+ * Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+ * Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+ * Dresden (Germany)
+ *
+ * This file is part of libelkvm.
+ *
+ * libelkvm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libelkvm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace Elkvm {
+
+  class Region;
+
+  /*
+   * Layout of a checkpoint image, see VM::checkpoint(). The header fills
+   * the first page, guest physical memory follows at mem_offset with every
+   * page at mem_offset plus its guest physical address, so restored VMs map
+   * it straight from the file. The state of pager, regions, mappings and
+   * vCPUs is stored behind the memory.
+   */
+  #define ELKVM_CHECKPOINT_MAGIC   "ELKVMCKP"
+  #define ELKVM_CHECKPOINT_VERSION 2
+
+  struct elkvm_checkpoint_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t cpus;
+    uint64_t mem_offset;
+    uint64_t mem_size;
+    uint64_t state_offset;
+    uint64_t state_size;
+  };
+
+  /*
+   * Serialization of the state section. Values are stored as they are in
+   * memory, regions are stored once in the region table and referred to by
+   * their index afterwards.
+   */
+  class CheckpointWriter {
+    private:
+      std::vector<char> buf;
+      std::map<const Region *, int64_t> region_ids;
+
+    public:
+      CheckpointWriter() : buf(), region_ids() {}
+
+      template<typename T>
+      void put(const T &val) {
+        static_assert(std::is_trivially_copyable<T>::value,
+            "only plain values can be stored");
+        const char *p = reinterpret_cast<const char *>(&val);
+        buf.insert(buf.end(), p, p + sizeof(T));
+      }
+      void put_string(const std::string &s);
+
+      /* add r to the region table, it has to be stored right after this */
+      void add_region(const std::shared_ptr<Region> &r);
+      void put_region(const std::shared_ptr<Region> &r);
+
+      const std::vector<char> &data() const { return buf; }
+  };
+
+  class CheckpointReader {
+    private:
+      const char *pos;
+      const char *end;
+      bool failed;
+      std::vector<std::shared_ptr<Region>> regions;
+
+    public:
+      CheckpointReader(const std::vector<char> &data) :
+        pos(data.data()),
+        end(data.data() + data.size()),
+        failed(false),
+        regions()
+      {}
+
+      CheckpointReader(const CheckpointReader &) = delete;
+      CheckpointReader &operator=(const CheckpointReader &) = delete;
+
+      template<typename T>
+      T get() {
+        static_assert(std::is_trivially_copyable<T>::value,
+            "only plain values can be loaded");
+        T val;
+        memset(&val, 0, sizeof(T));
+        if(failed || static_cast<size_t>(end - pos) < sizeof(T)) {
+          failed = true;
+          return val;
+        }
+        memcpy(&val, pos, sizeof(T));
+        pos += sizeof(T);
+        return val;
+      }
+      std::string get_string();
+
+      void add_region(const std::shared_ptr<Region> &r) { regions.push_back(r); }
+      std::shared_ptr<Region> get_region();
+
+      /* mark the image as broken, e.g. if a value is out of range */
+      void fail() { failed = true; }
+      bool ok() const { return !failed; }
+  };
+
+//namespace Elkvm
+}
@@ -1,3 +1,4 @@
 #pragma once
 
 #cmakedefine HAVE_LIBUDIS86
+#cmakedefine HAVE_LINUX_IO_URING_H
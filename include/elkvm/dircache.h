@@ -0,0 +1,125 @@
+/* * libelkvm - A library that allows execution of an ELF binary inside a virtual
+ * machine without a full-scale operating system
+ * Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+ * Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+ * Dresden (Germany)
+ *
+ * This file is part of libelkvm.
+ *
+ * libelkvm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libelkvm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace Elkvm {
+
+  /*
+   * The complete listing of a directory as getdents64 returns it, the
+   * records keep the d_off cookies of the host file system.
+   */
+  class DirListing {
+    private:
+      std::vector<char> records;
+      /* d_off cookie -> offset of the record following it */
+      std::unordered_map<int64_t, size_t> cookies;
+
+    public:
+      DirListing(std::vector<char> &&recs);
+
+      const char *data() const { return records.data(); }
+      size_t size() const { return records.size(); }
+
+      /*
+       * Offset of the first record to return for a directory file position
+       * pos, or npos if pos is no cookie of this listing.
+       */
+      size_t find(int64_t pos) const;
+      static const size_t npos = static_cast<size_t>(-1);
+  };
+
+  struct dir_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    size_t listings;
+    size_t bytes;
+  };
+
+  /*
+   * Monitor-side cache of directory listings for getdents64, see
+   * VM::set_dir_cache. It is meant for trees that are scanned over and over
+   * while hardly changing, e.g. source and toolchain trees during a build.
+   * A listing is checked against the directory's mtime and ctime whenever
+   * it is used, so changes are noticed. A cache may be shared by VMs, the
+   * least recently used listings are dropped once it holds more than
+   * max_bytes.
+   */
+  class DirCache {
+    private:
+      typedef std::pair<dev_t, ino_t> dir_key;
+      struct entry {
+        struct timespec mtime;
+        struct timespec ctime;
+        std::shared_ptr<const DirListing> listing;
+        std::list<dir_key>::iterator lru;
+
+        entry() : mtime(), ctime(), listing(), lru() {}
+        entry(const struct timespec &m, const struct timespec &c,
+            std::shared_ptr<const DirListing> l,
+            std::list<dir_key>::iterator it) :
+          mtime(m),
+          ctime(c),
+          listing(l),
+          lru(it)
+        {}
+      };
+
+      mutable std::mutex lock;
+      std::map<dir_key, entry> entries;
+      std::list<dir_key> lru;
+      size_t max_bytes;
+      dir_cache_stats stats;
+
+      void insert(const dir_key &key, const struct stat &st,
+          std::shared_ptr<const DirListing> listing);
+
+    public:
+      explicit DirCache(size_t max_bytes = 16 << 20);
+
+      /*
+       * The listing of the directory fd refers to, read through a file
+       * descriptor of its own if it is not cached or has changed. Returns
+       * nullptr and sets errno if fd is no readable directory.
+       */
+      std::shared_ptr<const DirListing> get(int fd);
+
+      dir_cache_stats get_stats() const;
+      void clear();
+  };
+
+//namespace Elkvm
+}
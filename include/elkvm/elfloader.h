@@ -30,6 +30,7 @@
 #include <elkvm/region.h>
 
 #include <memory>
+#include <vector>
 
 
 namespace Elkvm {
@@ -89,6 +90,8 @@ class ElfBinary {
     std::string _loader;
     guestptr_t _entry_point;
     struct Elf_auxv _auxv;
+    /* the loadable segments of this binary */
+    std::vector<std::shared_ptr<Region>> _regions;
 
     bool is_valid_elf_kind(const elf_ptr &eptr) const;
     bool is_valid_elf_class(const elf_ptr &eptr) const;
@@ -129,6 +132,8 @@ class ElfBinary {
     const struct Elf_auxv &get_auxv() const;
     bool is_dynamically_linked() const;
     std::string get_loader() const;
+    /* the regions of all loadable segments, including the loader's */
+    std::vector<std::shared_ptr<Region>> get_regions() const;
 };
 
 ptopt_t get_pager_opts_from_phdr_flags(int flags);
@@ -35,6 +35,9 @@ namespace Elkvm {
   bool operator==(const VM &lhs, const VM &rhs);
   unsigned get_hypercall_type(const std::shared_ptr<VCPU>&);
 
+  /* destroys the AIO contexts of a VM that goes away */
+  void release_aio_contexts(const VM *vm);
+
   //namespace Elkvm
 }
 #endif
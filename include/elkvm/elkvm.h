@@ -23,8 +23,11 @@
 #pragma once
 
 #include <poll.h>
+#include <linux/aio_abi.h>
 #include <linux/futex.h>
 #include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/shm.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/time.h>
@@ -37,6 +40,7 @@
 #include <libelf.h>
 #include <linux/kvm.h>
 
+#include <atomic>
 #include <vector>
 #include <memory>
 
@@ -59,10 +63,14 @@
 
 namespace Elkvm {
 
+class DirCache;
+class ImageOverlay;
+class MetadataCache;
 class ElfBinary;
 class rlimit;
 class VCPU;
 class VM;
+class Snapshot;
 
 /*
  * Functions to be called upon a hypercall from a VM.
@@ -111,23 +119,36 @@ struct elkvm_handlers {
       struct sigaction *oldact);
   long (*sigprocmask)(int how, const sigset_t *set, sigset_t *oldset);
   long (*ioctl) (int fd, unsigned long request, char *argp);
-  /* ... */
+  long (*pread64) (int fd, void *buf, size_t count, off_t offset);
+  long (*pwrite64) (int fd, const void *buf, size_t count, off_t offset);
   long (*readv) (int fd, struct iovec *iov, int iovcnt);
   long (*writev) (int fd, struct iovec *iov, int iovcnt);
   long (*access) (const char *pathname, int mode);
   long (*pipe) (int pipefd[2]);
+  /* ... */
+  long (*shmget) (key_t key, size_t size, int shmflg);
+  long (*shmctl) (int shmid, int cmd, struct shmid_ds *buf);
   long (*dup) (int oldfd);
   /* ... */
   long (*nanosleep)(const struct timespec *req, struct timespec *rem);
   long (*getpid)(void);
-  /* ... */
+  long (*sendfile)(int out_fd, int in_fd, off_t *offset, size_t count);
   long (*socket)(int, int, int);
+  long (*connect)(int, const struct sockaddr*, socklen_t);
   long (*accept)(int, struct sockaddr*, socklen_t*);
+  long (*sendto)(int, const void*, size_t, int, const struct sockaddr*,
+      socklen_t);
+  long (*recvfrom)(int, void*, size_t, int, struct sockaddr*, socklen_t*);
+  long (*sendmsg)(int, const struct msghdr*, int);
+  long (*recvmsg)(int, struct msghdr*, int);
+  long (*shutdown)(int, int);
   long (*bind)(int, const struct sockaddr*, socklen_t);
   long (*listen)(int, int);
   long (*getsockname)(int, struct sockaddr*, socklen_t*);
   long (*setsockopt)(int, int, int, const void*, socklen_t);
   /* ... */
+  long (*wait4)(pid_t pid, int *wstatus, int options, struct rusage *rusage);
+  /* ... */
   long (*getuid)(void);
   long (*getgid)(void);
   /* ... */
@@ -136,6 +157,9 @@ struct elkvm_handlers {
   /* ... */
   long (*uname) (struct utsname *buf);
   long (*fcntl) (int fd, int cmd, ...);
+  /* ... */
+  long (*fsync) (int fd);
+  long (*fdatasync) (int fd);
   long (*truncate) (const char *path, off_t length);
   long (*ftruncate) (int fd, off_t length);
   int (*getdents) (unsigned fd, struct linux_dirent *dirp, unsigned count);
@@ -162,8 +186,18 @@ struct elkvm_handlers {
   long (*futex)(int *uaddr, int op, int val, const struct timespec *timeout,
       int *uaddr2, int val3);
   /* ... */
+  long (*io_setup)(unsigned nr_events, aio_context_t *ctxp);
+  long (*io_destroy)(aio_context_t ctx);
+  long (*io_getevents)(aio_context_t ctx, long min_nr, long nr,
+      struct io_event *events, struct timespec *timeout);
+  long (*io_submit)(aio_context_t ctx, long nr, struct iocb **iocbpp);
+  long (*io_cancel)(aio_context_t ctx, struct iocb *iocb,
+      struct io_event *result);
+  /* ... */
   long (*epoll_create)(int);
   /* ... */
+  long (*getdents64)(unsigned fd, struct linux_dirent64 *dirp,
+      unsigned count);
   long (*set_tid_address)(int *);
   long (*epoll_ctl)(int, int, int, struct epoll_event*);
   long (*epoll_wait)(int, struct epoll_event*, int, int);
@@ -174,7 +208,64 @@ struct elkvm_handlers {
   long (*tgkill)(int tgid, int tid, int sig);
 
   int (*openat) (int dirfd, const char *pathname, int flags);
+  /* ... */
+  long (*newfstatat)(int dirfd, const char *pathname, struct stat *buf,
+      int flags);
+  /* ... */
+  /*
+   * poll and select are waited for with these as well, poll is only used if
+   * ppoll is not set. Like the raw system calls, they write the time that
+   * is left back to timeout. The fd_sets only hold nfds bits, rounded up to
+   * a multiple of the size of a long.
+   */
+  long (*pselect6)(int nfds, fd_set *readfds, fd_set *writefds,
+      fd_set *exceptfds, struct timespec *timeout, const sigset_t *sigmask);
+  long (*ppoll)(struct pollfd *fds, nfds_t nfds, struct timespec *timeout,
+      const sigset_t *sigmask);
+  /* ... */
   long (*set_robust_list)(struct robust_list_head *head, size_t len);
+  /* ... */
+  long (*splice)(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+      size_t len, unsigned flags);
+  long (*tee)(int fd_in, int fd_out, size_t len, unsigned flags);
+  /* ... */
+  long (*vmsplice)(int fd, const struct iovec *iov, unsigned long nr_segs,
+      unsigned flags);
+  /* ... */
+  long (*epoll_pwait)(int, struct epoll_event*, int, int, const sigset_t*);
+  /* used for signalfd and signalfd4 */
+  long (*signalfd)(int fd, const sigset_t *mask, int flags);
+  long (*timerfd_create)(int clockid, int flags);
+  /* used for eventfd and eventfd2 */
+  long (*eventfd)(unsigned int initval, int flags);
+  /* ... */
+  long (*timerfd_settime)(int fd, int flags,
+      const struct itimerspec *new_value, struct itimerspec *old_value);
+  long (*timerfd_gettime)(int fd, struct itimerspec *curr_value);
+  long (*accept4)(int, struct sockaddr*, socklen_t*, int);
+  /* ... */
+  long (*epoll_create1)(int flags);
+  long (*dup3)(int oldfd, int newfd, int flags);
+  long (*pipe2)(int pipefd[2], int flags);
+  /* ... */
+  long (*preadv) (int fd, const struct iovec *iov, int iovcnt, off_t offset);
+  long (*pwritev) (int fd, const struct iovec *iov, int iovcnt, off_t offset);
+  /* ... */
+  long (*recvmmsg)(int, struct mmsghdr*, unsigned, int, struct timespec*);
+  /* ... */
+  long (*sendmmsg)(int, struct mmsghdr*, unsigned, int);
+  /* ... */
+  long (*getrandom)(void *buf, size_t buflen, unsigned flags);
+  /* ... */
+  long (*copy_file_range)(int fd_in, loff_t *off_in, int fd_out,
+      loff_t *off_out, size_t len, unsigned flags);
+  long (*preadv2) (int fd, const struct iovec *iov, int iovcnt, off_t offset,
+      int flags);
+  long (*pwritev2) (int fd, const struct iovec *iov, int iovcnt, off_t offset,
+      int flags);
+  /* ... */
+  long (*statx)(int dirfd, const char *pathname, int flags, unsigned mask,
+      struct statx *buf);
 
   /* ELKVM debug callbacks */
 
@@ -197,6 +288,32 @@ extern struct hypercall_handlers hypercall_null;
 
 struct elkvm_opts;
 
+/*
+ * Breakdown of a VM's guest memory in bytes, see VM::memory_stats()
+ */
+struct elkvm_memory_stats {
+  size_t total;       /* all memory chunks */
+  size_t resident;    /* part of total that is backed by host pages */
+  size_t page_tables; /* page tables in use */
+  size_t elf;         /* segments of the binary and the dynamic loader */
+  size_t heap;        /* brk and mmap memory */
+  size_t stack;       /* user stack */
+  size_t system;      /* environment, GDT, IDT, kernel stack etc. */
+  size_t slack;       /* part of total that is not in use */
+};
+
+/*
+ * Time in nanoseconds spent in the phases of creating a VM with
+ * elkvm_vm_create or elkvm_vm_create_raw, see VM::create_stats()
+ */
+struct elkvm_create_stats {
+  uint64_t vm;        /* KVM VM, guest memory and page tables */
+  uint64_t vcpus;     /* KVM VCPUs and their initial registers */
+  uint64_t binary;    /* loading the ELF binary and its environment */
+  uint64_t proxy_os;  /* GDT, IDT, syscall entry and signal handler */
+  uint64_t total;
+};
+
 class VM {
   protected:
     std::vector<std::shared_ptr<VCPU>> cpus;
@@ -224,9 +341,41 @@ class VM {
     rlimit _rlimit;
     elkvm_signals sigs;
     elkvm_flat sighandler_cleanup;
+
+    /* the running program, which execve replaces */
+    std::vector<std::shared_ptr<Region>> _elf_regions;
+    std::shared_ptr<Region> _env_region;
+
     const Elkvm::hypercall_handlers *hypercall_handlers;
     const Elkvm::elkvm_handlers *syscall_handlers;
 
+    /* set by stop(), makes run() return after the current exit */
+    bool _stop;
+
+    /* true while run() executes the guest */
+    std::atomic<bool> _running;
+
+    /* time taken by the phases of elkvm_vm_create */
+    elkvm_create_stats _create_stats;
+
+    /* optional, answers getdents64 from cached directory listings */
+    std::shared_ptr<DirCache> _dir_cache;
+
+    /* optional, answers stat, access, readlink and failing opens */
+    std::shared_ptr<MetadataCache> _metadata_cache;
+
+    /* optional, serves the files below its mount point */
+    std::shared_ptr<ImageOverlay> _image_overlay;
+
+    /* 0, or -errno if this clone of a VM is incomplete */
+    int _clone_err;
+
+    int map_flat(Elkvm::elkvm_flat &flat, size_t size, const char *name,
+        bool kernel);
+
+    /* write the image to fd, base_fd is the previous image or -1 */
+    int save_checkpoint(int fd, int base_fd);
+
   public:
     VM(int fd, int argc, char **argv, char **environ,
         int run_struct_size,
@@ -234,6 +383,16 @@ class VM {
         const Elkvm::elkvm_handlers * const handlers,
         int debug);
 
+    /*
+     * Clone of orig on the KVM VM vmfd, orig's guest memory has been saved
+     * to fd and is mapped from there with map_flags. regions receives the
+     * copy of every region of orig. orig must not be running. If
+     * clone_error() is not 0 the clone cannot be used.
+     */
+    VM(int vmfd, const VM &orig, int fd, int map_flags, RegionMap &regions);
+    int clone_error() const { return _clone_err; }
+    ~VM();
+
     VM(VM const&) = delete;
     VM& operator=(VM const&) = delete;
 
@@ -244,6 +403,9 @@ class VM {
 
     int load_flat(Elkvm::elkvm_flat &flat, const std::string path,
         bool kernel);
+    /* load a flat binary that is already in host memory */
+    int load_flat(Elkvm::elkvm_flat &flat, const char *name,
+        const void *data, size_t size, bool kernel);
 
     void unpack_syscall(CURRENT_ABI::paramtype *arg);
     void unpack_syscall(CURRENT_ABI::paramtype *arg1,
@@ -274,6 +436,16 @@ class VM {
     void *host_p(guestptr_t ptr) const { return _rm->get_pager().get_host_p(ptr); }
     Elkvm::elkvm_flat &get_cleanup_flat();
 
+    /*
+     * \brief Track the regions of the running program: the loadable
+     *        segments of the binary and its loader, and the environment.
+     */
+    void set_program_regions(const std::vector<std::shared_ptr<Region>> &elf,
+        const std::shared_ptr<Region> &env);
+    const std::vector<std::shared_ptr<Region>> &elf_regions() const
+    { return _elf_regions; }
+    const std::shared_ptr<Region> &env_region() const { return _env_region; }
+
     const std::shared_ptr<Elkvm::Region>& get_gdt_region() { return _gdt; }
     void set_gdt_region(std::shared_ptr<Elkvm::Region> gdt) { _gdt = gdt; }
 
@@ -302,6 +474,76 @@ class VM {
      */
     int run();
 
+    /*
+     * \brief Make run() return once the current VM exit has been handled,
+     *        e.g. from a hypercall handler. Calling run() again resumes
+     *        the guest.
+     */
+    void stop() { _stop = true; }
+
+    /*
+     * \brief Replace the program of this VM with binary, as execve does,
+     *        the guest continues in the new program once the current
+     *        syscall returns. The KVM VM, its VCPUs, memory slots and the
+     *        proxy OS are kept; heap, stack, environment and the old
+     *        binary are dropped. Returns a negative errno, with nothing
+     *        changed, if binary cannot be executed, and -EBUSY if the VM
+     *        has more than one VCPU.
+     */
+    int execve(const std::string &binary, const std::vector<std::string> &argv,
+        const std::vector<std::string> &env);
+
+    /*
+     * \brief Fork the process running this VM, as fork does. The guest
+     *        memory is shared copy-on-write by the host, the child
+     *        registers it with a KVM VM and VCPUs of its own and continues
+     *        with the same metadata and registers as the parent. Returns
+     *        the pid of the child in the parent, 0 in the child and a
+     *        negative errno on failure. The VM must be stopped in a
+     *        syscall, as it is in a syscall handler.
+     */
+    int fork();
+
+    /*
+     * \brief Freeze the current state of this VM, new VMs can be cloned
+     *        from the snapshot. The VM must not be running, i.e. either
+     *        not started yet or stopped with stop(). Returns nullptr and
+     *        sets errno on failure.
+     */
+    std::shared_ptr<Snapshot> snapshot();
+
+    /*
+     * \brief Set this VM back to the state of snap without recreating it,
+     *        e.g. to run the same input again. The VM must be stopped and
+     *        be the VM snap was taken from or a clone of it. Only the guest
+     *        pages written since the VM was cloned or last reset are
+     *        restored, ELKVM_MEM_LOG_DIRTY has KVM log the guest's writes
+     *        as well. Returns 0 or a negative errno.
+     */
+    int reset(const Snapshot &snap);
+
+    /*
+     * \brief Save the complete state of this VM to an image file at path.
+     *        The VM must not be running, -EBUSY otherwise. The image is
+     *        written to a new file that replaces path once it is complete,
+     *        VMs restored from an earlier image at path keep their memory.
+     *        Guest memory is mapped from the image afterwards, so later
+     *        checkpoints to the same path only write the pages changed
+     *        since and copy the rest from the earlier image. Host file
+     *        descriptors of the guest are not saved. Returns 0 or a
+     *        negative errno.
+     */
+    int checkpoint(const char *path);
+
+    /*
+     * \brief Replace the state of this VM, which has to have as many
+     *        VCPUs as the checkpointed one, with the image at path. Guest
+     *        memory is mapped from the image and only read when it is
+     *        used. If restoring fails the VM is unusable. Returns 0 or a
+     *        negative errno.
+     */
+    int restore(const char *path);
+
     /*
      * Handle VM events
      */
@@ -316,6 +558,21 @@ class VM {
     int signal_register(int signum,
                         struct sigaction *act,
                         struct sigaction *oldact);
+    bool signal_pending() const;
+    /*
+     * Block the host signals the guest has handlers for and store the
+     * previous mask in oldset. A blocking system call checks
+     * signal_pending() afterwards and waits with oldset (ppoll, pselect), so
+     * a signal that arrives in between still wakes it up.
+     */
+    int signal_block(sigset_t *oldset) const;
+    /*
+     * The mask to wait with for a guest system call that passes its own
+     * sigmask: the guest's mask only decides about the signals the guest
+     * handles, all others stay as in oldset.
+     */
+    void signal_wait_mask(const sigset_t *oldset, const sigset_t *guest,
+        sigset_t *mask) const;
 
     /*
      * Memory stuff
@@ -324,15 +581,67 @@ class VM {
     { return get_region_manager()->get_pager().chunk_count(); }
 
     /*
-     * \brief Deletes (frees) the chunk with number num and hands a new chunk
-     *        with the newsize to a vm at the same memory slot.
-     *        THIS WILL DELETE ALL DATA IN THE OLD CHUNK!
+     * \brief Resizes the chunk with number num to newsize in place, it keeps
+     *        its memory slot and guest physical address. Data in the part of
+     *        the chunk that remains is preserved. Growing fails with -ENOMEM
+     *        if the guest physical space behind the chunk is in use.
      */
     int chunk_remap(int num, size_t newsize);
 
     struct kvm_userspace_memory_region get_chunk(int chunk)
     { return *get_region_manager()->get_pager().get_chunk(chunk); }
 
+    /*
+     * \brief Number of guest pages shared with other pages by KSM, only
+     *        non-zero if the VM was created with ELKVM_MEM_MERGEABLE.
+     */
+    int merged_pages(size_t *pages) const
+    { return get_region_manager()->get_pager().merged_pages(pages); }
+
+    /*
+     * \brief Where the guest memory of this VM goes to. resident is 0 if
+     *        it cannot be determined.
+     */
+    elkvm_memory_stats memory_stats();
+
+    /*
+     * \brief How long creating this VM took, all zero for VMs that were
+     *        not created by elkvm_vm_create or elkvm_vm_create_raw.
+     */
+    const elkvm_create_stats &create_stats() const { return _create_stats; }
+    void set_create_stats(const elkvm_create_stats &stats)
+    { _create_stats = stats; }
+
+    /*
+     * \brief Answer the guest's getdents64 calls from cache, which may be
+     *        shared with other VMs, or pass them through again if cache is
+     *        nullptr. Clones of this VM use the same cache.
+     */
+    void set_dir_cache(std::shared_ptr<DirCache> cache)
+    { _dir_cache = cache; }
+    const std::shared_ptr<DirCache> &dir_cache() const { return _dir_cache; }
+
+    /*
+     * \brief Answer the guest's stat, lstat, fstat, access and readlink calls
+     *        and opens of missing files from cache, or pass them through
+     *        again if cache is nullptr. Clones of this VM use the same cache.
+     */
+    void set_metadata_cache(std::shared_ptr<MetadataCache> cache)
+    { _metadata_cache = cache; }
+    const std::shared_ptr<MetadataCache> &metadata_cache() const
+    { return _metadata_cache; }
+
+    /*
+     * \brief Serve the files below the mount point of overlay from its
+     *        image instead of passing the guest's calls on them to the
+     *        handlers, or stop doing so if overlay is nullptr. Clones of this
+     *        VM use the same overlay.
+     */
+    void set_image_overlay(std::shared_ptr<ImageOverlay> overlay)
+    { _image_overlay = overlay; }
+    const std::shared_ptr<ImageOverlay> &image_overlay() const
+    { return _image_overlay; }
+
 };
 
 std::shared_ptr<VM> create_virtual_hardware(const elkvm_opts * const opts,
@@ -348,6 +657,8 @@ int setup_proxy_os(const std::shared_ptr<VM>& vm);
 std::shared_ptr<VM> create_vm_object(const elkvm_opts * const opts,
     const hypercall_handlers * const hyp,
     const elkvm_handlers * const handlers);
+/* drop a VM from the list of all VMs that create_vm_object adds it to */
+void forget_vm(const std::shared_ptr<VM>& vm);
 int create_vcpus(const std::shared_ptr<VM>& vm, unsigned cpus);
 int create_and_setup_environment(const ElfBinary &bin,
     const std::shared_ptr<VM>& vm,
@@ -71,8 +71,13 @@ namespace Elkvm {
       void push_argc(VCPU& vcpu) const;
 
     public:
+      /* env has to be the host's environment, the auxv is taken from
+       * behind it */
       Environment(const ElfBinary &bin, std::shared_ptr<Region> reg, int argc,
           char **argv, char **env);
+      /* any environment, with the auxv given separately */
+      Environment(const ElfBinary &bin, std::shared_ptr<Region> reg, int argc,
+          char **argv, char **env, Elf64_auxv_t *auxv);
       Environment(Environment const&) = delete;
       Environment& operator=(Environment const&) = delete;
       int create(VCPU &vcpu);
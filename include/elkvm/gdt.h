@@ -27,6 +27,10 @@
 #include <elkvm/region.h>
 #include <elkvm/vcpu.h>
 
+/*
+ * Only the cached registers of vcpu are updated and STAR is queued, the
+ * caller writes them with set_sregs() and flush_msrs().
+ */
 std::shared_ptr<Elkvm::Region>
 elkvm_gdt_setup(Elkvm::RegionManager &rm, std::shared_ptr<Elkvm::VCPU> vcpu);
 
@@ -25,7 +25,9 @@
 #include <stdbool.h>
 
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <elkvm/region.h>
@@ -39,6 +41,9 @@ namespace Elkvm {
       std::vector<Mapping> mappings_for_mmap;
       std::shared_ptr<RegionManager> _rm;
       guestptr_t curbrk;
+      std::recursive_mutex writer_lock;
+      /* System V segments by the guest address shmat attached them at */
+      std::map<guestptr_t, std::shared_ptr<Region>> shm_segments;
 
       int grow(size_t sz);
       int shrink(guestptr_t newbrk);
@@ -48,17 +53,37 @@ namespace Elkvm {
       void slice_region(Mapping &m, off_t off, size_t len);
 
       void free_unused_mappings(guestptr_t brk);
+      /* MAP_SHARED | MAP_ANONYMOUS memory, backed by a memfd */
+      std::shared_ptr<Region> create_shared_region(size_t length);
 
     public:
       HeapManager(std::shared_ptr<RegionManager> rm) :
 		mappings_for_brk(),
 		mappings_for_mmap(),
         _rm(rm),
-        curbrk(0x0)
+        curbrk(0x0),
+        writer_lock(),
+        shm_segments()
     {}
+      /* copy of orig for a cloned VM, see RegionManager */
+      HeapManager(std::shared_ptr<RegionManager> rm, const HeapManager &orig,
+          const RegionMap &regions);
+      /* replace all mappings with copies of orig's */
+      void reset(const HeapManager &orig, const RegionMap &regions);
+      void save_state(CheckpointWriter &w) const;
+      int restore_state(CheckpointReader &r);
+      /* unmap and free all mappings and their regions, for execve */
+      void clear();
       int init(std::shared_ptr<Region> data, size_t sz);
       int brk(guestptr_t newbrk);
       guestptr_t get_brk() const { return curbrk; };
+
+      /*
+       * Mapping references stay valid only as long as no other thread
+       * changes the mappings, so callers which map, unmap or mprotect
+       * hold this lock for the whole operation.
+       */
+      std::recursive_mutex &get_writer_lock() { return writer_lock; }
       bool contains_address(guestptr_t addr) const;
       bool brk_contains_address(guestptr_t addr) const
       { return (mappings_for_brk.front().guest_address() <= addr)
@@ -75,8 +100,23 @@ namespace Elkvm {
 
       void free_mapping(Mapping &mapping);
 
+      /*
+       * Remember the System V segment of region r that shmat attached at
+       * addr. find_segment returns the mapping of the segment attached at
+       * addr, or nullptr if there is none or it was unmapped in the
+       * meantime.
+       */
+      void add_segment(guestptr_t addr, std::shared_ptr<Region> r);
+      Mapping *find_segment(guestptr_t addr);
+
       void dump_mappings() const;
 
+      /*
+       * Memory used by brk and mmap, not counting the data segment of the
+       * binary that the heap starts with.
+       */
+      size_t heap_size() const;
+
       int map(Mapping &m);
       guestptr_t remap(Mapping &m, guestptr_t new_address_p, size_t new_size, int flags);
       int unmap(Mapping &m);
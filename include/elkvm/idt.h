@@ -28,6 +28,10 @@
 #include <elkvm/region.h>
 #include <elkvm/types.h>
 
+/*
+ * Only the cached segment registers of vcpu are updated, the caller writes
+ * them with set_sregs().
+ */
 int elkvm_idt_setup(Elkvm::RegionManager &rm, std::shared_ptr<Elkvm::VCPU> vcpu,
     Elkvm::elkvm_flat *);
 
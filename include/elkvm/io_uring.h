@@ -0,0 +1,146 @@
+/* * libelkvm - A library that allows execution of an ELF binary inside a virtual
+ * machine without a full-scale operating system
+ * Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+ * Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+ * Dresden (Germany)
+ *
+ * This file is part of libelkvm.
+ *
+ * libelkvm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libelkvm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <vector>
+
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <elkvm/elkvm.h>
+
+struct io_uring_cqe;
+struct io_uring_sqe;
+
+namespace Elkvm {
+
+  class PagerX86_64;
+
+  /*
+   * A minimal io_uring that talks to the kernel directly. Operations block
+   * the calling thread until their completion arrives, ELKVM runs a system
+   * call to its end before the vcpu enters the guest again anyway. Compared
+   * to plain system calls this saves copying between user and kernel space
+   * for fixed buffers and lets the kernel poll sockets instead of waking up
+   * a sleeping thread.
+   *
+   * All functions return the result of the operation or -errno. An offset
+   * of -1 means the current file position.
+   */
+  class IoUring {
+    private:
+      int ring_fd;
+      pid_t owner;
+
+      void *sq_ring_p;
+      size_t sq_ring_size;
+      struct io_uring_sqe *sqes;
+      size_t sqes_size;
+
+      unsigned *sq_head;
+      unsigned *sq_tail;
+      unsigned *sq_mask;
+      unsigned *sq_array;
+      unsigned *cq_head;
+      unsigned *cq_tail;
+      unsigned *cq_mask;
+      struct io_uring_cqe *cqes;
+
+      /*
+       * The chunks of the pager that were registered as fixed buffers, they
+       * are registered again once the pager's memory epoch moves on.
+       */
+      uint64_t buffers_epoch;
+      std::vector<struct iovec> buffers;
+      void register_buffers(const PagerX86_64 &pager);
+      int fixed_buffer(const void *buf, size_t len);
+
+      /*
+       * Operations are told apart by their user_data, wait reaps
+       * completions until the one of user_data shows up.
+       */
+      uint64_t next_user_data;
+      void push(const struct io_uring_sqe &sqe);
+      int wait(uint64_t user_data, long *res);
+      long submit_and_wait(struct io_uring_sqe &sqe);
+
+      long rw(uint8_t op, int fd, const void *buf, size_t len, off_t offset,
+          int flags);
+
+    public:
+      IoUring(unsigned entries);
+      ~IoUring();
+
+      IoUring(IoUring const&) = delete;
+      IoUring& operator=(IoUring const&) = delete;
+
+      bool is_valid() const { return ring_fd >= 0; }
+      bool is_owner() const { return owner == getpid(); }
+      void unregister_buffers();
+
+      long read(int fd, void *buf, size_t len, off_t offset);
+      long write(int fd, const void *buf, size_t len, off_t offset);
+      long readv(int fd, const struct iovec *iov, int iovcnt, off_t offset,
+          int flags);
+      long writev(int fd, const struct iovec *iov, int iovcnt, off_t offset,
+          int flags);
+      long recv(int fd, void *buf, size_t len, int flags);
+      long send(int fd, const void *buf, size_t len, int flags);
+      long accept(int fd, struct sockaddr *addr, socklen_t *addrlen,
+          int flags);
+      long fsync(int fd, bool datasync);
+  };
+
+  /*
+   * The io_uring of the calling thread, it is set up on first use. Returns
+   * nullptr if the host kernel does not support io_uring or lacks some of
+   * the operations needed.
+   */
+  IoUring *thread_io_uring();
+
+  /*
+   * Register the chunks of pager as fixed buffers with the io_uring of the
+   * calling thread, reads and writes into guest memory then skip mapping
+   * the buffers on every operation. The chunks are pinned in host memory
+   * and are copied if they are mapped copy-on-write, e.g. from a snapshot.
+   * Registration is refreshed as the chunks change, the memory stays pinned
+   * until io_uring_use_memory(nullptr) is called. This must happen before
+   * pager is destroyed.
+   */
+  void io_uring_use_memory(const PagerX86_64 *pager);
+
+  /*
+   * System call handlers that do their I/O through the io_uring of the
+   * calling thread: read, write, pread64, pwrite64, readv, writev, the
+   * preadv family, accept, sendto and recvfrom without an address, fsync
+   * and fdatasync. Everything else and all I/O on hosts without io_uring
+   * is passed to the kernel like default_handlers do.
+   */
+  extern struct elkvm_handlers io_uring_handlers;
+
+//namespace Elkvm
+}
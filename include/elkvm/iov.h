@@ -0,0 +1,106 @@
+/* * libelkvm - A library that allows execution of an ELF binary inside a virtual
+ * machine without a full-scale operating system
+ * Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+ * Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+ * Dresden (Germany)
+ *
+ * This file is part of libelkvm.
+ *
+ * libelkvm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libelkvm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <vector>
+
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <elkvm/types.h>
+
+namespace Elkvm {
+
+  class PagerX86_64;
+
+  /*
+   * Translate the guest buffer [addr, addr + len) into host iovecs that are
+   * appended to iov. Guest pages which are contiguous in host memory are
+   * merged into a single entry, so a buffer that does not cross a chunk
+   * boundary always yields exactly one entry.
+   *
+   * Translation stops at the first guest page that is not mapped or once
+   * IOV_MAX entries are in use. Returns the number of bytes covered by the
+   * new entries (which may be less than len, just like a short read or write)
+   * or -EFAULT if the first byte of the buffer is not mapped.
+   */
+  ssize_t guest_to_host_iov(const PagerX86_64 &pager, guestptr_t addr,
+      size_t len, std::vector<struct iovec> &iov);
+
+  /*
+   * Translate an array of iovcnt struct iovec located at guest address iov_p,
+   * whose iov_base members are guest addresses, into host iovecs. Semantics
+   * of the result equal those of guest_to_host_iov, additionally -EINVAL is
+   * returned if iovcnt exceeds IOV_MAX or the total length overflows.
+   */
+  ssize_t guest_iov_to_host_iov(const PagerX86_64 &pager, guestptr_t iov_p,
+      size_t iovcnt, std::vector<struct iovec> &iov);
+
+  /*
+   * Copy len bytes between host and guest memory, regardless of page or
+   * region boundaries. Return 0 on success or -EFAULT if any part of the
+   * guest buffer is not mapped.
+   */
+  int copy_from_guest(const PagerX86_64 &pager, void *dst, guestptr_t src,
+      size_t len);
+  int copy_to_guest(const PagerX86_64 &pager, guestptr_t dst, const void *src,
+      size_t len);
+
+  /*
+   * Read the guest's sigset_t, which is the kernel's and thus only as large
+   * as a long, into a host sigset_t. Returns -EINVAL if size does not match
+   * the kernel's sigset_t, just like the system calls taking one.
+   */
+  int copy_sigset_from_guest(const PagerX86_64 &pager, sigset_t *set,
+      guestptr_t set_p, size_t size);
+
+  /*
+   * A guest buffer the kernel reads or writes as a whole, i.e. a socket
+   * address, a pollfd array or an fd_set. map_guest_buffer makes host
+   * point to the buffer itself if it is contiguous in host memory, or to a
+   * copy otherwise. unmap_guest_buffer copies the first written bytes of
+   * such a copy back to the guest. Both return 0 or -EFAULT.
+   */
+  struct guest_buffer {
+    guestptr_t addr;
+    size_t len;
+    void *host;
+    std::vector<char> bounce;
+
+    guest_buffer() : addr(0x0), len(0), host(nullptr), bounce() {}
+    /* host may point into bounce, which only stays valid if it is moved */
+    guest_buffer(const guest_buffer &) = delete;
+    guest_buffer &operator=(const guest_buffer &) = delete;
+    guest_buffer(guest_buffer &&) = default;
+    guest_buffer &operator=(guest_buffer &&) = default;
+  };
+
+  int map_guest_buffer(const PagerX86_64 &pager, guestptr_t addr, size_t len,
+      guest_buffer &buf);
+  int unmap_guest_buffer(const PagerX86_64 &pager, const guest_buffer &buf,
+      size_t written);
+
+//namespace Elkvm
+}
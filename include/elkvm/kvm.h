@@ -38,6 +38,8 @@ struct elkvm_opts {
 	char **argv;
 	char **environ;
   bool debug;
+  /* ELKVM_MEM_* policy for all guest memory, set after elkvm_init */
+  unsigned mem_flags;
 
   /* TODO kvm-specific stuff */
   int fd;
@@ -48,13 +50,31 @@ namespace KVM {
 
   int init(struct elkvm_opts *opts);
 
+  /*
+   * Complete state of a VCPU as far as ELKVM uses it: registers, segment
+   * and system registers, FPU state and the MSRs set up for syscalls.
+   */
+  #define VCPU_STATE_MSRS 5
+  struct vcpu_state {
+    struct kvm_regs regs;
+    struct kvm_sregs sregs;
+    struct kvm_fpu fpu;
+    struct kvm_msr_entry msrs[VCPU_STATE_MSRS];
+  };
+
   class VCPU {
     private:
       int fd;
+      /* 0, or -errno if the KVM VCPU could not be created */
+      int init_err;
       struct kvm_regs regs;
       struct kvm_sregs sregs;
       struct kvm_run *run_struct;
 
+      /* MSR writes waiting for flush_msrs() */
+      struct kvm_msr_entry queued_msrs[VCPU_STATE_MSRS];
+      unsigned num_queued_msrs;
+
       Elkvm::Segment get_reg(const struct kvm_dtable * const ptr) const;
       Elkvm::Segment get_reg(const struct kvm_segment * const ptr) const;
       void set_reg(struct kvm_dtable *ptr, const Elkvm::Segment &seg);
@@ -66,6 +86,27 @@ namespace KVM {
 
     public:
       VCPU(int vmfd, unsigned num);
+      ~VCPU();
+
+      VCPU(VCPU const&) = delete;
+      VCPU& operator=(VCPU const&) = delete;
+
+      int init_error() const { return init_err; }
+
+      /*
+       * Take over the complete state of orig: the cached registers (as
+       * run() would set them), segment and system registers, FPU state
+       * and the MSRs used by ELKVM.
+       */
+      int copy_state(const VCPU &orig);
+      int get_state(struct vcpu_state *state) const;
+      int set_state(const struct vcpu_state *state);
+
+      /*
+       * Replace the KVM VCPU by VCPU num of the KVM VM vmfd and give it
+       * state, for a forked child that cannot use the VM of its parent.
+       */
+      int move_to(int vmfd, unsigned num, const struct vcpu_state *state);
 
       CURRENT_ABI::paramtype get_reg(Elkvm::Reg_t reg) const;
       void set_reg(Elkvm::Reg_t reg, CURRENT_ABI::paramtype val);
@@ -80,6 +121,13 @@ namespace KVM {
       CURRENT_ABI::paramtype get_msr(uint32_t idx);
       void set_msr(uint32_t idx, CURRENT_ABI::paramtype data);
 
+      /*
+       * Defer the write of an MSR, all queued MSRs are written with a single
+       * KVM_SET_MSRS by flush_msrs().
+       */
+      int queue_msr(uint32_t idx, CURRENT_ABI::paramtype data);
+      int flush_msrs();
+
       int run();
 
       /* Debugging */
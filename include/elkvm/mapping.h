@@ -30,6 +30,8 @@
 #include <elkvm/types.h>
 
 namespace Elkvm {
+  class CheckpointReader;
+  class CheckpointWriter;
   class Region;
 
   class Mapping {
@@ -64,6 +66,13 @@ namespace Elkvm {
           region(orig.get_region())
       { }
 
+      /* copy of orig that lives in region r of a cloned VM */
+      Mapping(const Mapping& orig, std::shared_ptr<Region> r);
+
+      /* checkpoints, the region has to be in the region table */
+      explicit Mapping(CheckpointReader &r);
+      void save_state(CheckpointWriter &w) const;
+
       Mapping& operator=(const Mapping& other)
       {
         host_p = other.base_address();
@@ -0,0 +1,205 @@
+/* * libelkvm - A library that allows execution of an ELF binary inside a virtual
+ * machine without a full-scale operating system
+ * Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+ * Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+ * Dresden (Germany)
+ *
+ * This file is part of libelkvm.
+ *
+ * libelkvm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libelkvm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+namespace Elkvm {
+
+  /* the calls whose results a MetadataCache keeps */
+  enum metadata_op {
+    MD_STAT,
+    MD_LSTAT,
+    MD_READLINK,
+    MD_ACCESS,
+    MD_FSTAT,
+    /* only failing opens are answered from the cache */
+    MD_OPEN,
+    MD_NUM_OPS
+  };
+
+  struct metadata_cache_stats {
+    uint64_t hits[MD_NUM_OPS];
+    uint64_t misses[MD_NUM_OPS];
+    /* hits that answered with an error, e.g. ENOENT */
+    uint64_t negative_hits;
+    /* entries dropped because their path was changed */
+    uint64_t invalidations;
+    size_t entries;
+  };
+
+  /* share of lookups of op that were hits, of all lookups for MD_NUM_OPS */
+  double hit_rate(const metadata_cache_stats &stats,
+      metadata_op op = MD_NUM_OPS);
+  std::ostream &print(std::ostream &os, const metadata_cache_stats &stats);
+
+  struct metadata_cache_opts {
+    /* drop entries as soon as inotify reports a change to their directory */
+    bool inotify;
+    /* entries expire after this many nanoseconds, 0 if they never do */
+    uint64_t ttl_ns;
+    /* only absolute paths below these directories are cached, all absolute
+     * paths if this is empty */
+    std::vector<std::string> prefixes;
+    /* the cache is emptied whenever it grows beyond this many entries */
+    size_t max_entries;
+
+    metadata_cache_opts() :
+      inotify(false),
+      ttl_ns(0),
+      prefixes(),
+      max_entries(0)
+    {}
+  };
+
+  /*
+   * Monitor-side cache of stat, lstat, fstat, access and readlink results,
+   * including failures, see VM::set_metadata_cache. It is meant for the
+   * storms of lookups on the same paths that dynamic loaders and
+   * interpreters cause during startup. Entries expire after ttl_ns and,
+   * with inotify set, are dropped when their parent directory reports a
+   * change. Renames of directories further up the path are not seen by
+   * inotify, so caches of trees that may be moved around should set a ttl
+   * as well. Without inotify, changes the guest makes itself through the
+   * calls the cache sees (open for writing, truncate, mkdir, unlink) are
+   * noticed right away, all others only once entries expire.
+   */
+  class MetadataCache {
+    private:
+      struct result {
+        bool valid;
+        long res;
+        uint64_t expires;
+        std::vector<char> data;
+
+        result() : valid(false), res(0), expires(0), data() {}
+      };
+
+      struct path_entry {
+        result ops[MD_FSTAT];
+        /* access results by mode */
+        std::unordered_map<int, result> access;
+
+        path_entry() : ops(), access() {}
+      };
+
+      struct fd_entry {
+        std::string path;
+        bool writable;
+        result stat;
+
+        fd_entry() : path(), writable(false), stat() {}
+        fd_entry(const std::string &p, bool w) :
+          path(p),
+          writable(w),
+          stat()
+        {}
+      };
+
+      mutable std::mutex lock;
+      const metadata_cache_opts opts;
+      std::unordered_map<std::string, path_entry> paths;
+      std::unordered_map<int, fd_entry> fds;
+      /* paths the guest has open for writing are not cached */
+      std::unordered_map<std::string, unsigned> writers;
+      metadata_cache_stats stats;
+
+      /* inotify state, see start_watcher */
+      int inotify_fd;
+      int stop_fd;
+      pthread_t watcher;
+      bool running;
+      /* the watcher is running and no events were lost */
+      bool watching;
+      unsigned generation;
+      std::unordered_map<int, std::unordered_set<std::string>> watch_dirs;
+      std::unordered_map<std::string, int> dir_watches;
+
+      void start_watcher();
+      void stop_watcher();
+      void check_fork();
+      static void *watch(void *cache);
+      void handle_events(const char *buf, size_t len);
+
+      bool fresh(const result &r) const;
+      bool watch_parent(const std::string &path, bool *is_new);
+      static size_t count(const path_entry &e);
+      void store(result &r, long res, const void *data, size_t len);
+      void forget(std::unordered_map<int, fd_entry>::iterator it);
+      void drop(const std::string &path);
+      void drop_below(const std::string &dir);
+      void drop_all();
+
+    public:
+      explicit MetadataCache(const metadata_cache_opts &opts);
+      ~MetadataCache();
+      MetadataCache(const MetadataCache &) = delete;
+      MetadataCache &operator=(const MetadataCache &) = delete;
+
+      /* whether results for path are kept at all */
+      bool cacheable(const char *path) const;
+
+      /*
+       * Look up the result of op on path, arg is the mode for MD_ACCESS.
+       * On a hit, true is returned, the result, as the system call would
+       * return it, is stored in res and up to len bytes of the struct stat
+       * or link target are copied to buf.
+       */
+      bool lookup(metadata_op op, const char *path, int arg, long *res,
+          void *buf, size_t len);
+      /* res is the result of op on path as in lookup, data is ignored for
+       * errors and for MD_ACCESS and MD_OPEN */
+      void insert(metadata_op op, const char *path, int arg, long res,
+          const void *data, size_t len);
+
+      /*
+       * The guest opened path with flags as fd. fstat results are only kept
+       * for fds that were opened read-only from a cacheable path, until they
+       * are closed or replaced. Opening a path for writing invalidates it.
+       */
+      void opened(int fd, const char *path, int flags);
+      bool lookup_fd(int fd, struct stat *buf);
+      void insert_fd(int fd, const struct stat *buf);
+      void closed(int fd);
+
+      /* the guest changed path, e.g. by unlinking it, relative paths
+       * invalidate everything unless inotify is used */
+      void invalidate(const char *path);
+      void clear();
+
+      metadata_cache_stats get_stats() const;
+  };
+
+//namespace Elkvm
+}
@@ -0,0 +1,159 @@
+/* * libelkvm - A library that allows execution of an ELF binary inside a virtual
+ * machine without a full-scale operating system
+ * Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+ * Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+ * Dresden (Germany)
+ *
+ * This file is part of libelkvm.
+ *
+ * libelkvm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libelkvm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace Elkvm {
+
+  /* a file, directory or symlink in an image */
+  struct image_node {
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    nlink_t nlink;
+    time_t mtime;
+    uint64_t size;
+    /* contents of a file or target of a symlink, inside the image */
+    const char *data;
+    size_t parent;
+    std::map<std::string, size_t> children;
+  };
+
+  /*
+   * A read-only tree served from a tar archive (ustar, with GNU and pax long
+   * names) that is mapped into the monitor, see VM::set_image_overlay. The
+   * guest sees the archive's contents under the mount point: open, stat,
+   * access, readlink, read, lseek, getdents64 and mmap on those paths are
+   * answered from the image without calling the handlers, as is reading
+   * them with sendfile, splice and copy_file_range. All other paths are
+   * passed through. Every file the guest opens is backed by a host fd on
+   * /dev/null, which keeps its number from being handed out twice.
+   *
+   * The guest's working directory always is a host directory, relative paths
+   * only lead into the image from a directory fd opened in it. Binaries in
+   * the image cannot be executed.
+   *
+   * The functions below return false if path or fd have nothing to do with
+   * the image and the call is to be passed through, with the path in
+   * host_path instead if that is not empty, which happens when a path leaves
+   * the image through ".." or a symlink. Otherwise res holds the system
+   * call's result, -errno on failure.
+   */
+  class ImageOverlay {
+    private:
+      struct open_file {
+        size_t node;
+        int64_t pos;
+        /* the child at pos of a directory, positions 0 and 1 are . and .. */
+        std::map<std::string, size_t>::const_iterator next;
+      };
+
+      const std::string mount;
+      const dev_t dev;
+      const char *image;
+      size_t image_size;
+      /* nodes[0] is the root, nodes do not change once parsed */
+      std::vector<image_node> nodes;
+
+      mutable std::mutex lock;
+      /* dups of an fd share its open_file, and so its position */
+      std::unordered_map<int, std::shared_ptr<open_file>> files;
+
+      ImageOverlay(const std::string &mount, const char *image, size_t size,
+          const struct stat &st);
+      int parse(time_t mtime);
+      size_t add_node(const std::string &name, mode_t mode, time_t mtime,
+          size_t target);
+
+      bool in_mount(const std::string &path) const;
+      long walk(int dirfd, const char *path, bool follow, size_t *node,
+          std::string *host_path) const;
+      std::shared_ptr<open_file> get_file(int fd) const;
+      void fill_stat(size_t node, struct stat *buf) const;
+
+    public:
+      /*
+       * \brief Map the tar archive at image and show it at mount_point, an
+       *        absolute path other than "/". Returns nullptr and sets errno
+       *        if the archive cannot be read.
+       */
+      static std::shared_ptr<ImageOverlay> load(const std::string &image,
+          const std::string &mount_point);
+      ~ImageOverlay();
+      ImageOverlay(const ImageOverlay &) = delete;
+      ImageOverlay &operator=(const ImageOverlay &) = delete;
+
+      const std::string &mount_point() const { return mount; }
+      size_t node_count() const { return nodes.size(); }
+
+      /* fd is a file of the image */
+      bool owns(int fd) const;
+
+      bool open(int dirfd, const char *path, int flags, long *res,
+          std::string *host_path);
+      /* flags are those of newfstatat */
+      bool stat(int dirfd, const char *path, int flags, struct stat *buf,
+          long *res, std::string *host_path) const;
+      bool fstat(int fd, struct stat *buf, long *res) const;
+      bool access(const char *path, int mode, long *res,
+          std::string *host_path) const;
+      bool readlink(const char *path, char *buf, size_t len, long *res,
+          std::string *host_path) const;
+
+      /* reads at off, or at the file position which is moved if off is -1 */
+      bool readv(int fd, const struct iovec *iov, size_t iovcnt, int64_t off,
+          long *res);
+      bool lseek(int fd, int64_t off, int whence, long *res);
+      /*
+       * hands up to count bytes from off on to out, which returns how many it
+       * took or -errno, for sendfile, splice and copy_file_range. The file
+       * position is used and moved by what out took if off is -1.
+       */
+      bool send(int fd, int64_t off, size_t count,
+          const std::function<long(const void *, size_t)> &out, long *res);
+      /* fills buf with whole records as the getdents64 handler does */
+      bool getdents64(int fd, void *buf, size_t len, long *res);
+      /* fills a private mapping of len bytes at buf from off on */
+      bool mmap(int fd, void *buf, size_t len, int64_t off, long *res) const;
+
+      /* the host fd newfd was made a copy of oldfd, or was closed */
+      void dup(int oldfd, int newfd);
+      void close(int fd);
+  };
+
+//namespace Elkvm
+}
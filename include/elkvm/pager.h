@@ -22,7 +22,10 @@
 
 #pragma once
 
+#include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <assert.h>
@@ -31,11 +34,14 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <elkvm/rcu.h>
 #include <elkvm/types.h>
 
 #define ELKVM_PAGER_MEMSIZE 16*1024*1024
 #define ELKVM_SYSTEM_MEMSIZE 16*1024*1024
 #define ELKVM_SYSTEM_MEMGROW 128*1024*1024
+/* new chunks start at this size and double up to ELKVM_SYSTEM_MEMGROW */
+#define ELKVM_SYSTEM_MEMGROW_MIN 2*1024*1024
 #define KERNEL_SPACE_BOTTOM 0xFFFF800000000000
 #define ADDRESS_SPACE_TOP 0xFFFFFFFFFFFFFFFF
 
@@ -59,9 +65,33 @@
  * KVM allows only for 32 memory slots in Linux 3.8
  * and 128 slots on Linux 3.11
  * its down to 125 slots in Linux 3.13
+ * newer kernels report their limit via KVM_CAP_NR_MEMSLOTS, this is only
+ * used if they do not
  */
 #define KVM_MEMORY_SLOTS 125
 
+/*
+ * All guest memory lives in one reserved range of host address space, a
+ * guest physical address is the offset into that range. This is the size
+ * of the reservation and thus the maximum guest physical memory size.
+ */
+#define ELKVM_GUEST_PHYS_MAX (64ULL*1024*1024*1024)
+
+/*
+ * Memory policy for guest memory, see PagerX86_64::set_memory_policy.
+ * POPULATE backs guest memory with host pages as soon as it is created,
+ * LOCK additionally keeps these pages resident with mlock. MERGEABLE lets
+ * KSM share pages with identical content between VMs, as all content is
+ * loaded page aligned this covers ELF text and libraries of VMs running
+ * the same binary. LOG_DIRTY registers all chunks with KVM's dirty page
+ * log, so resetting a VM to its snapshot only touches the pages the guest
+ * wrote to.
+ */
+#define ELKVM_MEM_POPULATE  0x1
+#define ELKVM_MEM_LOCK      0x2
+#define ELKVM_MEM_MERGEABLE 0x4
+#define ELKVM_MEM_LOG_DIRTY 0x8
+
 typedef unsigned int ptopt_t;
 #define PT_OPT_WRITE 0x1
 #define PT_OPT_EXEC  0x2
@@ -86,20 +116,125 @@ uint64_t pagesize_align(uint64_t size);
 
 namespace Elkvm {
 
+  class CheckpointReader;
+  class CheckpointWriter;
   class Region;
 
   class PagerX86_64 {
     private:
-      const int _vmfd;
-      std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> chunks;
+      int _vmfd;
+
+      /*
+       * Translations (get_host_p, host_to_guest_physical) do not take any
+       * lock, they work on an RCU snapshot of the chunk list and read page
+       * table entries atomically. Everything that changes the chunks or the
+       * page tables is serialized by writer_lock.
+       */
+      Rcu<std::vector<std::shared_ptr<struct kvm_userspace_memory_region>>>
+        chunks;
+      mutable std::recursive_mutex writer_lock;
+      void *host_sysmem_p;
       void *host_pml4_p;
       void *host_next_free_tbl_p;
       guestptr_t guest_next_free;
-      size_t total_memsz;
-      std::vector<uint32_t> free_slots;
 
-      std::shared_ptr<struct kvm_userspace_memory_region> alloc_chunk(void *addr,
-          size_t chunk_size, int flags);
+      /*
+       * Guest physical memory management: host_arena_p is the start of the
+       * reserved host range, guest physical space is handed out from holes
+       * left by freed chunks first and from the top of the used space
+       * otherwise. Chunks that touch each other are merged into a single
+       * memory slot.
+       */
+      char *host_arena_p;
+      guestptr_t guest_phys_top;
+      std::map<guestptr_t, size_t> guest_phys_holes;
+      std::vector<uint32_t> free_slots;
+      uint32_t next_slot;
+      uint32_t max_slots;
+      unsigned mem_policy;
+
+      /*
+       * Chunks that are still mapped from a snapshot or checkpoint file
+       * exactly as they were mapped, only these can be reset or saved page
+       * by page. The file is identified by device and inode.
+       */
+      std::vector<std::shared_ptr<struct kvm_userspace_memory_region>>
+        snapshot_chunks;
+      dev_t snapshot_dev;
+      ino_t snapshot_ino;
+      off_t snapshot_offset;
+
+      /*
+       * Chunks of shared memory, i.e. a file or System V segment mapped
+       * MAP_SHARED. They are never merged with other chunks and stay shared
+       * across checkpoints, snapshots and clones get a private copy.
+       */
+      std::vector<std::shared_ptr<struct kvm_userspace_memory_region>>
+        shared_chunks;
+      bool is_shared(
+          const std::shared_ptr<struct kvm_userspace_memory_region> &chunk) const;
+      int reserve_shared_chunk(size_t size, guestptr_t *guest_phys);
+      int add_shared_chunk(guestptr_t guest_phys, size_t size, bool readonly,
+          void **host_p);
+
+      bool mapped_from(int fd, off_t offset) const;
+      void set_mapped_from(int fd, off_t offset,
+          const std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> &cs);
+
+      int reserve_host_arena();
+      int alloc_guest_phys(size_t size, guestptr_t *guest_phys);
+      bool take_guest_phys(guestptr_t guest_phys, size_t size);
+      void free_guest_phys(guestptr_t guest_phys, size_t size);
+      int add_guest_memory(guestptr_t guest_phys, size_t size);
+      int replace_chunks(
+          const std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> &old,
+          guestptr_t guest_phys, size_t size);
+      int set_slot(const struct kvm_userspace_memory_region &chunk);
+
+      /*
+       * Writes of the host to guest memory, KVM's dirty log only has the
+       * guest's. host_written has a bit for every page of the arena the
+       * host wrote to, host_touched for every page get_host_p handed out,
+       * writes through such a pointer may go on into the following pages.
+       * take_pages moves the bits of a range of pages into out, which may
+       * be null to just clear them.
+       */
+      uint64_t *host_written;
+      uint64_t *host_touched;
+      void mark_pages(uint64_t *bitmap, const void *host_p, size_t len) const;
+      void take_pages(uint64_t *bitmap, uint64_t first, uint64_t count,
+          std::vector<uint64_t> *out) const;
+      void clear_host_writes(const struct kvm_userspace_memory_region &chunk);
+      int take_dirty_pages(const struct kvm_userspace_memory_region &chunk,
+          int pagemap, std::vector<uint64_t> &dirty);
+      int discard_dirty_pages(const struct kvm_userspace_memory_region &chunk,
+          int pagemap, int fd);
+      int write_dirty_pages(const struct kvm_userspace_memory_region &chunk,
+          int pagemap, int fd, off_t offset);
+      int write_chunk(const struct kvm_userspace_memory_region &chunk, int fd,
+          off_t offset, bool sparse) const;
+      int map_file_chunk(const struct kvm_userspace_memory_region &layout,
+          int fd, off_t offset, int map_flags,
+          std::shared_ptr<struct kvm_userspace_memory_region> *chunk);
+      int drop_chunk(const struct kvm_userspace_memory_region &chunk);
+      void copy_layout(const PagerX86_64 &orig);
+
+      /*
+       * Cached translations are only valid as long as they carry the current
+       * epoch, invalidate_tlb() moves the pager to a new epoch.
+       */
+      std::atomic<uint64_t> tlb_epoch;
+      void invalidate_tlb();
+
+      /*
+       * Moves to a new epoch whenever chunks are added, moved or dropped and
+       * whenever host pages of a chunk are discarded or replaced.
+       */
+      std::atomic<uint64_t> mem_epoch;
+      void host_memory_changed();
+
+      std::shared_ptr<struct kvm_userspace_memory_region> alloc_chunk(
+          guestptr_t guest_phys, size_t chunk_size, int flags);
 
       void create_entry(ptentry_t *host_entry_p, guestptr_t guest_next,
           ptopt_t opts) const;
@@ -117,16 +252,137 @@ namespace Elkvm {
 
     public:
       PagerX86_64(int vmfd);
+      ~PagerX86_64();
 
 	  PagerX86_64(PagerX86_64 const&) = delete;
 	  PagerX86_64& operator=(PagerX86_64 const&) = delete;
 
       int set_pml4(const std::shared_ptr<Region>& r);
+      /* start of the region that holds the page tables */
+      void *pml4_address() const { return host_pml4_p; }
 
       std::vector<std::shared_ptr<struct kvm_userspace_memory_region *>>::size_type
-        chunk_count() const { return chunks.size(); }
+        chunk_count() const { return chunks.read()->size(); }
 
       int create_mem_chunk(void **host_p, size_t chunk_size);
+
+      /*
+       * Snapshots and clones: write_memory saves all chunks to fd at their
+       * guest physical address, skipping pages that are all zeroes.
+       * clone_memory sets this (empty) pager up as a copy of orig whose
+       * chunks are mapped from such a file with map_flags, i.e. MAP_PRIVATE
+       * for copy-on-write clones. The memory policy is taken over but only
+       * applied to new chunks. rebase translates host addresses of orig
+       * into the clone.
+       */
+      int write_memory(int fd) const;
+      int clone_memory(const PagerX86_64 &orig, int fd, int map_flags);
+
+      /*
+       * Shared memory: map_shared_memory maps size bytes of fd from offset
+       * MAP_SHARED, attach_shared_memory attaches the System V segment
+       * shmid, each into a chunk of its own. Writes of other VMs or
+       * processes that map the same memory show up in the guest right
+       * away. unmap_shared_memory drops such a chunk again.
+       */
+      int map_shared_memory(int fd, off_t offset, size_t size, void **host_p);
+      int attach_shared_memory(int shmid, size_t size, bool readonly,
+          void **host_p);
+      int unmap_shared_memory(void *host_p);
+
+      /*
+       * Register all chunks with the KVM VM vmfd instead of the current one,
+       * for a forked child that cannot use the VM of its parent.
+       */
+      int move_to(int vmfd);
+
+      /*
+       * Reset this pager to orig, whose memory has been saved to fd. Chunks
+       * that are still mapped from fd and in KVM's dirty log only drop the
+       * pages written since, all others are mapped from fd again. Locked
+       * pages cannot be dropped, they are read from fd instead.
+       */
+      int reset_memory(const PagerX86_64 &orig, int fd);
+
+      /*
+       * Code that writes to guest memory through a pointer it did not get
+       * from get_host_p, e.g. into a newly allocated region, marks the
+       * range as written so reset_memory and checkpoint_memory see it.
+       */
+      void mark_host_written(const void *host_p, size_t len) const {
+        mark_pages(host_written, host_p, len);
+      }
+
+      /*
+       * Checkpoints: checkpoint_memory writes all chunks to fd at offset
+       * plus their guest physical address and maps them from there
+       * afterwards. fd has to be a new file, others may map the pages of
+       * the old one. If base_fd is the previous checkpoint, the pages of
+       * chunks still mapped from it are copied from base_fd and only the
+       * pages written in between are written from memory. Chunks that are
+       * not in KVM's dirty log are written completely every time.
+       * save_state and restore_state handle the rest of the pager's state,
+       * restore_state maps the chunks from the file, their pages are read
+       * on first access. Host addresses are stored relative to the arena.
+       */
+      int checkpoint_memory(int fd, off_t offset, int base_fd);
+      void save_state(CheckpointWriter &w) const;
+      int restore_state(CheckpointReader &r, int fd, off_t offset);
+      uint64_t arena_offset(const void *host_p) const;
+      void *arena_address(uint64_t offset) const;
+      void *rebase(const PagerX86_64 &orig, const void *host_p) const;
+      guestptr_t guest_phys_size() const { return guest_phys_top; }
+
+      /*
+       * Whoever holds on to the host pages of the chunks themselves, e.g.
+       * io_uring fixed buffers, has to look at the chunks again when this
+       * epoch changes.
+       */
+      uint64_t memory_epoch() const {
+        return mem_epoch.load(std::memory_order_acquire);
+      }
+
+      /*
+       * Grow or shrink a chunk without moving it, the contents of the
+       * remaining part are preserved. Growing only works if the guest
+       * physical space behind the chunk is free, a size of 0 frees the chunk.
+       */
+      int resize_chunk(
+          const std::shared_ptr<struct kvm_userspace_memory_region>& chunk,
+          size_t newsize);
+
+      /*
+       * Apply ELKVM_MEM_* flags to all chunks and remember them for chunks
+       * created or grown later, without ELKVM_MEM_LOCK all chunks are unlocked.
+       * apply_memory_policy only changes the existing chunks.
+       */
+      int set_memory_policy(unsigned flags);
+      int apply_memory_policy(unsigned flags);
+      unsigned memory_policy() const { return mem_policy; }
+
+      /*
+       * Populate, lock and/or mark mergeable a single range of guest memory,
+       * e.g. for MAP_POPULATE and MAP_LOCKED mappings. Unlocking leaves the
+       * range locked if the policy locks all guest memory anyway.
+       */
+      int populate_host_memory(void *host_p, size_t len, unsigned flags);
+      int unlock_host_memory(void *host_p, size_t len);
+
+      /*
+       * Count the pages of this pager's chunks that KSM currently shares
+       * with other pages. This needs access to /proc/self/pagemap and
+       * /proc/kpageflags, i.e. CAP_SYS_ADMIN.
+       */
+      int merged_pages(size_t *pages) const;
+
+      /*
+       * Memory accounting: the size of all chunks, the part of it that is
+       * backed by host pages and the part that holds page tables.
+       */
+      size_t chunk_memory_size() const;
+      int resident_size(size_t *size) const;
+      size_t page_table_size() const;
+
       void dump_page_tables() const;
       void dump_table(ptentry_t *host_p, int level) const;
 
@@ -164,6 +420,7 @@ namespace Elkvm {
 
   void dump_page_fault_info(guestptr_t pfla, uint32_t err_code, void *host_p);
   bool entry_exists(ptentry_t *entry);
+  ptentry_t read_entry(ptentry_t *entry);
 
   std::ostream &print(std::ostream &os, const struct kvm_userspace_memory_region &r);
   //namespace Elkvm
@@ -0,0 +1,173 @@
+/* * libelkvm - A library that allows execution of an ELF binary inside a virtual
+ * machine without a full-scale operating system
+ * Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+ * Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+ * Dresden (Germany)
+ *
+ * This file is part of libelkvm.
+ *
+ * libelkvm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libelkvm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace Elkvm {
+
+  /*
+   * Read-copy-update protected object
+   *
+   * Readers obtain a consistent snapshot of the object through read() without
+   * taking any lock. Writers, which have to be serialized by the owner of the
+   * Rcu, modify a private copy in update() or hand in a new object with
+   * replace(), which is then published atomically. Readers announce
+   * themselves in one of several counters, picked per thread, so that
+   * concurrent lookups do not all bounce the same cache line.
+   *
+   * Old versions are freed per grace period: every counter is split by the
+   * parity of the epoch a reader entered in. Moving from epoch e to e + 1
+   * waits until the readers that entered with the parity of e + 1, i.e. in
+   * e - 1 or earlier, are gone, new readers use the other half. A version
+   * retired in epoch e has seen both halves drained by epoch e + 2, no
+   * reader can hold it anymore. So old versions go away even if readers of
+   * overlapping read sections are active all the time. The storage of the
+   * last freed version is reused for the next copy.
+   */
+  template<typename T>
+  class Rcu {
+    private:
+      enum { NUM_COUNTERS = 32 };
+
+      struct alignas(64) counter {
+        std::atomic<unsigned long> active[2];
+      };
+
+      mutable std::array<counter, NUM_COUNTERS> readers;
+      std::atomic<T *> current;
+      std::atomic<uint64_t> epoch;
+      std::deque<std::pair<uint64_t, std::unique_ptr<T>>> retired;
+      std::unique_ptr<T> spare;
+
+      counter &my_counter() const {
+        static std::atomic<unsigned> next_slot(0);
+        static thread_local unsigned slot = next_slot++ % NUM_COUNTERS;
+        return readers[slot];
+      }
+
+      bool drained(unsigned parity) const {
+        for(auto &c : readers) {
+          if(c.active[parity].load() != 0) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      void reclaim() {
+        for(int i = 0; i < 2; i++) {
+          const uint64_t e = epoch.load(std::memory_order_relaxed);
+          if(!drained((e + 1) & 1)) {
+            break;
+          }
+          epoch.store(e + 1);
+        }
+
+        const uint64_t e = epoch.load(std::memory_order_relaxed);
+        while(!retired.empty() && retired.front().first + 2 <= e) {
+          spare = std::move(retired.front().second);
+          retired.pop_front();
+        }
+      }
+
+      void publish(std::unique_ptr<T> next) {
+        retired.emplace_back(epoch.load(std::memory_order_relaxed),
+            std::unique_ptr<T>(current.exchange(next.release())));
+        reclaim();
+      }
+
+    public:
+      class ReadGuard {
+        private:
+          std::atomic<unsigned long> *active;
+          const T *obj;
+
+        public:
+          ReadGuard(const Rcu &rcu) : active(nullptr), obj(nullptr) {
+            active = &rcu.my_counter().active[rcu.epoch.load() & 1];
+            active->fetch_add(1);
+            obj = rcu.current.load();
+          }
+          ReadGuard(ReadGuard &&other) : active(other.active), obj(other.obj) {
+            other.active = nullptr;
+          }
+          ~ReadGuard() {
+            if(active != nullptr) {
+              active->fetch_sub(1, std::memory_order_release);
+            }
+          }
+
+          ReadGuard(const ReadGuard &) = delete;
+          ReadGuard &operator=(const ReadGuard &) = delete;
+
+          const T &operator*() const { return *obj; }
+          const T *operator->() const { return obj; }
+      };
+
+      Rcu() : readers(), current(new T()), epoch(0), retired(), spare() {
+        for(auto &c : readers) {
+          c.active[0] = 0;
+          c.active[1] = 0;
+        }
+      }
+      ~Rcu() { delete current.load(); }
+
+      Rcu(const Rcu &) = delete;
+      Rcu &operator=(const Rcu &) = delete;
+
+      ReadGuard read() const { return ReadGuard(*this); }
+
+      /*
+       * Only to be used by (serialized) writers, which see the latest
+       * version of the object anyway.
+       */
+      const T &get() const { return *current.load(std::memory_order_relaxed); }
+
+      template<typename F>
+      void update(F modify) {
+        std::unique_ptr<T> next(std::move(spare));
+        if(next == nullptr) {
+          next.reset(new T(get()));
+        } else {
+          *next = get();
+        }
+        modify(*next);
+        publish(std::move(next));
+      }
+
+      /* publish value as the new version, without copying the current one */
+      void replace(T value) {
+        publish(std::unique_ptr<T>(new T(std::move(value))));
+      }
+  };
+
+//namespace Elkvm
+}
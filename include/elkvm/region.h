@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 
 #include <elkvm/mapping.h>
@@ -33,8 +34,11 @@ namespace Elkvm {
       void *host_p;
       guestptr_t addr;
       size_t rsize;
-      bool free;
+      /* may be read by lock-free lookups while the owner frees the region */
+      std::atomic<bool> free;
       std::string name;
+      /* backed by shared memory of its own, see RegionManager::map_shared */
+      bool shared;
 
     public:
       Region(void *chunk_p, size_t size, const std::string &title="anon region",
@@ -43,7 +47,8 @@ namespace Elkvm {
         addr(0),
         rsize(size),
         free(f),
-        name(title)
+        name(title),
+        shared(false)
     {}
 
 	  Region(const Region&) = delete;
@@ -57,11 +62,14 @@ namespace Elkvm {
       size_t space_after_address(const void * const) const;
       guestptr_t guest_address() const { return addr; }
       bool is_free() const { return free; }
+      bool is_shared() const { return shared; }
       void *last_valid_address() const;
       guestptr_t last_valid_guest_address() const;
       void set_free() { free = true; addr = 0x0; }
       void set_guest_addr(guestptr_t a) { addr = a; };
       void set_used() { free = false; }
+      void set_shared() { shared = true; }
+      void setName(const std::string &title) { name = title; }
       size_t size() const { return rsize; }
       std::shared_ptr<Region> slice_begin(const size_t size,
           const std::string &purpose="anon region");
@@ -73,6 +81,10 @@ namespace Elkvm {
   std::ostream &print(std::ostream &, const Region &);
   bool operator==(const Region &, const Region &);
 
+  /* the copy of orig in a cloned VM, nullptr stays nullptr */
+  std::shared_ptr<Region> cloned_region(const RegionMap &regions,
+      const std::shared_ptr<Region> &orig);
+
 //namespace Elkvm
 }
 
@@ -23,27 +23,105 @@
 #pragma once
 
 #include <array>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <elkvm/pager.h>
+#include <elkvm/rcu.h>
 #include <elkvm/region.h>
 
 namespace Elkvm {
   class RegionManager {
     public:
       static const unsigned n_freelists = 17; // TODO make configurable constant
+
+      /* regions of up to cache_pages pages are served from per-thread caches */
+      static const unsigned cache_pages = 16;
+      /* number of regions moved between a cache and the freelists at once */
+      static const unsigned cache_batch = 16;
+      /* a cache list is drained once it holds more regions than this */
+      static const unsigned cache_high  = 4 * cache_batch;
+
     private:
-      std::vector<std::shared_ptr<Region>> allocated_regions;
+      /*
+       * Small free regions, indexed by their page count. Regions in a cache
+       * stay in allocated_regions (marked as free), so handing them out or
+       * taking them back does not touch any shared state.
+       */
+      struct RegionCache {
+        std::array<std::vector<std::shared_ptr<Region>>, cache_pages> lists;
+
+        RegionCache() : lists() {}
+      };
+
+      /* gives the caches of an exiting thread back to their managers */
+      struct CacheOwner;
+
+      /* lookups work on an RCU snapshot, modifications take writer_lock */
+      Rcu<std::vector<std::shared_ptr<Region>>> allocated_regions;
       std::array<std::vector<std::shared_ptr<Region>>, n_freelists> freelists;
+      std::recursive_mutex writer_lock;
+
+      const uint64_t id;
+      std::mutex cache_lock;
+      std::map<std::thread::id, std::unique_ptr<RegionCache>> caches;
 
       PagerX86_64 pager;
 
+      /* size of the next chunk, grows geometrically with every chunk */
+      size_t chunk_grow;
+
+      /* 0, or -errno if the guest memory of a copy could not be mapped */
+      int clone_err;
+
       int add_chunk(size_t size, const std::string &purpose);
 
+      RegionCache &thread_cache();
+      std::shared_ptr<Region> allocate_cached(size_t pages,
+          const std::string &purpose);
+      void refill_cache(std::vector<std::shared_ptr<Region>> &list,
+          size_t pages, const std::string &purpose);
+      void drain_cache(std::vector<std::shared_ptr<Region>> &list);
+      void release_cache(std::thread::id thread);
+      void clone_regions(const RegionManager &orig, RegionMap &regions);
+      void drop_free_regions();
+
     public:
       RegionManager(int vmfd);
 
+      /*
+       * Copy of orig for a cloned VM, guest memory is mapped from fd, see
+       * PagerX86_64::clone_memory. regions receives the copy of each of
+       * orig's regions. orig must not change while it is copied.
+       * clone_error() tells if the memory could not be mapped, the copy
+       * cannot be used then.
+       */
+      RegionManager(int vmfd, const RegionManager &orig, int fd, int map_flags,
+          RegionMap &regions);
+      int clone_error() const { return clone_err; }
+      ~RegionManager();
+
+      RegionManager(const RegionManager &) = delete;
+      RegionManager &operator=(const RegionManager &) = delete;
+
+      /*
+       * Reset this manager to the state of orig, see
+       * PagerX86_64::reset_memory. All regions are replaced by copies of
+       * orig's, which regions receives.
+       */
+      int reset(const RegionManager &orig, int fd, RegionMap &regions);
+
+      /*
+       * Checkpoints, see PagerX86_64::checkpoint_memory. save_state stores
+       * the pager state and the region table, restore_state replaces all
+       * regions with the ones from the table and adds them to r.
+       */
+      void save_state(CheckpointWriter &w) const;
+      int restore_state(CheckpointReader &r, int fd, off_t offset);
+
       bool address_valid(const void *host_p) const;
       bool host_address_mapped(const void * const) const;
       bool same_region(const void *p1, const void *p2) const;
@@ -52,12 +130,23 @@ namespace Elkvm {
       std::shared_ptr<Region> allocate_region(size_t size,
           const std::string &purpose="anon region");
       void free_region(std::shared_ptr<Region> r);
+
+      /*
+       * Regions of shared memory, see PagerX86_64::map_shared_memory and
+       * attach_shared_memory. The region is in use right away, freeing it
+       * unmaps the shared memory. Return nullptr and set errno on failure.
+       */
+      std::shared_ptr<Region> map_shared(int fd, off_t offset, size_t size,
+          const std::string &purpose);
+      std::shared_ptr<Region> attach_shared(int shmid, size_t size,
+          bool readonly, const std::string &purpose);
       void free_region(void *host_p, size_t sz);
       void use_region(std::shared_ptr<Region> r);
 
       std::shared_ptr<Region> find_free_region(size_t size);
       std::shared_ptr<Region> find_region(const void *host_p) const;
       std::shared_ptr<Region> find_region(guestptr_t addr) const;
+      std::vector<std::shared_ptr<Region>> used_regions() const;
 
       void dump_regions() const;
       void dump_mappings() const;
@@ -0,0 +1,64 @@
+/* * libelkvm - A library that allows execution of an ELF binary inside a virtual
+ * machine without a full-scale operating system
+ * Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+ * Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+ * Dresden (Germany)
+ *
+ * This file is part of libelkvm.
+ *
+ * libelkvm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libelkvm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <memory>
+
+namespace Elkvm {
+
+  class VM;
+
+  /*
+   * A frozen copy of a VM that new VMs can be cloned from, see
+   * VM::snapshot(). The guest memory is kept in a memfd, clones map it
+   * MAP_PRIVATE and thus share all pages until they write to them. All
+   * other state (registers, page tables, regions, mappings, signal
+   * handlers) is copied. Host file descriptors used by the guest are
+   * shared by all clones.
+   */
+  class Snapshot {
+    private:
+      int kvm_fd;
+      int mem_fd;
+      /* never runs, holds the metadata the clones are copied from */
+      std::shared_ptr<VM> image;
+
+      friend class VM;
+
+    public:
+      Snapshot(int kvmfd, int memfd, std::shared_ptr<VM> vm);
+      ~Snapshot();
+
+      Snapshot(Snapshot const&) = delete;
+      Snapshot& operator=(Snapshot const&) = delete;
+
+      /*
+       * \brief Create a new VM in the state of the snapshot. Returns nullptr
+       *        and sets errno on failure.
+       */
+      std::shared_ptr<VM> clone() const;
+  };
+
+//namespace Elkvm
+}
@@ -33,6 +33,8 @@
 
 namespace Elkvm {
 
+  class CheckpointReader;
+  class CheckpointWriter;
   class VM;
   class Region;
   class RegionManager;
@@ -46,6 +48,13 @@ namespace Elkvm {
 
     public:
       Stack(std::shared_ptr<RegionManager> rm);
+      Stack(std::shared_ptr<RegionManager> rm, const Stack &orig,
+          const RegionMap &regions);
+      void reset(const Stack &orig, const RegionMap &regions);
+      void save_state(CheckpointWriter &w) const;
+      int restore_state(CheckpointReader &r);
+      /* replace the user stack with a new, empty one, for execve */
+      int reset_user();
       void init(std::shared_ptr<VCPU> v, const Environment &e,
           std::shared_ptr<RegionManager> rm);
       int pushq(guestptr_t rsp, uint64_t val);
@@ -54,6 +63,8 @@ namespace Elkvm {
       bool grow(guestptr_t pfla);
       guestptr_t kernel_base() const { return kernel_stack->guest_address(); }
       guestptr_t user_base() const { return base; }
+      /* memory of the user stack in bytes */
+      size_t user_size() const;
       int expand();
   };
 
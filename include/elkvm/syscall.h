@@ -32,7 +32,7 @@
 #define ELKVM_HYPERCALL_INTERRUPT 2
 
 #define ELKVM_HYPERCALL_EXIT      0x42
-#define NUM_SYSCALLS 313
+#define NUM_SYSCALLS (__NR_clone3 + 1)
 
 #define DETECT_UNIMPLEMENTED 1
 #if DETECT_UNIMPLEMENTED
@@ -422,4 +422,31 @@ long elkvm_do_ppoll(Elkvm::VM *);
 long elkvm_do_unshare(Elkvm::VM *);
 long elkvm_do_set_robust_list(Elkvm::VM *);
 long elkvm_do_get_robust_list(Elkvm::VM *);
+long elkvm_do_splice(Elkvm::VM *);
+long elkvm_do_tee(Elkvm::VM *);
+long elkvm_do_vmsplice(Elkvm::VM *);
+long elkvm_do_epoll_pwait(Elkvm::VM *);
+long elkvm_do_signalfd(Elkvm::VM *);
+long elkvm_do_timerfd_create(Elkvm::VM *);
+long elkvm_do_eventfd(Elkvm::VM *);
+long elkvm_do_timerfd_settime(Elkvm::VM *);
+long elkvm_do_timerfd_gettime(Elkvm::VM *);
+long elkvm_do_accept4(Elkvm::VM *);
+long elkvm_do_signalfd4(Elkvm::VM *);
+long elkvm_do_eventfd2(Elkvm::VM *);
+long elkvm_do_epoll_create1(Elkvm::VM *);
+long elkvm_do_dup3(Elkvm::VM *);
+long elkvm_do_pipe2(Elkvm::VM *);
+long elkvm_do_preadv(Elkvm::VM *);
+long elkvm_do_pwritev(Elkvm::VM *);
+long elkvm_do_recvmmsg(Elkvm::VM *);
+long elkvm_do_prlimit64(Elkvm::VM *);
+long elkvm_do_sendmmsg(Elkvm::VM *);
+long elkvm_do_getrandom(Elkvm::VM *);
+long elkvm_do_copy_file_range(Elkvm::VM *);
+long elkvm_do_preadv2(Elkvm::VM *);
+long elkvm_do_pwritev2(Elkvm::VM *);
+long elkvm_do_statx(Elkvm::VM *);
+long elkvm_do_rseq(Elkvm::VM *);
+long elkvm_do_clone3(Elkvm::VM *);
 
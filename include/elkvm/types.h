@@ -30,6 +30,7 @@
 #include <sys/types.h>
 #include <signal.h>
 
+#include <map>
 #include <memory>
 
 /*
@@ -69,6 +70,18 @@ struct linux_dirent {
     */
 };
 
+/*
+ * Directory entry as returned by getdents64, records are padded to a
+ * multiple of 8 bytes and follow each other d_reclen bytes apart
+ */
+struct linux_dirent64 {
+    uint64_t       d_ino;     /* Inode number */
+    int64_t        d_off;     /* Position of the next entry */
+    unsigned short d_reclen;  /* Length of this linux_dirent64 */
+    unsigned char  d_type;    /* File type */
+    char           d_name[];  /* Filename (null-terminated) */
+};
+
 
 namespace Elkvm {
 class Region;
@@ -89,4 +102,9 @@ struct elkvm_flat {
 struct elkvm_signals {
   struct sigaction signals[_NSIG];
 };
+
+/*
+ * Maps the regions of a VM to their copies in a clone of that VM.
+ */
+typedef std::map<const Region *, std::shared_ptr<Region>> RegionMap;
 } // namespace Elkvm
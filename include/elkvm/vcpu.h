@@ -113,6 +113,8 @@ class VCPU {
     bool is_singlestepping;
     KVM::VCPU _kvm_vcpu;
     Elkvm::Stack stack;
+    /* 0, or -errno if this copy of a VCPU is incomplete */
+    int clone_err;
 
     void initialize_regs();
 
@@ -120,6 +122,29 @@ class VCPU {
     static const int hypercall_exit = 1;
 
     VCPU(std::shared_ptr<Elkvm::RegionManager> rm, int vmfd, unsigned cpu_num);
+    /*
+     * Copy of orig for a cloned VM, orig must not be running. The registers
+     * are taken as they will be set when orig resumes. clone_error() tells
+     * if the copy could not be made.
+     */
+    VCPU(std::shared_ptr<Elkvm::RegionManager> rm, int vmfd, unsigned cpu_num,
+        const VCPU &orig, const RegionMap &regions);
+    int clone_error() const { return clone_err; }
+    /*
+     * Set this VCPU back to the state of orig, as for a copy.
+     */
+    int reset(const VCPU &orig, const RegionMap &regions);
+    /*
+     * Forks: get_state is taken in the parent, move_to recreates this VCPU
+     * as VCPU cpu_num of the child's KVM VM vmfd with that state.
+     */
+    int get_state(KVM::vcpu_state *state) const;
+    int move_to(int vmfd, unsigned cpu_num, const KVM::vcpu_state &state);
+    /*
+     * Checkpoints: store or load registers and stack, see VM::checkpoint.
+     */
+    int save_state(CheckpointWriter &w) const;
+    int restore_state(CheckpointReader &r);
     /*
      * Get VCPU registers from hypervisor
      */
@@ -145,6 +170,9 @@ class VCPU {
     /* MSRs */
     void set_msr(uint32_t idx, CURRENT_ABI::paramtype data);
     CURRENT_ABI::paramtype get_msr(uint32_t idx);
+    /* batched MSR writes, see KVM::VCPU::queue_msr() */
+    int queue_msr(uint32_t idx, CURRENT_ABI::paramtype data);
+    int flush_msrs();
 
     /* RUNNING the VCPU */
     int run();
@@ -168,8 +196,14 @@ class VCPU {
     CURRENT_ABI::paramtype pop();
     void push(CURRENT_ABI::paramtype val);
     guestptr_t kernel_stack_base() { return stack.kernel_base(); }
+    size_t stack_size() const { return stack.user_size(); }
     int handle_stack_expansion(uint32_t err, bool debug);
     void init_rsp();
+    /*
+     * Start over with a new user stack, cleared general purpose registers
+     * and no TLS (fs base), for execve. Only the register cache is changed.
+     */
+    int reset_user();
 };
 
 std::ostream &print(std::ostream &os, const VCPU &vcpu);
@@ -203,6 +237,7 @@ std::ostream &print_stack(std::ostream &os, const VM &vm, const VCPU &vcpu);
 #define VCPU_MSR_LSTAR  0xC0000082
 #define VCPU_MSR_CSTAR  0xC0000083
 #define VCPU_MSR_SFMASK 0XC0000084
+#define VCPU_MSR_KERNEL_GS_BASE 0xC0000102
 
 void kvm_vcpu_dump_msr(const std::shared_ptr<Elkvm::VCPU>& vcpu, uint32_t);
 
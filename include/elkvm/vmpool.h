@@ -0,0 +1,107 @@
+/* * libelkvm - A library that allows execution of an ELF binary inside a virtual
+ * machine without a full-scale operating system
+ * Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+ * Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+ * Dresden (Germany)
+ *
+ * This file is part of libelkvm.
+ *
+ * libelkvm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libelkvm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <elkvm/elkvm.h>
+
+namespace Elkvm {
+
+  class Snapshot;
+
+  /*
+   * A set of VMs that are ready to run, so that starting a VM on demand
+   * does not pay for KVM_CREATE_VM, the memory slots and the VCPUs. All VMs
+   * of a pool are copy-on-write clones of one snapshot, taken after
+   * setup_proxy_os (and after loading the binary, if one is given). A
+   * background thread keeps size VMs ready and resets returned VMs to the
+   * snapshot, so they are reused instead of destroyed.
+   *
+   * As the guest calling exit_group only ends VM::run() if the exit_group
+   * handler does not terminate the process, pooled VMs need handlers that
+   * replace pass_exit_group.
+   */
+  class VMPool {
+    private:
+      std::shared_ptr<Snapshot> snap;
+      unsigned size;
+
+      std::mutex lock;
+      std::condition_variable wakeup;
+      /* VMs in the state of the snapshot, handed out by acquire() */
+      std::deque<std::shared_ptr<VM>> ready;
+      /* VMs given back by release(), waiting to be reset */
+      std::deque<std::shared_ptr<VM>> returned;
+      bool stopping;
+      std::thread refiller;
+
+      void refill();
+
+    public:
+      VMPool(std::shared_ptr<Snapshot> snapshot, unsigned size);
+      ~VMPool();
+
+      VMPool(VMPool const&) = delete;
+      VMPool& operator=(VMPool const&) = delete;
+
+      /*
+       * \brief Create a VM with cpus VCPUs as elkvm_vm_create does
+       *        (elkvm_vm_create_raw if binary is nullptr) and a pool of size
+       *        clones of it. Creating the VM fails the same way as in
+       *        elkvm_vm_create, if taking the snapshot fails nullptr is
+       *        returned and errno is set. The VM itself is only kept as
+       *        the snapshot.
+       */
+      static std::shared_ptr<VMPool> create(elkvm_opts *opts,
+          unsigned size,
+          const char *binary = nullptr,
+          const hypercall_handlers * const hyp = &hypercall_null,
+          const elkvm_handlers * const handlers = &default_handlers,
+          unsigned cpus = 1);
+
+      /*
+       * \brief Take a VM out of the pool. A VM is cloned right away if none
+       *        is ready. Returns nullptr and sets errno on failure.
+       */
+      std::shared_ptr<VM> acquire();
+
+      /*
+       * \brief Give back a VM that came from acquire(), after its run()
+       *        returned. It is reset to the snapshot in the background and
+       *        handed out again.
+       */
+      void release(std::shared_ptr<VM> vm);
+
+      /* number of VMs that can be handed out without waiting */
+      unsigned available();
+  };
+
+//namespace Elkvm
+}
@@ -0,0 +1,291 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <elkvm/checkpoint.h>
+#include <elkvm/elkvm.h>
+#include <elkvm/heap.h>
+#include <elkvm/pager.h>
+#include <elkvm/region.h>
+#include <elkvm/region_manager.h>
+#include <elkvm/vcpu.h>
+
+namespace Elkvm {
+
+  void CheckpointWriter::put_string(const std::string &s) {
+    put<uint64_t>(s.size());
+    buf.insert(buf.end(), s.begin(), s.end());
+  }
+
+  void CheckpointWriter::add_region(const std::shared_ptr<Region> &r) {
+    const int64_t idx = region_ids.size();
+    region_ids[r.get()] = idx;
+  }
+
+  void CheckpointWriter::put_region(const std::shared_ptr<Region> &r) {
+    if(r == nullptr) {
+      put<int64_t>(-1);
+      return;
+    }
+    auto it = region_ids.find(r.get());
+    assert(it != region_ids.end() && "region is not in the region table");
+    put<int64_t>(it->second);
+  }
+
+  std::string CheckpointReader::get_string() {
+    const uint64_t len = get<uint64_t>();
+    if(failed || static_cast<uint64_t>(end - pos) < len) {
+      failed = true;
+      return "";
+    }
+    std::string s(pos, len);
+    pos += len;
+    return s;
+  }
+
+  std::shared_ptr<Region> CheckpointReader::get_region() {
+    const int64_t idx = get<int64_t>();
+    if(idx == -1) {
+      return nullptr;
+    }
+    if(idx < 0 || static_cast<uint64_t>(idx) >= regions.size()) {
+      failed = true;
+      return nullptr;
+    }
+    return regions[idx];
+  }
+
+  static int write_all(int fd, const void *buf, size_t len, off_t off) {
+    const char *p = static_cast<const char *>(buf);
+    size_t done = 0;
+    while(done < len) {
+      ssize_t bytes = pwrite(fd, p + done, len - done, off + done);
+      if(bytes < 0) {
+        if(errno == EINTR) {
+          continue;
+        }
+        return -errno;
+      }
+      done += bytes;
+    }
+    return 0;
+  }
+
+  static int read_all(int fd, void *buf, size_t len, off_t off) {
+    char *p = static_cast<char *>(buf);
+    size_t done = 0;
+    while(done < len) {
+      ssize_t bytes = pread(fd, p + done, len - done, off + done);
+      if(bytes < 0) {
+        if(errno == EINTR) {
+          continue;
+        }
+        return -errno;
+      }
+      if(bytes == 0) {
+        return -EINVAL;
+      }
+      done += bytes;
+    }
+    return 0;
+  }
+
+  int VM::checkpoint(const char *path) {
+    if(_running) {
+      return -EBUSY;
+    }
+
+    /* VMs restored from an earlier image at path map its pages MAP_PRIVATE,
+     * pages they have not written to yet would change with the file. The
+     * image is written to a new file that replaces the old one at the end,
+     * the old one stays around as long as it is mapped. */
+    std::string tmp = std::string(path) + ".XXXXXX";
+    int fd = mkostemp(&tmp[0], O_CLOEXEC);
+    if(fd < 0) {
+      return -errno;
+    }
+    int base_fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    int err = save_checkpoint(fd, base_fd);
+    if(base_fd >= 0) {
+      close(base_fd);
+    }
+    close(fd);
+    if(!err && rename(tmp.c_str(), path)) {
+      err = -errno;
+    }
+    if(err) {
+      unlink(tmp.c_str());
+    }
+    return err;
+  }
+
+  int VM::save_checkpoint(int fd, int base_fd) {
+    /* an interrupted checkpoint must not look valid */
+    struct elkvm_checkpoint_header header;
+    memset(&header, 0, sizeof(header));
+    int err = write_all(fd, &header, sizeof(header), 0);
+    if(err) {
+      return err;
+    }
+
+    auto &pager = _rm->get_pager();
+    err = pager.checkpoint_memory(fd, HOST_PAGESIZE, base_fd);
+    if(err) {
+      return err;
+    }
+
+    CheckpointWriter w;
+    _rm->save_state(w);
+    w.put_region(_gdt);
+    w.put_region(sighandler_cleanup.region);
+    w.put<uint64_t>(sighandler_cleanup.size);
+    w.put<uint64_t>(_elf_regions.size());
+    for(const auto &region : _elf_regions) {
+      w.put_region(region);
+    }
+    w.put_region(_env_region);
+    w.put(sigs);
+    for(int i = 0; i < RLIMIT_NLIMITS; i++) {
+      w.put(*_rlimit.get(i));
+    }
+    hm.save_state(w);
+    w.put<uint32_t>(cpus.size());
+    for(const auto &vcpu : cpus) {
+      err = vcpu->save_state(w);
+      if(err) {
+        return err;
+      }
+    }
+
+    memcpy(header.magic, ELKVM_CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = ELKVM_CHECKPOINT_VERSION;
+    header.cpus = cpus.size();
+    header.mem_offset = HOST_PAGESIZE;
+    header.mem_size = pager.guest_phys_size();
+    header.state_offset = header.mem_offset + pagesize_align(header.mem_size);
+    header.state_size = w.data().size();
+
+    err = write_all(fd, w.data().data(), header.state_size, header.state_offset);
+    if(!err && ftruncate(fd, header.state_offset + header.state_size)) {
+      err = -errno;
+    }
+    if(!err && fdatasync(fd)) {
+      err = -errno;
+    }
+    if(!err) {
+      err = write_all(fd, &header, sizeof(header), 0);
+    }
+    if(!err && fdatasync(fd)) {
+      err = -errno;
+    }
+    return err;
+  }
+
+  int VM::restore(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+      return -errno;
+    }
+
+    struct elkvm_checkpoint_header header;
+    struct stat st;
+    int err = read_all(fd, &header, sizeof(header), 0);
+    if(!err && fstat(fd, &st)) {
+      err = -errno;
+    }
+    if(!err && (memcmp(header.magic, ELKVM_CHECKPOINT_MAGIC, sizeof(header.magic))
+          || header.version != ELKVM_CHECKPOINT_VERSION
+          || header.cpus != cpus.size()
+          || header.mem_offset % HOST_PAGESIZE
+          || header.mem_size > header.state_offset
+          || header.state_offset - header.mem_size < header.mem_offset
+          || header.state_size > static_cast<uint64_t>(st.st_size)
+          || header.state_offset
+            > static_cast<uint64_t>(st.st_size) - header.state_size)) {
+      err = -EINVAL;
+    }
+
+    std::vector<char> state;
+    if(!err) {
+      state.resize(header.state_size);
+      err = read_all(fd, state.data(), state.size(), header.state_offset);
+    }
+    if(err) {
+      close(fd);
+      return err;
+    }
+
+    /* guest memory stays mapped from the file after it is closed */
+    CheckpointReader r(state);
+    err = _rm->restore_state(r, fd, header.mem_offset);
+    close(fd);
+    if(err) {
+      return err;
+    }
+
+    _gdt = r.get_region();
+    sighandler_cleanup.region = r.get_region();
+    sighandler_cleanup.size = r.get<uint64_t>();
+    _elf_regions.clear();
+    for(uint64_t n = r.get<uint64_t>(); r.ok() && n > 0; n--) {
+      _elf_regions.push_back(r.get_region());
+    }
+    _env_region = r.get_region();
+    sigs = r.get<elkvm_signals>();
+    for(int i = 0; i < RLIMIT_NLIMITS; i++) {
+      auto rlim = r.get<struct ::rlimit>();
+      _rlimit.set(i, &rlim);
+    }
+    err = hm.restore_state(r);
+    if(err) {
+      return err;
+    }
+    if(r.get<uint32_t>() != cpus.size()) {
+      return -EINVAL;
+    }
+    for(const auto &vcpu : cpus) {
+      err = vcpu->restore_state(r);
+      if(err) {
+        return err;
+      }
+    }
+    _stop = false;
+    return r.ok() ? 0 : -EINVAL;
+  }
+
+//namespace Elkvm
+}
@@ -0,0 +1,170 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cstring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <elkvm/dircache.h>
+#include <elkvm/types.h>
+
+namespace Elkvm {
+
+  const size_t DirListing::npos;
+
+  DirListing::DirListing(std::vector<char> &&recs) :
+    records(std::move(recs)),
+    cookies()
+  {
+    /* position 0 is the start of the directory */
+    cookies[0] = 0;
+    size_t off = 0;
+    while(off < records.size()) {
+      const struct linux_dirent64 *d =
+        reinterpret_cast<const struct linux_dirent64 *>(&records[off]);
+      off += d->d_reclen;
+      cookies[d->d_off] = off;
+    }
+  }
+
+  size_t DirListing::find(int64_t pos) const {
+    auto it = cookies.find(pos);
+    return it == cookies.end() ? npos : it->second;
+  }
+
+  DirCache::DirCache(size_t max) :
+    lock(),
+    entries(),
+    lru(),
+    max_bytes(max),
+    stats()
+  {}
+
+  static bool same_time(const struct timespec &a, const struct timespec &b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+  }
+
+  /* read the whole directory through a file descriptor of our own, so the
+   * position of fd does not move */
+  static std::shared_ptr<const DirListing> read_listing(int fd) {
+    int dfd = openat(fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dfd < 0) {
+      return nullptr;
+    }
+
+    std::vector<char> records;
+    const size_t step = 64 * 1024;
+    long res;
+    do {
+      size_t done = records.size();
+      records.resize(done + step);
+      res = syscall(__NR_getdents64, dfd, &records[done], step);
+      records.resize(done + (res > 0 ? res : 0));
+    } while(res > 0);
+
+    const int saved_errno = errno;
+    close(dfd);
+    if(res < 0) {
+      errno = saved_errno;
+      return nullptr;
+    }
+    records.shrink_to_fit();
+    return std::make_shared<const DirListing>(std::move(records));
+  }
+
+  std::shared_ptr<const DirListing> DirCache::get(int fd) {
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+      return nullptr;
+    }
+    if(!S_ISDIR(st.st_mode)) {
+      errno = ENOTDIR;
+      return nullptr;
+    }
+
+    const dir_key key(st.st_dev, st.st_ino);
+    {
+      std::lock_guard<std::mutex> l(lock);
+      auto it = entries.find(key);
+      if(it != entries.end()) {
+        if(same_time(it->second.mtime, st.st_mtim)
+            && same_time(it->second.ctime, st.st_ctim)) {
+          lru.splice(lru.begin(), lru, it->second.lru);
+          stats.hits++;
+          return it->second.listing;
+        }
+        stats.bytes -= it->second.listing->size();
+        stats.listings--;
+        lru.erase(it->second.lru);
+        entries.erase(it);
+      }
+      stats.misses++;
+    }
+
+    /* the directory is read without holding the lock */
+    std::shared_ptr<const DirListing> listing = read_listing(fd);
+    if(listing != nullptr) {
+      insert(key, st, listing);
+    }
+    return listing;
+  }
+
+  void DirCache::insert(const dir_key &key, const struct stat &st,
+      std::shared_ptr<const DirListing> listing) {
+    std::lock_guard<std::mutex> l(lock);
+    if(listing->size() > max_bytes || entries.count(key)) {
+      return;
+    }
+
+    while(stats.bytes + listing->size() > max_bytes) {
+      auto victim = entries.find(lru.back());
+      stats.bytes -= victim->second.listing->size();
+      stats.listings--;
+      entries.erase(victim);
+      lru.pop_back();
+    }
+
+    lru.push_front(key);
+    entries[key] = { st.st_mtim, st.st_ctim, listing, lru.begin() };
+    stats.bytes += listing->size();
+    stats.listings++;
+  }
+
+  dir_cache_stats DirCache::get_stats() const {
+    std::lock_guard<std::mutex> l(lock);
+    return stats;
+  }
+
+  void DirCache::clear() {
+    std::lock_guard<std::mutex> l(lock);
+    entries.clear();
+    lru.clear();
+    stats.listings = 0;
+    stats.bytes = 0;
+  }
+
+//namespace Elkvm
+}
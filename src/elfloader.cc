@@ -150,6 +150,7 @@ namespace Elkvm {
     _loader("undefined ldr"),
     _entry_point(~0ULL),
     _auxv(),
+    _regions(),
     text_header()
   {
     assert(!pathname.empty() && "cannot load binary from empty pathname");
@@ -326,6 +327,7 @@ namespace Elkvm {
     size_t total_size = phdr.p_memsz + offset_in_page(load_addr);
     auto loadable_region = _rm->allocate_region(total_size, "ELF PHdr");
     loadable_region->set_guest_addr(page_begin(load_addr));
+    _regions.push_back(loadable_region);
 
     int err = load_program_header(phdr, *loadable_region, file, eptr);
     assert(err == 0 && "Error in ElfBinary::load_program_header");
@@ -495,6 +497,15 @@ namespace Elkvm {
     return _loader;
   }
 
+  std::vector<std::shared_ptr<Region>> ElfBinary::get_regions() const {
+    std::vector<std::shared_ptr<Region>> regions(_regions);
+    if(_ldr != nullptr) {
+      auto ldr = _ldr->get_regions();
+      regions.insert(regions.end(), ldr.begin(), ldr.end());
+    }
+    return regions;
+  }
+
   ptopt_t get_pager_opts_from_phdr_flags(int flags) {
     ptopt_t opts = 0;
     if(flags & PF_X) {
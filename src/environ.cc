@@ -78,6 +78,20 @@ namespace Elkvm {
     fill_auxv(auxv);
   }
 
+  Environment::Environment(const ElfBinary &bin, std::shared_ptr<Region> reg,
+      int argc, char **argv, char **env, Elf64_auxv_t *auxv) :
+    _region(reg),
+    _auxv(),
+    _env(),
+    _argv(),
+    _argc(argc),
+    binary(bin)
+  {
+    fill_argv(argv);
+    fill_env(env);
+    fill_auxv(auxv);
+  }
+
   Elf64_auxv_t *Environment::calc_auxv(char **env) const {
     /* XXX this breaks, if we do not get the original envp */
 
@@ -136,9 +136,7 @@ std::shared_ptr<Elkvm::Region> elkvm_gdt_setup(Elkvm::RegionManager &rm,
     uint64_t sysret_star = (ss_selector - 0x8) | 0x3;
     uint64_t star = (sysret_star << 48) | (syscall_star << 32);
 
-    vcpu->set_msr(VCPU_MSR_STAR, star);
-
-    err = vcpu->get_sregs();
+    err = vcpu->queue_msr(VCPU_MSR_STAR, star);
     if(err) {
         return nullptr;
     }
@@ -159,11 +157,6 @@ std::shared_ptr<Elkvm::Region> elkvm_gdt_setup(Elkvm::RegionManager &rm,
       0x0);
   vcpu->set_reg(Elkvm::Seg_t::tr, tr);
 
-    err = vcpu->set_sregs();
-    if(err) {
-        return nullptr;
-    }
-
     return gdt_region;
 }
 
@@ -22,10 +22,14 @@
 //
 
 #include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <set>
 
+#include <elkvm/checkpoint.h>
 #include <elkvm/elkvm.h>
 #include <elkvm/elkvm-internal.h>
 #include <elkvm/elfloader.h>
@@ -36,6 +40,65 @@
 
 namespace Elkvm {
 
+  HeapManager::HeapManager(std::shared_ptr<RegionManager> rm,
+      const HeapManager &orig, const RegionMap &regions) :
+    mappings_for_brk(),
+    mappings_for_mmap(),
+    _rm(rm),
+    curbrk(orig.curbrk),
+    writer_lock(),
+    shm_segments()
+  {
+    reset(orig, regions);
+  }
+
+  void HeapManager::reset(const HeapManager &orig, const RegionMap &regions) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    mappings_for_brk.clear();
+    mappings_for_mmap.clear();
+    for(const auto &m : orig.mappings_for_brk) {
+      mappings_for_brk.emplace_back(m, cloned_region(regions, m.get_region()));
+    }
+    for(const auto &m : orig.mappings_for_mmap) {
+      mappings_for_mmap.emplace_back(m, cloned_region(regions, m.get_region()));
+    }
+    shm_segments.clear();
+    for(const auto &s : orig.shm_segments) {
+      shm_segments[s.first] = cloned_region(regions, s.second);
+    }
+    curbrk = orig.curbrk;
+  }
+
+  void HeapManager::save_state(CheckpointWriter &w) const {
+    w.put<guestptr_t>(curbrk);
+    w.put<uint64_t>(mappings_for_brk.size());
+    for(const auto &m : mappings_for_brk) {
+      m.save_state(w);
+    }
+    w.put<uint64_t>(mappings_for_mmap.size());
+    for(const auto &m : mappings_for_mmap) {
+      m.save_state(w);
+    }
+  }
+
+  int HeapManager::restore_state(CheckpointReader &r) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    curbrk = r.get<guestptr_t>();
+    mappings_for_brk.clear();
+    for(uint64_t n = r.get<uint64_t>(); r.ok() && n > 0; n--) {
+      mappings_for_brk.emplace_back(r);
+    }
+    mappings_for_mmap.clear();
+    for(uint64_t n = r.get<uint64_t>(); r.ok() && n > 0; n--) {
+      mappings_for_mmap.emplace_back(r);
+    }
+    /* the restored memory is no longer attached to any segment */
+    shm_segments.clear();
+    return r.ok() ? 0 : -EINVAL;
+  }
+
   void HeapManager::free_unused_mappings(guestptr_t brk) {
     while(brk <= mappings_for_brk.back().guest_address()) {
       /* no need to call pop_back here, unmap does this for us */
@@ -165,7 +228,12 @@ namespace Elkvm {
       if(it == mappings_for_mmap.end()) {
         it = std::find_if(mappings_for_mmap.begin(), mappings_for_mmap.end(),
             [addr](const Mapping &m) { return m.contains_address(addr); });
-        if(it != mappings_for_mmap.end()) {
+        if(it != mappings_for_mmap.end() && it->get_region()->is_shared()) {
+          /* shared memory cannot be split up, only its pages go away */
+          size_t len = std::min<size_t>(length,
+              it->guest_address() + it->get_length() - addr);
+          unmap(*it, addr, pages_from_size(len));
+        } else if(it != mappings_for_mmap.end()) {
           /* TODO this should be done after we get back to the user! */
           /* this mapping needs to be split! */
           slice(*it, addr, length);
@@ -191,7 +259,10 @@ namespace Elkvm {
 
     length = pagesize_align(length);
 
-    if(r == nullptr) {
+    if(r == nullptr && (flags & MAP_SHARED) && (flags & MAP_ANONYMOUS)) {
+      r = create_shared_region(length);
+      assert(r != nullptr && "could not create shared memory");
+    } else if(r == nullptr) {
       std::ostringstream str;
       str << "mapping with fd: " << std::dec << fd;
       r = _rm->allocate_region(length, str.str());
@@ -207,6 +278,22 @@ namespace Elkvm {
     return mapping;
   }
 
+  std::shared_ptr<Region> HeapManager::create_shared_region(size_t length) {
+    /* the memory stays shared with forked children, as it does on Linux */
+    int fd = memfd_create("elkvm shared memory", MFD_CLOEXEC);
+    if(fd < 0) {
+      return nullptr;
+    }
+
+    std::shared_ptr<Region> r = nullptr;
+    if(ftruncate(fd, length) == 0) {
+      r = _rm->map_shared(fd, 0, length, "shared anon mapping");
+    }
+    /* the mapping keeps the memory alive */
+    close(fd);
+    return r;
+  }
+
   void HeapManager::free_mapping(Mapping &mapping) {
     auto it = std::find(mappings_for_brk.begin(), mappings_for_brk.end(), mapping);
     if(it == mappings_for_brk.end()) {
@@ -218,6 +305,60 @@ namespace Elkvm {
     }
   }
 
+  void HeapManager::add_segment(guestptr_t addr, std::shared_ptr<Region> r) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+    shm_segments[addr] = r;
+  }
+
+  Mapping *HeapManager::find_segment(guestptr_t addr) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+    auto s = shm_segments.find(addr);
+    if(s == shm_segments.end()) {
+      return nullptr;
+    }
+
+    auto it = std::find_if(mappings_for_mmap.begin(), mappings_for_mmap.end(),
+        [addr, &s](const Mapping &m)
+        { return m.guest_address() == addr && m.get_region() == s->second; });
+    if(it == mappings_for_mmap.end()) {
+      /* munmap took the segment away */
+      shm_segments.erase(s);
+      return nullptr;
+    }
+    return &*it;
+  }
+
+  void HeapManager::clear() {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+    auto &pager = _rm->get_pager();
+
+    /* brk mappings are in both lists and slices may share a region */
+    std::set<std::shared_ptr<Region>> regions;
+    auto drop = [&pager, &regions](const Mapping &m) {
+      if(m.get_flags() & MAP_LOCKED) {
+        pager.unlock_host_memory(m.base_address(), m.get_length());
+      }
+      /* pages may already be gone, e.g. after mprotect(PROT_NONE) */
+      for(int i = 0; i < pages_from_size(m.get_length()); i++) {
+        pager.free_page(m.guest_address() + i * ELKVM_PAGESIZE);
+      }
+      regions.insert(m.get_region());
+    };
+    std::for_each(mappings_for_brk.begin(), mappings_for_brk.end(), drop);
+    std::for_each(mappings_for_mmap.begin(), mappings_for_mmap.end(), drop);
+
+    for(const auto &r : regions) {
+      if(r != nullptr && !r->is_free()) {
+        _rm->free_region(r);
+      }
+    }
+
+    mappings_for_brk.clear();
+    mappings_for_mmap.clear();
+    shm_segments.clear();
+    curbrk = 0x0;
+  }
+
   int HeapManager::init(std::shared_ptr<Region> data, size_t sz) {
     mappings_for_brk.emplace_back(data, data->guest_address(), sz,
         PROT_READ | PROT_WRITE, MAP_ANONYMOUS, 0, 0);
@@ -228,6 +369,28 @@ namespace Elkvm {
     return 0;
   }
 
+  size_t HeapManager::heap_size() const {
+    /* map() also tracks brk mappings in mappings_for_mmap */
+    std::set<const Region *> regions;
+    for(const auto &m : mappings_for_brk) {
+      regions.insert(m.get_region().get());
+    }
+    for(const auto &m : mappings_for_mmap) {
+      regions.insert(m.get_region().get());
+    }
+    if(!mappings_for_brk.empty()) {
+      regions.erase(mappings_for_brk.front().get_region().get());
+    }
+
+    size_t size = 0;
+    for(const auto *r : regions) {
+      if(r != nullptr) {
+        size += r->size();
+      }
+    }
+    return size;
+  }
+
   void HeapManager::dump_mappings() const {
     std::cout << "DUMPING ALL MAPPINGS:\n";
     std::cout << "====================\n";
@@ -269,6 +432,17 @@ namespace Elkvm {
       _rm->use_region(m.get_region());
     }
     assert(err == 0);
+
+    /* the page tables are complete by now, back them with host memory too,
+     * as on Linux this is best effort and failures are not reported */
+    if(m.get_flags() & (MAP_POPULATE | MAP_LOCKED)) {
+      unsigned flags = ELKVM_MEM_POPULATE;
+      if(m.get_flags() & MAP_LOCKED) {
+        flags |= ELKVM_MEM_LOCK;
+      }
+      _rm->get_pager().populate_host_memory(m.base_address(),
+          m.get_length(), flags);
+    }
     return err;
   }
 
@@ -334,6 +508,12 @@ namespace Elkvm {
     assert(pages <= m.get_pages());
     assert(m.contains_address(unmap_addr + ((pages-1) * ELKVM_PAGESIZE)));
 
+    if(m.get_flags() & MAP_LOCKED) {
+      char *host_p = static_cast<char *>(m.base_address())
+        + (unmap_addr - m.guest_address());
+      _rm->get_pager().unlock_host_memory(host_p, pages * ELKVM_PAGESIZE);
+    }
+
     int err = _rm->get_pager().unmap_region(unmap_addr, pages);
     assert(err == 0 && "could not unmap this mapping");
     m.pages_unmapped(pages);
@@ -75,7 +75,5 @@ int elkvm_idt_setup(Elkvm::RegionManager &rm,
   Elkvm::Segment idt(idt_region->guest_address(), 0xFFF);
   vcpu->set_reg(Elkvm::Seg_t::idt, idt);
 
-	int err = vcpu->set_sregs();
-
-	return err;
+	return 0;
 }
@@ -0,0 +1,551 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+#include <errno.h>
+#include <linux/kvm.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <elkvm/config.h>
+#include <elkvm/io_uring.h>
+#include <elkvm/pager.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+/* the kernel limits a single read or write and a fixed buffer in size */
+static const size_t max_rw_count = 0x7ffff000;
+static const size_t max_fixed_buffer = 1UL << 30;
+
+static thread_local const Elkvm::PagerX86_64 *uring_memory = nullptr;
+
+namespace Elkvm {
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+  IoUring::IoUring(unsigned entries) :
+    ring_fd(-1),
+    owner(getpid()),
+    sq_ring_p(MAP_FAILED),
+    sq_ring_size(0),
+    sqes(nullptr),
+    sqes_size(0),
+    sq_head(nullptr),
+    sq_tail(nullptr),
+    sq_mask(nullptr),
+    sq_array(nullptr),
+    cq_head(nullptr),
+    cq_tail(nullptr),
+    cq_mask(nullptr),
+    cqes(nullptr),
+    buffers_epoch(0),
+    buffers(),
+    next_user_data(1)
+  {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(fd < 0) {
+      return;
+    }
+
+    /* IORING_OP_READ, IORING_OP_SEND etc. came with the same kernels */
+    const unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP
+      | IORING_FEAT_FAST_POLL;
+    if((p.features & needed) != needed) {
+      close(fd);
+      return;
+    }
+
+    sq_ring_size = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+        p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+    sq_ring_p = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *s = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sq_ring_p == MAP_FAILED || s == MAP_FAILED) {
+      if(s != MAP_FAILED) {
+        munmap(s, sqes_size);
+      }
+      close(fd);
+      return;
+    }
+    sqes = static_cast<struct io_uring_sqe *>(s);
+
+    /* with IORING_FEAT_SINGLE_MMAP both rings share one mapping, the CQ
+     * ring is not mapped on its own */
+    char *sq = static_cast<char *>(sq_ring_p);
+    sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    cq_head = reinterpret_cast<unsigned *>(sq + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(sq + p.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned *>(sq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(sq + p.cq_off.cqes);
+    ring_fd = fd;
+  }
+
+  IoUring::~IoUring() {
+    /* closing the ring drops the fixed buffers as well */
+    if(sqes != nullptr) {
+      munmap(sqes, sqes_size);
+    }
+    if(sq_ring_p != MAP_FAILED) {
+      munmap(sq_ring_p, sq_ring_size);
+    }
+    if(ring_fd >= 0) {
+      close(ring_fd);
+    }
+  }
+
+  void IoUring::register_buffers(const PagerX86_64 &pager) {
+    unregister_buffers();
+    buffers_epoch = pager.memory_epoch();
+
+    for(unsigned i = 0; i < pager.chunk_count(); i++) {
+      auto chunk = pager.get_chunk(i);
+      /* read-only chunks cannot be pinned for writing */
+      if(chunk->memory_size > max_fixed_buffer
+          || (chunk->flags & KVM_MEM_READONLY)) {
+        continue;
+      }
+      struct iovec iov;
+      iov.iov_base = reinterpret_cast<void *>(chunk->userspace_addr);
+      iov.iov_len = chunk->memory_size;
+      buffers.push_back(iov);
+    }
+
+    if(!buffers.empty() && syscall(__NR_io_uring_register, ring_fd,
+          IORING_REGISTER_BUFFERS, buffers.data(), buffers.size())) {
+      /* most likely RLIMIT_MEMLOCK, do without fixed buffers until the
+       * chunks change */
+      buffers.clear();
+    }
+  }
+
+  void IoUring::unregister_buffers() {
+    if(!buffers.empty()) {
+      syscall(__NR_io_uring_register, ring_fd, IORING_UNREGISTER_BUFFERS,
+          nullptr, 0);
+      buffers.clear();
+    }
+    buffers_epoch = 0;
+  }
+
+  int IoUring::fixed_buffer(const void *buf, size_t len) {
+    if(uring_memory == nullptr) {
+      unregister_buffers();
+      return -1;
+    }
+    if(uring_memory->memory_epoch() != buffers_epoch) {
+      register_buffers(*uring_memory);
+    }
+
+    const char *b = static_cast<const char *>(buf);
+    for(unsigned i = 0; i < buffers.size(); i++) {
+      const char *base = static_cast<const char *>(buffers[i].iov_base);
+      if(b >= base && b + len <= base + buffers[i].iov_len) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  void IoUring::push(const struct io_uring_sqe &sqe) {
+    const unsigned tail = *sq_tail;
+    const unsigned idx = tail & *sq_mask;
+    sqes[idx] = sqe;
+    sq_array[idx] = idx;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  int IoUring::wait(uint64_t user_data, long *res) {
+    while(true) {
+      unsigned head = *cq_head;
+      while(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe cqe = cqes[head & *cq_mask];
+        __atomic_store_n(cq_head, ++head, __ATOMIC_RELEASE);
+        /* completions of cancelled operations are of no interest */
+        if(cqe.user_data == user_data) {
+          *res = cqe.res;
+          return 0;
+        }
+      }
+
+      /* submitting and waiting in one go would hide a signal behind the
+       * number of submitted entries, most operations on files complete
+       * during submission anyway */
+      const unsigned pending = *sq_tail
+        - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+      int ret = pending
+        ? syscall(__NR_io_uring_enter, ring_fd, pending, 0, 0, nullptr, 0)
+        : syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS,
+            nullptr, 0);
+      if(ret < 0 && errno != EAGAIN && errno != EBUSY) {
+        return -errno;
+      }
+    }
+  }
+
+  long IoUring::submit_and_wait(struct io_uring_sqe &sqe) {
+    const uint64_t user_data = next_user_data++;
+    sqe.user_data = user_data;
+    push(sqe);
+
+    long res = 0;
+    int err = wait(user_data, &res);
+    if(err == -EINTR) {
+      /* a signal interrupts the operation just like a blocking system
+       * call, unless it completes before the cancellation */
+      struct io_uring_sqe cancel;
+      memset(&cancel, 0, sizeof(cancel));
+      cancel.opcode = IORING_OP_ASYNC_CANCEL;
+      cancel.fd = -1;
+      cancel.addr = user_data;
+      cancel.user_data = next_user_data++;
+      push(cancel);
+      while((err = wait(user_data, &res)) == -EINTR);
+      if(!err && res == -ECANCELED) {
+        res = -EINTR;
+      }
+    }
+    if(err) {
+      /* drop the operation if the kernel has not seen it yet */
+      *sq_tail = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+      return err;
+    }
+    return res;
+  }
+
+  long IoUring::rw(uint8_t op, int fd, const void *buf, size_t len,
+      off_t offset, int flags) {
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = op;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<__u64>(buf);
+    sqe.len = std::min(len, max_rw_count);
+    sqe.off = static_cast<__u64>(offset);
+    sqe.rw_flags = flags;
+
+    if(op == IORING_OP_READ || op == IORING_OP_WRITE) {
+      int idx = fixed_buffer(buf, sqe.len);
+      if(idx >= 0) {
+        sqe.opcode = op == IORING_OP_READ ? IORING_OP_READ_FIXED
+          : IORING_OP_WRITE_FIXED;
+        sqe.buf_index = idx;
+      }
+    }
+    return submit_and_wait(sqe);
+  }
+
+  long IoUring::read(int fd, void *buf, size_t len, off_t offset) {
+    return rw(IORING_OP_READ, fd, buf, len, offset, 0);
+  }
+
+  long IoUring::write(int fd, const void *buf, size_t len, off_t offset) {
+    return rw(IORING_OP_WRITE, fd, buf, len, offset, 0);
+  }
+
+  long IoUring::readv(int fd, const struct iovec *iov, int iovcnt,
+      off_t offset, int flags) {
+    return rw(IORING_OP_READV, fd, iov, iovcnt, offset, flags);
+  }
+
+  long IoUring::writev(int fd, const struct iovec *iov, int iovcnt,
+      off_t offset, int flags) {
+    return rw(IORING_OP_WRITEV, fd, iov, iovcnt, offset, flags);
+  }
+
+  long IoUring::recv(int fd, void *buf, size_t len, int flags) {
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_RECV;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<__u64>(buf);
+    sqe.len = std::min(len, max_rw_count);
+    sqe.msg_flags = flags;
+    return submit_and_wait(sqe);
+  }
+
+  long IoUring::send(int fd, const void *buf, size_t len, int flags) {
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_SEND;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<__u64>(buf);
+    sqe.len = std::min(len, max_rw_count);
+    sqe.msg_flags = flags;
+    return submit_and_wait(sqe);
+  }
+
+  long IoUring::accept(int fd, struct sockaddr *addr, socklen_t *addrlen,
+      int flags) {
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_ACCEPT;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<__u64>(addr);
+    sqe.addr2 = reinterpret_cast<__u64>(addrlen);
+    sqe.accept_flags = flags;
+    return submit_and_wait(sqe);
+  }
+
+  long IoUring::fsync(int fd, bool datasync) {
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_FSYNC;
+    sqe.fd = fd;
+    sqe.fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+    return submit_and_wait(sqe);
+  }
+
+  IoUring *thread_io_uring() {
+    static thread_local std::unique_ptr<IoUring> ring;
+    static thread_local bool unsupported = false;
+
+    if(ring != nullptr && !ring->is_owner()) {
+      /* a forked child shares the ring and its buffers with the parent */
+      ring.reset();
+      unsupported = false;
+    }
+    if(ring == nullptr && !unsupported) {
+      ring.reset(new IoUring(8));
+      if(!ring->is_valid()) {
+        ring.reset();
+        unsupported = true;
+      }
+    }
+    return ring.get();
+  }
+
+#else
+
+  IoUring *thread_io_uring() {
+    return nullptr;
+  }
+
+#endif
+
+  void io_uring_use_memory(const PagerX86_64 *pager) {
+    uring_memory = pager;
+#ifdef HAVE_LINUX_IO_URING_H
+    IoUring *ring = thread_io_uring();
+    if(pager == nullptr && ring != nullptr) {
+      ring->unregister_buffers();
+    }
+#endif
+  }
+
+//namespace Elkvm
+}
+
+/*
+ * Handlers return -1 and set errno on failure, just like the system calls
+ * default_handlers pass their arguments to.
+ */
+static long uring_result(long res) {
+  if(res < 0) {
+    errno = -res;
+    return -1;
+  }
+  return res;
+}
+
+static long uring_read(int fd, void *buf, size_t count) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr) {
+    return Elkvm::default_handlers.read(fd, buf, count);
+  }
+  return uring_result(ring->read(fd, buf, count, -1));
+}
+
+static long uring_write(int fd, void *buf, size_t count) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr) {
+    return Elkvm::default_handlers.write(fd, buf, count);
+  }
+  return uring_result(ring->write(fd, buf, count, -1));
+}
+
+static long uring_pread64(int fd, void *buf, size_t count, off_t offset) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr) {
+    return Elkvm::default_handlers.pread64(fd, buf, count, offset);
+  }
+  /* -1 would read from the file position */
+  if(offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return uring_result(ring->read(fd, buf, count, offset));
+}
+
+static long uring_pwrite64(int fd, const void *buf, size_t count,
+    off_t offset) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr) {
+    return Elkvm::default_handlers.pwrite64(fd, buf, count, offset);
+  }
+  if(offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return uring_result(ring->write(fd, buf, count, offset));
+}
+
+static long uring_readv(int fd, struct iovec *iov, int iovcnt) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr) {
+    return Elkvm::default_handlers.readv(fd, iov, iovcnt);
+  }
+  return uring_result(ring->readv(fd, iov, iovcnt, -1, 0));
+}
+
+static long uring_writev(int fd, struct iovec *iov, int iovcnt) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr) {
+    return Elkvm::default_handlers.writev(fd, iov, iovcnt);
+  }
+  return uring_result(ring->writev(fd, iov, iovcnt, -1, 0));
+}
+
+static long uring_preadv(int fd, const struct iovec *iov, int iovcnt,
+    off_t offset) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr) {
+    return Elkvm::default_handlers.preadv(fd, iov, iovcnt, offset);
+  }
+  if(offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return uring_result(ring->readv(fd, iov, iovcnt, offset, 0));
+}
+
+static long uring_pwritev(int fd, const struct iovec *iov, int iovcnt,
+    off_t offset) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr) {
+    return Elkvm::default_handlers.pwritev(fd, iov, iovcnt, offset);
+  }
+  if(offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return uring_result(ring->writev(fd, iov, iovcnt, offset, 0));
+}
+
+/* an offset of -1 means the file position for the v2 variants as well */
+static long uring_preadv2(int fd, const struct iovec *iov, int iovcnt,
+    off_t offset, int flags) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr) {
+    return Elkvm::default_handlers.preadv2(fd, iov, iovcnt, offset, flags);
+  }
+  return uring_result(ring->readv(fd, iov, iovcnt, offset, flags));
+}
+
+static long uring_pwritev2(int fd, const struct iovec *iov, int iovcnt,
+    off_t offset, int flags) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr) {
+    return Elkvm::default_handlers.pwritev2(fd, iov, iovcnt, offset, flags);
+  }
+  return uring_result(ring->writev(fd, iov, iovcnt, offset, flags));
+}
+
+static long uring_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr) {
+    return Elkvm::default_handlers.accept(fd, addr, addrlen);
+  }
+  return uring_result(ring->accept(fd, addr, addrlen, 0));
+}
+
+/* with an address the socket goes the way of the default handlers */
+static long uring_sendto(int sock, const void *buf, size_t len, int flags,
+    const struct sockaddr *dest_addr, socklen_t addrlen) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr || dest_addr != nullptr) {
+    return Elkvm::default_handlers.sendto(sock, buf, len, flags, dest_addr,
+        addrlen);
+  }
+  return uring_result(ring->send(sock, buf, len, flags));
+}
+
+static long uring_recvfrom(int sock, void *buf, size_t len, int flags,
+    struct sockaddr *src_addr, socklen_t *addrlen) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr || src_addr != nullptr) {
+    return Elkvm::default_handlers.recvfrom(sock, buf, len, flags, src_addr,
+        addrlen);
+  }
+  return uring_result(ring->recv(sock, buf, len, flags));
+}
+
+static long uring_fsync(int fd) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr) {
+    return Elkvm::default_handlers.fsync(fd);
+  }
+  return uring_result(ring->fsync(fd, false));
+}
+
+static long uring_fdatasync(int fd) {
+  Elkvm::IoUring *ring = Elkvm::thread_io_uring();
+  if(ring == nullptr) {
+    return Elkvm::default_handlers.fdatasync(fd);
+  }
+  return uring_result(ring->fsync(fd, true));
+}
+
+/* default_handlers is initialized statically, so it can be copied here */
+static Elkvm::elkvm_handlers make_io_uring_handlers() {
+  Elkvm::elkvm_handlers h = Elkvm::default_handlers;
+  h.read = uring_read;
+  h.write = uring_write;
+  h.pread64 = uring_pread64;
+  h.pwrite64 = uring_pwrite64;
+  h.readv = uring_readv;
+  h.writev = uring_writev;
+  h.accept = uring_accept;
+  h.sendto = uring_sendto;
+  h.recvfrom = uring_recvfrom;
+  h.fsync = uring_fsync;
+  h.fdatasync = uring_fdatasync;
+  h.preadv = uring_preadv;
+  h.pwritev = uring_pwritev;
+  h.preadv2 = uring_preadv2;
+  h.pwritev2 = uring_pwritev2;
+  return h;
+}
+
+struct Elkvm::elkvm_handlers Elkvm::io_uring_handlers = make_io_uring_handlers();
@@ -0,0 +1,187 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <algorithm>
+#include <cstring>
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+
+#include <elkvm/iov.h>
+#include <elkvm/pager.h>
+
+namespace Elkvm {
+
+  ssize_t guest_to_host_iov(const PagerX86_64 &pager, guestptr_t addr,
+      size_t len, std::vector<struct iovec> &iov) {
+    /* the result has to fit into a ssize_t and must not wrap around */
+    len = std::min(len, static_cast<size_t>(SSIZE_MAX));
+    if(addr + len < addr) {
+      len = -addr;
+    }
+
+    size_t done = 0;
+    while(done < len) {
+      guestptr_t cur = addr + done;
+      char *host_p = reinterpret_cast<char *>(pager.get_host_p(cur));
+      if(host_p == nullptr) {
+        break;
+      }
+      size_t sz = std::min(len - done, static_cast<size_t>(page_remain(cur)));
+
+      if(!iov.empty() &&
+          reinterpret_cast<char *>(iov.back().iov_base) + iov.back().iov_len
+          == host_p) {
+        iov.back().iov_len += sz;
+      } else {
+        if(iov.size() >= IOV_MAX) {
+          break;
+        }
+        iov.push_back({ host_p, sz });
+      }
+      done += sz;
+    }
+
+    if(done == 0 && len > 0) {
+      return -EFAULT;
+    }
+    return done;
+  }
+
+  ssize_t guest_iov_to_host_iov(const PagerX86_64 &pager, guestptr_t iov_p,
+      size_t iovcnt, std::vector<struct iovec> &iov) {
+    if(iovcnt > IOV_MAX) {
+      return -EINVAL;
+    }
+
+    std::vector<struct iovec> guest_iov(iovcnt);
+    int err = copy_from_guest(pager, guest_iov.data(), iov_p,
+        iovcnt * sizeof(struct iovec));
+    if(err) {
+      return err;
+    }
+
+    size_t total = 0;
+    for(const auto &giov : guest_iov) {
+      if(giov.iov_len > SSIZE_MAX - total) {
+        return -EINVAL;
+      }
+      total += giov.iov_len;
+    }
+
+    ssize_t done = 0;
+    for(const auto &giov : guest_iov) {
+      if(giov.iov_len == 0) {
+        continue;
+      }
+      ssize_t res = guest_to_host_iov(pager,
+          reinterpret_cast<guestptr_t>(giov.iov_base), giov.iov_len, iov);
+      if(res < 0) {
+        return done > 0 ? done : res;
+      }
+      done += res;
+      if(static_cast<size_t>(res) < giov.iov_len) {
+        break;
+      }
+    }
+    return done;
+  }
+
+  int copy_from_guest(const PagerX86_64 &pager, void *dst, guestptr_t src,
+      size_t len) {
+    char *d = reinterpret_cast<char *>(dst);
+    while(len > 0) {
+      void *host_p = pager.get_host_p(src);
+      if(host_p == nullptr) {
+        return -EFAULT;
+      }
+      size_t sz = std::min(len, static_cast<size_t>(page_remain(src)));
+      memcpy(d, host_p, sz);
+      d += sz;
+      src += sz;
+      len -= sz;
+    }
+    return 0;
+  }
+
+  int copy_to_guest(const PagerX86_64 &pager, guestptr_t dst, const void *src,
+      size_t len) {
+    const char *s = reinterpret_cast<const char *>(src);
+    while(len > 0) {
+      void *host_p = pager.get_host_p(dst);
+      if(host_p == nullptr) {
+        return -EFAULT;
+      }
+      size_t sz = std::min(len, static_cast<size_t>(page_remain(dst)));
+      memcpy(host_p, s, sz);
+      s += sz;
+      dst += sz;
+      len -= sz;
+    }
+    return 0;
+  }
+
+  int copy_sigset_from_guest(const PagerX86_64 &pager, sigset_t *set,
+      guestptr_t set_p, size_t size) {
+    if(size != sizeof(unsigned long)) {
+      return -EINVAL;
+    }
+    sigemptyset(set);
+    return copy_from_guest(pager, set, set_p, size);
+  }
+
+  int map_guest_buffer(const PagerX86_64 &pager, guestptr_t addr, size_t len,
+      guest_buffer &buf) {
+    buf.addr = addr;
+    buf.len = len;
+    buf.host = nullptr;
+    if(addr == 0x0 || len == 0) {
+      return 0;
+    }
+
+    std::vector<struct iovec> iov;
+    ssize_t mapped = guest_to_host_iov(pager, addr, len, iov);
+    if(mapped < 0 || static_cast<size_t>(mapped) != len) {
+      return -EFAULT;
+    }
+    if(iov.size() == 1) {
+      buf.host = iov[0].iov_base;
+      return 0;
+    }
+    buf.bounce.resize(len);
+    buf.host = buf.bounce.data();
+    return copy_from_guest(pager, buf.host, addr, len);
+  }
+
+  int unmap_guest_buffer(const PagerX86_64 &pager, const guest_buffer &buf,
+      size_t written) {
+    if(buf.bounce.empty() || written == 0) {
+      return 0;
+    }
+    return copy_to_guest(pager, buf.addr, buf.host, std::min(written, buf.len));
+  }
+
+//namespace Elkvm
+}
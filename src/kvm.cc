@@ -38,22 +38,147 @@ namespace KVM {
 
 VCPU::VCPU(int vmfd, unsigned num)
   : fd(-1),
+	init_err(0),
 	regs(),
 	sregs(),
 	run_struct(0),
+	queued_msrs(),
+	num_queued_msrs(0),
 	debug()
 {
 
-    fd = ioctl(vmfd, KVM_CREATE_VCPU, num);
-    assert(fd > 0 && "error creating vcpu");
-
     memset(&regs, 0, sizeof(struct kvm_regs));
     memset(&sregs, 0, sizeof(struct kvm_sregs));
 
-    run_struct = reinterpret_cast<struct kvm_run *>(
-        mmap(NULL, sizeof(struct kvm_run), PROT_READ | PROT_WRITE,
-        MAP_SHARED, fd, 0));
-    assert(run_struct != nullptr && "error allocating run_struct");
+    fd = ioctl(vmfd, KVM_CREATE_VCPU, num);
+    if(fd < 0) {
+      init_err = -errno;
+      return;
+    }
+
+    void *p = mmap(NULL, sizeof(struct kvm_run), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED) {
+      init_err = -errno;
+      return;
+    }
+    run_struct = reinterpret_cast<struct kvm_run *>(p);
+}
+
+VCPU::~VCPU() {
+  if(run_struct != nullptr) {
+    munmap(run_struct, sizeof(struct kvm_run));
+  }
+  if(fd >= 0) {
+    close(fd);
+  }
+}
+
+int VCPU::copy_state(const VCPU &orig) {
+  struct vcpu_state state;
+  int err = orig.get_state(&state);
+  if(err) {
+    return err;
+  }
+  return set_state(&state);
+}
+
+int VCPU::move_to(int vmfd, unsigned num, const struct vcpu_state *state) {
+  int newfd = ioctl(vmfd, KVM_CREATE_VCPU, num);
+  if(newfd < 0) {
+    return -errno;
+  }
+
+  void *p = mmap(NULL, sizeof(struct kvm_run), PROT_READ | PROT_WRITE,
+      MAP_SHARED, newfd, 0);
+  if(p == MAP_FAILED) {
+    int err = -errno;
+    close(newfd);
+    return err;
+  }
+
+  munmap(run_struct, sizeof(struct kvm_run));
+  close(fd);
+  fd = newfd;
+  run_struct = reinterpret_cast<struct kvm_run *>(p);
+
+  int err = set_state(state);
+  if(err) {
+    return err;
+  }
+  if(debug.control && set_debug()) {
+    return -errno;
+  }
+  return 0;
+}
+
+static const uint32_t vcpu_state_msrs[VCPU_STATE_MSRS] = {
+  VCPU_MSR_STAR, VCPU_MSR_LSTAR, VCPU_MSR_CSTAR, VCPU_MSR_SFMASK,
+  VCPU_MSR_KERNEL_GS_BASE
+};
+
+/* KVM_GET_MSRS and KVM_SET_MSRS take a kvm_msrs followed by its entries */
+#define VCPU_STATE_MSR_LIST_SIZE \
+  (sizeof(struct kvm_msrs) + VCPU_STATE_MSRS * sizeof(struct kvm_msr_entry))
+
+int VCPU::get_state(struct vcpu_state *state) const {
+  state->regs = regs;
+
+  int err = ioctl(fd, KVM_GET_SREGS, &state->sregs);
+  if(err) {
+    return -errno;
+  }
+  err = ioctl(fd, KVM_GET_FPU, &state->fpu);
+  if(err) {
+    return -errno;
+  }
+
+  alignas(struct kvm_msrs) char buf[VCPU_STATE_MSR_LIST_SIZE];
+  memset(buf, 0, sizeof(buf));
+  struct kvm_msrs *msrs = reinterpret_cast<struct kvm_msrs *>(buf);
+  msrs->nmsrs = VCPU_STATE_MSRS;
+  for(unsigned i = 0; i < VCPU_STATE_MSRS; i++) {
+    msrs->entries[i].index = vcpu_state_msrs[i];
+  }
+
+  /* returns the number of MSRs read */
+  err = ioctl(fd, KVM_GET_MSRS, msrs);
+  if(err != VCPU_STATE_MSRS) {
+    return err < 0 ? -errno : -EIO;
+  }
+  memcpy(state->msrs, msrs->entries, sizeof(state->msrs));
+  return 0;
+}
+
+int VCPU::set_state(const struct vcpu_state *state) {
+  regs = state->regs;
+  int err = ioctl(fd, KVM_SET_REGS, &regs);
+  if(err) {
+    return -errno;
+  }
+
+  sregs = state->sregs;
+  err = ioctl(fd, KVM_SET_SREGS, &sregs);
+  if(err) {
+    return -errno;
+  }
+  err = ioctl(fd, KVM_SET_FPU, &state->fpu);
+  if(err) {
+    return -errno;
+  }
+
+  alignas(struct kvm_msrs) char buf[VCPU_STATE_MSR_LIST_SIZE];
+  memset(buf, 0, sizeof(buf));
+  struct kvm_msrs *msrs = reinterpret_cast<struct kvm_msrs *>(buf);
+  msrs->nmsrs = VCPU_STATE_MSRS;
+  memcpy(msrs->entries, state->msrs, sizeof(state->msrs));
+
+  /* returns the number of MSRs written */
+  err = ioctl(fd, KVM_SET_MSRS, msrs);
+  if(err != VCPU_STATE_MSRS) {
+    return err < 0 ? -errno : -EIO;
+  }
+  return 0;
 }
 
 CURRENT_ABI::paramtype VCPU::get_reg(Elkvm::Reg_t reg) const {
@@ -270,6 +395,42 @@ void VCPU::set_msr(uint32_t idx, CURRENT_ABI::paramtype data) {
   assert(err >= 0 && "error setting msr");
 }
 
+int VCPU::queue_msr(uint32_t idx, CURRENT_ABI::paramtype data) {
+  if(num_queued_msrs == VCPU_STATE_MSRS) {
+    int err = flush_msrs();
+    if(err) {
+      return err;
+    }
+  }
+
+  queued_msrs[num_queued_msrs].index = idx;
+  queued_msrs[num_queued_msrs].reserved = 0;
+  queued_msrs[num_queued_msrs].data = data;
+  num_queued_msrs++;
+  return 0;
+}
+
+int VCPU::flush_msrs() {
+  if(num_queued_msrs == 0) {
+    return 0;
+  }
+
+  alignas(struct kvm_msrs) char buf[VCPU_STATE_MSR_LIST_SIZE];
+  memset(buf, 0, sizeof(buf));
+  struct kvm_msrs *msrs = reinterpret_cast<struct kvm_msrs *>(buf);
+  msrs->nmsrs = num_queued_msrs;
+  memcpy(msrs->entries, queued_msrs,
+      num_queued_msrs * sizeof(struct kvm_msr_entry));
+
+  /* returns the number of MSRs written */
+  int err = ioctl(fd, KVM_SET_MSRS, msrs);
+  if(err != static_cast<int>(num_queued_msrs)) {
+    return err < 0 ? -errno : -EIO;
+  }
+  num_queued_msrs = 0;
+  return 0;
+}
+
 Segment VCPU::get_reg(Elkvm::Seg_t segtype) const {
   switch(segtype) {
     case Elkvm::Seg_t::cs:
@@ -446,6 +607,7 @@ int elkvm_init(Elkvm::elkvm_opts *opts, int argc, char **argv, char **environ) {
   opts->argc = argc;
   opts->argv = argv;
   opts->environ = environ;
+  opts->mem_flags = 0;
 
   return Elkvm::KVM::init(opts);
 }
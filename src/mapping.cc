@@ -24,6 +24,7 @@
 #include <cstring>
 #include <vector>
 
+#include <elkvm/checkpoint.h>
 #include <elkvm/elkvm.h>
 #include <elkvm/elkvm-internal.h>
 #include <elkvm/mapping.h>
@@ -53,6 +54,56 @@ namespace Elkvm {
       mapped_pages = pages_from_size(length);
   }
 
+  Mapping::Mapping(const Mapping& orig, std::shared_ptr<Region> r) :
+    host_p(orig.base_address()),
+    addr(orig.guest_address()),
+    length(orig.get_length()),
+    mapped_pages(orig.get_pages()),
+    prot(orig.get_prot()),
+    flags(orig.get_flags()),
+    fd(orig.get_fd()),
+    offset(orig.get_offset()),
+    region(r)
+  {
+    if(region != nullptr) {
+      host_p = static_cast<char *>(region->base_address())
+        + (static_cast<char *>(orig.base_address())
+            - static_cast<char *>(orig.get_region()->base_address()));
+    }
+  }
+
+  Mapping::Mapping(CheckpointReader &r) :
+    host_p(nullptr),
+    addr(r.get<guestptr_t>()),
+    length(r.get<uint64_t>()),
+    mapped_pages(r.get<uint32_t>()),
+    prot(r.get<int32_t>()),
+    flags(r.get<int32_t>()),
+    fd(r.get<int32_t>()),
+    offset(r.get<int64_t>()),
+    region(r.get_region())
+  {
+    const uint64_t off = r.get<uint64_t>();
+    if(region == nullptr || off > region->size()) {
+      r.fail();
+      return;
+    }
+    host_p = static_cast<char *>(region->base_address()) + off;
+  }
+
+  void Mapping::save_state(CheckpointWriter &w) const {
+    w.put<guestptr_t>(addr);
+    w.put<uint64_t>(length);
+    w.put<uint32_t>(mapped_pages);
+    w.put<int32_t>(prot);
+    w.put<int32_t>(flags);
+    w.put<int32_t>(fd);
+    w.put<int64_t>(offset);
+    w.put_region(region);
+    w.put<uint64_t>(static_cast<char *>(host_p)
+        - static_cast<char *>(region->base_address()));
+  }
+
   guestptr_t Mapping::grow_to_fill() {
     addr = region->guest_address();
     length = region->size();
@@ -0,0 +1,662 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <unordered_set>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <elkvm/metacache.h>
+
+namespace Elkvm {
+
+  /*
+   * The watcher thread is not copied into a forked child, the caches notice
+   * the new generation and start over. The locks of all caches are taken
+   * around fork, so the child does not inherit one the watcher was holding.
+   */
+  static std::mutex registry_lock;
+  static std::unordered_set<std::mutex *> registry;
+  static unsigned fork_generation = 0;
+
+  static void prepare_fork() {
+    registry_lock.lock();
+    for(auto l : registry) {
+      l->lock();
+    }
+  }
+
+  static void parent_after_fork() {
+    for(auto l : registry) {
+      l->unlock();
+    }
+    registry_lock.unlock();
+  }
+
+  static void child_after_fork() {
+    fork_generation++;
+    parent_after_fork();
+  }
+
+  static const uint32_t watch_mask = IN_ATTRIB | IN_CREATE | IN_DELETE
+    | IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO
+    | IN_ONLYDIR;
+
+  static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  /* failures that only depend on the file system, not on e.g. memory */
+  static bool cacheable_error(long res) {
+    switch(-res) {
+      case ENOENT:
+      case ENOTDIR:
+      case EACCES:
+      case ELOOP:
+      case EINVAL:
+      case EROFS:
+      case ENAMETOOLONG:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  /* failures stat and open have in common */
+  static bool open_error(long res) {
+    return res == -ENOENT || res == -ENOTDIR;
+  }
+
+  static std::string parent_dir(const std::string &path) {
+    size_t slash = path.rfind('/');
+    return slash == 0 ? "/" : path.substr(0, slash);
+  }
+
+  MetadataCache::MetadataCache(const metadata_cache_opts &o) :
+    lock(),
+    opts(o),
+    paths(),
+    fds(),
+    writers(),
+    stats(),
+    inotify_fd(-1),
+    stop_fd(-1),
+    watcher(),
+    running(false),
+    watching(false),
+    generation(0),
+    watch_dirs(),
+    dir_watches()
+  {
+    static std::once_flag atfork;
+    std::call_once(atfork, [] {
+      pthread_atfork(prepare_fork, parent_after_fork, child_after_fork);
+    });
+
+    std::lock_guard<std::mutex> rl(registry_lock);
+    registry.insert(&lock);
+    generation = fork_generation;
+    if(opts.inotify) {
+      start_watcher();
+    }
+  }
+
+  MetadataCache::~MetadataCache() {
+    {
+      std::lock_guard<std::mutex> rl(registry_lock);
+      registry.erase(&lock);
+    }
+    if(generation != fork_generation) {
+      /* the watcher was left behind in the parent */
+      running = false;
+    }
+    stop_watcher();
+  }
+
+  void MetadataCache::start_watcher() {
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if(inotify_fd < 0 || stop_fd < 0) {
+      stop_watcher();
+      return;
+    }
+
+    /* signals for the guest must not end up in the watcher */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    running = pthread_create(&watcher, nullptr, watch, this) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    watching = running;
+    if(!running) {
+      stop_watcher();
+    }
+  }
+
+  void MetadataCache::stop_watcher() {
+    if(running) {
+      uint64_t one = 1;
+      if(write(stop_fd, &one, sizeof(one)) == sizeof(one)) {
+        pthread_join(watcher, nullptr);
+      } else {
+        pthread_detach(watcher);
+      }
+      running = false;
+    }
+    watching = false;
+    if(inotify_fd >= 0) {
+      close(inotify_fd);
+      inotify_fd = -1;
+    }
+    if(stop_fd >= 0) {
+      close(stop_fd);
+      stop_fd = -1;
+    }
+    watch_dirs.clear();
+    dir_watches.clear();
+  }
+
+  /* called with the lock held */
+  void MetadataCache::check_fork() {
+    if(generation == fork_generation) {
+      return;
+    }
+    /* the watcher was left behind in the parent, the descriptors are ours */
+    generation = fork_generation;
+    running = false;
+    watching = false;
+    drop_all();
+    if(opts.inotify) {
+      stop_watcher();
+      start_watcher();
+    }
+  }
+
+  void *MetadataCache::watch(void *p) {
+    MetadataCache *cache = static_cast<MetadataCache *>(p);
+    char buf[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfds[2] = {
+      { cache->inotify_fd, POLLIN, 0 },
+      { cache->stop_fd, POLLIN, 0 },
+    };
+
+    while(true) {
+      if(poll(pfds, 2, -1) < 0) {
+        if(errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      if(pfds[1].revents) {
+        return nullptr;
+      }
+      if(pfds[0].revents & (POLLERR | POLLNVAL)) {
+        break;
+      }
+
+      ssize_t len = read(cache->inotify_fd, buf, sizeof(buf));
+      if(len < 0 && (errno == EAGAIN || errno == EINTR)) {
+        continue;
+      }
+      if(len <= 0) {
+        break;
+      }
+      std::lock_guard<std::mutex> l(cache->lock);
+      cache->handle_events(buf, len);
+    }
+
+    /* without events nothing in the cache can be trusted any longer */
+    std::lock_guard<std::mutex> l(cache->lock);
+    cache->drop_all();
+    cache->watching = false;
+    return nullptr;
+  }
+
+  void MetadataCache::handle_events(const char *buf, size_t len) {
+    size_t off = 0;
+    while(off < len) {
+      const struct inotify_event *ev =
+        reinterpret_cast<const struct inotify_event *>(buf + off);
+      off += sizeof(*ev) + ev->len;
+
+      if(ev->mask & IN_Q_OVERFLOW) {
+        drop_all();
+        continue;
+      }
+      auto it = watch_dirs.find(ev->wd);
+      if(it == watch_dirs.end()) {
+        continue;
+      }
+
+      if(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_IGNORED)) {
+        for(auto &dir : it->second) {
+          drop_below(dir);
+          dir_watches.erase(dir);
+        }
+        watch_dirs.erase(it);
+        if(!(ev->mask & IN_IGNORED)) {
+          inotify_rm_watch(inotify_fd, ev->wd);
+        }
+        continue;
+      }
+
+      if(ev->len == 0) {
+        continue;
+      }
+      for(auto &dir : it->second) {
+        std::string path = (dir == "/" ? dir : dir + "/") + ev->name;
+        drop(path);
+        /* a directory or symlink by that name may have been replaced */
+        if(ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) {
+          drop_below(path);
+        }
+      }
+    }
+  }
+
+  bool MetadataCache::cacheable(const char *path) const {
+    if(path == nullptr || path[0] != '/') {
+      return false;
+    }
+
+    /* only one spelling of each path is cached, so that invalidating it
+     * catches every entry */
+    size_t len = strnlen(path, PATH_MAX);
+    if(len == PATH_MAX || (len > 1 && path[len - 1] == '/')
+        || strstr(path, "//") != nullptr || strstr(path, "/./") != nullptr
+        || strstr(path, "/../") != nullptr) {
+      return false;
+    }
+    if((len >= 2 && strcmp(path + len - 2, "/.") == 0)
+        || (len >= 3 && strcmp(path + len - 3, "/..") == 0)) {
+      return false;
+    }
+
+    if(opts.prefixes.empty()) {
+      return true;
+    }
+    for(auto &prefix : opts.prefixes) {
+      size_t plen = prefix.size();
+      if(plen > 0 && prefix[plen - 1] == '/') {
+        plen--;
+      }
+      if(strncmp(path, prefix.c_str(), plen) == 0
+          && (path[plen] == '\0' || path[plen] == '/')) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool MetadataCache::fresh(const result &r) const {
+    return r.valid && (opts.ttl_ns == 0 || now_ns() < r.expires);
+  }
+
+  /* called with the lock held, is_new tells whether the watch was only
+   * added now, i.e. after the result to be cached was looked up */
+  bool MetadataCache::watch_parent(const std::string &path, bool *is_new) {
+    if(!watching) {
+      return false;
+    }
+    std::string dir = parent_dir(path);
+    if(dir_watches.count(dir)) {
+      *is_new = false;
+      return true;
+    }
+
+    int wd = inotify_add_watch(inotify_fd, dir.c_str(), watch_mask);
+    if(wd < 0) {
+      return false;
+    }
+    dir_watches[dir] = wd;
+    watch_dirs[wd].insert(dir);
+    *is_new = true;
+    return true;
+  }
+
+  void MetadataCache::store(result &r, long res, const void *data,
+      size_t len) {
+    if(!r.valid) {
+      stats.entries++;
+    }
+    r.valid = true;
+    r.res = res;
+    r.expires = opts.ttl_ns ? now_ns() + opts.ttl_ns : 0;
+    if(res >= 0 && data != nullptr) {
+      const char *d = static_cast<const char *>(data);
+      r.data.assign(d, d + len);
+    } else {
+      r.data.clear();
+    }
+  }
+
+  bool MetadataCache::lookup(metadata_op op, const char *path, int arg,
+      long *res, void *buf, size_t len) {
+    if(!cacheable(path)) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> l(lock);
+    check_fork();
+    if(opts.inotify && !watching) {
+      return false;
+    }
+
+    auto it = paths.find(path);
+    const result *r = nullptr;
+    if(it != paths.end()) {
+      if(op == MD_ACCESS) {
+        auto a = it->second.access.find(arg);
+        if(a != it->second.access.end()) {
+          r = &a->second;
+        }
+      } else {
+        r = &it->second.ops[op == MD_OPEN ? MD_STAT : op];
+      }
+    }
+
+    if(r == nullptr || !fresh(*r) || (op == MD_OPEN && !open_error(r->res))) {
+      stats.misses[op]++;
+      if(opts.inotify) {
+        /* watch before the guest looks, so no change can slip through
+         * between the lookup and insert */
+        bool is_new;
+        watch_parent(path, &is_new);
+      }
+      return false;
+    }
+
+    stats.hits[op]++;
+    *res = r->res;
+    if(r->res < 0) {
+      stats.negative_hits++;
+    } else if(buf != nullptr) {
+      size_t n = std::min(len, r->data.size());
+      memcpy(buf, r->data.data(), n);
+      if(op == MD_READLINK) {
+        *res = n;
+      }
+    }
+    return true;
+  }
+
+  void MetadataCache::insert(metadata_op op, const char *path, int arg,
+      long res, const void *data, size_t len) {
+    if(op == MD_FSTAT || (op == MD_OPEN && !open_error(res))
+        || (res < 0 && !cacheable_error(res)) || !cacheable(path)) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> l(lock);
+    check_fork();
+    const std::string key(path);
+    if(writers.count(key)) {
+      return;
+    }
+    if(opts.inotify) {
+      bool is_new;
+      if(!watch_parent(key, &is_new) || is_new) {
+        return;
+      }
+    }
+    if(opts.max_entries && stats.entries >= opts.max_entries) {
+      drop_all();
+    }
+
+    path_entry &e = paths[key];
+    store(op == MD_ACCESS ? e.access[arg] : e.ops[op == MD_OPEN ? MD_STAT : op],
+        res, data, len);
+  }
+
+  void MetadataCache::opened(int fd, const char *path, int flags) {
+    const bool writable = (flags & O_ACCMODE) != O_RDONLY
+      || (flags & (O_CREAT | O_TRUNC));
+    if(writable) {
+      invalidate(path);
+    }
+    if(fd < 0) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> l(lock);
+    check_fork();
+    auto it = fds.find(fd);
+    if(it != fds.end()) {
+      forget(it);
+    }
+    if(!cacheable(path)) {
+      return;
+    }
+    if(writable) {
+      writers[path]++;
+    } else if(opts.inotify) {
+      bool is_new;
+      if(!watch_parent(path, &is_new)) {
+        return;
+      }
+    }
+    fds[fd] = fd_entry(path, writable);
+  }
+
+  bool MetadataCache::lookup_fd(int fd, struct stat *buf) {
+    std::lock_guard<std::mutex> l(lock);
+    check_fork();
+    auto it = fds.find(fd);
+    if(it == fds.end() || it->second.writable) {
+      return false;
+    }
+    if(!fresh(it->second.stat) || (opts.inotify && !watching)) {
+      stats.misses[MD_FSTAT]++;
+      return false;
+    }
+    stats.hits[MD_FSTAT]++;
+    memcpy(buf, it->second.stat.data.data(), sizeof(*buf));
+    return true;
+  }
+
+  void MetadataCache::insert_fd(int fd, const struct stat *buf) {
+    std::lock_guard<std::mutex> l(lock);
+    check_fork();
+    auto it = fds.find(fd);
+    if(it == fds.end() || it->second.writable
+        || writers.count(it->second.path)) {
+      return;
+    }
+    if(opts.max_entries && stats.entries >= opts.max_entries) {
+      drop_all();
+      return;
+    }
+    store(it->second.stat, 0, buf, sizeof(*buf));
+  }
+
+  void MetadataCache::closed(int fd) {
+    std::lock_guard<std::mutex> l(lock);
+    check_fork();
+    auto it = fds.find(fd);
+    if(it != fds.end()) {
+      forget(it);
+    }
+  }
+
+  /* called with the lock held */
+  void MetadataCache::forget(std::unordered_map<int, fd_entry>::iterator it) {
+    if(it->second.stat.valid) {
+      stats.entries--;
+    }
+    if(it->second.writable) {
+      /* the guest wrote to the file until now */
+      std::string path = it->second.path;
+      auto w = writers.find(path);
+      if(--w->second == 0) {
+        writers.erase(w);
+      }
+      fds.erase(it);
+      drop(path);
+    } else {
+      fds.erase(it);
+    }
+  }
+
+  void MetadataCache::invalidate(const char *path) {
+    if(path == nullptr) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> l(lock);
+    check_fork();
+    if(path[0] != '/') {
+      /* inotify tells about these, otherwise the path is unknown */
+      if(!opts.inotify) {
+        drop_all();
+      }
+      return;
+    }
+    if(cacheable(path)) {
+      drop(path);
+      drop_below(path);
+    }
+  }
+
+  size_t MetadataCache::count(const path_entry &e) {
+    size_t n = 0;
+    for(unsigned i = 0; i < MD_FSTAT; i++) {
+      n += e.ops[i].valid;
+    }
+    for(auto &a : e.access) {
+      n += a.second.valid;
+    }
+    return n;
+  }
+
+  /* called with the lock held */
+  void MetadataCache::drop(const std::string &path) {
+    auto it = paths.find(path);
+    if(it != paths.end()) {
+      size_t n = count(it->second);
+      stats.entries -= n;
+      stats.invalidations += n;
+      paths.erase(it);
+    }
+    for(auto &fd : fds) {
+      if(fd.second.stat.valid && fd.second.path == path) {
+        fd.second.stat.valid = false;
+        stats.entries--;
+        stats.invalidations++;
+      }
+    }
+  }
+
+  /* called with the lock held */
+  void MetadataCache::drop_below(const std::string &dir) {
+    const std::string prefix = dir == "/" ? dir : dir + "/";
+    for(auto it = paths.begin(); it != paths.end();) {
+      if(it->first.compare(0, prefix.size(), prefix) == 0) {
+        size_t n = count(it->second);
+        stats.entries -= n;
+        stats.invalidations += n;
+        it = paths.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    for(auto &fd : fds) {
+      if(fd.second.stat.valid
+          && fd.second.path.compare(0, prefix.size(), prefix) == 0) {
+        fd.second.stat.valid = false;
+        stats.entries--;
+        stats.invalidations++;
+      }
+    }
+  }
+
+  /* called with the lock held, fds stay tracked */
+  void MetadataCache::drop_all() {
+    stats.invalidations += stats.entries;
+    stats.entries = 0;
+    paths.clear();
+    for(auto &fd : fds) {
+      fd.second.stat.valid = false;
+    }
+  }
+
+  void MetadataCache::clear() {
+    std::lock_guard<std::mutex> l(lock);
+    check_fork();
+    paths.clear();
+    for(auto &fd : fds) {
+      fd.second.stat.valid = false;
+    }
+    stats.entries = 0;
+  }
+
+  metadata_cache_stats MetadataCache::get_stats() const {
+    std::lock_guard<std::mutex> l(lock);
+    return stats;
+  }
+
+  double hit_rate(const metadata_cache_stats &stats, metadata_op op) {
+    uint64_t hits = 0;
+    uint64_t lookups = 0;
+    for(unsigned i = 0; i < MD_NUM_OPS; i++) {
+      if(op == MD_NUM_OPS || op == static_cast<metadata_op>(i)) {
+        hits += stats.hits[i];
+        lookups += stats.hits[i] + stats.misses[i];
+      }
+    }
+    return lookups ? static_cast<double>(hits) / lookups : 0.0;
+  }
+
+  std::ostream &print(std::ostream &os, const metadata_cache_stats &stats) {
+    static const char *names[MD_NUM_OPS] = {
+      "stat", "lstat", "readlink", "access", "fstat", "open"
+    };
+
+    std::ios_base::fmtflags flags = os.flags();
+    os << std::fixed << std::setprecision(1);
+    os << "METADATA CACHE: hit rate " << hit_rate(stats) * 100 << "%";
+    for(unsigned i = 0; i < MD_NUM_OPS; i++) {
+      os << " " << names[i] << ": " << stats.hits[i] << "/"
+        << stats.hits[i] + stats.misses[i];
+    }
+    os << " negative hits: " << stats.negative_hits
+      << " invalidations: " << stats.invalidations
+      << " entries: " << stats.entries;
+    os.flags(flags);
+    return os;
+  }
+
+//namespace Elkvm
+}
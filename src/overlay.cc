@@ -0,0 +1,882 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <elkvm/overlay.h>
+#include <elkvm/types.h>
+
+namespace Elkvm {
+
+  struct tar_header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+  };
+  static_assert(sizeof(tar_header) == 512, "tar headers are one block");
+
+  static const size_t npos = static_cast<size_t>(-1);
+  /* as many symlinks as Linux follows in one lookup */
+  static const unsigned max_links = 40;
+
+  /* octal, or base-256 if the high bit is set as GNU tar writes it */
+  static uint64_t tar_number(const char *field, size_t len) {
+    uint64_t v = 0;
+    if(field[0] & 0x80) {
+      v = field[0] & 0x7f;
+      for(size_t i = 1; i < len; i++) {
+        v = (v << 8) | static_cast<unsigned char>(field[i]);
+      }
+      return v;
+    }
+
+    size_t i = 0;
+    while(i < len && field[i] == ' ') {
+      i++;
+    }
+    for(; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+      v = v * 8 + (field[i] - '0');
+    }
+    return v;
+  }
+
+  static bool tar_checksum_ok(const tar_header *h) {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(h);
+    const size_t chksum = offsetof(tar_header, chksum);
+    uint64_t sum = 0;
+    for(size_t i = 0; i < sizeof(*h); i++) {
+      sum += (i >= chksum && i < chksum + sizeof(h->chksum)) ? ' ' : p[i];
+    }
+    return sum == tar_number(h->chksum, sizeof(h->chksum));
+  }
+
+  static bool zero_block(const char *p) {
+    return std::all_of(p, p + sizeof(tar_header),
+        [](char c) { return c == '\0'; });
+  }
+
+  /* a string of the image, which need not be terminated */
+  struct image_string {
+    const char *p;
+    size_t len;
+
+    std::string str() const { return std::string(p, len); }
+  };
+
+  static image_string field(const char *f, size_t len) {
+    return { f, strnlen(f, len) };
+  }
+
+  /* pax records are "<length> <key>=<value>\n" */
+  static void parse_pax(const char *p, size_t len,
+      std::map<std::string, image_string> *pax) {
+    const char *end = p + len;
+    while(p < end) {
+      char *num_end;
+      unsigned long reclen = strtoul(p, &num_end, 10);
+      if(reclen == 0 || reclen > static_cast<size_t>(end - p)
+          || *num_end != ' ') {
+        return;
+      }
+      const char *key = num_end + 1;
+      const char *rec_end = p + reclen - 1;
+      const char *eq = static_cast<const char *>(
+          memchr(key, '=', rec_end - key));
+      if(eq != nullptr) {
+        (*pax)[std::string(key, eq)] = { eq + 1,
+          static_cast<size_t>(rec_end - eq - 1) };
+      }
+      p += reclen;
+    }
+  }
+
+  /* the components of path, without empty ones */
+  static void split(const char *path, size_t len,
+      std::deque<std::string> *comps) {
+    const char *end = path + len;
+    while(path < end) {
+      const char *slash = std::find(path, end, '/');
+      if(slash != path) {
+        comps->emplace_back(path, slash);
+      }
+      path = slash + 1;
+    }
+  }
+
+  static std::string join(const std::string &base,
+      const std::deque<std::string> &comps, bool dir_only) {
+    std::string path = base;
+    for(auto &c : comps) {
+      path += "/" + c;
+    }
+    if(path.empty() || dir_only) {
+      path += "/";
+    }
+    return path;
+  }
+
+  static unsigned char dirent_type(mode_t mode) {
+    if(S_ISDIR(mode)) {
+      return DT_DIR;
+    }
+    if(S_ISLNK(mode)) {
+      return DT_LNK;
+    }
+    return DT_REG;
+  }
+
+  ImageOverlay::ImageOverlay(const std::string &mp, const char *img,
+      size_t size, const struct stat &st) :
+    mount(mp),
+    /* a major number no driver uses, so dev and ino stay unique */
+    dev(makedev(0xfff, st.st_ino & 0xfffff)),
+    image(img),
+    image_size(size),
+    nodes(),
+    lock(),
+    files()
+  {}
+
+  ImageOverlay::~ImageOverlay() {
+    munmap(const_cast<char *>(image), image_size);
+  }
+
+  std::shared_ptr<ImageOverlay> ImageOverlay::load(const std::string &path,
+      const std::string &mount_point) {
+    std::string mp = mount_point;
+    while(mp.size() > 1 && mp[mp.size() - 1] == '/') {
+      mp.erase(mp.size() - 1);
+    }
+    if(mp.size() < 2 || mp[0] != '/') {
+      errno = EINVAL;
+      return nullptr;
+    }
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+      return nullptr;
+    }
+    struct stat st;
+    void *img = MAP_FAILED;
+    if(::fstat(fd, &st) == 0) {
+      img = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    const int saved_errno = errno;
+    ::close(fd);
+    if(img == MAP_FAILED) {
+      errno = saved_errno;
+      return nullptr;
+    }
+
+    std::shared_ptr<ImageOverlay> overlay(new ImageOverlay(mp,
+          static_cast<const char *>(img), st.st_size, st));
+    int err = overlay->parse(st.st_mtime);
+    if(err) {
+      errno = -err;
+      return nullptr;
+    }
+    return overlay;
+  }
+
+  int ImageOverlay::parse(time_t mtime) {
+    nodes.clear();
+    nodes.push_back({ S_IFDIR | 0755, 0, 0, 2, mtime, 0, nullptr, 0, {} });
+
+    std::map<std::string, image_string> pax;
+    image_string long_name = { nullptr, 0 };
+    image_string long_link = { nullptr, 0 };
+    size_t off = 0;
+    while(off + sizeof(tar_header) <= image_size) {
+      const tar_header *h = reinterpret_cast<const tar_header *>(image + off);
+      if(zero_block(image + off)) {
+        break;
+      }
+      if(!tar_checksum_ok(h)) {
+        return -EINVAL;
+      }
+
+      uint64_t size = tar_number(h->size, sizeof(h->size));
+      if(pax.count("size") && h->typeflag != 'x') {
+        size = strtoull(pax["size"].str().c_str(), nullptr, 10);
+      }
+      const char *data = image + off + sizeof(tar_header);
+      if(size > image_size - off - sizeof(tar_header)) {
+        return -EINVAL;
+      }
+      off += sizeof(tar_header) + ((size + 511) & ~511ULL);
+
+      switch(h->typeflag) {
+        case 'L':
+          long_name = field(data, size);
+          continue;
+        case 'K':
+          long_link = field(data, size);
+          continue;
+        case 'x':
+          parse_pax(data, size, &pax);
+          continue;
+        case 'g':
+          continue;
+      }
+
+      std::string name;
+      if(pax.count("path")) {
+        name = pax["path"].str();
+      } else if(long_name.p != nullptr) {
+        name = long_name.str();
+      } else {
+        name = field(h->prefix, sizeof(h->prefix)).str();
+        if(!name.empty()) {
+          name += "/";
+        }
+        name += field(h->name, sizeof(h->name)).str();
+      }
+      image_string link = pax.count("linkpath") ? pax["linkpath"]
+        : long_link.p != nullptr ? long_link
+        : field(h->linkname, sizeof(h->linkname));
+
+      mode_t perm = tar_number(h->mode, sizeof(h->mode)) & 07777;
+      time_t entry_mtime = pax.count("mtime")
+        ? strtoll(pax["mtime"].str().c_str(), nullptr, 10)
+        : tar_number(h->mtime, sizeof(h->mtime));
+      uid_t uid = pax.count("uid")
+        ? strtoul(pax["uid"].str().c_str(), nullptr, 10)
+        : tar_number(h->uid, sizeof(h->uid));
+      gid_t gid = pax.count("gid")
+        ? strtoul(pax["gid"].str().c_str(), nullptr, 10)
+        : tar_number(h->gid, sizeof(h->gid));
+      pax.clear();
+      long_name.p = nullptr;
+      long_link.p = nullptr;
+
+      size_t node = npos;
+      switch(h->typeflag) {
+        case '0':
+        case '\0':
+        case '7':
+          node = add_node(name, S_IFREG | perm, entry_mtime, npos);
+          if(node != npos) {
+            nodes[node].data = data;
+            nodes[node].size = size;
+          }
+          break;
+        case '1': {
+          /* hard links name an earlier entry of the archive */
+          size_t target = add_node(link.str(), 0, 0, npos);
+          if(target != npos) {
+            add_node(name, 0, 0, target);
+          }
+          continue;
+        }
+        case '2':
+          node = add_node(name, S_IFLNK | 0777, entry_mtime, npos);
+          if(node != npos) {
+            nodes[node].data = link.p;
+            nodes[node].size = link.len;
+          }
+          break;
+        case '5':
+          node = add_node(name, S_IFDIR | perm, entry_mtime, npos);
+          break;
+        default:
+          /* devices and fifos are left out */
+          continue;
+      }
+      if(node != npos) {
+        nodes[node].uid = uid;
+        nodes[node].gid = gid;
+      }
+    }
+
+    for(auto &n : nodes) {
+      if(S_ISDIR(n.mode)) {
+        n.nlink = 2 + std::count_if(n.children.begin(), n.children.end(),
+            [this](const std::pair<const std::string, size_t> &c) {
+              return S_ISDIR(nodes[c.second].mode);
+            });
+      }
+    }
+    return 0;
+  }
+
+  /*
+   * Adds the entry name of the archive with mode and returns its node,
+   * directories on the way are made up if the archive leaves them out. With
+   * a target, name becomes a hard link to that node instead, and with
+   * neither mode nor target, the node of name is only looked up. Returns
+   * npos for names that do not fit into the tree.
+   */
+  size_t ImageOverlay::add_node(const std::string &name, mode_t mode,
+      time_t mtime, size_t target) {
+    std::deque<std::string> comps;
+    split(name.c_str(), name.size(), &comps);
+    comps.erase(std::remove(comps.begin(), comps.end(), "."), comps.end());
+    if(std::find(comps.begin(), comps.end(), "..") != comps.end()) {
+      return npos;
+    }
+    const bool lookup = mode == 0 && target == npos;
+
+    size_t cur = 0;
+    for(size_t i = 0; i < comps.size(); i++) {
+      if(!S_ISDIR(nodes[cur].mode)) {
+        return npos;
+      }
+      const bool last = i + 1 == comps.size();
+      auto it = nodes[cur].children.find(comps[i]);
+      if(lookup) {
+        if(it == nodes[cur].children.end()) {
+          return npos;
+        }
+        cur = it->second;
+        continue;
+      }
+
+      if(last && target != npos) {
+        if(S_ISDIR(nodes[target].mode)) {
+          return npos;
+        }
+        nodes[cur].children[comps[i]] = target;
+        nodes[target].nlink++;
+        return target;
+      }
+      if(it != nodes[cur].children.end()
+          && (!last || (S_ISDIR(nodes[it->second].mode) && S_ISDIR(mode)))) {
+        cur = it->second;
+        continue;
+      }
+
+      /* later entries replace earlier ones */
+      const mode_t m = last ? mode : S_IFDIR | 0755;
+      nodes.push_back({ m, 0, 0, 1, mtime, 0, nullptr, cur, {} });
+      nodes[cur].children[comps[i]] = nodes.size() - 1;
+      cur = nodes.size() - 1;
+    }
+
+    if(!lookup && S_ISDIR(mode)) {
+      /* the root or a directory that was made up before */
+      nodes[cur].mode = mode;
+      nodes[cur].mtime = mtime;
+    }
+    return cur;
+  }
+
+  bool ImageOverlay::in_mount(const std::string &path) const {
+    return path.compare(0, mount.size(), mount) == 0
+      && (path.size() == mount.size() || path[mount.size()] == '/');
+  }
+
+  /*
+   * Resolves path relative to dirfd, following a symlink at its end if
+   * follow is set. Returns 0 and the node, -errno if the lookup fails inside
+   * the image, or 1 if path does not lead into the image, with host_path
+   * set if it left the image on the way.
+   */
+  long ImageOverlay::walk(int dirfd, const char *path, bool follow,
+      size_t *node, std::string *host_path) const {
+    if(path == nullptr) {
+      return 1;
+    }
+
+    const size_t len = strlen(path);
+    std::deque<std::string> comps;
+    size_t cur = 0;
+    if(path[0] == '/') {
+      if(!in_mount(path)) {
+        return 1;
+      }
+      split(path + mount.size(), len - mount.size(), &comps);
+    } else {
+      std::shared_ptr<open_file> dir = dirfd == AT_FDCWD ? nullptr
+        : get_file(dirfd);
+      if(dir == nullptr) {
+        return 1;
+      }
+      if(!S_ISDIR(nodes[dir->node].mode)) {
+        return -ENOTDIR;
+      }
+      if(len == 0) {
+        return -ENOENT;
+      }
+      cur = dir->node;
+      split(path, len, &comps);
+    }
+
+    const bool dir_only = len > 0 && path[len - 1] == '/';
+    unsigned links = 0;
+    while(!comps.empty()) {
+      std::string name = comps.front();
+      comps.pop_front();
+      if(!S_ISDIR(nodes[cur].mode)) {
+        return -ENOTDIR;
+      }
+      if(name == ".") {
+        continue;
+      }
+      if(name == "..") {
+        if(cur == 0) {
+          *host_path = join(mount.substr(0, mount.rfind('/')), comps,
+              dir_only);
+          return 1;
+        }
+        cur = nodes[cur].parent;
+        continue;
+      }
+
+      auto it = nodes[cur].children.find(name);
+      if(it == nodes[cur].children.end()) {
+        return -ENOENT;
+      }
+      const image_node &next = nodes[it->second];
+      if(!S_ISLNK(next.mode) || (comps.empty() && !follow && !dir_only)) {
+        cur = it->second;
+        continue;
+      }
+
+      if(++links > max_links) {
+        return -ELOOP;
+      }
+      if(next.size == 0) {
+        return -ENOENT;
+      }
+      std::deque<std::string> target;
+      split(next.data, next.size, &target);
+      comps.insert(comps.begin(), target.begin(), target.end());
+      if(next.data[0] == '/') {
+        std::string abs = join("", comps, dir_only);
+        if(!in_mount(abs)) {
+          *host_path = abs;
+          return 1;
+        }
+        comps.clear();
+        split(abs.c_str() + mount.size(), abs.size() - mount.size(), &comps);
+        cur = 0;
+      }
+    }
+
+    if(dir_only && !S_ISDIR(nodes[cur].mode)) {
+      return -ENOTDIR;
+    }
+    *node = cur;
+    return 0;
+  }
+
+  std::shared_ptr<ImageOverlay::open_file> ImageOverlay::get_file(
+      int fd) const {
+    std::lock_guard<std::mutex> l(lock);
+    auto it = files.find(fd);
+    return it == files.end() ? nullptr : it->second;
+  }
+
+  bool ImageOverlay::owns(int fd) const {
+    return get_file(fd) != nullptr;
+  }
+
+  void ImageOverlay::fill_stat(size_t node, struct stat *buf) const {
+    const image_node &n = nodes[node];
+    memset(buf, 0, sizeof(*buf));
+    buf->st_dev = dev;
+    buf->st_ino = node + 1;
+    buf->st_mode = n.mode;
+    buf->st_nlink = n.nlink;
+    buf->st_uid = n.uid;
+    buf->st_gid = n.gid;
+    buf->st_size = n.size;
+    buf->st_blksize = 4096;
+    buf->st_blocks = (n.size + 511) / 512;
+    buf->st_atim.tv_sec = n.mtime;
+    buf->st_mtim.tv_sec = n.mtime;
+    buf->st_ctim.tv_sec = n.mtime;
+  }
+
+  bool ImageOverlay::open(int dirfd, const char *path, int flags, long *res,
+      std::string *host_path) {
+    size_t node = 0;
+    long err = walk(dirfd, path, !(flags & O_NOFOLLOW), &node, host_path);
+    if(err > 0) {
+      return false;
+    }
+
+    const bool writing = (flags & O_ACCMODE) != O_RDONLY || (flags & O_TRUNC);
+    if(err == -ENOENT && (flags & O_CREAT)) {
+      err = -EROFS;
+    } else if(err == 0) {
+      const mode_t mode = nodes[node].mode;
+      if((flags & O_CREAT) && (flags & O_EXCL)) {
+        err = -EEXIST;
+      } else if(S_ISLNK(mode)) {
+        err = -ELOOP;
+      } else if(S_ISDIR(mode) && (writing || (flags & O_CREAT))) {
+        err = -EISDIR;
+      } else if(!S_ISDIR(mode) && (flags & O_DIRECTORY)) {
+        err = -ENOTDIR;
+      } else if(writing) {
+        err = -EROFS;
+      }
+    }
+    if(err < 0) {
+      *res = err;
+      return true;
+    }
+
+    int fd = ::open("/dev/null", O_RDONLY | (flags & O_CLOEXEC));
+    if(fd < 0) {
+      *res = -errno;
+      return true;
+    }
+    std::lock_guard<std::mutex> l(lock);
+    files[fd] = std::make_shared<open_file>(
+        open_file { node, 0, nodes[node].children.begin() });
+    *res = fd;
+    return true;
+  }
+
+  bool ImageOverlay::stat(int dirfd, const char *path, int flags,
+      struct stat *buf, long *res, std::string *host_path) const {
+    size_t node = 0;
+    if((flags & AT_EMPTY_PATH) && path != nullptr && path[0] == '\0') {
+      return fstat(dirfd, buf, res);
+    }
+    long err = walk(dirfd, path, !(flags & AT_SYMLINK_NOFOLLOW), &node,
+        host_path);
+    if(err > 0) {
+      return false;
+    }
+    if(err == 0) {
+      fill_stat(node, buf);
+    }
+    *res = err;
+    return true;
+  }
+
+  bool ImageOverlay::fstat(int fd, struct stat *buf, long *res) const {
+    std::shared_ptr<open_file> f = get_file(fd);
+    if(f == nullptr) {
+      return false;
+    }
+    fill_stat(f->node, buf);
+    *res = 0;
+    return true;
+  }
+
+  bool ImageOverlay::access(const char *path, int mode, long *res,
+      std::string *host_path) const {
+    size_t node = 0;
+    long err = walk(AT_FDCWD, path, true, &node, host_path);
+    if(err > 0) {
+      return false;
+    }
+
+    if(err == 0 && (mode & W_OK)) {
+      err = -EROFS;
+    } else if(err == 0 && (mode & (R_OK | X_OK))) {
+      /* like access, with the real ids but without supplementary groups */
+      const image_node &n = nodes[node];
+      const int want = (mode & R_OK ? 4 : 0) | (mode & X_OK ? 1 : 0);
+      int have = 7;
+      if(getuid() != 0) {
+        const int shift = getuid() == n.uid ? 6 : getgid() == n.gid ? 3 : 0;
+        have = (n.mode >> shift) & 7;
+      } else if(!S_ISDIR(n.mode) && !(n.mode & 0111)) {
+        have = 6;
+      }
+      if((have & want) != want) {
+        err = -EACCES;
+      }
+    }
+    *res = err;
+    return true;
+  }
+
+  bool ImageOverlay::readlink(const char *path, char *buf, size_t len,
+      long *res, std::string *host_path) const {
+    size_t node = 0;
+    long err = walk(AT_FDCWD, path, false, &node, host_path);
+    if(err > 0) {
+      return false;
+    }
+
+    if(err == 0 && (!S_ISLNK(nodes[node].mode) || len == 0)) {
+      err = -EINVAL;
+    }
+    if(err < 0) {
+      *res = err;
+      return true;
+    }
+    const size_t n = std::min<size_t>(len, nodes[node].size);
+    memcpy(buf, nodes[node].data, n);
+    *res = n;
+    return true;
+  }
+
+  bool ImageOverlay::readv(int fd, const struct iovec *iov, size_t iovcnt,
+      int64_t off, long *res) {
+    std::shared_ptr<open_file> f = get_file(fd);
+    if(f == nullptr) {
+      return false;
+    }
+    const image_node &n = nodes[f->node];
+    if(S_ISDIR(n.mode)) {
+      *res = -EISDIR;
+      return true;
+    }
+    if(off < -1) {
+      *res = -EINVAL;
+      return true;
+    }
+
+    /* reads at the file position are ordered, positional ones are not */
+    std::unique_lock<std::mutex> l(lock, std::defer_lock);
+    uint64_t pos = off;
+    if(off == -1) {
+      l.lock();
+      pos = f->pos;
+    }
+    size_t total = 0;
+    for(size_t i = 0; i < iovcnt && pos < n.size; i++) {
+      const size_t len = std::min<uint64_t>(iov[i].iov_len, n.size - pos);
+      memcpy(iov[i].iov_base, n.data + pos, len);
+      pos += len;
+      total += len;
+    }
+    if(off == -1) {
+      f->pos = pos;
+    }
+    *res = total;
+    return true;
+  }
+
+  bool ImageOverlay::send(int fd, int64_t off, size_t count,
+      const std::function<long(const void *, size_t)> &out, long *res) {
+    std::shared_ptr<open_file> f = get_file(fd);
+    if(f == nullptr) {
+      return false;
+    }
+    const image_node &n = nodes[f->node];
+    if(S_ISDIR(n.mode) || off < -1) {
+      *res = -EINVAL;
+      return true;
+    }
+
+    /* out may block on a pipe, so the lock is not held while it runs */
+    uint64_t pos = off;
+    if(off == -1) {
+      std::lock_guard<std::mutex> l(lock);
+      pos = f->pos;
+    }
+    long total = 0;
+    while(static_cast<size_t>(total) < count && pos < n.size) {
+      const size_t len = std::min<uint64_t>(count - total, n.size - pos);
+      long took = out(n.data + pos, len);
+      if(took < 0) {
+        if(total == 0) {
+          *res = took;
+          return true;
+        }
+        break;
+      }
+      pos += took;
+      total += took;
+      if(static_cast<size_t>(took) < len) {
+        break;
+      }
+    }
+    if(off == -1) {
+      std::lock_guard<std::mutex> l(lock);
+      f->pos = pos;
+    }
+    *res = total;
+    return true;
+  }
+
+  bool ImageOverlay::lseek(int fd, int64_t off, int whence, long *res) {
+    std::shared_ptr<open_file> f = get_file(fd);
+    if(f == nullptr) {
+      return false;
+    }
+    const image_node &n = nodes[f->node];
+
+    std::lock_guard<std::mutex> l(lock);
+    int64_t pos;
+    switch(whence) {
+      case SEEK_SET:
+        pos = off;
+        break;
+      case SEEK_CUR:
+        pos = f->pos + off;
+        break;
+      case SEEK_END:
+        pos = n.size + off;
+        break;
+      case SEEK_DATA:
+      case SEEK_HOLE:
+        if(S_ISDIR(n.mode) || off < 0 || static_cast<uint64_t>(off) >= n.size) {
+          *res = S_ISDIR(n.mode) || off < 0 ? -EINVAL : -ENXIO;
+          return true;
+        }
+        pos = whence == SEEK_DATA ? off : n.size;
+        break;
+      default:
+        *res = -EINVAL;
+        return true;
+    }
+    if(pos < 0 || (S_ISDIR(n.mode) && whence == SEEK_END)) {
+      *res = -EINVAL;
+      return true;
+    }
+
+    f->pos = pos;
+    if(S_ISDIR(n.mode)) {
+      f->next = n.children.begin();
+      for(int64_t i = 2; i < pos && f->next != n.children.end(); i++) {
+        ++f->next;
+      }
+    }
+    *res = pos;
+    return true;
+  }
+
+  bool ImageOverlay::getdents64(int fd, void *buf, size_t len, long *res) {
+    std::shared_ptr<open_file> f = get_file(fd);
+    if(f == nullptr) {
+      return false;
+    }
+    const image_node &n = nodes[f->node];
+    if(!S_ISDIR(n.mode)) {
+      *res = -ENOTDIR;
+      return true;
+    }
+
+    std::lock_guard<std::mutex> l(lock);
+    char *p = static_cast<char *>(buf);
+    size_t used = 0;
+    while(true) {
+      const char *name;
+      size_t node;
+      if(f->pos == 0) {
+        name = ".";
+        node = f->node;
+      } else if(f->pos == 1) {
+        name = "..";
+        node = n.parent;
+      } else if(f->next != n.children.end()) {
+        name = f->next->first.c_str();
+        node = f->next->second;
+      } else {
+        break;
+      }
+
+      const size_t namelen = strlen(name);
+      const size_t reclen = (offsetof(struct linux_dirent64, d_name)
+          + namelen + 1 + 7) & ~7UL;
+      if(used + reclen > len) {
+        if(used == 0) {
+          *res = -EINVAL;
+          return true;
+        }
+        break;
+      }
+
+      struct linux_dirent64 *d =
+        reinterpret_cast<struct linux_dirent64 *>(p + used);
+      memset(d, 0, reclen);
+      d->d_ino = node + 1;
+      d->d_off = f->pos + 1;
+      d->d_reclen = reclen;
+      d->d_type = dirent_type(nodes[node].mode);
+      memcpy(d->d_name, name, namelen);
+      used += reclen;
+
+      if(f->pos >= 2) {
+        ++f->next;
+      }
+      f->pos++;
+    }
+    *res = used;
+    return true;
+  }
+
+  bool ImageOverlay::mmap(int fd, void *buf, size_t len, int64_t off,
+      long *res) const {
+    std::shared_ptr<open_file> f = get_file(fd);
+    if(f == nullptr) {
+      return false;
+    }
+    const image_node &n = nodes[f->node];
+    if(!S_ISREG(n.mode)) {
+      *res = -ENODEV;
+      return true;
+    }
+
+    /* as for files, the rest of the last page is zeroed */
+    size_t copy = 0;
+    if(off >= 0 && static_cast<uint64_t>(off) < n.size) {
+      copy = std::min<uint64_t>(len, n.size - off);
+      memcpy(buf, n.data + off, copy);
+    }
+    memset(static_cast<char *>(buf) + copy, 0, len - copy);
+    *res = 0;
+    return true;
+  }
+
+  void ImageOverlay::dup(int oldfd, int newfd) {
+    std::lock_guard<std::mutex> l(lock);
+    auto it = files.find(oldfd);
+    if(it != files.end()) {
+      files[newfd] = it->second;
+    } else {
+      files.erase(newfd);
+    }
+  }
+
+  void ImageOverlay::close(int fd) {
+    std::lock_guard<std::mutex> l(lock);
+    files.erase(fd);
+  }
+
+//namespace Elkvm
+}
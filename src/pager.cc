@@ -27,9 +27,17 @@
 #include <string>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <linux/kernel-page-flags.h>
+
+#include <elkvm/checkpoint.h>
 #include <elkvm/elkvm.h>
 #include <elkvm/elkvm-internal.h>
 #include <elkvm/pager.h>
@@ -38,241 +46,1683 @@
 namespace Elkvm {
   class VCPU;
 
-  /***************************************************************
-   *                Translation Lookaside Buffers                *
-   *                -----------------------------                *
-   *                                                             *
-   * The classes below implement alternative TLB implementations *
-   * that get_host_p() can use to speed up page lookups.         *
-   *                                                             *
-   * The interface is:                                           *
-   *     guestptr_t TLB::find(guest_ptr_t)                       *
-   *     void set(guestptr_t key, guestptr_t val)                *
-   *                                                             *
-   * There is no interface/inheritance as we want to             *
-   * avoid vtable indirections.                                  *
-   ***************************************************************/
+  /***************************************************************
+   *                Translation Lookaside Buffers                *
+   *                -----------------------------                *
+   *                                                             *
+   * The classes below implement alternative TLB implementations *
+   * that get_host_p() can use to speed up page lookups.         *
+   *                                                             *
+   * The interface is:                                           *
+   *     guestptr_t TLB::find(guest_ptr_t, uint64_t epoch)       *
+   *     void set(guestptr_t key, guestptr_t val, uint64_t epoch)*
+   *                                                             *
+   * There is no interface/inheritance as we want to             *
+   * avoid vtable indirections.                                  *
+   *                                                             *
+   * Every thread has its own TLB, so lookups need no locking.   *
+   * Entries are tagged with the epoch of the pager they were    *
+   * created for and only hit if that epoch is still current.    *
+   ***************************************************************/
+
+#define TLB_STATS 0 /* set to 1 if you want verbose TLB statistics */
+
+  /*
+   * TLB based on std::map
+   *
+   * This TLB uses a std::map to store page lookups. It is not
+   * bounded by any size limits and will simply become a mirror
+   * of the guest page table after some time. This means that this
+   * TLB might be useful for large, unpredictable workloads as there
+   * will be no problems with cache evictions. However, std::map
+   * works badly for small working sets as lookups are too slow to
+   * improve over what get_host_p does anyway.
+   */
+  class MappedTLB {
+    std::map<guestptr_t, std::pair<guestptr_t, uint64_t>> _entries;  // the actual TLB
+    unsigned _stat_hit, _stat_miss;             // statistics counters
+
+      public:
+        MappedTLB()
+          : _entries(), _stat_hit(0), _stat_miss(0)
+        {
+        }
+
+        guestptr_t find(const guestptr_t entry, uint64_t epoch) {
+          const auto& it = _entries.find(entry & ~ELKVM_PAGE_MASK);
+#if TLB_STATS
+          static int num_find = 0;
+          if (num_find++ > 10000) {
+            INFO() << "MISSES " << _stat_miss << " HITS " << _stat_hit;
+          }
+#endif
+          if (it != _entries.end() && it->second.second == epoch) {
+            _stat_hit++;
+            return it->second.first + (entry & ELKVM_PAGE_MASK);
+          }
+          _stat_miss++;
+          return 0;
+        }
+
+        void set(guestptr_t entry, guestptr_t value, uint64_t epoch) {
+          _entries[entry & ~ELKVM_PAGE_MASK] =
+            std::make_pair(value & ~ELKVM_PAGE_MASK, epoch);
+        }
+  };
+
+
+  /*
+   * Custom TLB implementation
+   *
+   * This TLB uses a fixed-size array to store TLB entries. Position in the
+   * array is calculated by hash()ing the respective entry value. Evictions
+   * may occur for some workloads - adjusting cache size or hash() function
+   * might help then.
+   */
+  class TLB
+  {
+      struct tlb_entry {
+        guestptr_t page;
+        guestptr_t host;
+        uint64_t   epoch;
+      };
+
+      tlb_entry  *_entries;     // the actual TLB
+      unsigned    _stat_hit;    // statistics counters ...
+      unsigned    _stat_miss;
+      unsigned    _stat_evict;
+      unsigned    _stat_enter;
+
+      enum {
+          NUM_ENTRIES = 0x1000,     // TLB size
+          low_mask    = 0xFFF000,   // hash mask
+          low_shift   = 12,         // hash bit shift
+      };
+
+      inline guestptr_t hash(guestptr_t entry)
+      {
+          return (entry & low_mask) >> low_shift;
+      }
+
+      public:
+          TLB() : _entries(0),
+                  _stat_hit(0),
+                  _stat_miss(0),
+                  _stat_evict(0),
+                  _stat_enter(0)
+          {
+            _entries = new tlb_entry[NUM_ENTRIES]();
+          }
+
+          ~TLB() { delete[] _entries; }
+
+          TLB(const TLB &) = delete;
+          TLB &operator=(const TLB &) = delete;
+
+          guestptr_t find(guestptr_t entry, uint64_t epoch)
+          {
+#if TLB_STATS
+            static int num_lookups = 0;
+
+            if (++num_lookups > 100000) {
+              INFO() << "TLB stats: "
+                     << "ADDed: " << _stat_enter
+                     << " HITS: " << _stat_hit
+                     << " MISSES: " << _stat_miss
+                     << " EVICTIONS: " << _stat_evict;
+              num_lookups = 0;
+              _stat_hit = _stat_miss = _stat_evict = _stat_enter = 0;
+            }
+#endif
+
+            guestptr_t h = hash(entry);
+            const auto& lookup = _entries[h];
+            //DBG() << std::hex << "[" << entry << "] " << lookup.page << " -> " << lookup.host;
+            if (lookup.page == (entry & ~ELKVM_PAGE_MASK)
+                && lookup.epoch == epoch) {
+              _stat_hit += 1;
+              return (lookup.host | (entry & ELKVM_PAGE_MASK));
+            }
+            _stat_miss += 1;
+
+            return 0;
+          }
+
+          void set(guestptr_t entry, guestptr_t value, uint64_t epoch)
+          {
+            guestptr_t h = hash(entry);
+            tlb_entry& tlb_slot = _entries[h];
+
+            _stat_enter++;
+            if (tlb_slot.page != 0) { _stat_evict++; }
+
+            tlb_slot.page = entry & ~ELKVM_PAGE_MASK;
+            tlb_slot.host = value & ~ELKVM_PAGE_MASK;
+            tlb_slot.epoch = epoch;
+            //DBG() << std::hex << "[" << entry << "] " << tlb_slot.page << " -> " << tlb_slot.host;
+          }
+  };
+
+  /* epochs are unique across all pagers, so TLB entries never alias */
+  static std::atomic<uint64_t> next_tlb_epoch(1);
+
+  /* one bit per page of the arena */
+  static const size_t host_bitmap_size = ELKVM_GUEST_PHYS_MAX / HOST_PAGESIZE / 8;
+
+  PagerX86_64::PagerX86_64(int vmfd)
+    : _vmfd(vmfd),
+      chunks(),
+      writer_lock(),
+      host_sysmem_p(0),
+      host_pml4_p(0),
+      host_next_free_tbl_p(0),
+      guest_next_free(~0ULL),
+      host_arena_p(nullptr),
+      guest_phys_top(0),
+      guest_phys_holes(),
+      free_slots(),
+      next_slot(0),
+      max_slots(KVM_MEMORY_SLOTS),
+      mem_policy(0),
+      snapshot_chunks(),
+      snapshot_dev(0),
+      snapshot_ino(0),
+      snapshot_offset(0),
+      shared_chunks(),
+      host_written(nullptr),
+      host_touched(nullptr),
+      tlb_epoch(next_tlb_epoch++),
+      mem_epoch(next_tlb_epoch++)
+  {
+    if(vmfd < 1) {
+      throw;
+    }
+
+    int slots = ioctl(_vmfd, KVM_CHECK_EXTENSION, KVM_CAP_NR_MEMSLOTS);
+    if(slots > 0) {
+      max_slots = slots;
+    }
+  }
+
+  PagerX86_64::~PagerX86_64() {
+    if(host_arena_p != nullptr) {
+      munmap(host_arena_p, ELKVM_GUEST_PHYS_MAX);
+      munmap(host_written, 2 * host_bitmap_size);
+    }
+  }
+
+  int PagerX86_64::reserve_host_arena() {
+    if(host_arena_p != nullptr) {
+      return 0;
+    }
+
+    /* only address space, memory is made accessible chunk by chunk */
+    void *p = mmap(NULL, ELKVM_GUEST_PHYS_MAX, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(p == MAP_FAILED) {
+      return -errno;
+    }
+    /* both bitmaps only take up memory where pages are marked */
+    void *b = mmap(NULL, 2 * host_bitmap_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(b == MAP_FAILED) {
+      int err = -errno;
+      munmap(p, ELKVM_GUEST_PHYS_MAX);
+      return err;
+    }
+    host_arena_p = static_cast<char *>(p);
+    host_written = static_cast<uint64_t *>(b);
+    host_touched = host_written + host_bitmap_size / sizeof(uint64_t);
+    return 0;
+  }
+
+  void PagerX86_64::mark_pages(uint64_t *bitmap, const void *host_p,
+      size_t len) const {
+    if(len == 0) {
+      return;
+    }
+    const uint64_t off = static_cast<const char *>(host_p) - host_arena_p;
+    assert(off < ELKVM_GUEST_PHYS_MAX && "marked page outside of the arena");
+    const uint64_t last = (off + len - 1) / HOST_PAGESIZE;
+    for(uint64_t page = off / HOST_PAGESIZE; page <= last; page++) {
+      /* most pages are marked already, reading first keeps the cache line
+       * shared between threads */
+      const uint64_t bit = 1ULL << (page % 64);
+      if(!(__atomic_load_n(&bitmap[page / 64], __ATOMIC_RELAXED) & bit)) {
+        __atomic_fetch_or(&bitmap[page / 64], bit, __ATOMIC_RELAXED);
+      }
+    }
+  }
+
+  void PagerX86_64::take_pages(uint64_t *bitmap, uint64_t first,
+      uint64_t count, std::vector<uint64_t> *out) const {
+    const uint64_t end = first + count;
+    for(uint64_t w = first / 64; w * 64 < end; w++) {
+      uint64_t mask = ~0ULL;
+      if(w * 64 < first) {
+        mask &= ~0ULL << (first - w * 64);
+      }
+      if((w + 1) * 64 > end) {
+        mask &= ~0ULL >> ((w + 1) * 64 - end);
+      }
+      if(!(__atomic_load_n(&bitmap[w], __ATOMIC_RELAXED) & mask)) {
+        continue;
+      }
+
+      uint64_t bits = __atomic_fetch_and(&bitmap[w], ~mask, __ATOMIC_RELAXED)
+        & mask;
+      while(out != nullptr && bits) {
+        const uint64_t page = w * 64 + __builtin_ctzll(bits) - first;
+        (*out)[page / 64] |= 1ULL << (page % 64);
+        bits &= bits - 1;
+      }
+    }
+  }
+
+  void PagerX86_64::clear_host_writes(
+      const struct kvm_userspace_memory_region &chunk) {
+    const uint64_t first = (reinterpret_cast<char *>(chunk.userspace_addr)
+        - host_arena_p) / HOST_PAGESIZE;
+    take_pages(host_written, first, chunk.memory_size / HOST_PAGESIZE, nullptr);
+    take_pages(host_touched, first, chunk.memory_size / HOST_PAGESIZE, nullptr);
+  }
+
+  int PagerX86_64::alloc_guest_phys(size_t size, guestptr_t *guest_phys) {
+    /* first fit, holes are sorted by address so low memory is reused first */
+    for(auto it = guest_phys_holes.begin(); it != guest_phys_holes.end(); it++) {
+      if(it->second >= size) {
+        *guest_phys = it->first;
+        if(it->second > size) {
+          guest_phys_holes[it->first + size] = it->second - size;
+        }
+        guest_phys_holes.erase(it);
+        return 0;
+      }
+    }
+
+    if(guest_phys_top + size > ELKVM_GUEST_PHYS_MAX) {
+      return -ENOMEM;
+    }
+    *guest_phys = guest_phys_top;
+    guest_phys_top += size;
+    return 0;
+  }
+
+  bool PagerX86_64::take_guest_phys(guestptr_t guest_phys, size_t size) {
+    if(guest_phys == guest_phys_top) {
+      if(guest_phys_top + size > ELKVM_GUEST_PHYS_MAX) {
+        return false;
+      }
+      guest_phys_top += size;
+      return true;
+    }
+
+    auto it = guest_phys_holes.upper_bound(guest_phys);
+    if(it == guest_phys_holes.begin()) {
+      return false;
+    }
+    it--;
+
+    const guestptr_t hole_start = it->first;
+    const guestptr_t hole_end = it->first + it->second;
+    if(guest_phys + size > hole_end) {
+      return false;
+    }
+
+    guest_phys_holes.erase(it);
+    if(hole_start < guest_phys) {
+      guest_phys_holes[hole_start] = guest_phys - hole_start;
+    }
+    if(guest_phys + size < hole_end) {
+      guest_phys_holes[guest_phys + size] = hole_end - guest_phys - size;
+    }
+    return true;
+  }
+
+  void PagerX86_64::free_guest_phys(guestptr_t guest_phys, size_t size) {
+    auto next = guest_phys_holes.find(guest_phys + size);
+    if(next != guest_phys_holes.end()) {
+      size += next->second;
+      guest_phys_holes.erase(next);
+    }
+
+    auto prev = guest_phys_holes.lower_bound(guest_phys);
+    if(prev != guest_phys_holes.begin()) {
+      prev--;
+      if(prev->first + prev->second == guest_phys) {
+        guest_phys = prev->first;
+        size += prev->second;
+        guest_phys_holes.erase(prev);
+      }
+    }
+
+    if(guest_phys + size == guest_phys_top) {
+      guest_phys_top = guest_phys;
+    } else {
+      guest_phys_holes[guest_phys] = size;
+    }
+  }
+
+  void PagerX86_64::invalidate_tlb() {
+    tlb_epoch.store(next_tlb_epoch++);
+  }
+
+  void PagerX86_64::host_memory_changed() {
+    mem_epoch.store(next_tlb_epoch++, std::memory_order_release);
+  }
+
+  int PagerX86_64::set_pml4(const std::shared_ptr<Region>& r) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+    host_sysmem_p = reinterpret_cast<void *>(chunks.get()[0]->userspace_addr);
+    host_pml4_p = r->base_address();
+    guestptr_t pml4_guest_physical = host_to_guest_physical(host_pml4_p);
+    guest_next_free = KERNEL_SPACE_BOTTOM;
+
+    int err = create_page_tables();
+    assert(err == 0 && "could not create page tables");
+
+    return pml4_guest_physical;
+  }
+
+  std::shared_ptr<struct kvm_userspace_memory_region>
+  PagerX86_64::alloc_chunk(guestptr_t guest_phys, size_t chunk_size, int flags) {
+    std::shared_ptr<struct kvm_userspace_memory_region>chunk =
+      std::make_shared<struct kvm_userspace_memory_region>();
+    if(!chunk) {
+      return nullptr;
+    }
+
+    chunk->userspace_addr = (__u64)(host_arena_p + guest_phys);
+    chunk->guest_phys_addr = guest_phys;
+    chunk->memory_size = chunk_size;
+    chunk->flags = flags;
+
+    if(!free_slots.empty()) {
+      chunk->slot = free_slots.back();
+      free_slots.pop_back();
+    } else {
+      chunk->slot = next_slot++;
+    }
+
+    return chunk;
+  }
+
+  int PagerX86_64::add_guest_memory(guestptr_t guest_phys, size_t size) {
+    std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> neighbours;
+    guestptr_t start = guest_phys;
+    guestptr_t end = guest_phys + size;
+
+    for(const auto &c : chunks.get()) {
+      if(is_shared(c)) {
+        continue;
+      }
+      if(c->guest_phys_addr + c->memory_size == guest_phys) {
+        start = c->guest_phys_addr;
+        neighbours.insert(neighbours.begin(), c);
+      } else if(c->guest_phys_addr == guest_phys + size) {
+        end = c->guest_phys_addr + c->memory_size;
+        neighbours.push_back(c);
+      }
+    }
+
+    if(!neighbours.empty()) {
+      return replace_chunks(neighbours, start, end - start);
+    }
+
+    auto chunk = alloc_chunk(guest_phys, size, 0);
+    if(chunk == nullptr) {
+      return -ENOMEM;
+    }
+
+    int err = map_chunk_to_kvm(chunk);
+    if(err) {
+      free_slots.push_back(chunk->slot);
+      return err;
+    }
+
+    chunks.update([&chunk](
+          std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> &cs)
+        { cs.push_back(chunk); });
+    return 0;
+  }
+
+  int PagerX86_64::replace_chunks(
+      const std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> &old,
+      guestptr_t guest_phys, size_t size) {
+    assert(!old.empty());
+
+    /* KVM cannot resize a slot and slots must not overlap, so the old ones
+     * are deleted before the new one is created, the memory behind them
+     * stays in place. If any of this fails the old slots come back. */
+    int err = 0;
+    unsigned deleted = 0;
+    for(; deleted < old.size(); deleted++) {
+      struct kvm_userspace_memory_region del = *old[deleted];
+      del.memory_size = 0;
+      err = set_slot(del);
+      if(err) {
+        break;
+      }
+    }
+
+    auto chunk = std::make_shared<struct kvm_userspace_memory_region>(*old[0]);
+    chunk->guest_phys_addr = guest_phys;
+    chunk->userspace_addr = (__u64)(host_arena_p + guest_phys);
+    chunk->memory_size = size;
+    if(!err) {
+      err = set_slot(*chunk);
+    }
+    if(err) {
+      for(unsigned i = 0; i < deleted; i++) {
+        int e = set_slot(*old[i]);
+        assert(e == 0 && "could not restore memory slot");
+        (void)e;
+      }
+      return err;
+    }
+
+    for(unsigned i = 1; i < old.size(); i++) {
+      free_slots.push_back(old[i]->slot);
+    }
+
+    chunks.update([&old, &chunk](
+          std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> &cs) {
+        std::replace(cs.begin(), cs.end(), old[0], chunk);
+        for(unsigned i = 1; i < old.size(); i++) {
+          cs.erase(std::find(cs.begin(), cs.end(), old[i]));
+        }
+    });
+    return 0;
+  }
+
+  int PagerX86_64::set_slot(const struct kvm_userspace_memory_region &chunk) {
+    if(chunk.slot >= max_slots) {
+      return -ENOSPC;
+    }
+    int err = ioctl(_vmfd, KVM_SET_USER_MEMORY_REGION, &chunk);
+    host_memory_changed();
+    return err ? -errno : 0;
+  }
+
+  bool PagerX86_64::is_shared(
+      const std::shared_ptr<struct kvm_userspace_memory_region> &chunk) const {
+    return std::find(shared_chunks.begin(), shared_chunks.end(), chunk)
+      != shared_chunks.end();
+  }
+
+  int PagerX86_64::reserve_shared_chunk(size_t size, guestptr_t *guest_phys) {
+    if(size == 0 || !page_aligned<size_t>(size)) {
+      return -EINVAL;
+    }
+    int err = reserve_host_arena();
+    if(err) {
+      return err;
+    }
+    return alloc_guest_phys(size, guest_phys);
+  }
+
+  int PagerX86_64::add_shared_chunk(guestptr_t guest_phys, size_t size,
+      bool readonly, void **host_p) {
+    int flags = KVM_MEM_READONLY;
+    if(!readonly) {
+      flags = (mem_policy & ELKVM_MEM_LOG_DIRTY) ? KVM_MEM_LOG_DIRTY_PAGES : 0;
+    }
+
+    char *p = host_arena_p + guest_phys;
+    auto chunk = alloc_chunk(guest_phys, size, flags);
+    int err = chunk == nullptr ? -ENOMEM : set_slot(*chunk);
+    if(err) {
+      if(chunk != nullptr) {
+        free_slots.push_back(chunk->slot);
+      }
+      mmap(p, size, PROT_NONE,
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+      free_guest_phys(guest_phys, size);
+      return err;
+    }
+
+    chunks.update([&chunk](
+          std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> &cs)
+        { cs.push_back(chunk); });
+    shared_chunks.push_back(chunk);
+    *host_p = p;
+    return 0;
+  }
+
+  int PagerX86_64::map_shared_memory(int fd, off_t offset, size_t size,
+      void **host_p) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    guestptr_t guest_phys;
+    int err = reserve_shared_chunk(size, &guest_phys);
+    if(err) {
+      return err;
+    }
+
+    if(mmap(host_arena_p + guest_phys, size, PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED) {
+      err = -errno;
+      free_guest_phys(guest_phys, size);
+      return err;
+    }
+    return add_shared_chunk(guest_phys, size, false, host_p);
+  }
+
+  int PagerX86_64::attach_shared_memory(int shmid, size_t size, bool readonly,
+      void **host_p) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    guestptr_t guest_phys;
+    int err = reserve_shared_chunk(size, &guest_phys);
+    if(err) {
+      return err;
+    }
+
+    /* the segment replaces the reserved address space of the arena */
+    if(shmat(shmid, host_arena_p + guest_phys,
+          SHM_REMAP | (readonly ? SHM_RDONLY : 0)) == reinterpret_cast<void *>(-1)) {
+      err = -errno;
+      free_guest_phys(guest_phys, size);
+      return err;
+    }
+    return add_shared_chunk(guest_phys, size, readonly, host_p);
+  }
+
+  int PagerX86_64::unmap_shared_memory(void *host_p) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    auto it = std::find_if(shared_chunks.begin(), shared_chunks.end(),
+        [host_p](const std::shared_ptr<struct kvm_userspace_memory_region> &c)
+        { return reinterpret_cast<void *>(c->userspace_addr) == host_p; });
+    if(it == shared_chunks.end()) {
+      return -EINVAL;
+    }
+
+    auto chunk = *it;
+    /* mapping over it detaches a System V segment as well */
+    int err = drop_chunk(*chunk);
+    if(err) {
+      return err;
+    }
+    shared_chunks.erase(it);
+    free_slots.push_back(chunk->slot);
+    chunks.update([&chunk](
+          std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> &cs)
+        { cs.erase(std::find(cs.begin(), cs.end(), chunk)); });
+    free_guest_phys(chunk->guest_phys_addr, chunk->memory_size);
+    invalidate_tlb();
+    return 0;
+  }
+
+  int PagerX86_64::move_to(int vmfd) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    _vmfd = vmfd;
+    auto cs = chunks.read();
+    for(const auto &chunk : *cs) {
+      int err = set_slot(*chunk);
+      if(err) {
+        return err;
+      }
+    }
+    return 0;
+  }
+
+  int PagerX86_64::resize_chunk(
+      const std::shared_ptr<struct kvm_userspace_memory_region>& chunk,
+      size_t newsize) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    if(!page_aligned<size_t>(newsize)) {
+      return -EIO;
+    }
+
+    const guestptr_t start = chunk->guest_phys_addr;
+    const size_t oldsize = chunk->memory_size;
+    char *host_p = host_arena_p + start;
+
+    /* gives back the memory grown into if the slot cannot be resized */
+    auto shrink_back = [&]() {
+      if(newsize > oldsize) {
+        munlock(host_p + oldsize, newsize - oldsize);
+        mprotect(host_p + oldsize, newsize - oldsize, PROT_NONE);
+        free_guest_phys(start + oldsize, newsize - oldsize);
+      }
+    };
+
+    if(newsize > oldsize) {
+      if(!take_guest_phys(start + oldsize, newsize - oldsize)) {
+        return -ENOMEM;
+      }
+      if(mprotect(host_p + oldsize, newsize - oldsize, PROT_READ | PROT_WRITE)) {
+        int err = -errno;
+        free_guest_phys(start + oldsize, newsize - oldsize);
+        return err;
+      }
+      int err = populate_host_memory(host_p + oldsize, newsize - oldsize,
+          mem_policy);
+      if(err) {
+        shrink_back();
+        return err;
+      }
+    }
+
+    /* as in replace_chunks, the old slot has to go first */
+    struct kvm_userspace_memory_region del = *chunk;
+    del.memory_size = 0;
+    int err = set_slot(del);
+    if(err) {
+      shrink_back();
+      return err;
+    }
+
+    if(newsize == 0) {
+      free_slots.push_back(chunk->slot);
+      chunks.update([&chunk](
+            std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> &cs)
+          { cs.erase(std::find(cs.begin(), cs.end(), chunk)); });
+    } else {
+      auto resized = std::make_shared<struct kvm_userspace_memory_region>(*chunk);
+      resized->memory_size = newsize;
+      err = set_slot(*resized);
+      if(err) {
+        int e = set_slot(*chunk);
+        assert(e == 0 && "could not restore memory slot");
+        (void)e;
+        shrink_back();
+        return err;
+      }
+      chunks.update([&chunk, &resized](
+            std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> &cs)
+          { std::replace(cs.begin(), cs.end(), chunk, resized); });
+    }
+
+    if(newsize < oldsize) {
+      /* replacing the memory drops it even if it is locked or was mapped
+       * from a snapshot, growing into it later yields zeroed pages. If that
+       * fails the range stays reserved, so it is never handed out again
+       * with the old contents */
+      invalidate_tlb();
+      if(mmap(host_p + newsize, oldsize - newsize, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0)
+          == MAP_FAILED) {
+        return -errno;
+      }
+      free_guest_phys(start + newsize, oldsize - newsize);
+    }
+
+    return 0;
+  }
+
+  void PagerX86_64::create_entry(ptentry_t *host_entry_p, guestptr_t guest_next,
+      ptopt_t opts) const {
+    /* save base address of next tbl in entry */
+    ptentry_t entry = page_begin(guest_next);
+
+    entry |= PT_BIT_USER;
+
+    if(opts & PT_OPT_WRITE) {
+      entry |= PT_BIT_WRITEABLE;
+    }
+
+    if(!(opts & PT_OPT_EXEC)) {
+      entry |= PT_BIT_NXE;
+    }
+
+    /* mark the entry as present */
+    entry |= PT_BIT_PRESENT;
+
+    /* concurrent page table walks must never see a half-written entry */
+    __atomic_store_n(host_entry_p, entry, __ATOMIC_RELEASE);
+    mark_host_written(host_entry_p, sizeof(*host_entry_p));
+  }
+
+  int PagerX86_64::create_mem_chunk(void **host_p, size_t chunk_size) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    /* keep sizes page aligned */
+    if(!page_aligned<size_t>(chunk_size)) {
+      return -EIO;
+    }
+
+    int err = reserve_host_arena();
+    if(err) {
+      return err;
+    }
+
+    guestptr_t guest_phys;
+    err = alloc_guest_phys(chunk_size, &guest_phys);
+    if(err) {
+      return err;
+    }
+
+    char *p = host_arena_p + guest_phys;
+    if(mprotect(p, chunk_size, PROT_READ | PROT_WRITE)) {
+      err = -errno;
+      free_guest_phys(guest_phys, chunk_size);
+      return err;
+    }
+
+    err = populate_host_memory(p, chunk_size, mem_policy);
+    if(err == 0) {
+      err = add_guest_memory(guest_phys, chunk_size);
+    }
+    if(err) {
+      munlock(p, chunk_size);
+      mprotect(p, chunk_size, PROT_NONE);
+      free_guest_phys(guest_phys, chunk_size);
+      return err;
+    }
+
+    *host_p = p;
+    return 0;
+  }
+
+  int PagerX86_64::set_memory_policy(unsigned flags) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    const bool unmerge = (mem_policy & ELKVM_MEM_MERGEABLE)
+      && !(flags & ELKVM_MEM_MERGEABLE);
+    const bool log_dirty = (mem_policy ^ flags) & ELKVM_MEM_LOG_DIRTY;
+    mem_policy = flags;
+    if(log_dirty) {
+      /* the log misses the writes so far, the next reset or checkpoint
+       * has to take all pages */
+      snapshot_chunks.clear();
+    }
+    for(const auto &chunk : chunks.get()) {
+      if(log_dirty) {
+        /* KVM can change the flags of a slot in place, lookups never look
+         * at them, so the chunk is not replaced */
+        chunk->flags ^= KVM_MEM_LOG_DIRTY_PAGES;
+        int err = set_slot(*chunk);
+        if(err) {
+          return err;
+        }
+      }
+
+      void *p = reinterpret_cast<void *>(chunk->userspace_addr);
+      if(!(flags & ELKVM_MEM_LOCK)) {
+        ::munlock(p, chunk->memory_size);
+      }
+      if(unmerge) {
+        madvise(p, chunk->memory_size, MADV_UNMERGEABLE);
+      }
+    }
+
+    return apply_memory_policy(flags);
+  }
+
+  int PagerX86_64::apply_memory_policy(unsigned flags) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    for(const auto &chunk : chunks.get()) {
+      int err = populate_host_memory(reinterpret_cast<void *>(chunk->userspace_addr),
+          chunk->memory_size, flags);
+      if(err) {
+        return err;
+      }
+    }
+    return 0;
+  }
+
+  int PagerX86_64::populate_host_memory(void *host_p, size_t len,
+      unsigned flags) {
+    if(len == 0) {
+      return 0;
+    }
+
+    if(flags & ELKVM_MEM_MERGEABLE) {
+      if(madvise(host_p, len, MADV_MERGEABLE)) {
+        return -errno;
+      }
+    }
+
+    /* mlock faults in all pages itself */
+    if(flags & ELKVM_MEM_LOCK) {
+      if(::mlock(host_p, len)) {
+        return -errno;
+      }
+      return 0;
+    }
+
+    if(flags & ELKVM_MEM_POPULATE) {
+#ifdef MADV_POPULATE_WRITE
+      if(madvise(host_p, len, MADV_POPULATE_WRITE) == 0) {
+        return 0;
+      }
+      if(errno != EINVAL) {
+        return -errno;
+      }
+#endif
+      /* older kernels: write fault every page, adding 0 atomically does not
+       * race with vcpus writing to the memory. mlock would do the same, but
+       * fails under the default RLIMIT_MEMLOCK */
+      char *p = static_cast<char *>(host_p);
+      char *end = p + len;
+      for(; p < end; p += HOST_PAGESIZE) {
+        __atomic_fetch_add(p, 0, __ATOMIC_RELAXED);
+      }
+      __atomic_fetch_add(end - 1, 0, __ATOMIC_RELAXED);
+    }
+    return 0;
+  }
+
+  int PagerX86_64::unlock_host_memory(void *host_p, size_t len) {
+    if(mem_policy & ELKVM_MEM_LOCK) {
+      return 0;
+    }
+    if(::munlock(host_p, len)) {
+      return -errno;
+    }
+    return 0;
+  }
+
+  int PagerX86_64::merged_pages(size_t *pages) const {
+    int pagemap = open("/proc/self/pagemap", O_RDONLY);
+    if(pagemap < 0) {
+      return -errno;
+    }
+    int kpageflags = open("/proc/kpageflags", O_RDONLY);
+    if(kpageflags < 0) {
+      int err = -errno;
+      close(pagemap);
+      return err;
+    }
+
+    /* pagemap entries: bit 63 page present, bits 0-54 page frame number */
+    constexpr uint64_t present = 1ULL << 63;
+    constexpr uint64_t pfn_mask = (1ULL << 55) - 1;
+    constexpr size_t batch = 512;
+    uint64_t entries[batch];
+
+    int err = 0;
+    *pages = 0;
+    auto cs = chunks.read();
+    for(const auto &chunk : *cs) {
+      const uint64_t first = chunk->userspace_addr / HOST_PAGESIZE;
+      const uint64_t count = chunk->memory_size / HOST_PAGESIZE;
+      for(uint64_t i = 0; i < count && err == 0; i += batch) {
+        size_t n = std::min<uint64_t>(batch, count - i);
+        ssize_t bytes = pread(pagemap, entries, n * sizeof(uint64_t),
+            (first + i) * sizeof(uint64_t));
+        if(bytes != static_cast<ssize_t>(n * sizeof(uint64_t))) {
+          err = bytes < 0 ? -errno : -EIO;
+          break;
+        }
+
+        for(size_t j = 0; j < n; j++) {
+          /* without CAP_SYS_ADMIN all frame numbers read as 0 */
+          uint64_t pfn = entries[j] & pfn_mask;
+          if(!(entries[j] & present) || pfn == 0) {
+            continue;
+          }
+          uint64_t kflags;
+          if(pread(kpageflags, &kflags, sizeof(kflags), pfn * sizeof(kflags))
+              != sizeof(kflags)) {
+            err = -errno;
+            break;
+          }
+          if(kflags & (1ULL << KPF_KSM)) {
+            (*pages)++;
+          }
+        }
+      }
+    }
+
+    close(kpageflags);
+    close(pagemap);
+    return err;
+  }
+
+  static int write_all(int fd, const char *p, size_t len, off_t off) {
+    size_t done = 0;
+    while(done < len) {
+      ssize_t bytes = pwrite(fd, p + done, len - done, off + done);
+      if(bytes < 0) {
+        if(errno == EINTR) {
+          continue;
+        }
+        return -errno;
+      }
+      done += bytes;
+    }
+    return 0;
+  }
+
+  static int read_all(int fd, char *p, size_t len, off_t off) {
+    size_t done = 0;
+    while(done < len) {
+      ssize_t bytes = pread(fd, p + done, len - done, off + done);
+      if(bytes < 0) {
+        if(errno == EINTR) {
+          continue;
+        }
+        return -errno;
+      }
+      if(bytes == 0) {
+        /* behind the end of the file, like a hole */
+        memset(p + done, 0, len - done);
+        break;
+      }
+      done += bytes;
+    }
+    return 0;
+  }
+
+  int PagerX86_64::write_chunk(const struct kvm_userspace_memory_region &chunk,
+      int fd, off_t offset, bool sparse) const {
+    static const char zero_page[HOST_PAGESIZE] = { 0 };
+
+    const char *host_p = reinterpret_cast<const char *>(chunk.userspace_addr);
+    if(!sparse) {
+      return write_all(fd, host_p, chunk.memory_size,
+          offset + chunk.guest_phys_addr);
+    }
+
+    size_t off = 0;
+    while(off < chunk.memory_size) {
+      /* pages never written to read as zero and need not be stored */
+      if(memcmp(host_p + off, zero_page, HOST_PAGESIZE) == 0) {
+        off += HOST_PAGESIZE;
+        continue;
+      }
+
+      size_t len = HOST_PAGESIZE;
+      while(off + len < chunk.memory_size
+          && memcmp(host_p + off + len, zero_page, HOST_PAGESIZE) != 0) {
+        len += HOST_PAGESIZE;
+      }
+
+      int err = write_all(fd, host_p + off, len,
+          offset + chunk.guest_phys_addr + off);
+      if(err) {
+        return err;
+      }
+      off += len;
+    }
+    return 0;
+  }
+
+  int PagerX86_64::write_memory(int fd) const {
+    auto cs = chunks.read();
+    for(const auto &chunk : *cs) {
+      int err = write_chunk(*chunk, fd, 0, true);
+      if(err) {
+        return err;
+      }
+    }
+    return 0;
+  }
+
+  bool PagerX86_64::mapped_from(int fd, off_t offset) const {
+    struct stat st;
+    if(snapshot_chunks.empty() || fstat(fd, &st)) {
+      return false;
+    }
+    return st.st_dev == snapshot_dev && st.st_ino == snapshot_ino
+      && offset == snapshot_offset;
+  }
+
+  void PagerX86_64::set_mapped_from(int fd, off_t offset,
+      const std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> &cs) {
+    struct stat st;
+    if(fstat(fd, &st)) {
+      snapshot_chunks.clear();
+      return;
+    }
+    snapshot_chunks = cs;
+    snapshot_dev = st.st_dev;
+    snapshot_ino = st.st_ino;
+    snapshot_offset = offset;
+  }
+
+  int PagerX86_64::map_file_chunk(const struct kvm_userspace_memory_region &layout,
+      int fd, off_t offset, int map_flags,
+      std::shared_ptr<struct kvm_userspace_memory_region> *chunk) {
+    char *p = host_arena_p + layout.guest_phys_addr;
+    void *m = mmap(p, layout.memory_size, PROT_READ | PROT_WRITE,
+        map_flags | MAP_FIXED, fd, offset + layout.guest_phys_addr);
+    if(m == MAP_FAILED) {
+      return -errno;
+    }
+
+    /* same guest physical address and memory slot as in layout */
+    auto c = std::make_shared<struct kvm_userspace_memory_region>(layout);
+    c->userspace_addr = reinterpret_cast<__u64>(p);
+    clear_host_writes(*c);
+    c->flags = (mem_policy & ELKVM_MEM_LOG_DIRTY) ? KVM_MEM_LOG_DIRTY_PAGES : 0;
+    int err = set_slot(*c);
+    if(err) {
+      return err;
+    }
+    *chunk = c;
+    return 0;
+  }
+
+  int PagerX86_64::drop_chunk(const struct kvm_userspace_memory_region &chunk) {
+    struct kvm_userspace_memory_region del = chunk;
+    del.memory_size = 0;
+    int err = set_slot(del);
+    if(err) {
+      return err;
+    }
+    if(mmap(reinterpret_cast<void *>(chunk.userspace_addr), chunk.memory_size,
+          PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+          -1, 0) == MAP_FAILED) {
+      return -errno;
+    }
+    return 0;
+  }
+
+  void PagerX86_64::copy_layout(const PagerX86_64 &orig) {
+    host_sysmem_p = rebase(orig, orig.host_sysmem_p);
+    host_pml4_p = rebase(orig, orig.host_pml4_p);
+    host_next_free_tbl_p = rebase(orig, orig.host_next_free_tbl_p);
+    guest_next_free = orig.guest_next_free;
+    guest_phys_top = orig.guest_phys_top;
+    guest_phys_holes = orig.guest_phys_holes;
+    free_slots = orig.free_slots;
+    next_slot = orig.next_slot;
+  }
+
+  int PagerX86_64::clone_memory(const PagerX86_64 &orig, int fd, int map_flags) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+    assert(chunks.get().empty() && "can only clone into an empty pager");
+
+    int err = reserve_host_arena();
+    if(err) {
+      return err;
+    }
+    mem_policy = orig.mem_policy;
+
+    std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> cloned;
+    auto orig_chunks = orig.chunks.read();
+    for(const auto &chunk : *orig_chunks) {
+      std::shared_ptr<struct kvm_userspace_memory_region> c;
+      err = map_file_chunk(*chunk, fd, 0, map_flags, &c);
+      if(err) {
+        return err;
+      }
+      cloned.push_back(c);
+    }
+    chunks.replace(cloned);
+    if(map_flags & MAP_PRIVATE) {
+      set_mapped_from(fd, 0, cloned);
+    }
+
+    copy_layout(orig);
+    invalidate_tlb();
+
+    return 0;
+  }
+
+  int PagerX86_64::reset_memory(const PagerX86_64 &orig, int fd) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if(pagemap < 0) {
+      return -errno;
+    }
+
+    /* chunks that were added, resized or never mapped from fd go away, as
+     * do chunks whose writes KVM did not log */
+    const bool from_fd = mapped_from(fd, 0);
+    int err = 0;
+    std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> kept;
+    for(const auto &chunk : chunks.get()) {
+      if(from_fd && (chunk->flags & KVM_MEM_LOG_DIRTY_PAGES)
+          && std::find(snapshot_chunks.begin(), snapshot_chunks.end(), chunk)
+            != snapshot_chunks.end()) {
+        err = discard_dirty_pages(*chunk, pagemap, fd);
+        if(err) {
+          break;
+        }
+        kept.push_back(chunk);
+        continue;
+      }
+
+      err = drop_chunk(*chunk);
+      if(err) {
+        break;
+      }
+    }
+    close(pagemap);
+    if(err) {
+      return err;
+    }
+
+    auto orig_chunks = orig.chunks.read();
+    for(const auto &orig_chunk : *orig_chunks) {
+      if(std::find_if(kept.begin(), kept.end(),
+            [&orig_chunk](
+              const std::shared_ptr<struct kvm_userspace_memory_region> &c)
+            { return c->guest_phys_addr == orig_chunk->guest_phys_addr; })
+          != kept.end()) {
+        continue;
+      }
+
+      std::shared_ptr<struct kvm_userspace_memory_region> c;
+      err = map_file_chunk(*orig_chunk, fd, 0, MAP_PRIVATE, &c);
+      if(err) {
+        return err;
+      }
+      kept.push_back(c);
+    }
+    chunks.replace(kept);
+    set_mapped_from(fd, 0, kept);
+    shared_chunks.clear();
+
+    copy_layout(orig);
+    invalidate_tlb();
+
+    return 0;
+  }
+
+  /* index of the first set bit at or after page, count if there is none */
+  static uint64_t next_set_page(const std::vector<uint64_t> &bits,
+      uint64_t page, uint64_t count) {
+    while(page < count) {
+      const uint64_t w = bits[page / 64] & (~0ULL << (page % 64));
+      if(w) {
+        return std::min(count, page - page % 64 + __builtin_ctzll(w));
+      }
+      page += 64 - page % 64;
+    }
+    return count;
+  }
 
-#define TLB_STATS 0 /* set to 1 if you want verbose TLB statistics */
+  static bool page_set(const std::vector<uint64_t> &bits, uint64_t page) {
+    return bits[page / 64] & (1ULL << (page % 64));
+  }
 
-  /*
-   * TLB based on std::map
-   *
-   * This TLB uses a std::map to store page lookups. It is not
-   * bounded by any size limits and will simply become a mirror
-   * of the guest page table after some time. This means that this
-   * TLB might be useful for large, unpredictable workloads as there
-   * will be no problems with cache evictions. However, std::map
-   * works badly for small working sets as lookups are too slow to
-   * improve over what get_host_p does anyway.
-   */
-  class MappedTLB {
-    std::map<guestptr_t, guestptr_t> _entries;  // the actual TLB
-    unsigned _stat_hit, _stat_miss;             // statistics counters
+  int PagerX86_64::take_dirty_pages(
+      const struct kvm_userspace_memory_region &chunk, int pagemap,
+      std::vector<uint64_t> &dirty) {
+    const uint64_t count = chunk.memory_size / HOST_PAGESIZE;
+    const uint64_t first = (reinterpret_cast<char *>(chunk.userspace_addr)
+        - host_arena_p) / HOST_PAGESIZE;
+
+    /* the guest's writes */
+    assert(chunk.flags & KVM_MEM_LOG_DIRTY_PAGES);
+    struct kvm_dirty_log log;
+    memset(&log, 0, sizeof(log));
+    log.slot = chunk.slot;
+    log.dirty_bitmap = dirty.data();
+    if(ioctl(_vmfd, KVM_GET_DIRTY_LOG, &log)) {
+      return -errno;
+    }
 
-      public:
-        MappedTLB()
-          : _entries(), _stat_hit(0), _stat_miss(0)
-        {
+    /* the host's writes */
+    take_pages(host_written, first, count, &dirty);
+
+    /* the host may have written on behind a pointer from get_host_p, up to
+     * the end of the buffer. Written pages are private copies instead of
+     * pages of the file, so the run of private pages starting at the page
+     * handed out covers the buffer. pagemap entries: bit 63 page present,
+     * bit 62 swapped, bit 61 file page */
+    std::vector<uint64_t> touched(dirty.size(), 0);
+    take_pages(host_touched, first, count, &touched);
+
+    constexpr uint64_t present = 1ULL << 63;
+    constexpr uint64_t swapped = 1ULL << 62;
+    constexpr uint64_t file = 1ULL << 61;
+    constexpr size_t batch = 64;
+    uint64_t entries[batch];
+
+    const uint64_t vpage = chunk.userspace_addr / HOST_PAGESIZE;
+    for(uint64_t page = next_set_page(touched, 0, count); page < count;
+        page = next_set_page(touched, page, count)) {
+      bool run = true;
+      while(run && page < count) {
+        size_t n = std::min<uint64_t>(batch, count - page);
+        ssize_t bytes = pread(pagemap, entries, n * sizeof(uint64_t),
+            (vpage + page) * sizeof(uint64_t));
+        if(bytes != static_cast<ssize_t>(n * sizeof(uint64_t))) {
+          return bytes < 0 ? -errno : -EIO;
         }
 
-        guestptr_t find(const guestptr_t entry) {
-          const auto& it = _entries.find(entry & ~ELKVM_PAGE_MASK);
-#if TLB_STATS
-          static int num_find = 0;
-          if (num_find++ > 10000) {
-            INFO() << "MISSES " << _stat_miss << " HITS " << _stat_hit;
-          }
-#endif
-          if (it != _entries.end()) {
-            _stat_hit++;
-            return it->second + (entry & ELKVM_PAGE_MASK);
+        for(size_t j = 0; run && j < n; j++) {
+          run = (entries[j] & swapped)
+            || ((entries[j] & present) && !(entries[j] & file));
+          if(run) {
+            dirty[page / 64] |= 1ULL << (page % 64);
+            page++;
           }
-          _stat_miss++;
-          return 0;
         }
+      }
+      /* the run ends at a page of the file, i.e. one nobody wrote to */
+      page++;
+    }
+    return 0;
+  }
 
-        void set(guestptr_t entry, guestptr_t value) {
-          _entries[entry & ~ELKVM_PAGE_MASK] = value & ~ELKVM_PAGE_MASK;
-        }
-  };
+  /* call f(page, end) for every run [page, end) of set bits, up to count */
+  template<typename F>
+  static int for_each_run(const std::vector<uint64_t> &bits, uint64_t count,
+      F f) {
+    for(uint64_t page = next_set_page(bits, 0, count); page < count;
+        page = next_set_page(bits, page, count)) {
+      uint64_t end = page + 1;
+      while(end < count && page_set(bits, end)) {
+        end++;
+      }
+      int err = f(page, end);
+      if(err) {
+        return err;
+      }
+      page = end;
+    }
+    return 0;
+  }
 
+  int PagerX86_64::discard_dirty_pages(
+      const struct kvm_userspace_memory_region &chunk, int pagemap, int fd) {
+    const uint64_t count = chunk.memory_size / HOST_PAGESIZE;
+    std::vector<uint64_t> dirty((count + 63) / 64, 0);
+    int err = take_dirty_pages(chunk, pagemap, dirty);
+    if(err) {
+      return err;
+    }
 
-  /*
-   * Custom TLB implementation
-   *
-   * This TLB uses a fixed-size array to store TLB entries. Position in the
-   * array is calculated by hash()ing the respective entry value. Evictions
-   * may occur for some workloads - adjusting cache size or hash() function
-   * might help then.
-   */
-  class TLB
-  {
-      std::pair<guestptr_t, guestptr_t> *_entries; // the actual TLB
-      unsigned    _stat_hit;    // statistics counters ...
-      unsigned    _stat_miss;
-      unsigned    _stat_evict;
-      unsigned    _stat_enter;
+    /* dropping the private copies makes the file pages visible again */
+    char *host_p = reinterpret_cast<char *>(chunk.userspace_addr);
+    return for_each_run(dirty, count, [&](uint64_t page, uint64_t end) {
+        char *p = host_p + page * HOST_PAGESIZE;
+        const size_t len = (end - page) * HOST_PAGESIZE;
+        host_memory_changed();
+        if(madvise(p, len, MADV_DONTNEED) == 0) {
+          return 0;
+        }
+        /* locked pages cannot be dropped, they stay resident and are read
+         * from the file instead */
+        if(errno != EINVAL) {
+          return -errno;
+        }
+        return read_all(fd, p, len, chunk.guest_phys_addr + page * HOST_PAGESIZE);
+      });
+  }
 
-      enum {
-          NUM_ENTRIES = 0x1000,     // TLB size
-          low_mask    = 0xFFF000,   // hash mask
-          low_shift   = 12,         // hash bit shift
-      };
+  int PagerX86_64::write_dirty_pages(
+      const struct kvm_userspace_memory_region &chunk, int pagemap, int fd,
+      off_t offset) {
+    const uint64_t count = chunk.memory_size / HOST_PAGESIZE;
+    std::vector<uint64_t> dirty((count + 63) / 64, 0);
+    int err = take_dirty_pages(chunk, pagemap, dirty);
+    if(err) {
+      return err;
+    }
 
-      inline guestptr_t hash(guestptr_t entry)
-      {
-          return (entry & low_mask) >> low_shift;
+    const char *host_p = reinterpret_cast<const char *>(chunk.userspace_addr);
+    return for_each_run(dirty, count, [&](uint64_t page, uint64_t end) {
+        return write_all(fd, host_p + page * HOST_PAGESIZE,
+            (end - page) * HOST_PAGESIZE,
+            offset + chunk.guest_phys_addr + page * HOST_PAGESIZE);
+      });
+  }
+
+  /* copy len bytes at off from in to out, the file system may share the
+   * blocks instead of copying them */
+  static int copy_range(int in, int out, off_t off, size_t len) {
+    loff_t in_off = off;
+    loff_t out_off = off;
+    while(len > 0) {
+      ssize_t bytes = copy_file_range(in, &in_off, out, &out_off, len, 0);
+      if(bytes < 0 && errno == EINTR) {
+        continue;
+      }
+      if(bytes < 0 && errno != ENOSYS && errno != EXDEV && errno != EINVAL
+          && errno != EOPNOTSUPP) {
+        return -errno;
+      }
+      if(bytes < 0) {
+        break;
+      }
+      if(bytes == 0) {
+        /* the rest of in is behind its end and reads as zero */
+        return 0;
       }
+      len -= bytes;
+    }
 
-      public:
-          TLB() : _entries(0),
-                  _stat_hit(0),
-                  _stat_miss(0),
-                  _stat_evict(0),
-                  _stat_enter(0)
-          {
-            _entries = new std::pair<guestptr_t,guestptr_t>[NUM_ENTRIES];
-            memset(_entries, 0, NUM_ENTRIES * sizeof(guestptr_t));
-          }
+    /* copy_file_range does not work for these files */
+    std::vector<char> buf(std::min<size_t>(len, 1 << 20));
+    while(len > 0) {
+      ssize_t bytes = pread(in, buf.data(), std::min(len, buf.size()), in_off);
+      if(bytes < 0 && errno == EINTR) {
+        continue;
+      }
+      if(bytes <= 0) {
+        return bytes < 0 ? -errno : 0;
+      }
+      int err = write_all(out, buf.data(), bytes, out_off);
+      if(err) {
+        return err;
+      }
+      in_off += bytes;
+      out_off += bytes;
+      len -= bytes;
+    }
+    return 0;
+  }
 
-          guestptr_t find(guestptr_t entry)
-          {
-#if TLB_STATS
-            static int num_lookups = 0;
+  int PagerX86_64::checkpoint_memory(int fd, off_t offset, int base_fd) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
 
-            if (++num_lookups > 100000) {
-              INFO() << "TLB stats: "
-                     << "ADDed: " << _stat_enter
-                     << " HITS: " << _stat_hit
-                     << " MISSES: " << _stat_miss
-                     << " EVICTIONS: " << _stat_evict;
-              num_lookups = 0;
-              _stat_hit = _stat_miss = _stat_evict = _stat_enter = 0;
-            }
-#endif
+    int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if(pagemap < 0) {
+      return -errno;
+    }
 
-            guestptr_t h = hash(entry);
-            const auto& lookup = _entries[h];
-            //DBG() << std::hex << "[" << entry << "] " << lookup.first << " -> " << lookup.second;
-            if (lookup.first == (entry & ~ELKVM_PAGE_MASK)) {
-              _stat_hit += 1;
-              return (lookup.second | (entry & ELKVM_PAGE_MASK));
-            }
-            _stat_miss += 1;
+    /* chunks still mapped from base_fd take their pages from there, only
+     * the pages written since are taken from memory */
+    const bool incremental = base_fd >= 0 && mapped_from(base_fd, offset);
+    int err = 0;
+    std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> saved;
+    for(const auto &chunk : chunks.get()) {
+      if(incremental && (chunk->flags & KVM_MEM_LOG_DIRTY_PAGES)
+          && std::find(snapshot_chunks.begin(), snapshot_chunks.end(), chunk)
+            != snapshot_chunks.end()) {
+        err = copy_range(base_fd, fd, offset + chunk->guest_phys_addr,
+            chunk->memory_size);
+        if(!err) {
+          err = write_dirty_pages(*chunk, pagemap, fd, offset);
+        }
+      } else {
+        /* the file may still hold an older chunk in this place */
+        const bool sparse = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+            offset + chunk->guest_phys_addr, chunk->memory_size) == 0;
+        err = write_chunk(*chunk, fd, offset, sparse);
+        if(err) {
+          break;
+        }
+        if(is_shared(chunk)) {
+          continue;
+        }
 
-            return 0;
+        /* the dirty log starts over */
+        if(chunk->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+          std::vector<uint64_t> dirty(
+              (chunk->memory_size / HOST_PAGESIZE + 63) / 64, 0);
+          struct kvm_dirty_log log;
+          memset(&log, 0, sizeof(log));
+          log.slot = chunk->slot;
+          log.dirty_bitmap = dirty.data();
+          if(ioctl(_vmfd, KVM_GET_DIRTY_LOG, &log)) {
+            err = -errno;
           }
+        }
+      }
+      if(err) {
+        break;
+      }
 
-          void set(guestptr_t entry, guestptr_t value)
-          {
-            guestptr_t h = hash(entry);
-            std::pair<guestptr_t, guestptr_t>& tlb_slot = _entries[h];
-
-            _stat_enter++;
-            if (tlb_slot.first != 0) { _stat_evict++; }
+      /* writes from now on are tracked as private copies of the pages of
+       * fd, base_fd is left alone for whoever else maps it */
+      void *host_p = reinterpret_cast<void *>(chunk->userspace_addr);
+      host_memory_changed();
+      if(mmap(host_p, chunk->memory_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_FIXED, fd, offset + chunk->guest_phys_addr)
+          == MAP_FAILED) {
+        err = -errno;
+        break;
+      }
+      clear_host_writes(*chunk);
+      err = populate_host_memory(host_p, chunk->memory_size, mem_policy);
+      if(err) {
+        break;
+      }
+      saved.push_back(chunk);
+    }
+    close(pagemap);
 
-            tlb_slot.first = entry & ~ELKVM_PAGE_MASK;
-            tlb_slot.second = value & ~ELKVM_PAGE_MASK;
-            //DBG() << std::hex << "[" << entry << "] " << tlb_slot.first << " -> " << tlb_slot.second;
-          }
-  };
+    set_mapped_from(fd, offset, saved);
+    return err;
+  }
 
-  PagerX86_64::PagerX86_64(int vmfd)
-    : _vmfd(vmfd),
-      chunks(),
-      host_pml4_p(0),
-      host_next_free_tbl_p(0),
-      guest_next_free(~0ULL),
-      total_memsz(0),
-      free_slots()
-  {
-    if(vmfd < 1) {
-      throw;
+  uint64_t PagerX86_64::arena_offset(const void *host_p) const {
+    if(host_p == nullptr) {
+      return ~0ULL;
     }
+    return static_cast<const char *>(host_p) - host_arena_p;
   }
 
-  int PagerX86_64::set_pml4(const std::shared_ptr<Region>& r) {
-    host_pml4_p = r->base_address();
-    guestptr_t pml4_guest_physical = host_to_guest_physical(host_pml4_p);
-    guest_next_free = KERNEL_SPACE_BOTTOM;
-
-    int err = create_page_tables();
-    assert(err == 0 && "could not create page tables");
-
-    return pml4_guest_physical;
+  void *PagerX86_64::arena_address(uint64_t offset) const {
+    if(offset == ~0ULL) {
+      return nullptr;
+    }
+    return host_arena_p + offset;
   }
 
-  std::shared_ptr<struct kvm_userspace_memory_region>
-  PagerX86_64::alloc_chunk(void *addr, size_t chunk_size, int flags) {
-    std::shared_ptr<struct kvm_userspace_memory_region>chunk =
-      std::make_shared<struct kvm_userspace_memory_region>();
-    if(!chunk) {
-      return nullptr;
+  void PagerX86_64::save_state(CheckpointWriter &w) const {
+    w.put<uint64_t>(guest_phys_top);
+    w.put<uint64_t>(guest_next_free);
+    w.put<uint64_t>(arena_offset(host_sysmem_p));
+    w.put<uint64_t>(arena_offset(host_pml4_p));
+    w.put<uint64_t>(arena_offset(host_next_free_tbl_p));
+
+    w.put<uint64_t>(guest_phys_holes.size());
+    for(const auto &hole : guest_phys_holes) {
+      w.put<uint64_t>(hole.first);
+      w.put<uint64_t>(hole.second);
+    }
+    w.put<uint64_t>(free_slots.size());
+    for(auto slot : free_slots) {
+      w.put<uint32_t>(slot);
+    }
+    w.put<uint32_t>(next_slot);
+
+    auto cs = chunks.read();
+    w.put<uint64_t>(cs->size());
+    for(const auto &chunk : *cs) {
+      w.put<uint64_t>(chunk->guest_phys_addr);
+      w.put<uint64_t>(chunk->memory_size);
+      w.put<uint32_t>(chunk->slot);
     }
+  }
 
-    chunk->userspace_addr = (__u64)addr;
-    chunk->guest_phys_addr = total_memsz;
-    chunk->memory_size = chunk_size;
-    chunk->flags = flags;
-    total_memsz += chunk_size;
+  int PagerX86_64::restore_state(CheckpointReader &r, int fd, off_t offset) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
 
-    chunk->slot = chunks.size();
-    chunks.push_back(chunk);
+    const guestptr_t top = r.get<uint64_t>();
+    const guestptr_t next_free = r.get<uint64_t>();
+    const uint64_t sysmem = r.get<uint64_t>();
+    const uint64_t pml4 = r.get<uint64_t>();
+    const uint64_t next_free_tbl = r.get<uint64_t>();
 
-    if(!free_slots.empty()) {
-      chunk->slot = free_slots.back();
-      free_slots.pop_back();
+    std::map<guestptr_t, size_t> holes;
+    for(uint64_t n = r.get<uint64_t>(); r.ok() && n > 0; n--) {
+      guestptr_t start = r.get<uint64_t>();
+      holes[start] = r.get<uint64_t>();
+    }
+    std::vector<uint32_t> slots;
+    for(uint64_t n = r.get<uint64_t>(); r.ok() && n > 0; n--) {
+      slots.push_back(r.get<uint32_t>());
+    }
+    const uint32_t slot_top = r.get<uint32_t>();
+
+    std::vector<struct kvm_userspace_memory_region> layout;
+    for(uint64_t n = r.get<uint64_t>(); r.ok() && n > 0; n--) {
+      struct kvm_userspace_memory_region c;
+      memset(&c, 0, sizeof(c));
+      c.guest_phys_addr = r.get<uint64_t>();
+      c.memory_size = r.get<uint64_t>();
+      c.slot = r.get<uint32_t>();
+      if(!page_aligned<uint64_t>(c.guest_phys_addr)
+          || !page_aligned<uint64_t>(c.memory_size)
+          || c.guest_phys_addr > top
+          || c.memory_size > top - c.guest_phys_addr
+          || c.slot >= max_slots) {
+        r.fail();
+      }
+      layout.push_back(c);
+    }
+    struct stat st;
+    if(!r.ok() || top > ELKVM_GUEST_PHYS_MAX || slot_top > max_slots
+        || (pml4 != ~0ULL && pml4 >= top)
+        || (sysmem != ~0ULL && sysmem >= top)
+        || (next_free_tbl != ~0ULL && next_free_tbl >= top)
+        || fstat(fd, &st)
+        || static_cast<uint64_t>(offset) > static_cast<uint64_t>(st.st_size)
+        || top > static_cast<uint64_t>(st.st_size) - offset) {
+      return -EINVAL;
     }
 
-    return chunk;
-  }
+    int err = reserve_host_arena();
+    if(err) {
+      return err;
+    }
 
-  void PagerX86_64::create_entry(ptentry_t *host_entry_p, guestptr_t guest_next,
-      ptopt_t opts) const {
-    /* save base address of next tbl in entry */
-    *host_entry_p = page_begin(guest_next);
+    /* the image is mapped outside of the arena first and only moved in once
+     * the memory slots point at it, until then a failure leaves the current
+     * memory untouched. Nothing is read here, pages are loaded from the file
+     * on first use. */
+    std::vector<void *> staged;
+    for(const auto &l : layout) {
+      void *m = mmap(NULL, l.memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+          fd, offset + l.guest_phys_addr);
+      if(m == MAP_FAILED) {
+        err = -errno;
+        break;
+      }
+      staged.push_back(m);
+      err = populate_host_memory(m, l.memory_size, mem_policy);
+      if(err) {
+        break;
+      }
+    }
 
-    *host_entry_p |= PT_BIT_USER;
+    const auto old = chunks.get();
+    unsigned deleted = 0;
+    for(; !err && deleted < old.size(); deleted++) {
+      struct kvm_userspace_memory_region del = *old[deleted];
+      del.memory_size = 0;
+      err = set_slot(del);
+      if(err) {
+        break;
+      }
+    }
 
-    if(opts & PT_OPT_WRITE) {
-      *host_entry_p |= PT_BIT_WRITEABLE;
+    /* same guest physical addresses and memory slots as in the image */
+    std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> restored;
+    for(unsigned i = 0; !err && i < layout.size(); i++) {
+      auto c = std::make_shared<struct kvm_userspace_memory_region>(layout[i]);
+      c->userspace_addr = reinterpret_cast<__u64>(host_arena_p
+          + c->guest_phys_addr);
+      c->flags = (mem_policy & ELKVM_MEM_LOG_DIRTY) ? KVM_MEM_LOG_DIRTY_PAGES : 0;
+      err = set_slot(*c);
+      if(err) {
+        break;
+      }
+      restored.push_back(c);
     }
 
-    if(!(opts & PT_OPT_EXEC)) {
-      *host_entry_p |= PT_BIT_NXE;
+    if(err) {
+      for(const auto &c : restored) {
+        struct kvm_userspace_memory_region del = *c;
+        del.memory_size = 0;
+        int e = set_slot(del);
+        assert(e == 0 && "could not delete memory slot");
+        (void)e;
+      }
+      for(unsigned i = 0; i < deleted; i++) {
+        int e = set_slot(*old[i]);
+        assert(e == 0 && "could not restore memory slot");
+        (void)e;
+      }
+      for(unsigned i = 0; i < staged.size(); i++) {
+        munmap(staged[i], layout[i].memory_size);
+      }
+      return err;
     }
 
-    /* mark the entry as present */
-    *host_entry_p |= PT_BIT_PRESENT;
+    /* the arena stays reserved where the old chunks were */
+    for(const auto &chunk : old) {
+      void *m = mmap(reinterpret_cast<void *>(chunk->userspace_addr),
+          chunk->memory_size, PROT_NONE,
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+      assert(m != MAP_FAILED && "could not release guest memory");
+      (void)m;
+    }
+    for(unsigned i = 0; i < restored.size(); i++) {
+      void *m = mremap(staged[i], restored[i]->memory_size,
+          restored[i]->memory_size, MREMAP_MAYMOVE | MREMAP_FIXED,
+          reinterpret_cast<void *>(restored[i]->userspace_addr));
+      assert(m != MAP_FAILED && "could not move guest memory into the arena");
+      (void)m;
+      clear_host_writes(*restored[i]);
+    }
+    chunks.replace(restored);
+    set_mapped_from(fd, offset, restored);
+    shared_chunks.clear();
+
+    host_sysmem_p = arena_address(sysmem);
+    host_pml4_p = arena_address(pml4);
+    host_next_free_tbl_p = arena_address(next_free_tbl);
+    guest_next_free = next_free;
+    guest_phys_top = top;
+    guest_phys_holes = holes;
+    free_slots = slots;
+    next_slot = slot_top;
+    invalidate_tlb();
+
+    return 0;
   }
 
-  int PagerX86_64::create_mem_chunk(void **host_p, size_t chunk_size) {
-    /* keep sizes page aligned */
-    if(!page_aligned<size_t>(chunk_size)) {
-      return -EIO;
+  void *PagerX86_64::rebase(const PagerX86_64 &orig, const void *host_p) const {
+    if(host_p == nullptr) {
+      return nullptr;
     }
+    return host_arena_p
+      + (static_cast<const char *>(host_p) - orig.host_arena_p);
+  }
 
-    int err = posix_memalign(host_p, HOST_PAGESIZE, chunk_size);
-    if(err) {
-      return err;
+  size_t PagerX86_64::chunk_memory_size() const {
+    size_t size = 0;
+    auto cs = chunks.read();
+    for(const auto &chunk : *cs) {
+      size += chunk->memory_size;
     }
-    auto chunk = alloc_chunk(*host_p, chunk_size, 0);
-    if(chunk == nullptr) {
-      free(*host_p);
-      *host_p = NULL;
-      return -ENOMEM;
+    return size;
+  }
+
+  int PagerX86_64::resident_size(size_t *size) const {
+    *size = 0;
+    auto cs = chunks.read();
+    for(const auto &chunk : *cs) {
+      std::vector<unsigned char> vec(chunk->memory_size / HOST_PAGESIZE);
+      if(mincore(reinterpret_cast<void *>(chunk->userspace_addr),
+            chunk->memory_size, vec.data())) {
+        return -errno;
+      }
+      for(auto v : vec) {
+        if(v & 1) {
+          *size += HOST_PAGESIZE;
+        }
+      }
     }
+    return 0;
+  }
 
-    err = map_chunk_to_kvm(chunk);
-    return err;
+  size_t PagerX86_64::page_table_size() const {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+    return static_cast<char *>(host_next_free_tbl_p)
+      - static_cast<char *>(host_pml4_p);
   }
 
   int PagerX86_64::create_page_tables() {
     assert(host_pml4_p != nullptr);
-    assert(chunks[0]->memory_size >= ELKVM_SYSTEM_MEMSIZE);
-
-    memset(host_pml4_p, 0, ELKVM_SYSTEM_MEMSIZE);
+    assert(chunks.get()[0]->memory_size >= ELKVM_SYSTEM_MEMSIZE);
+
+    /* discarding the pages zeroes them on first use instead of committing
+     * the whole system memory up front, pages the memory policy populated
+     * or locked are cleared in place so they stay faulted in */
+    host_memory_changed();
+    if((mem_policy & (ELKVM_MEM_POPULATE | ELKVM_MEM_LOCK))
+        || madvise(host_pml4_p, ELKVM_SYSTEM_MEMSIZE, MADV_DONTNEED)) {
+      memset(host_pml4_p, 0, ELKVM_SYSTEM_MEMSIZE);
+    }
+    mark_host_written(host_pml4_p, ELKVM_SYSTEM_MEMSIZE);
     host_next_free_tbl_p = static_cast<char *>(host_pml4_p) + HOST_PAGESIZE;
 
     return 0;
@@ -283,6 +1733,7 @@ namespace Elkvm {
     assert(guest_next_tbl != 0x0);
 
     memset(host_next_free_tbl_p, 0, HOST_PAGESIZE);
+    mark_host_written(host_next_free_tbl_p, HOST_PAGESIZE);
     host_next_free_tbl_p =
       static_cast<char *>(host_next_free_tbl_p) + HOST_PAGESIZE;
 
@@ -300,7 +1751,7 @@ namespace Elkvm {
   }
 
   void PagerX86_64::dump_table(ptentry_t *host_p, int level) const {
-    assert(!chunks.empty());
+    assert(host_sysmem_p != nullptr);
 
     if(level < 1) {
       return;
@@ -345,8 +1796,7 @@ namespace Elkvm {
             entry_guest_physical,
             (*entry >> 63));
         present[entries++] = reinterpret_cast<ptentry_t *>(
-          reinterpret_cast<char *>(entry_guest_physical) +
-          chunks[0]->userspace_addr);
+          static_cast<char *>(host_sysmem_p) + entry_guest_physical);
         if(*entry & 0x1) {
           assert(entry_guest_physical != 0);
         }
@@ -365,13 +1815,15 @@ namespace Elkvm {
   }
 
   ptentry_t *PagerX86_64::find_next_table(ptentry_t *tbl_entry_p) const {
-    if(!entry_exists(tbl_entry_p)) {
+    ptentry_t entry = read_entry(tbl_entry_p);
+    if(!(entry & PT_BIT_PRESENT)) {
       return NULL;
     }
 
     /* location of the next table is in bits 12 - 51 of the entry */
-    ptentry_t guest_next_tbl = *tbl_entry_p & 0x000FFFFFFFFFF000;
-    return (ptentry_t *)(chunks[0]->userspace_addr + guest_next_tbl);
+    ptentry_t guest_next_tbl = entry & 0x000FFFFFFFFFF000;
+    return reinterpret_cast<ptentry_t *>(
+        static_cast<char *>(host_sysmem_p) + guest_next_tbl);
   }
 
   ptentry_t *PagerX86_64::find_table_entry(ptentry_t *tbl_base_p,
@@ -383,24 +1835,30 @@ namespace Elkvm {
   }
 
   int PagerX86_64::free_page(guestptr_t guest_virtual) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
     ptentry_t *pt_entry = page_table_walk(guest_virtual);
 
     if(pt_entry == NULL) {
       return -1;
     }
 
-    *pt_entry = 0;
+    __atomic_store_n(pt_entry, 0, __ATOMIC_RELEASE);
+    mark_host_written(pt_entry, sizeof(*pt_entry));
+    invalidate_tlb();
     return 0;
   }
 
   void *PagerX86_64::get_host_p(guestptr_t guest_virtual) const {
-    static TLB tlb;
+    static thread_local TLB tlb;
     if(guest_virtual == 0x0) {
       return nullptr;
     }
 
-    guestptr_t t = tlb.find(guest_virtual);
+    /* read the epoch first, a concurrent unmap then makes our entry stale */
+    const uint64_t epoch = tlb_epoch.load(std::memory_order_acquire);
+    guestptr_t t = tlb.find(guest_virtual, epoch);
     if (t) {
+      mark_pages(host_touched, reinterpret_cast<void *>(t), 1);
       return (void*)t;
     }
 
@@ -409,11 +1867,17 @@ namespace Elkvm {
       return NULL;
     }
 
+    ptentry_t pte = read_entry(entry);
+    if(!(pte & PT_BIT_PRESENT)) {
+      return NULL;
+    }
+
     std::shared_ptr<struct kvm_userspace_memory_region> chunk = nullptr;
     guestptr_t guest_physical =
-      (*entry & 0x000FFFFFFFFFF000) | (guest_virtual & (ELKVM_PAGESIZE-1));
+      (pte & 0x000FFFFFFFFFF000) | (guest_virtual & (ELKVM_PAGESIZE-1));
 
-    for(const auto &c : chunks) {
+    auto cs = chunks.read();
+    for(const auto &c : *cs) {
       if(contains_phys_address(c, guest_physical)) {
         chunk = c;
         break;
@@ -423,9 +1887,11 @@ namespace Elkvm {
       return NULL;
     }
 
-    tlb.set(guest_virtual, ((guest_physical - chunk->guest_phys_addr) + chunk->userspace_addr));
-    return (void *)((guest_physical - chunk->guest_phys_addr)
-        + chunk->userspace_addr);
+    void *host_p = reinterpret_cast<void *>(
+        (guest_physical - chunk->guest_phys_addr) + chunk->userspace_addr);
+    tlb.set(guest_virtual, reinterpret_cast<guestptr_t>(host_p), epoch);
+    mark_pages(host_touched, host_p, 1);
+    return host_p;
   }
 
   guestptr_t PagerX86_64::host_to_guest_physical(void *host_p) const {
@@ -440,17 +1906,23 @@ namespace Elkvm {
 
   int PagerX86_64::map_chunk_to_kvm(
       const std::shared_ptr<struct kvm_userspace_memory_region>& chunk) {
+      std::lock_guard<std::recursive_mutex> lock(writer_lock);
+      if(chunk->memory_size != 0 && (mem_policy & ELKVM_MEM_LOG_DIRTY)) {
+        chunk->flags |= KVM_MEM_LOG_DIRTY_PAGES;
+      }
       if(chunk->memory_size == 0) {
         free_slots.push_back(chunk->slot);
-        auto it = std::find(chunks.begin(), chunks.end(), chunk);
-        if(it != chunks.end()) {
-          chunks.erase(it);
-        }
+        chunks.update([&chunk](
+              std::vector<std::shared_ptr<struct kvm_userspace_memory_region>> &cs) {
+            auto it = std::find(cs.begin(), cs.end(), chunk);
+            if(it != cs.end()) {
+              cs.erase(it);
+            }
+        });
+        invalidate_tlb();
       }
 
-      assert(chunk->slot < KVM_MEMORY_SLOTS);
-      int err = ioctl(_vmfd, KVM_SET_USER_MEMORY_REGION, chunk.get());
-      return err ? -errno : 0;
+      return set_slot(*chunk);
     //  if(err) {
     //    long sz = sysconf(_SC_PAGESIZE);
     //    printf("Could not set memory region\n");
@@ -472,12 +1944,13 @@ namespace Elkvm {
   std::shared_ptr<struct kvm_userspace_memory_region> PagerX86_64::get_chunk(
       std::vector<std::shared_ptr<struct kvm_userspace_memory_region *>>::size_type chunk)
   const {
-    return chunks.at(chunk);
+    return chunks.read()->at(chunk);
   }
 
     std::shared_ptr<struct kvm_userspace_memory_region>
     PagerX86_64::find_chunk_for_host_p(void *host_mem_p) const {
-      for(const auto &chunk : chunks) {
+      auto cs = chunks.read();
+      for(const auto &chunk : *cs) {
         if(contains_address(chunk, host_mem_p)) {
           return chunk;
         }
@@ -489,6 +1962,7 @@ namespace Elkvm {
 
 
   guestptr_t PagerX86_64::map_kernel_page(void *host_mem_p, ptopt_t opts) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
     guestptr_t guest_physical = host_to_guest_physical(host_mem_p);
     guestptr_t guest_virtual = (guest_next_free & ~(ELKVM_PAGESIZE-1))
       | (guest_physical & (ELKVM_PAGESIZE-1));
@@ -521,6 +1995,7 @@ namespace Elkvm {
 
   int PagerX86_64::map_region(void *start_p, guestptr_t start_addr, unsigned pages,
       ptopt_t opts) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
     char *current_p = static_cast<char *>(start_p);
     guestptr_t current_addr = start_addr;
     for(unsigned i = 0; i < pages; i++) {
@@ -536,6 +2011,7 @@ namespace Elkvm {
 
   int PagerX86_64::map_user_page(void *host_mem_p, guestptr_t guest_virtual,
       ptopt_t opts) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
     assert(guest_virtual != 0x0 && "cannot map NULL to somewhere!");
 
     assert((host_mem_p < static_cast<char *>(host_pml4_p)) ||
@@ -558,7 +2034,7 @@ namespace Elkvm {
 
     /* do NOT overwrite existing page table entries! */
     if(entry_exists(pt_entry)) {
-      if((*pt_entry & 0x000FFFFFFFFFF000)
+      if((read_entry(pt_entry) & 0x000FFFFFFFFFF000)
           != (guest_physical & ~(ELKVM_PAGESIZE-1))) {
         DBG() << "page already exists";
         return -1;
@@ -635,6 +2111,7 @@ namespace Elkvm {
   }
 
   int PagerX86_64::unmap_region(guestptr_t start_addr, unsigned pages) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
 
     guestptr_t current_addr = start_addr;
     for(unsigned i = 0; i < pages; i++) {
@@ -657,11 +2134,12 @@ namespace Elkvm {
     }
 
     if(opts & PT_OPT_WRITE) {
-      *entry |= PT_BIT_WRITEABLE;
+      __atomic_or_fetch(entry, PT_BIT_WRITEABLE, __ATOMIC_RELEASE);
     }
     if(opts & PT_OPT_EXEC) {
-      *entry &= ~PT_BIT_NXE;
+      __atomic_and_fetch(entry, ~PT_BIT_NXE, __ATOMIC_RELEASE);
     }
+    mark_host_written(entry, sizeof(*entry));
     return 0;
   }
 
@@ -702,7 +2180,11 @@ namespace Elkvm {
   }
 
   bool entry_exists(ptentry_t *e) {
-    return *e & 0x1;
+    return read_entry(e) & PT_BIT_PRESENT;
+  }
+
+  ptentry_t read_entry(ptentry_t *e) {
+    return __atomic_load_n(e, __ATOMIC_ACQUIRE);
   }
 
   std::ostream &print(std::ostream &os,
@@ -51,6 +51,16 @@ namespace Elkvm {
     return r.contains_address(p);
   }
 
+  std::shared_ptr<Region> cloned_region(const RegionMap &regions,
+      const std::shared_ptr<Region> &orig) {
+    if(orig == nullptr) {
+      return nullptr;
+    }
+    auto it = regions.find(orig.get());
+    assert(it != regions.end() && "region is not part of the cloned VM");
+    return it->second;
+  }
+
   bool operator==(const Region &r1, const Region &r2) {
     return r1.base_address() == r2.base_address()
       && r1.guest_address() == r2.guest_address()
@@ -22,29 +22,219 @@
 //
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cstring>
 #include <memory>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
 
+#include <elkvm/checkpoint.h>
 #include <elkvm/elkvm-log.h>
 #include <elkvm/heap.h>
 #include <elkvm/region.h>
 #include <elkvm/region_manager.h>
 
 namespace Elkvm {
+  /* ids are never reused, so a thread never picks up a dead manager's cache */
+  static std::atomic<uint64_t> next_region_manager_id(1);
+
+  /* managers that are alive, so exiting threads can find their caches */
+  static std::mutex managers_lock;
+  static std::map<uint64_t, RegionManager *> managers;
+
+  struct RegionManager::CacheOwner {
+    std::set<uint64_t> ids;
+
+    CacheOwner() : ids() {}
+    ~CacheOwner() {
+      std::lock_guard<std::mutex> lock(managers_lock);
+      for(const auto id : ids) {
+        auto it = managers.find(id);
+        if(it != managers.end()) {
+          it->second->release_cache(std::this_thread::get_id());
+        }
+      }
+    }
+  };
+
   RegionManager::RegionManager(int vmfd)
 	: allocated_regions(),
 	  freelists(),
-	  pager(vmfd)
+	  writer_lock(),
+	  id(next_region_manager_id++),
+	  cache_lock(),
+	  caches(),
+	  pager(vmfd),
+	  chunk_grow(ELKVM_SYSTEM_MEMGROW_MIN),
+	  clone_err(0)
   {
+    {
+      std::lock_guard<std::mutex> lock(managers_lock);
+      managers[id] = this;
+    }
     auto sysregion = allocate_region(ELKVM_PAGER_MEMSIZE, "ELKVM Pager Memory");
     pager.set_pml4(sysregion);
   }
 
+  RegionManager::RegionManager(int vmfd, const RegionManager &orig, int fd,
+      int map_flags, RegionMap &regions)
+	: allocated_regions(),
+	  freelists(),
+	  writer_lock(),
+	  id(next_region_manager_id++),
+	  cache_lock(),
+	  caches(),
+	  pager(vmfd),
+	  chunk_grow(orig.chunk_grow),
+	  clone_err(0)
+  {
+    {
+      std::lock_guard<std::mutex> lock(managers_lock);
+      managers[id] = this;
+    }
+    clone_err = pager.clone_memory(orig.pager, fd, map_flags);
+
+    /* even if that failed, the VM being cloned looks its regions up here */
+    clone_regions(orig, regions);
+  }
+
+  RegionManager::~RegionManager() {
+    std::lock_guard<std::mutex> lock(managers_lock);
+    managers.erase(id);
+  }
+
+  int RegionManager::reset(const RegionManager &orig, int fd,
+      RegionMap &regions) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    int err = pager.reset_memory(orig.pager, fd);
+    if(err) {
+      return err;
+    }
+
+    drop_free_regions();
+    chunk_grow = orig.chunk_grow;
+
+    clone_regions(orig, regions);
+    return 0;
+  }
+
+  void RegionManager::drop_free_regions() {
+    std::lock_guard<std::mutex> lock(cache_lock);
+    for(auto &cache : caches) {
+      for(auto &list : cache.second->lists) {
+        list.clear();
+      }
+    }
+    for(auto &list : freelists) {
+      list.clear();
+    }
+  }
+
+  void RegionManager::save_state(CheckpointWriter &w) const {
+    pager.save_state(w);
+    w.put<uint64_t>(chunk_grow);
+
+    /* free regions in thread caches are part of allocated_regions */
+    std::vector<std::shared_ptr<Region>> all(*allocated_regions.read());
+    for(const auto &list : freelists) {
+      all.insert(all.end(), list.begin(), list.end());
+    }
+
+    w.put<uint64_t>(all.size());
+    for(const auto &r : all) {
+      w.add_region(r);
+      w.put<uint64_t>(pager.arena_offset(r->base_address()));
+      w.put<uint64_t>(r->size());
+      w.put<uint64_t>(r->guest_address());
+      w.put<uint8_t>(r->is_free());
+      w.put_string(r->getName());
+    }
+  }
+
+  int RegionManager::restore_state(CheckpointReader &r, int fd, off_t offset) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    int err = pager.restore_state(r, fd, offset);
+    if(err) {
+      return err;
+    }
+    chunk_grow = r.get<uint64_t>();
+    drop_free_regions();
+
+    std::vector<std::shared_ptr<Region>> used;
+    for(uint64_t n = r.get<uint64_t>(); r.ok() && n > 0; n--) {
+      const uint64_t off = r.get<uint64_t>();
+      const size_t size = r.get<uint64_t>();
+      const guestptr_t addr = r.get<uint64_t>();
+      const bool free = r.get<uint8_t>();
+      const std::string name = r.get_string();
+      if(off >= pager.guest_phys_size() || size > pager.guest_phys_size() - off) {
+        r.fail();
+        break;
+      }
+
+      auto region = std::make_shared<Region>(pager.arena_address(off), size,
+          name, free);
+      region->set_guest_addr(addr);
+      r.add_region(region);
+      if(free) {
+        freelists[get_freelist_idx(size)].push_back(region);
+      } else {
+        used.push_back(region);
+      }
+    }
+    allocated_regions.replace(used);
+
+    return r.ok() ? 0 : -EINVAL;
+  }
+
+  void RegionManager::clone_regions(const RegionManager &orig,
+      RegionMap &regions) {
+    auto clone = [this, &orig, &regions](const std::shared_ptr<Region> &r)
+      -> std::shared_ptr<Region> {
+      auto it = regions.find(r.get());
+      if(it != regions.end()) {
+        return it->second;
+      }
+      auto c = std::make_shared<Region>(
+          pager.rebase(orig.pager, r->base_address()), r->size(), r->getName(),
+          r->is_free());
+      c->set_guest_addr(r->guest_address());
+      regions[r.get()] = c;
+      return c;
+    };
+
+    /* regions in orig's thread caches are free but in allocated_regions,
+     * the caches of the copy are empty, so they go to the freelists */
+    std::vector<std::shared_ptr<Region>> used;
+    auto orig_regions = orig.allocated_regions.read();
+    for(const auto &r : *orig_regions) {
+      auto c = clone(r);
+      if(r->is_free()) {
+        freelists[get_freelist_idx(c->size())].push_back(c);
+      } else {
+        used.push_back(c);
+      }
+    }
+    allocated_regions.replace(used);
+
+    for(unsigned i = 0; i < n_freelists; i++) {
+      for(const auto &r : orig.freelists[i]) {
+        freelists[i].push_back(clone(r));
+      }
+    }
+  }
+
   void RegionManager::dump_regions() const {
     INFO() << "DUMPING ALL REGIONS:";
     INFO() << "====================";
-    for(const auto &reg : allocated_regions) {
+    auto regions = allocated_regions.read();
+    for(const auto &reg : *regions) {
       print(std::cout, *reg);
     }
 
@@ -53,6 +243,12 @@ namespace Elkvm {
 
   std::shared_ptr<Region> RegionManager::allocate_region(size_t size,
       const std::string &purpose) {
+    const size_t pages = pagesize_align(size) / ELKVM_PAGESIZE;
+    if(0 < pages && pages <= cache_pages) {
+      return allocate_cached(pages, purpose);
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
     auto r = find_free_region(size);
 
     if(r == nullptr) {
@@ -70,12 +266,128 @@ namespace Elkvm {
     }
 
     use_region(r);
+    pager.mark_host_written(r->base_address(), r->size());
 
     assert(size <= r->size());
     return r;
   }
 
+  RegionManager::RegionCache &RegionManager::thread_cache() {
+    static thread_local uint64_t last_id = 0;
+    static thread_local RegionCache *last_cache = nullptr;
+    static thread_local CacheOwner owner;
+    if(last_id == id) {
+      return *last_cache;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_lock);
+    auto &cache = caches[std::this_thread::get_id()];
+    if(cache == nullptr) {
+      cache.reset(new RegionCache());
+      owner.ids.insert(id);
+    }
+    last_id = id;
+    last_cache = cache.get();
+    return *cache;
+  }
+
+  std::shared_ptr<Region> RegionManager::allocate_cached(size_t pages,
+      const std::string &purpose) {
+    auto &list = thread_cache().lists[pages - 1];
+    if(list.empty()) {
+      refill_cache(list, pages, purpose);
+    }
+
+    /* cached regions keep the name of whoever used them before */
+    auto r = list.back();
+    list.pop_back();
+    r->setName(purpose);
+    r->set_used();
+    pager.mark_host_written(r->base_address(), r->size());
+    return r;
+  }
+
+  void RegionManager::refill_cache(std::vector<std::shared_ptr<Region>> &list,
+      size_t pages, const std::string &purpose) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+    const size_t size = pages * ELKVM_PAGESIZE;
+
+    std::vector<std::shared_ptr<Region>> batch;
+    for(unsigned i = 0; i < cache_batch; i++) {
+      auto r = find_free_region(size);
+      if(r == nullptr) {
+        int err = add_chunk(size * cache_batch, purpose);
+        assert(err == 0 && "could not allocate memory for new region");
+
+        r = find_free_region(size);
+        assert(r != nullptr && "should have free region after allocation");
+      }
+
+      if(r->size() > size) {
+        auto new_region = r->slice_begin(size);
+        add_free_region(r);
+        r = new_region;
+      }
+      batch.push_back(r);
+    }
+
+    /* the whole batch becomes visible to lookups with a single update */
+    allocated_regions.update([&batch](std::vector<std::shared_ptr<Region>> &regions)
+        { regions.insert(regions.end(), batch.begin(), batch.end()); });
+    list.insert(list.end(), batch.begin(), batch.end());
+  }
+
+  void RegionManager::drain_cache(std::vector<std::shared_ptr<Region>> &list) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+
+    /* give back the regions that have been in the cache for the longest time */
+    std::vector<std::shared_ptr<Region>> batch(list.begin(),
+        list.begin() + cache_batch);
+    list.erase(list.begin(), list.begin() + cache_batch);
+
+    allocated_regions.update([&batch](std::vector<std::shared_ptr<Region>> &regions) {
+        regions.erase(std::remove_if(regions.begin(), regions.end(),
+            [&batch](const std::shared_ptr<Region> &r)
+            { return std::find(batch.begin(), batch.end(), r) != batch.end(); }),
+          regions.end());
+    });
+
+    for(const auto &r : batch) {
+      freelists[get_freelist_idx(r->size())].push_back(r);
+    }
+  }
+
+  void RegionManager::release_cache(std::thread::id thread) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+    std::unique_ptr<RegionCache> cache;
+    {
+      std::lock_guard<std::mutex> l(cache_lock);
+      auto it = caches.find(thread);
+      if(it == caches.end()) {
+        return;
+      }
+      cache = std::move(it->second);
+      caches.erase(it);
+    }
+
+    std::vector<std::shared_ptr<Region>> batch;
+    for(const auto &list : cache->lists) {
+      batch.insert(batch.end(), list.begin(), list.end());
+    }
+    allocated_regions.update([&batch](std::vector<std::shared_ptr<Region>> &regions) {
+        regions.erase(std::remove_if(regions.begin(), regions.end(),
+            [&batch](const std::shared_ptr<Region> &r)
+            { return std::find(batch.begin(), batch.end(), r) != batch.end(); }),
+          regions.end());
+    });
+
+    for(const auto &r : batch) {
+      freelists[get_freelist_idx(r->size())].push_back(r);
+    }
+  }
+
   std::shared_ptr<Region> RegionManager::find_free_region(size_t size) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
     auto list_idx = get_freelist_idx(size);
 
     while(list_idx < freelists.size()) {
@@ -93,29 +405,41 @@ namespace Elkvm {
   }
 
   std::shared_ptr<Region> RegionManager::find_region(const void *host_p) const {
-    auto r = std::find_if(allocated_regions.begin(), allocated_regions.end(),
+    auto regions = allocated_regions.read();
+    auto r = std::find_if(regions->begin(), regions->end(),
          [host_p](const std::shared_ptr<Region>& a)
-         { return a->contains_address(host_p); });
-    if(r == allocated_regions.end()) {
+         { return !a->is_free() && a->contains_address(host_p); });
+    if(r == regions->end()) {
       return nullptr;
     }
     return *r;
   }
 
   std::shared_ptr<Region> RegionManager::find_region(guestptr_t addr) const {
-    auto r = std::find_if(allocated_regions.begin(), allocated_regions.end(),
+    auto regions = allocated_regions.read();
+    auto r = std::find_if(regions->begin(), regions->end(),
          [addr](const std::shared_ptr<Region>& a)
-         { return a->contains_address(addr); });
-    if(r == allocated_regions.end()) {
+         { return !a->is_free() && a->contains_address(addr); });
+    if(r == regions->end()) {
       return nullptr;
     }
     return *r;
   }
 
+  std::vector<std::shared_ptr<Region>> RegionManager::used_regions() const {
+    std::vector<std::shared_ptr<Region>> used;
+    auto regions = allocated_regions.read();
+    std::copy_if(regions->begin(), regions->end(), std::back_inserter(used),
+        [](const std::shared_ptr<Region>& r) { return !r->is_free(); });
+    return used;
+  }
+
   int RegionManager::add_chunk(const size_t size, const std::string &purpose) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
     void *chunk_p;
-    const size_t grow_size = size > ELKVM_SYSTEM_MEMGROW ?
-      pagesize_align(size) : ELKVM_SYSTEM_MEMGROW;
+    /* small VMs should not pay for a large chunk, big ones should not run
+     * out of memory slots, so chunks start small and double in size */
+    const size_t grow_size = std::max<size_t>(pagesize_align(size), chunk_grow);
 
     int err = pager.create_mem_chunk(&chunk_p, grow_size);
     if(err) {
@@ -124,20 +448,84 @@ namespace Elkvm {
       return err;
     }
 
+    chunk_grow = std::min<size_t>(2 * chunk_grow, ELKVM_SYSTEM_MEMGROW);
+
     auto idx = get_freelist_idx(grow_size);
     freelists[idx].push_back(std::make_shared<Region>(chunk_p, grow_size, purpose));
     return 0;
   }
 
   void RegionManager::add_free_region(std::shared_ptr<Region> r) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
     auto list_idx = get_freelist_idx(r->size());
     freelists[list_idx].push_back(r);
   }
 
+  std::shared_ptr<Region> RegionManager::map_shared(int fd, off_t offset,
+      size_t size, const std::string &purpose) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+    void *host_p;
+    int err = pager.map_shared_memory(fd, offset, size, &host_p);
+    if(err) {
+      errno = -err;
+      return nullptr;
+    }
+
+    auto r = std::make_shared<Region>(host_p, size, purpose);
+    r->set_shared();
+    use_region(r);
+    return r;
+  }
+
+  std::shared_ptr<Region> RegionManager::attach_shared(int shmid, size_t size,
+      bool readonly, const std::string &purpose) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+    void *host_p;
+    int err = pager.attach_shared_memory(shmid, size, readonly, &host_p);
+    if(err) {
+      errno = -err;
+      return nullptr;
+    }
+
+    auto r = std::make_shared<Region>(host_p, size, purpose);
+    r->set_shared();
+    use_region(r);
+    return r;
+  }
+
   void RegionManager::free_region(std::shared_ptr<Region> r) {
-    auto rit = std::find(allocated_regions.begin(), allocated_regions.end(), r);
-    assert(rit != allocated_regions.end());
-    allocated_regions.erase(rit);
+    if(r->is_shared()) {
+      std::lock_guard<std::recursive_mutex> lock(writer_lock);
+      allocated_regions.update([&r](std::vector<std::shared_ptr<Region>> &regions) {
+          auto rit = std::find(regions.begin(), regions.end(), r);
+          assert(rit != regions.end());
+          regions.erase(rit);
+      });
+      r->set_free();
+
+      /* the memory goes away with the region, it never becomes free memory */
+      int err = pager.unmap_shared_memory(r->base_address());
+      assert(err == 0 && "could not unmap shared memory");
+      return;
+    }
+
+    const size_t pages = r->size() / ELKVM_PAGESIZE;
+    if(page_aligned<size_t>(r->size()) && 0 < pages && pages <= cache_pages) {
+      auto &list = thread_cache().lists[pages - 1];
+      r->set_free();
+      list.push_back(r);
+      if(list.size() > cache_high) {
+        drain_cache(list);
+      }
+      return;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+    allocated_regions.update([&r](std::vector<std::shared_ptr<Region>> &regions) {
+        auto rit = std::find(regions.begin(), regions.end(), r);
+        assert(rit != regions.end());
+        regions.erase(rit);
+    });
 
     r->set_free();
     auto list_idx = get_freelist_idx(r->size());
@@ -145,24 +533,19 @@ namespace Elkvm {
   }
 
   void RegionManager::free_region(void *host_p, const size_t sz) {
-    auto rit = std::find_if(allocated_regions.begin(), allocated_regions.end(),
-        [host_p](const std::shared_ptr<Region>& a)
-        { return a->contains_address(host_p); });
-
-    assert(rit != allocated_regions.end());
-    assert((*rit)->contains_address(host_p));
-    assert((*rit)->size() == sz);
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
+    auto r = find_region(host_p);
 
-    auto list_idx = get_freelist_idx(sz);
+    assert(r != nullptr);
+    assert(r->size() == sz);
 
-    (*rit)->set_free();
-    freelists[list_idx].push_back(*rit);
-    allocated_regions.erase(rit);
+    free_region(r);
   }
 
   bool RegionManager::host_address_mapped(const void *const p) const {
-    for(const auto &r : allocated_regions) {
-      if(r->contains_address(p)) {
+    auto regions = allocated_regions.read();
+    for(const auto &r : *regions) {
+      if(!r->is_free() && r->contains_address(p)) {
         return true;
       }
     }
@@ -175,9 +558,11 @@ namespace Elkvm {
   }
 
   void RegionManager::use_region(std::shared_ptr<Region> r) {
+    std::lock_guard<std::recursive_mutex> lock(writer_lock);
     assert(r->is_free());
     r->set_used();
-    allocated_regions.push_back(r);
+    allocated_regions.update([&r](std::vector<std::shared_ptr<Region>> &regions)
+        { regions.push_back(r); });
   }
 
   std::array<std::vector<Region>, RegionManager::n_freelists>::size_type
@@ -26,6 +26,7 @@
 #include <memory>
 
 #include <assert.h>
+#include <pthread.h>
 #include <signal.h>
 
 #include <elkvm/elkvm.h>
@@ -35,6 +36,8 @@
 
 static int pending_signals[32];
 static int num_pending_signals = 0;
+/* the signals elkvm_signal_handler is installed for */
+static sigset_t handled_signals;
 
 void elkvm_signal_handler(int signum) {
 
@@ -81,11 +84,35 @@ int Elkvm::VM::signal_register(int signum, struct sigaction *act,
               << " Msg: " << strerror(errno);
     }
     assert(err == 0);
+    sigaddset(&handled_signals, signum);
   }
 
   return 0;
 }
 
+bool Elkvm::VM::signal_pending() const {
+  return num_pending_signals > 0;
+}
+
+int Elkvm::VM::signal_block(sigset_t *oldset) const {
+  return pthread_sigmask(SIG_BLOCK, &handled_signals, oldset);
+}
+
+void Elkvm::VM::signal_wait_mask(const sigset_t *oldset,
+    const sigset_t *guest, sigset_t *mask) const {
+  *mask = *oldset;
+  for(int signum = 1; signum < _NSIG; signum++) {
+    if(sigismember(&handled_signals, signum) != 1) {
+      continue;
+    }
+    if(sigismember(guest, signum) == 1) {
+      sigaddset(mask, signum);
+    } else {
+      sigdelset(mask, signum);
+    }
+  }
+}
+
 int Elkvm::VM::signal_deliver() {
   if(num_pending_signals <= 0) {
     return 0;
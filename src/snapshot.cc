@@ -0,0 +1,166 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cassert>
+#include <cerrno>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/kvm.h>
+#include <elkvm/pager.h>
+#include <elkvm/region.h>
+#include <elkvm/region_manager.h>
+#include <elkvm/snapshot.h>
+#include <elkvm/vcpu.h>
+
+namespace Elkvm {
+
+  std::shared_ptr<Snapshot> VM::snapshot() {
+    auto &pager = _rm->get_pager();
+
+    int kvmfd = open(KVM_DEV_PATH, O_RDWR | O_CLOEXEC);
+    if(kvmfd < 0) {
+      return nullptr;
+    }
+
+    int memfd = memfd_create("elkvm snapshot", MFD_CLOEXEC);
+    if(memfd < 0) {
+      int err = errno;
+      close(kvmfd);
+      errno = err;
+      return nullptr;
+    }
+
+    int err = 0;
+    if(ftruncate(memfd, pager.guest_phys_size())) {
+      err = -errno;
+    }
+    if(err == 0) {
+      err = pager.write_memory(memfd);
+    }
+
+    int vmfd = -1;
+    if(err == 0) {
+      vmfd = ioctl(kvmfd, KVM_CREATE_VM, 0);
+      if(vmfd < 0) {
+        err = -errno;
+      }
+    }
+
+    if(err) {
+      close(memfd);
+      close(kvmfd);
+      errno = -err;
+      return nullptr;
+    }
+
+    /* the image maps the file shared, it is never written to */
+    RegionMap regions;
+    auto image = std::make_shared<VM>(vmfd, *this, memfd, MAP_SHARED, regions);
+    err = image->clone_error();
+    if(err) {
+      image = nullptr;
+      close(memfd);
+      close(kvmfd);
+      errno = -err;
+      return nullptr;
+    }
+    return std::make_shared<Snapshot>(kvmfd, memfd, image);
+  }
+
+  int VM::reset(const Snapshot &snap) {
+    const VM &orig = *snap.image;
+    assert(cpus.size() == orig.cpus.size() && "VM is no clone of the snapshot");
+
+    RegionMap regions;
+    int err = _rm->reset(*orig._rm, snap.mem_fd, regions);
+    if(err) {
+      return err;
+    }
+
+    _gdt = cloned_region(regions, orig._gdt);
+    hm.reset(orig.hm, regions);
+    _rlimit = orig._rlimit;
+    sigs = orig.sigs;
+    sighandler_cleanup = orig.sighandler_cleanup;
+    sighandler_cleanup.region =
+      cloned_region(regions, orig.sighandler_cleanup.region);
+    _elf_regions.clear();
+    for(const auto &r : orig._elf_regions) {
+      _elf_regions.push_back(cloned_region(regions, r));
+    }
+    _env_region = cloned_region(regions, orig._env_region);
+
+    for(unsigned i = 0; i < cpus.size(); i++) {
+      err = cpus[i]->reset(*orig.cpus[i], regions);
+      if(err) {
+        return err;
+      }
+    }
+    _stop = false;
+    return 0;
+  }
+
+  Snapshot::Snapshot(int kvmfd, int memfd, std::shared_ptr<VM> vm)
+    : kvm_fd(kvmfd),
+      mem_fd(memfd),
+      image(vm)
+  {}
+
+  Snapshot::~Snapshot() {
+    image = nullptr;
+    close(mem_fd);
+    close(kvm_fd);
+  }
+
+  std::shared_ptr<VM> Snapshot::clone() const {
+    int vmfd = ioctl(kvm_fd, KVM_CREATE_VM, 0);
+    if(vmfd < 0) {
+      return nullptr;
+    }
+
+    RegionMap regions;
+    auto vm = std::make_shared<VM>(vmfd, *image, mem_fd, MAP_PRIVATE, regions);
+    int err = vm->clone_error();
+    if(err) {
+      errno = -err;
+      return nullptr;
+    }
+
+    /* populating or locking breaks up the sharing, only do it if asked to */
+    auto &pager = vm->get_region_manager()->get_pager();
+    err = pager.apply_memory_policy(pager.memory_policy());
+    if(err) {
+      errno = -err;
+      return nullptr;
+    }
+    return vm;
+  }
+
+//namespace Elkvm
+}
@@ -24,6 +24,7 @@
 #include <assert.h>
 #include <errno.h>
 
+#include <elkvm/checkpoint.h>
 #include <elkvm/debug.h>
 #include <elkvm/elkvm.h>
 #include <elkvm/elkvm-internal.h>
@@ -59,6 +60,60 @@ namespace Elkvm {
     kernel_stack->set_guest_addr(kstack_addr);
   }
 
+  Stack::Stack(std::shared_ptr<RegionManager> rm, const Stack &orig,
+      const RegionMap &regions)
+    : stack_regions(),
+      _rm(rm),
+      kernel_stack(cloned_region(regions, orig.kernel_stack)),
+      base(orig.base)
+  {
+    reset(orig, regions);
+  }
+
+  void Stack::reset(const Stack &orig, const RegionMap &regions) {
+    stack_regions.clear();
+    for(const auto &r : orig.stack_regions) {
+      stack_regions.push_back(cloned_region(regions, r));
+    }
+    kernel_stack = cloned_region(regions, orig.kernel_stack);
+    base = orig.base;
+  }
+
+  void Stack::save_state(CheckpointWriter &w) const {
+    w.put<uint64_t>(stack_regions.size());
+    for(const auto &r : stack_regions) {
+      w.put_region(r);
+    }
+    w.put_region(kernel_stack);
+    w.put<guestptr_t>(base);
+  }
+
+  int Stack::restore_state(CheckpointReader &r) {
+    stack_regions.clear();
+    for(uint64_t n = r.get<uint64_t>(); r.ok() && n > 0; n--) {
+      stack_regions.push_back(r.get_region());
+    }
+    kernel_stack = r.get_region();
+    base = r.get<guestptr_t>();
+    return r.ok() ? 0 : -EINVAL;
+  }
+
+  int Stack::reset_user() {
+    auto &pager = _rm->get_pager();
+    for(const auto &r : stack_regions) {
+      int err = pager.unmap_region(r->guest_address(),
+          r->size() / ELKVM_PAGESIZE);
+      if(err) {
+        return err;
+      }
+      _rm->free_region(r);
+    }
+    stack_regions.clear();
+
+    base = LINUX_64_STACK_BASE;
+    return expand();
+  }
+
   int Stack::pushq(guestptr_t rsp, uint64_t val) {
     uint64_t *host_p = reinterpret_cast<uint64_t *>(
         _rm->get_pager().get_host_p(rsp));
@@ -103,6 +158,14 @@ namespace Elkvm {
     return 0;
   }
 
+  size_t Stack::user_size() const {
+    size_t size = 0;
+    for(const auto &r : stack_regions) {
+      size += r->size();
+    }
+    return size;
+  }
+
   bool Stack::is_stack_expansion(guestptr_t pfla) {
     guestptr_t stack_top = page_begin(stack_regions.back()->guest_address());
     if(pfla > stack_top) {
@@ -24,26 +24,10 @@
 #include <elkvm/elkvm.h>
 #include <elkvm/syscall.h>
 
-long elkvm_do_poll(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
 long elkvm_do_sigreturn(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
 
-long elkvm_do_pread64(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_pwrite64(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_select(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
 long elkvm_do_sched_yield(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
@@ -60,18 +44,6 @@ long elkvm_do_madvise(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
 
-long elkvm_do_shmget(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_shmat(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_shmctl(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
 long elkvm_do_dup2(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
@@ -92,30 +64,10 @@ long elkvm_do_setitimer(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
 
-long elkvm_do_clone(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_fork(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_vfork(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_execve(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
 long elkvm_do_exit(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
 
-long elkvm_do_wait4(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
 long elkvm_do_kill(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
@@ -132,10 +84,6 @@ long elkvm_do_semctl(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
 
-long elkvm_do_shmdt(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
 long elkvm_do_msgget(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
@@ -156,14 +104,6 @@ long elkvm_do_flock(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
 
-long elkvm_do_fsync(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_fdatasync(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
 long elkvm_do_rename(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
@@ -380,22 +320,6 @@ long elkvm_do_sched_rr_get_interval(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
 
-long elkvm_do_mlock(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_munlock(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_mlockall(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_munlockall(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
 long elkvm_do_vhangup(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
@@ -588,26 +512,6 @@ long elkvm_do_set_thread_area(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
 
-long elkvm_do_io_setup(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_io_destroy(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_getevents(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_submit(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_cancel(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
 long elkvm_do_get_thread_area(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
@@ -628,10 +532,6 @@ long elkvm_do_remap_file_pages(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
 
-long elkvm_do_getdents64(Elkvm::VM * vmi __attribute__((unused))) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
 long elkvm_do_restart_syscall(Elkvm::VM * vmi __attribute__((unused))) {
   UNIMPLEMENTED_SYSCALL;
 }
@@ -776,10 +676,6 @@ long elkvm_do_futimesat(Elkvm::VM *) {
   UNIMPLEMENTED_SYSCALL;
 }
 
-long elkvm_do_newfstatat(Elkvm::VM *) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
 long elkvm_do_unlinkat(Elkvm::VM *) {
   UNIMPLEMENTED_SYSCALL;
 }
@@ -808,14 +704,6 @@ long elkvm_do_faccessat(Elkvm::VM *) {
   UNIMPLEMENTED_SYSCALL;
 }
 
-long elkvm_do_pselect6(Elkvm::VM *) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
-long elkvm_do_ppoll(Elkvm::VM *) {
-  UNIMPLEMENTED_SYSCALL;
-}
-
 long elkvm_do_unshare(Elkvm::VM *) {
   UNIMPLEMENTED_SYSCALL;
 }
@@ -39,7 +39,10 @@
 #include <elkvm/elfloader.h>
 #include <elkvm/heap.h>
 #include <elkvm/interrupt.h>
+#include <elkvm/iov.h>
 #include <elkvm/mapping.h>
+#include <elkvm/metacache.h>
+#include <elkvm/overlay.h>
 #include <elkvm/syscall.h>
 #include <elkvm/vcpu.h>
 #include <elkvm/region.h>
@@ -358,6 +361,124 @@ __attribute__((used))
   [__NR_unshare]         = { elkvm_do_unshare, "UNSHARE" },
   [__NR_set_robust_list] = { elkvm_do_set_robust_list, "SET ROBUST LIST" },
   [__NR_get_robust_list] = { elkvm_do_get_robust_list, "GET ROBUST LIST" },
+  [__NR_splice]          = { elkvm_do_splice, "SPLICE" },
+  [__NR_tee]             = { elkvm_do_tee, "TEE" },
+  [__NR_sync_file_range] = { nullptr, "SYNC FILE RANGE" },
+  [__NR_vmsplice]        = { elkvm_do_vmsplice, "VMSPLICE" },
+  [__NR_move_pages]      = { nullptr, "MOVE PAGES" },
+  [__NR_utimensat]       = { nullptr, "UTIMENSAT" },
+  [__NR_epoll_pwait]     = { elkvm_do_epoll_pwait, "EPOLL PWAIT" },
+  [__NR_signalfd]        = { elkvm_do_signalfd, "SIGNALFD" },
+  [__NR_timerfd_create]  = { elkvm_do_timerfd_create, "TIMERFD CREATE" },
+  [__NR_eventfd]         = { elkvm_do_eventfd, "EVENTFD" },
+  [__NR_fallocate]       = { nullptr, "FALLOCATE" },
+  [__NR_timerfd_settime] = { elkvm_do_timerfd_settime, "TIMERFD SETTIME" },
+  [__NR_timerfd_gettime] = { elkvm_do_timerfd_gettime, "TIMERFD GETTIME" },
+  [__NR_accept4]         = { elkvm_do_accept4, "ACCEPT4" },
+  [__NR_signalfd4]       = { elkvm_do_signalfd4, "SIGNALFD4" },
+  [__NR_eventfd2]        = { elkvm_do_eventfd2, "EVENTFD2" },
+  [__NR_epoll_create1]   = { elkvm_do_epoll_create1, "EPOLL CREATE1" },
+  [__NR_dup3]            = { elkvm_do_dup3, "DUP3" },
+  [__NR_pipe2]           = { elkvm_do_pipe2, "PIPE2" },
+  [__NR_inotify_init1]   = { nullptr, "INOTIFY INIT1" },
+  [__NR_preadv]          = { elkvm_do_preadv, "PREADV" },
+  [__NR_pwritev]         = { elkvm_do_pwritev, "PWRITEV" },
+  [__NR_rt_tgsigqueueinfo] = { nullptr, "RT TGSIGQUEUEINFO" },
+  [__NR_perf_event_open] = { nullptr, "PERF EVENT OPEN" },
+  [__NR_recvmmsg]        = { elkvm_do_recvmmsg, "RECVMMSG" },
+  [__NR_fanotify_init]   = { nullptr, "FANOTIFY INIT" },
+  [__NR_fanotify_mark]   = { nullptr, "FANOTIFY MARK" },
+  [__NR_prlimit64]       = { elkvm_do_prlimit64, "PRLIMIT64" },
+  [__NR_name_to_handle_at] = { nullptr, "NAME TO HANDLE AT" },
+  [__NR_open_by_handle_at] = { nullptr, "OPEN BY HANDLE AT" },
+  [__NR_clock_adjtime]   = { nullptr, "CLOCK ADJTIME" },
+  [__NR_syncfs]          = { nullptr, "SYNCFS" },
+  [__NR_sendmmsg]        = { elkvm_do_sendmmsg, "SENDMMSG" },
+  [__NR_setns]           = { nullptr, "SETNS" },
+  [__NR_getcpu]          = { nullptr, "GETCPU" },
+  [__NR_process_vm_readv] = { nullptr, "PROCESS VM READV" },
+  [__NR_process_vm_writev] = { nullptr, "PROCESS VM WRITEV" },
+  [__NR_kcmp]            = { nullptr, "KCMP" },
+  [__NR_finit_module]    = { nullptr, "FINIT MODULE" },
+  [__NR_sched_setattr]   = { nullptr, "SCHED SETATTR" },
+  [__NR_sched_getattr]   = { nullptr, "SCHED GETATTR" },
+  [__NR_renameat2]       = { nullptr, "RENAMEAT2" },
+  [__NR_seccomp]         = { nullptr, "SECCOMP" },
+  [__NR_getrandom]       = { elkvm_do_getrandom, "GETRANDOM" },
+  [__NR_memfd_create]    = { nullptr, "MEMFD CREATE" },
+  [__NR_kexec_file_load] = { nullptr, "KEXEC FILE LOAD" },
+  [__NR_bpf]             = { nullptr, "BPF" },
+  [__NR_execveat]        = { nullptr, "EXECVEAT" },
+  [__NR_userfaultfd]     = { nullptr, "USERFAULTFD" },
+  [__NR_membarrier]      = { nullptr, "MEMBARRIER" },
+  [__NR_mlock2]          = { nullptr, "MLOCK2" },
+  [__NR_copy_file_range] = { elkvm_do_copy_file_range, "COPY FILE RANGE" },
+  [__NR_preadv2]         = { elkvm_do_preadv2, "PREADV2" },
+  [__NR_pwritev2]        = { elkvm_do_pwritev2, "PWRITEV2" },
+  [__NR_pkey_mprotect]   = { nullptr, "PKEY MPROTECT" },
+  [__NR_pkey_alloc]      = { nullptr, "PKEY ALLOC" },
+  [__NR_pkey_free]       = { nullptr, "PKEY FREE" },
+  [__NR_statx]           = { elkvm_do_statx, "STATX" },
+  [__NR_io_pgetevents]   = { nullptr, "IO PGETEVENTS" },
+  [__NR_rseq]            = { elkvm_do_rseq, "RSEQ" },
+  /* 335 to 423 are not used on x86_64 */
+  [335] = { nullptr, nullptr }, [336] = { nullptr, nullptr },
+  [337] = { nullptr, nullptr }, [338] = { nullptr, nullptr },
+  [339] = { nullptr, nullptr }, [340] = { nullptr, nullptr },
+  [341] = { nullptr, nullptr }, [342] = { nullptr, nullptr },
+  [343] = { nullptr, nullptr }, [344] = { nullptr, nullptr },
+  [345] = { nullptr, nullptr }, [346] = { nullptr, nullptr },
+  [347] = { nullptr, nullptr }, [348] = { nullptr, nullptr },
+  [349] = { nullptr, nullptr }, [350] = { nullptr, nullptr },
+  [351] = { nullptr, nullptr }, [352] = { nullptr, nullptr },
+  [353] = { nullptr, nullptr }, [354] = { nullptr, nullptr },
+  [355] = { nullptr, nullptr }, [356] = { nullptr, nullptr },
+  [357] = { nullptr, nullptr }, [358] = { nullptr, nullptr },
+  [359] = { nullptr, nullptr }, [360] = { nullptr, nullptr },
+  [361] = { nullptr, nullptr }, [362] = { nullptr, nullptr },
+  [363] = { nullptr, nullptr }, [364] = { nullptr, nullptr },
+  [365] = { nullptr, nullptr }, [366] = { nullptr, nullptr },
+  [367] = { nullptr, nullptr }, [368] = { nullptr, nullptr },
+  [369] = { nullptr, nullptr }, [370] = { nullptr, nullptr },
+  [371] = { nullptr, nullptr }, [372] = { nullptr, nullptr },
+  [373] = { nullptr, nullptr }, [374] = { nullptr, nullptr },
+  [375] = { nullptr, nullptr }, [376] = { nullptr, nullptr },
+  [377] = { nullptr, nullptr }, [378] = { nullptr, nullptr },
+  [379] = { nullptr, nullptr }, [380] = { nullptr, nullptr },
+  [381] = { nullptr, nullptr }, [382] = { nullptr, nullptr },
+  [383] = { nullptr, nullptr }, [384] = { nullptr, nullptr },
+  [385] = { nullptr, nullptr }, [386] = { nullptr, nullptr },
+  [387] = { nullptr, nullptr }, [388] = { nullptr, nullptr },
+  [389] = { nullptr, nullptr }, [390] = { nullptr, nullptr },
+  [391] = { nullptr, nullptr }, [392] = { nullptr, nullptr },
+  [393] = { nullptr, nullptr }, [394] = { nullptr, nullptr },
+  [395] = { nullptr, nullptr }, [396] = { nullptr, nullptr },
+  [397] = { nullptr, nullptr }, [398] = { nullptr, nullptr },
+  [399] = { nullptr, nullptr }, [400] = { nullptr, nullptr },
+  [401] = { nullptr, nullptr }, [402] = { nullptr, nullptr },
+  [403] = { nullptr, nullptr }, [404] = { nullptr, nullptr },
+  [405] = { nullptr, nullptr }, [406] = { nullptr, nullptr },
+  [407] = { nullptr, nullptr }, [408] = { nullptr, nullptr },
+  [409] = { nullptr, nullptr }, [410] = { nullptr, nullptr },
+  [411] = { nullptr, nullptr }, [412] = { nullptr, nullptr },
+  [413] = { nullptr, nullptr }, [414] = { nullptr, nullptr },
+  [415] = { nullptr, nullptr }, [416] = { nullptr, nullptr },
+  [417] = { nullptr, nullptr }, [418] = { nullptr, nullptr },
+  [419] = { nullptr, nullptr }, [420] = { nullptr, nullptr },
+  [421] = { nullptr, nullptr }, [422] = { nullptr, nullptr },
+  [423] = { nullptr, nullptr },
+  [__NR_pidfd_send_signal] = { nullptr, "PIDFD SEND SIGNAL" },
+  [__NR_io_uring_setup]  = { nullptr, "IO URING SETUP" },
+  [__NR_io_uring_enter]  = { nullptr, "IO URING ENTER" },
+  [__NR_io_uring_register] = { nullptr, "IO URING REGISTER" },
+  [__NR_open_tree]       = { nullptr, "OPEN TREE" },
+  [__NR_move_mount]      = { nullptr, "MOVE MOUNT" },
+  [__NR_fsopen]          = { nullptr, "FSOPEN" },
+  [__NR_fsconfig]        = { nullptr, "FSCONFIG" },
+  [__NR_fsmount]         = { nullptr, "FSMOUNT" },
+  [__NR_fspick]          = { nullptr, "FSPICK" },
+  [__NR_pidfd_open]      = { nullptr, "PIDFD OPEN" },
+  [__NR_clone3]          = { elkvm_do_clone3, "CLONE3" },
 
 };
 
@@ -411,16 +532,17 @@ int Elkvm::VM::handle_hypercall(const std::shared_ptr<Elkvm::VCPU>& vcpu) {
 int Elkvm::VM::handle_syscall(const std::shared_ptr<Elkvm::VCPU>& vcpu)
 {
   CURRENT_ABI::paramtype syscall_num = CURRENT_ABI::get_parameter(vcpu, 0);
-  if(debug_mode()) {
-    DBG() << "SYSCALL " << std::dec << syscall_num << " detected"
-      << " (" << elkvm_syscalls[syscall_num].name << ")";
-  }
 
   long result;
-  if(syscall_num > NUM_SYSCALLS) {
+  if(syscall_num >= NUM_SYSCALLS
+      || elkvm_syscalls[syscall_num].func == nullptr) {
     ERROR() << "\tINVALID syscall_num: " << syscall_num << "\n";
     result = -ENOSYS;
   } else {
+    if(debug_mode()) {
+      DBG() << "SYSCALL " << std::dec << syscall_num << " detected"
+        << " (" << elkvm_syscalls[syscall_num].name << ")";
+    }
     result = elkvm_syscalls[syscall_num].func(this);
     if(syscall_num == __NR_exit_group) {
       return ELKVM_HYPERCALL_EXIT;
@@ -449,6 +571,12 @@ void dbg_log_read(const Elkvm::VM &vm, const int fd, const guestptr_t buf_p,
   //namespace Elkvm
 }
 
+/* the path to pass through after the image overlay did not answer a call */
+static const char *passed_path(const char *path,
+    const std::string &host_path) {
+  return host_path.empty() ? path : host_path.c_str();
+}
+
 long elkvm_do_read(Elkvm::VM * vmi) {
   if(vmi->get_handlers()->read == NULL) {
     ERROR() << "READ handler not found" << LOG_RESET << "\n";
@@ -457,59 +585,42 @@ long elkvm_do_read(Elkvm::VM * vmi) {
 
   CURRENT_ABI::paramtype fd;
   CURRENT_ABI::paramtype buf_p = 0x0;
-  char *buf;
   CURRENT_ABI::paramtype count;
 
   vmi->unpack_syscall(&fd, &buf_p, &count);
 
-  assert(buf_p != 0x0);
-  buf = reinterpret_cast<char *>(vmi->get_region_manager()->get_pager().get_host_p(buf_p));
-
-  uint64_t bend_p = buf_p + count - 1;
-  void *bend = vmi->get_region_manager()->get_pager().get_host_p(bend_p);
-  long result = 0;
-
-  if(!vmi->get_region_manager()->same_region(buf, bend)) {
-    assert(vmi->get_region_manager()->host_address_mapped(bend));
-    char *host_begin_mark = NULL;
-    char *host_end_mark = buf;
-    uint64_t mark_p = buf_p;
-    ssize_t current_count = count;
-    do {
-      host_begin_mark = reinterpret_cast<char *>(vmi->get_region_manager()->get_pager().get_host_p(mark_p));
-      std::shared_ptr<Elkvm::Region> region = vmi->get_region_manager()->find_region(host_begin_mark);
-      if(mark_p != buf_p) {
-        assert(host_begin_mark == region->base_address());
-      }
-
-      host_end_mark = reinterpret_cast<char *>(region->last_valid_address());
-      assert(host_end_mark > host_begin_mark);
-
-      ssize_t newcount = host_end_mark - host_begin_mark;
-      if(newcount > current_count) {
-        newcount = current_count;
-      }
-
-      long in_result = vmi->get_handlers()->read((int)fd, host_begin_mark, newcount);
-      if(in_result < 0) {
-        return errno;
-      }
-      if(in_result < newcount) {
-        return result + in_result;
-      }
-      Elkvm::dbg_log_read(*vmi, fd, buf_p, buf, newcount, count, result);
+  std::vector<struct iovec> iov;
+  ssize_t len = Elkvm::guest_to_host_iov(vmi->get_region_manager()->get_pager(),
+      buf_p, count, iov);
+  if(len < 0) {
+    return len;
+  }
+  void *buf = iov.empty() ? nullptr : iov[0].iov_base;
 
-      mark_p += in_result;
-      current_count -= in_result;
-      result += in_result;
-    } while(!vmi->get_region_manager()->same_region(host_begin_mark, bend));
-    assert(current_count == 0);
+  long result;
+  auto &overlay = vmi->image_overlay();
+  if(overlay != nullptr
+      && overlay->readv(fd, iov.data(), iov.size(), -1, &result)) {
+    Elkvm::dbg_log_read(*vmi, fd, buf_p, buf, len, count, result);
+    return result;
+  }
 
+  /* buffers which are split up in host memory are read with a single readv */
+  if(iov.size() <= 1) {
+    result = vmi->get_handlers()->read(static_cast<int>(fd), buf, len);
   } else {
-    result = vmi->get_handlers()->read((int)fd, buf, (size_t)count);
+    if(vmi->get_handlers()->readv == NULL) {
+      ERROR() << "READV handler not found" << LOG_RESET << "\n";
+      return -ENOSYS;
+    }
+    result = vmi->get_handlers()->readv(static_cast<int>(fd), iov.data(),
+        iov.size());
   }
 
-  Elkvm::dbg_log_read(*vmi, fd, buf_p, buf, count, count, result);
+  Elkvm::dbg_log_read(*vmi, fd, buf_p, buf, len, count, result);
+  if(result < 0) {
+    return -errno;
+  }
 
   return result;
 }
@@ -522,55 +633,44 @@ long elkvm_do_write(Elkvm::VM * vmi) {
 
   CURRENT_ABI::paramtype fd = 0x0;
   guestptr_t buf_p = 0x0;
-  void *buf;
   CURRENT_ABI::paramtype count = 0x0;
 
   vmi->unpack_syscall(&fd, &buf_p, &count);
 
-  assert(buf_p != 0x0);
-  buf = vmi->get_region_manager()->get_pager().get_host_p(buf_p);
-
-  std::shared_ptr<Elkvm::Region> r = vmi->get_region_manager()->find_region(buf);
-  assert(r != nullptr);
+  std::vector<struct iovec> iov;
+  ssize_t len = Elkvm::guest_to_host_iov(vmi->get_region_manager()->get_pager(),
+      buf_p, count, iov);
+  if(len < 0) {
+    return len;
+  }
+  void *buf = iov.empty() ? nullptr : iov[0].iov_base;
 
-  char *current_buf = reinterpret_cast<char *>(buf);
-  size_t remaining_count = count;
-  ssize_t total = 0;
-  while(!r->contains_address(current_buf + remaining_count - 1)) {
-    long result = vmi->get_handlers()->write(static_cast<int>(fd),
-        current_buf, r->space_after_address(current_buf));
-    if(result < 0) {
-      return -errno;
-    }
-    total += result;
-
-    if(vmi->debug_mode()) {
-      DBG() << "SPLIT WRITE to fd: " << fd << " with size " << count
-            << " buf " << (void*)buf_p << "(" << (void*)buf << ")" << LOG_RESET;
-      DBG() << "current buf: " << (void*)current_buf
-            << " remaining bytes: " << remaining_count << LOG_RESET;
-      DBG() << "RESULT " <<  result;
+  /* buffers which are split up in host memory are written with a single
+   * writev */
+  long result;
+  if(iov.size() <= 1) {
+    result = vmi->get_handlers()->write(static_cast<int>(fd), buf, len);
+  } else {
+    if(vmi->get_handlers()->writev == NULL) {
+      ERROR() << "WRITEV handler not found" << LOG_RESET << "\n";
+      return -ENOSYS;
     }
-    current_buf += result;
-    remaining_count -= result;
-    r = vmi->get_region_manager()->find_region(current_buf);
+    result = vmi->get_handlers()->writev(static_cast<int>(fd), iov.data(),
+        iov.size());
   }
-  assert(r->contains_address(reinterpret_cast<char *>(buf) + count - 1));
 
-  long result = vmi->get_handlers()->write(static_cast<int>(fd),
-      current_buf, remaining_count);
+  if(vmi->debug_mode()) {
+    DBG() << "WRITE to fd: " << fd << " with size " << LOG_DEC_HEX(len)
+          << " of " << LOG_DEC_HEX(count)
+          << " buf @ " << LOG_GUEST_HOST(buf_p, buf)
+          << " in " << iov.size() << " host buffer(s)";
+    Elkvm::dbg_log_result<int>(result);
+  }
   if(result < 0) {
     return -errno;
   }
-  total += result;
-
-  if(vmi->debug_mode()) {
-    DBG() << "SPLIT WRITE to fd: " << fd << " with size " << count
-          << " buf " << (void*)buf_p << "(" << (void*)buf << ")" << LOG_RESET;
-    DBG() << "RESULT " <<  result;
-  }
 
-  return total;
+  return result;
 }
 
 long elkvm_do_close(Elkvm::VM * vmi) {
@@ -583,11 +683,21 @@ long elkvm_do_close(Elkvm::VM * vmi) {
   vmi->unpack_syscall(&fd);
 
   long result = vmi->get_handlers()->close((int)fd);
+  const int saved_errno = errno;
 
   if(vmi->debug_mode()) {
     DBG() << "CLOSE file with fd: " << fd;
     Elkvm::dbg_log_result<int>(result);
   }
+  if(vmi->metadata_cache() != nullptr) {
+    vmi->metadata_cache()->closed(fd);
+  }
+  if(vmi->image_overlay() != nullptr) {
+    vmi->image_overlay()->close(fd);
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
 
   return result;
 }
@@ -600,7 +710,7 @@ long elkvm_do_stat(Elkvm::VM * vmi) {
 
   CURRENT_ABI::paramtype path_p = 0;
   CURRENT_ABI::paramtype buf_p = 0;
-  char *path = NULL;
+  const char *path = NULL;
   struct stat *buf;
   vmi->unpack_syscall(&path_p, &buf_p);
 
@@ -609,7 +719,24 @@ long elkvm_do_stat(Elkvm::VM * vmi) {
   assert(buf_p != 0x0);
   buf  = reinterpret_cast<struct stat *>(vmi->get_region_manager()->get_pager().get_host_p(buf_p));
 
-  long result = vmi->get_handlers()->stat(path, buf);
+  auto &overlay = vmi->image_overlay();
+  auto &cache = vmi->metadata_cache();
+  std::string host_path;
+  long result;
+  if(overlay == nullptr
+      || !overlay->stat(AT_FDCWD, path, 0, buf, &result, &host_path)) {
+    path = passed_path(path, host_path);
+    if(cache == nullptr || !cache->lookup(Elkvm::MD_STAT, path, 0, &result,
+          buf, sizeof(*buf))) {
+      result = vmi->get_handlers()->stat(path, buf);
+      if(result < 0) {
+        result = -errno;
+      }
+      if(cache != nullptr) {
+        cache->insert(Elkvm::MD_STAT, path, 0, result, buf, sizeof(*buf));
+      }
+    }
+  }
   if(vmi->debug_mode()) {
     DBG() << "STAT file " << path << " with buf at: " << (void*)buf_p << "(" << (void*)buf << ")";
     Elkvm::dbg_log_result<int>(result);
@@ -635,7 +762,18 @@ long elkvm_do_fstat(Elkvm::VM * vmi) {
   if(vmi->debug_mode()) {
     DBG() << "FSTAT file with fd " << fd << " buf at " << LOG_GUEST_HOST(buf_p, buf);
   }
-  long result = vmi->get_handlers()->fstat(fd, buf);
+  auto &overlay = vmi->image_overlay();
+  auto &cache = vmi->metadata_cache();
+  long result = 0;
+  if((overlay == nullptr || !overlay->fstat(fd, buf, &result))
+      && (cache == nullptr || !cache->lookup_fd(fd, buf))) {
+    result = vmi->get_handlers()->fstat(fd, buf);
+    if(result < 0) {
+      result = -errno;
+    } else if(cache != nullptr) {
+      cache->insert_fd(fd, buf);
+    }
+  }
 
   if(vmi->debug_mode()) {
     Elkvm::dbg_log_result<int>(result);
@@ -652,7 +790,7 @@ long elkvm_do_lstat(Elkvm::VM * vmi) {
 
   CURRENT_ABI::paramtype path_p = 0;
   CURRENT_ABI::paramtype buf_p = 0;
-  char *path = NULL;
+  const char *path = NULL;
   struct stat *buf;
   vmi->unpack_syscall(&path_p, &buf_p);
 
@@ -661,7 +799,24 @@ long elkvm_do_lstat(Elkvm::VM * vmi) {
   assert(buf_p != 0x0);
   buf  = reinterpret_cast<struct stat *>(vmi->get_region_manager()->get_pager().get_host_p(buf_p));
 
-  long result = vmi->get_handlers()->lstat(path, buf);
+  auto &overlay = vmi->image_overlay();
+  auto &cache = vmi->metadata_cache();
+  std::string host_path;
+  long result;
+  if(overlay == nullptr
+      || !overlay->stat(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW, buf, &result, &host_path)) {
+    path = passed_path(path, host_path);
+    if(cache == nullptr || !cache->lookup(Elkvm::MD_LSTAT, path, 0, &result,
+          buf, sizeof(*buf))) {
+      result = vmi->get_handlers()->lstat(path, buf);
+      if(result < 0) {
+        result = -errno;
+      }
+      if(cache != nullptr) {
+        cache->insert(Elkvm::MD_LSTAT, path, 0, result, buf, sizeof(*buf));
+      }
+    }
+  }
   if(vmi->debug_mode()) {
     DBG() << "LSTAT file " << path << " with buf at " << (void*) buf_p
           << " (" << (void*)buf << ")";
@@ -683,7 +838,11 @@ long elkvm_do_lseek(Elkvm::VM * vmi) {
 
   vmi->unpack_syscall(&fd, &off, &whence);
 
-  long result = vmi->get_handlers()->lseek(fd, off, whence);
+  long result;
+  auto &overlay = vmi->image_overlay();
+  if(overlay == nullptr || !overlay->lseek(fd, off, whence, &result)) {
+    result = vmi->get_handlers()->lseek(fd, off, whence);
+  }
   if(vmi->debug_mode()) {
     DBG() << "LSEEK fd " << fd << " offset " << off << " whence " << whence;
     Elkvm::dbg_log_result<int>(result);
@@ -739,6 +898,27 @@ long elkvm_do_mmap(Elkvm::VM * vmi) {
   CURRENT_ABI::paramtype off    = 0;
 
   vmi->unpack_syscall(&addr, &length, &prot, &flags, &fd, &off);
+
+  /* files of the image overlay are copied into private anonymous memory,
+   * as the image is read-only, nobody can tell the difference */
+  auto &overlay = vmi->image_overlay();
+  const bool from_image = !(flags & MAP_ANONYMOUS) && overlay != nullptr
+    && overlay->owns(fd);
+  if(from_image) {
+    struct stat st;
+    long err = 0;
+    overlay->fstat(fd, &st, &err);
+    if(!S_ISREG(st.st_mode)) {
+      return -ENODEV;
+    }
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE)) {
+      return -EACCES;
+    }
+    flags = (flags & ~MAP_SHARED_VALIDATE) | MAP_PRIVATE | MAP_ANONYMOUS;
+  }
+
+  std::lock_guard<std::recursive_mutex> lock(
+      vmi->get_heap_manager().get_writer_lock());
 #if ELKVM_DEBUG_MMAP
   log_mmap_args(addr, length, prot, flags, fd, off);
   vmi->get_region_manager()->dump_regions();
@@ -746,8 +926,8 @@ long elkvm_do_mmap(Elkvm::VM * vmi) {
 
   /* create a mapping object with the data from the user, this will
    * also allocate the memory for this mapping */
-  Elkvm::Mapping &mapping =
-    vmi->get_heap_manager().get_mapping(addr, length, prot, flags, fd, off);
+  Elkvm::Mapping &mapping = vmi->get_heap_manager().get_mapping(addr, length,
+      prot, flags, from_image ? -1 : fd, from_image ? 0 : off);
 
 
   /* if a handler is specified, call the monitor for corrections etc. */
@@ -773,7 +953,14 @@ long elkvm_do_mmap(Elkvm::VM * vmi) {
    * i.e. copy data for file-based mappings, split existing mappings for
    * MAP_FIXED if necessary etc. */
 
-  if(!mapping.anonymous()) {
+  if(from_image || !mapping.anonymous()) {
+    vmi->get_region_manager()->get_pager().mark_host_written(
+        mapping.base_address(), mapping.get_length());
+  }
+  if(from_image) {
+    overlay->mmap(fd, mapping.base_address(), mapping.get_length(), off,
+        &result);
+  } else if(!mapping.anonymous()) {
     mapping.fill();
   }
 
@@ -819,6 +1006,7 @@ long elkvm_do_munmap(Elkvm::VM * vmi) {
   }
 
   auto &hm = vmi->get_heap_manager();
+  std::lock_guard<std::recursive_mutex> lock(hm.get_writer_lock());
   Elkvm::Mapping &mapping = hm.find_mapping(addr);
   if(vmi->debug_mode()) {
     print(std::cout, mapping);
@@ -843,6 +1031,8 @@ long elkvm_do_munmap(Elkvm::VM * vmi) {
 long elkvm_do_brk(Elkvm::VM * vmi) {
   guestptr_t user_brk_req = 0;
   vmi->unpack_syscall(&user_brk_req);
+  std::lock_guard<std::recursive_mutex> lock(
+      vmi->get_heap_manager().get_writer_lock());
 
   if(vmi->debug_mode()) {
     DBG() << "BRK requested with address: " << (void*)user_brk_req
@@ -904,22 +1094,6 @@ long elkvm_do_ioctl(Elkvm::VM * vmi) {
   return result;
 }
 
-void elkvm_get_host_iov(Elkvm::VM * vmi,
-    uint64_t iov_p, uint64_t iovcnt, struct iovec *host_iov) {
-  struct iovec *guest_iov = NULL;
-  assert(iov_p != 0x0);
-  guest_iov = reinterpret_cast<struct iovec *>
-    (vmi->get_region_manager()->get_pager().get_host_p(iov_p));
-
-  for(unsigned i = 0; i < iovcnt; i++) {
-    assert(guest_iov[i].iov_base != NULL);
-    host_iov[i].iov_base = vmi->get_region_manager()->get_pager().get_host_p(
-        reinterpret_cast<guestptr_t>(guest_iov[i].iov_base));
-    host_iov[i].iov_len  = guest_iov[i].iov_len;
-  }
-
-}
-
 long elkvm_do_readv(Elkvm::VM * vmi) {
   if(vmi->get_handlers()->readv == NULL) {
     ERROR() << "READV handler not found" << LOG_RESET << "\n";
@@ -932,18 +1106,34 @@ long elkvm_do_readv(Elkvm::VM * vmi) {
 
   vmi->unpack_syscall(&fd, &iov_p, &iovcnt);
 
-  struct iovec host_iov[iovcnt];
-  elkvm_get_host_iov(vmi, iov_p, iovcnt, host_iov);
+  std::vector<struct iovec> host_iov;
+  ssize_t len = Elkvm::guest_iov_to_host_iov(
+      vmi->get_region_manager()->get_pager(), iov_p, iovcnt, host_iov);
+  if(len < 0) {
+    return len;
+  }
 
-  long result = vmi->get_handlers()->readv(fd, host_iov, iovcnt);
+  long result;
+  auto &overlay = vmi->image_overlay();
+  if(overlay != nullptr && overlay->readv(fd, host_iov.data(),
+        host_iov.size(), -1, &result)) {
+    return result;
+  }
+
+  result = vmi->get_handlers()->readv(fd, host_iov.data(),
+      host_iov.size());
   if(vmi->debug_mode()) {
     DBG() << "READV with df " << fd << " (@ " << (void*)&fd
-          << ") iov @ " << (void*)iov_p << " count: " << iovcnt;
+          << ") iov @ " << (void*)iov_p << " count: " << iovcnt
+          << " host count: " << host_iov.size();
     Elkvm::dbg_log_result<int>(result);
     if(result < 0) {
       ERROR() << "ERROR No: " << errno << " Msg: " << strerror(errno);
     }
   }
+  if(result < 0) {
+    return -errno;
+  }
   return result;
 }
 
@@ -959,15 +1149,23 @@ long elkvm_do_writev(Elkvm::VM * vmi) {
 
   vmi->unpack_syscall(&fd, &iov_p, &iovcnt);
 
-  struct iovec host_iov[iovcnt];
-  elkvm_get_host_iov(vmi, iov_p, iovcnt, host_iov);
+  std::vector<struct iovec> host_iov;
+  ssize_t len = Elkvm::guest_iov_to_host_iov(
+      vmi->get_region_manager()->get_pager(), iov_p, iovcnt, host_iov);
+  if(len < 0) {
+    return len;
+  }
 
-  long result = vmi->get_handlers()->writev(fd, host_iov, iovcnt);
+  long result = vmi->get_handlers()->writev(fd, host_iov.data(),
+      host_iov.size());
   if(vmi->debug_mode()) {
     DBG() << "WRITEV with fd: " << fd << " iov @ " << (void*)iov_p
-          << " iovcnt " << iovcnt;
+          << " iovcnt " << iovcnt << " host iovcnt " << host_iov.size();
     Elkvm::dbg_log_result<int>(result);
   }
+  if(result < 0) {
+    return -errno;
+  }
   return result;
 }
 
@@ -983,12 +1181,31 @@ long elkvm_do_access(Elkvm::VM * vmi) {
   vmi->unpack_syscall(&path_p, &mode);
 
   assert(path_p != 0x0);
-  char *pathname = reinterpret_cast<char *>(vmi->get_region_manager()->get_pager().get_host_p(path_p));
+  const char *pathname = reinterpret_cast<char *>(vmi->get_region_manager()->get_pager().get_host_p(path_p));
   if(pathname == NULL) {
     return -EFAULT;
   }
 
-  long result = vmi->get_handlers()->access(pathname, mode);
+  /* EINVAL for an invalid mode says nothing about pathname */
+  const bool valid = (mode & ~(R_OK | W_OK | X_OK)) == 0;
+  auto &overlay = vmi->image_overlay();
+  auto cache = valid ? vmi->metadata_cache() : nullptr;
+  std::string host_path;
+  long result;
+  if(!valid || overlay == nullptr
+      || !overlay->access(pathname, mode, &result, &host_path)) {
+    pathname = passed_path(pathname, host_path);
+    if(cache == nullptr || !cache->lookup(Elkvm::MD_ACCESS, pathname, mode,
+          &result, nullptr, 0)) {
+      result = vmi->get_handlers()->access(pathname, mode);
+      if(result) {
+        result = -errno;
+      }
+      if(cache != nullptr) {
+        cache->insert(Elkvm::MD_ACCESS, pathname, mode, result, nullptr, 0);
+      }
+    }
+  }
   if(vmi->debug_mode()) {
     DBG() << "ACCESS with pathname: " << pathname << " (" << (void*)path_p
           << ") mode " << mode;
@@ -996,7 +1213,7 @@ long elkvm_do_access(Elkvm::VM * vmi) {
   }
 
   if(result) {
-    return -errno;
+    return result;
   }
 
   return 0;
@@ -1028,6 +1245,38 @@ long elkvm_do_pipe(Elkvm::VM * vmi) {
   return 0;
 }
 
+long elkvm_do_pipe2(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->pipe2 == nullptr) {
+    ERROR() << "PIPE2 handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  guestptr_t pipefd_p = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&pipefd_p, &flags);
+
+  int pipefd[2];
+  long result = vmi->get_handlers()->pipe2(pipefd, flags);
+  const int saved_errno = errno;
+  if(vmi->debug_mode()) {
+    DBG() << "PIPE2 with pipefds at 0x" << std::hex << pipefd_p
+          << " flags 0x" << flags << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result) {
+    return -saved_errno;
+  }
+
+  int err = Elkvm::copy_to_guest(vmi->get_region_manager()->get_pager(),
+      pipefd_p, pipefd, sizeof(pipefd));
+  if(err) {
+    close(pipefd[0]);
+    close(pipefd[1]);
+  }
+  return err;
+}
+
 long elkvm_do_mremap(Elkvm::VM *vmi) {
   guestptr_t old_address_p = 0x0;
   void *old_address = NULL;
@@ -1038,6 +1287,8 @@ long elkvm_do_mremap(Elkvm::VM *vmi) {
   void *new_address = NULL;
 
   vmi->unpack_syscall(&old_address_p, &old_size, &new_size, &flags, &new_address_p);
+  std::lock_guard<std::recursive_mutex> lock(
+      vmi->get_heap_manager().get_writer_lock());
 
   if(old_address_p != 0x0) {
     old_address = vmi->get_region_manager()->get_pager().get_host_p(old_address_p);
@@ -1085,8 +1336,45 @@ long elkvm_do_dup(Elkvm::VM * vmi) {
   if(vmi->debug_mode()) {
     DBG() << "DUP result: " << result << "\n";
   }
+  if(result < 0) {
+    return -errno;
+  }
+  if(vmi->image_overlay() != nullptr) {
+    vmi->image_overlay()->dup(oldfd, result);
+  }
+
+  return result;
+}
+
+long elkvm_do_dup3(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->dup3 == nullptr) {
+    ERROR() << "DUP3 handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
 
-  return -errno;
+  CURRENT_ABI::paramtype oldfd = 0x0;
+  CURRENT_ABI::paramtype newfd = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&oldfd, &newfd, &flags);
+
+  long result = vmi->get_handlers()->dup3(oldfd, newfd, flags);
+  if(result >= 0 && vmi->metadata_cache() != nullptr) {
+    /* newfd was closed and refers to another file now */
+    vmi->metadata_cache()->closed(newfd);
+  }
+  if(result >= 0 && vmi->image_overlay() != nullptr) {
+    vmi->image_overlay()->dup(oldfd, newfd);
+  }
+  if(vmi->debug_mode()) {
+    DBG() << "DUP3 oldfd " << oldfd << " newfd " << newfd
+          << " flags 0x" << std::hex << flags << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
 }
 
 long elkvm_do_nanosleep(Elkvm::VM * vmi) {
@@ -1187,6 +1475,10 @@ long elkvm_do_fcntl(Elkvm::VM * vmi) {
       result = vmi->get_handlers()->fcntl(fd, cmd, arg_p);
       break;
   }
+  if((cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC) && result >= 0
+      && vmi->image_overlay() != nullptr) {
+    vmi->image_overlay()->dup(fd, result);
+  }
 
   if(vmi->debug_mode()) {
     DBG() << "FCNTL with fd: " << fd << " cmd: " << cmd << " arg_p: " << (void*)arg_p;
@@ -1199,6 +1491,46 @@ long elkvm_do_fcntl(Elkvm::VM * vmi) {
   return result;
 }
 
+long elkvm_do_fsync(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->fsync == NULL) {
+    ERROR() << "FSYNC handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype fd = 0;
+  vmi->unpack_syscall(&fd);
+
+  long result = vmi->get_handlers()->fsync(fd);
+  if(vmi->debug_mode()) {
+    DBG() << "FSYNC with fd: " << fd;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
+}
+
+long elkvm_do_fdatasync(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->fdatasync == NULL) {
+    ERROR() << "FDATASYNC handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype fd = 0;
+  vmi->unpack_syscall(&fd);
+
+  long result = vmi->get_handlers()->fdatasync(fd);
+  if(vmi->debug_mode()) {
+    DBG() << "FDATASYNC with fd: " << fd;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
+}
+
 long elkvm_do_truncate(Elkvm::VM * vmi) {
   if(vmi->get_handlers()->truncate == NULL) {
     ERROR() << "TRUNCATE handler not found" << LOG_RESET << "\n";
@@ -1213,6 +1545,11 @@ long elkvm_do_truncate(Elkvm::VM * vmi) {
 
   path = reinterpret_cast<char *>(vmi->get_region_manager()->get_pager().get_host_p(path_p));
   long result = vmi->get_handlers()->truncate(path, length);
+  const int saved_errno = errno;
+  if(result == 0 && vmi->metadata_cache() != nullptr) {
+    vmi->metadata_cache()->invalidate(path);
+  }
+  errno = saved_errno;
   if(vmi->debug_mode()) {
     DBG() << "TRUNCATE with path at: " << (void*)path << " (" << path << ") "
           << " length " << length;
@@ -1258,10 +1595,18 @@ long elkvm_do_getdents(Elkvm::VM * vmi) {
 
   vmi->unpack_syscall(&fd, &dirp_p, &count);
 
+  /* the handler needs a single host buffer, a dirent list that does not fit
+   * into the first host-contiguous part of dirp is returned on the next call */
+  std::vector<struct iovec> iov;
+  ssize_t len = Elkvm::guest_to_host_iov(vmi->get_region_manager()->get_pager(),
+      dirp_p, count, iov);
+  if(len < 0) {
+    return len;
+  }
   struct linux_dirent *dirp = NULL;
-  if(dirp_p != 0x0) {
-    dirp = reinterpret_cast<struct linux_dirent *>(
-        vmi->get_region_manager()->get_pager().get_host_p(dirp_p));
+  if(!iov.empty()) {
+    dirp = reinterpret_cast<struct linux_dirent *>(iov[0].iov_base);
+    count = iov[0].iov_len;
   }
 
   int res = vmi->get_handlers()->getdents(fd, dirp, count);
@@ -1339,6 +1684,11 @@ long elkvm_do_mkdir(Elkvm::VM * vmi) {
   assert(pathname_p != 0x0);
   pathname = reinterpret_cast<char *>(vmi->get_region_manager()->get_pager().get_host_p(pathname_p));
   long result = vmi->get_handlers()->mkdir(pathname, mode);
+  const int saved_errno = errno;
+  if(result == 0 && vmi->metadata_cache() != nullptr) {
+    vmi->metadata_cache()->invalidate(pathname);
+  }
+  errno = saved_errno;
   if(vmi->debug_mode()) {
     DBG() << "MKDIR with pathname at: " << (void*)pathname
           << " (" << pathname << ") mode " << mode;
@@ -1365,6 +1715,11 @@ long elkvm_do_unlink(Elkvm::VM * vmi) {
   assert(pathname_p != 0x0);
   pathname = reinterpret_cast<char *>(vmi->get_region_manager()->get_pager().get_host_p(pathname_p));
   long result = vmi->get_handlers()->unlink(pathname);
+  const int saved_errno = errno;
+  if(result == 0 && vmi->metadata_cache() != nullptr) {
+    vmi->metadata_cache()->invalidate(pathname);
+  }
+  errno = saved_errno;
   if(vmi->debug_mode()) {
     DBG() << "UNLINK with pathname at: " << (void*)pathname << " (" << pathname << ")";
     Elkvm::dbg_log_result<int>(result);
@@ -1384,14 +1739,34 @@ long elkvm_do_readlink(Elkvm::VM * vmi) {
   CURRENT_ABI::paramtype path_p = 0;
   CURRENT_ABI::paramtype buf_p = 0;
   CURRENT_ABI::paramtype bufsiz = 0;
-  char *path = NULL;
+  const char *path = NULL;
   char *buf = NULL;
 
   vmi->unpack_syscall(&path_p, &buf_p, &bufsiz);
 
   path = reinterpret_cast<char *>(vmi->get_region_manager()->get_pager().get_host_p(path_p));
   buf  = reinterpret_cast<char *>(vmi->get_region_manager()->get_pager().get_host_p(buf_p));
-  long result = vmi->get_handlers()->readlink(path, buf, bufsiz);
+  /* EINVAL for an empty buffer says nothing about path */
+  auto &overlay = vmi->image_overlay();
+  auto cache = bufsiz > 0 ? vmi->metadata_cache() : nullptr;
+  std::string host_path;
+  long result;
+  if(overlay == nullptr
+      || !overlay->readlink(path, buf, bufsiz, &result, &host_path)) {
+    path = passed_path(path, host_path);
+    if(cache == nullptr || !cache->lookup(Elkvm::MD_READLINK, path, 0,
+          &result, buf, bufsiz)) {
+      result = vmi->get_handlers()->readlink(path, buf, bufsiz);
+      if(result < 0) {
+        result = -errno;
+      }
+      /* a target that fills the buffer may have been cut short */
+      if(cache != nullptr && result < static_cast<long>(bufsiz)) {
+        cache->insert(Elkvm::MD_READLINK, path, 0, result, buf,
+            result < 0 ? 0 : result);
+      }
+    }
+  }
   if(vmi->debug_mode()) {
     DBG() << "READLINK with path at: " << (void*)path << " (" << path << ") buf at "
           << (void*)buf << " bufsize " << bufsiz;
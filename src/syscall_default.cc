@@ -27,16 +27,27 @@
 #include <cstdarg>
 #include <cstdio>
 #include <cstring>
+#include <linux/aio_abi.h>
 #include <linux/futex.h>
 #include <linux/unistd.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/sendfile.h>
+#include <sys/shm.h>
+#include <sys/signalfd.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/vfs.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -71,6 +82,10 @@ long pass_lstat(const char *path, struct stat *buf) {
   return lstat(path, buf);
 }
 
+long pass_poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+  return poll(fds, nfds, timeout);
+}
+
 long pass_lseek(int fd, off_t offset, int whence) {
   return lseek(fd, offset, whence);
 }
@@ -90,6 +105,14 @@ long pass_ioctl(int fd, unsigned long request, char *argp) {
   return ioctl(fd, request, argp);
 }
 
+long pass_pread64(int fd, void *buf, size_t count, off_t offset) {
+  return pread(fd, buf, count, offset);
+}
+
+long pass_pwrite64(int fd, const void *buf, size_t count, off_t offset) {
+  return pwrite(fd, buf, count, offset);
+}
+
 long pass_munmap(struct region_mapping *mapping) {
   return munmap(mapping->host_p, mapping->length);
 }
@@ -110,6 +133,14 @@ long pass_pipe(int pipefds[2]) {
   return pipe(pipefds);
 }
 
+long pass_shmget(key_t key, size_t size, int shmflg) {
+  return shmget(key, size, shmflg);
+}
+
+long pass_shmctl(int shmid, int cmd, struct shmid_ds *buf) {
+  return shmctl(shmid, cmd, buf);
+}
+
 long pass_dup(int oldfd) {
   return dup(oldfd);
 }
@@ -123,6 +154,10 @@ long pass_getpid() {
   return getpid();
 }
 
+long pass_sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+  return sendfile(out_fd, in_fd, offset, count);
+}
+
 long pass_getuid() {
   return getuid();
 }
@@ -169,6 +204,14 @@ long pass_fcntl(int fd, int cmd, ...) {
   return result;
 }
 
+long pass_fsync(int fd) {
+  return fsync(fd);
+}
+
+long pass_fdatasync(int fd) {
+  return fdatasync(fd);
+}
+
 long pass_truncate(const char *path, off_t length) {
   return truncate(path, length);
 }
@@ -238,6 +281,28 @@ long pass_futex(int *uaddr, int op, int val, const struct timespec *timeout,
   return syscall(__NR_futex, uaddr, op, val, timeout, uaddr2, val3);
 }
 
+long pass_io_setup(unsigned nr_events, aio_context_t *ctxp) {
+  return syscall(__NR_io_setup, nr_events, ctxp);
+}
+
+long pass_io_destroy(aio_context_t ctx) {
+  return syscall(__NR_io_destroy, ctx);
+}
+
+long pass_io_getevents(aio_context_t ctx, long min_nr, long nr,
+    struct io_event *events, struct timespec *timeout) {
+  return syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+long pass_io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp) {
+  return syscall(__NR_io_submit, ctx, nr, iocbpp);
+}
+
+long pass_io_cancel(aio_context_t ctx, struct iocb *iocb,
+    struct io_event *result) {
+  return syscall(__NR_io_cancel, ctx, iocb, result);
+}
+
 long pass_clock_gettime(clockid_t clk_id, struct timespec *tp) {
   return clock_gettime(clk_id, tp);
 }
@@ -258,10 +323,19 @@ int pass_openat(int dirfd, const char *pathname, int flags) {
   return openat(dirfd, pathname, flags);
 }
 
+long pass_newfstatat(int dirfd, const char *pathname, struct stat *buf,
+    int flags) {
+  return fstatat(dirfd, pathname, buf, flags);
+}
+
 long pass_socket(int domain, int type, int protocol) {
   return socket(domain, type, protocol);
 }
 
+long pass_connect(int sock, struct sockaddr const *addr, socklen_t addrlen) {
+  return connect(sock, addr, addrlen);
+}
+
 long pass_bind(int sock, struct sockaddr const *addr, socklen_t addrlen) {
   return bind(sock, addr, addrlen);
 }
@@ -270,6 +344,38 @@ long pass_accept(int sock, struct sockaddr* addr, socklen_t *len) {
   return accept(sock, addr, len);
 }
 
+long pass_sendto(int sock, const void *buf, size_t len, int flags,
+    const struct sockaddr *dest_addr, socklen_t addrlen) {
+  return sendto(sock, buf, len, flags, dest_addr, addrlen);
+}
+
+long pass_recvfrom(int sock, void *buf, size_t len, int flags,
+    struct sockaddr *src_addr, socklen_t *addrlen) {
+  return recvfrom(sock, buf, len, flags, src_addr, addrlen);
+}
+
+long pass_sendmsg(int sock, const struct msghdr *msg, int flags) {
+  return sendmsg(sock, msg, flags);
+}
+
+long pass_recvmsg(int sock, struct msghdr *msg, int flags) {
+  return recvmsg(sock, msg, flags);
+}
+
+long pass_shutdown(int sock, int how) {
+  return shutdown(sock, how);
+}
+
+long pass_recvmmsg(int sock, struct mmsghdr *msgvec, unsigned vlen, int flags,
+    struct timespec *timeout) {
+  return recvmmsg(sock, msgvec, vlen, flags, timeout);
+}
+
+long pass_sendmmsg(int sock, struct mmsghdr *msgvec, unsigned vlen,
+    int flags) {
+  return sendmmsg(sock, msgvec, vlen, flags);
+}
+
 long pass_listen(int sock, int backlog) {
   return listen(sock, backlog);
 }
@@ -283,10 +389,19 @@ long pass_setsockopt(int sock, int lvl, int optname, const void* optval,
   return setsockopt(sock, lvl, optname, optval, optlen);
 }
 
+long pass_wait4(pid_t pid, int *wstatus, int options, struct rusage *rusage) {
+  return wait4(pid, wstatus, options, rusage);
+}
+
 long pass_epoll_create(int size) {
   return epoll_create(size);
 }
 
+long pass_getdents64(unsigned fd, struct linux_dirent64 *dirp,
+    unsigned count) {
+  return syscall(__NR_getdents64, fd, dirp, count);
+}
+
 long pass_set_tid_address(int *tidptr) {
   return syscall(__NR_set_tid_address, tidptr);
 }
@@ -304,6 +419,112 @@ long pass_set_robust_list(struct robust_list_head *head, size_t len) {
   return syscall(__NR_set_robust_list, head, len);
 }
 
+/* the C library wrappers would not report the remaining time */
+long pass_pselect6(int nfds, fd_set *readfds, fd_set *writefds,
+    fd_set *exceptfds, struct timespec *timeout, const sigset_t *sigmask) {
+  struct {
+    const sigset_t *ss;
+    size_t ss_len;
+  } data = { sigmask, _NSIG / 8 };
+  return syscall(__NR_pselect6, nfds, readfds, writefds, exceptfds, timeout,
+      &data);
+}
+
+long pass_ppoll(struct pollfd *fds, nfds_t nfds, struct timespec *timeout,
+    const sigset_t *sigmask) {
+  return syscall(__NR_ppoll, fds, nfds, timeout, sigmask, _NSIG / 8);
+}
+
+long pass_splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+    size_t len, unsigned flags) {
+  return splice(fd_in, off_in, fd_out, off_out, len, flags);
+}
+
+long pass_tee(int fd_in, int fd_out, size_t len, unsigned flags) {
+  return tee(fd_in, fd_out, len, flags);
+}
+
+long pass_vmsplice(int fd, const struct iovec *iov, unsigned long nr_segs,
+    unsigned flags) {
+  return vmsplice(fd, iov, nr_segs, flags);
+}
+
+long pass_epoll_pwait(int epfd, struct epoll_event *events, int max,
+    int timeout, const sigset_t *sigmask) {
+  return epoll_pwait(epfd, events, max, timeout, sigmask);
+}
+
+long pass_signalfd(int fd, const sigset_t *mask, int flags) {
+  return signalfd(fd, mask, flags);
+}
+
+long pass_timerfd_create(int clockid, int flags) {
+  return timerfd_create(clockid, flags);
+}
+
+long pass_eventfd(unsigned int initval, int flags) {
+  return eventfd(initval, flags);
+}
+
+long pass_timerfd_settime(int fd, int flags,
+    const struct itimerspec *new_value, struct itimerspec *old_value) {
+  return timerfd_settime(fd, flags, new_value, old_value);
+}
+
+long pass_timerfd_gettime(int fd, struct itimerspec *curr_value) {
+  return timerfd_gettime(fd, curr_value);
+}
+
+long pass_accept4(int sock, struct sockaddr *addr, socklen_t *len,
+    int flags) {
+  return accept4(sock, addr, len, flags);
+}
+
+long pass_epoll_create1(int flags) {
+  return epoll_create1(flags);
+}
+
+long pass_dup3(int oldfd, int newfd, int flags) {
+  return dup3(oldfd, newfd, flags);
+}
+
+long pass_pipe2(int pipefds[2], int flags) {
+  return pipe2(pipefds, flags);
+}
+
+long pass_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+  return preadv(fd, iov, iovcnt, offset);
+}
+
+long pass_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+  return pwritev(fd, iov, iovcnt, offset);
+}
+
+long pass_preadv2(int fd, const struct iovec *iov, int iovcnt, off_t offset,
+    int flags) {
+  return preadv2(fd, iov, iovcnt, offset, flags);
+}
+
+long pass_pwritev2(int fd, const struct iovec *iov, int iovcnt, off_t offset,
+    int flags) {
+  return pwritev2(fd, iov, iovcnt, offset, flags);
+}
+
+long pass_getrandom(void *buf, size_t buflen, unsigned flags) {
+  return syscall(__NR_getrandom, buf, buflen, flags);
+}
+
+long pass_copy_file_range(int fd_in, loff_t *off_in, int fd_out,
+    loff_t *off_out, size_t len, unsigned flags) {
+  return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out, len,
+      flags);
+}
+
+long pass_statx(int dirfd, const char *pathname, int flags, unsigned mask,
+    struct statx *buf) {
+  return syscall(__NR_statx, dirfd, pathname, flags, mask, buf);
+}
+
 Elkvm::elkvm_handlers
 Elkvm::default_handlers = {
   .read = pass_read,
@@ -313,7 +534,7 @@ Elkvm::default_handlers = {
   .stat = pass_stat,
   .fstat = pass_fstat,
   .lstat = pass_lstat,
-  .poll = NULL,
+  .poll = pass_poll,
   .lseek = pass_lseek,
   .mmap_before = NULL,
   .mmap_after = NULL,
@@ -323,25 +544,38 @@ Elkvm::default_handlers = {
   .sigaction = allow_sigaction,
   .sigprocmask = pass_sigprocmask,
   .ioctl = pass_ioctl,
-  /* ... */
+  .pread64 = pass_pread64,
+  .pwrite64 = pass_pwrite64,
   .readv = pass_readv,
   .writev = pass_writev,
   .access = pass_access,
   .pipe = pass_pipe,
+  /* ... */
+  .shmget = pass_shmget,
+  .shmctl = pass_shmctl,
   .dup = pass_dup,
   /* ... */
   .nanosleep = pass_nanosleep,
   /* ... */
   .getpid = pass_getpid,
+  .sendfile = pass_sendfile,
   /* ... */
   .socket = pass_socket,
+  .connect = pass_connect,
   .accept = pass_accept,
+  .sendto = pass_sendto,
+  .recvfrom = pass_recvfrom,
+  .sendmsg = pass_sendmsg,
+  .recvmsg = pass_recvmsg,
+  .shutdown = pass_shutdown,
   .bind = pass_bind,
   .listen = pass_listen,
   .getsockname = pass_getsockname,
   /* ... */
   .setsockopt = pass_setsockopt,
   /* ... */
+  .wait4 = pass_wait4,
+  /* ... */
   .getuid  = pass_getuid,
   .getgid  = pass_getgid,
   .geteuid = pass_geteuid,
@@ -349,6 +583,8 @@ Elkvm::default_handlers = {
   /* ... */
   .uname = pass_uname,
   .fcntl = pass_fcntl,
+  .fsync = pass_fsync,
+  .fdatasync = pass_fdatasync,
   .truncate = pass_truncate,
   .ftruncate = pass_ftruncate,
   .getdents = pass_getdents,
@@ -371,8 +607,14 @@ Elkvm::default_handlers = {
   .gettid = pass_gettid,
   .time = pass_time,
   .futex = pass_futex,
+  .io_setup = pass_io_setup,
+  .io_destroy = pass_io_destroy,
+  .io_getevents = pass_io_getevents,
+  .io_submit = pass_io_submit,
+  .io_cancel = pass_io_cancel,
   /* ... */
   .epoll_create = pass_epoll_create,
+  .getdents64 = pass_getdents64,
   .set_tid_address = pass_set_tid_address,
   .epoll_ctl = pass_epoll_ctl,
   .epoll_wait = pass_epoll_wait,
@@ -382,8 +624,33 @@ Elkvm::default_handlers = {
   .exit_group = pass_exit_group,
   .tgkill = pass_tgkill,
   .openat = pass_openat,
-  /* ... */
+  .newfstatat = pass_newfstatat,
+  .pselect6 = pass_pselect6,
+  .ppoll = pass_ppoll,
   .set_robust_list = pass_set_robust_list,
+  .splice = pass_splice,
+  .tee = pass_tee,
+  .vmsplice = pass_vmsplice,
+  .epoll_pwait = pass_epoll_pwait,
+  .signalfd = pass_signalfd,
+  .timerfd_create = pass_timerfd_create,
+  .eventfd = pass_eventfd,
+  .timerfd_settime = pass_timerfd_settime,
+  .timerfd_gettime = pass_timerfd_gettime,
+  .accept4 = pass_accept4,
+  .epoll_create1 = pass_epoll_create1,
+  .dup3 = pass_dup3,
+  .pipe2 = pass_pipe2,
+  /* ... */
+  .preadv = pass_preadv,
+  .pwritev = pass_pwritev,
+  .recvmmsg = pass_recvmmsg,
+  .sendmmsg = pass_sendmmsg,
+  .getrandom = pass_getrandom,
+  .copy_file_range = pass_copy_file_range,
+  .preadv2 = pass_preadv2,
+  .pwritev2 = pass_pwritev2,
+  .statx = pass_statx,
 
   .bp_callback = NULL,
 };
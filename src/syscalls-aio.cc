@@ -0,0 +1,498 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <linux/aio_abi.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-internal.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/heap.h>
+#include <elkvm/iov.h>
+#include <elkvm/overlay.h>
+#include <elkvm/region.h>
+#include <elkvm/region_manager.h>
+#include <elkvm/syscall.h>
+
+/*
+ * The AIO context of a guest is the guest address of a read-only page that
+ * holds the host context at its start. The rest of the page is zero, so
+ * libaio does not find the magic of a completion ring there and always asks
+ * the kernel for events.
+ *
+ * Every submitted iocb is copied into an aio_request whose buffers are host
+ * addresses, buffers that are split up in host memory turn into vectored
+ * requests. The kernel reports that copy as obj of the completion, which is
+ * replaced with the guest iocb again before the guest sees the event.
+ *
+ * Files of the image overlay only have /dev/null behind their host fd, the
+ * kernel would complete reads from them with 0 bytes. Their iocbs are
+ * refused with EINVAL, like those of files without AIO support.
+ */
+static const std::string aio_region_name = "AIO context";
+
+struct aio_request {
+  struct iocb cb;
+  guestptr_t guest_iocb;
+  std::vector<struct iovec> iov;
+
+  aio_request() : cb(), guest_iocb(0x0), iov() {}
+};
+
+/*
+ * Host contexts of all VMs of this process with their requests in flight,
+ * by VM and guest address of the context page. A guest can only use
+ * contexts of its own VM, even if it makes the page writable and stores
+ * another context there, and only as long as the page is still mapped.
+ */
+struct aio_context {
+  aio_context_t host;
+  std::shared_ptr<Elkvm::Region> region;
+  std::map<const struct iocb *, std::unique_ptr<aio_request>> requests;
+
+  aio_context() : host(0), region(), requests() {}
+};
+
+typedef std::pair<const Elkvm::VM *, guestptr_t> aio_key;
+
+static std::mutex aio_lock;
+static std::map<aio_key, aio_context> aio_contexts;
+
+static int host_context(Elkvm::VM * vmi, guestptr_t ctx,
+    aio_context_t *host_ctx) {
+  auto &hm = vmi->get_heap_manager();
+  std::lock_guard<std::recursive_mutex> lock(hm.get_writer_lock());
+  if(ctx == 0x0 || !hm.address_mapped(ctx)) {
+    return -EINVAL;
+  }
+  Elkvm::Mapping &mapping = hm.find_mapping(ctx);
+
+  std::lock_guard<std::mutex> aio(aio_lock);
+  auto it = aio_contexts.find(aio_key(vmi, ctx));
+  if(it == aio_contexts.end() || mapping.guest_address() != ctx
+      || mapping.get_region() != it->second.region) {
+    return -EINVAL;
+  }
+  *host_ctx = it->second.host;
+  return 0;
+}
+
+static int translate_iocb(Elkvm::VM * vmi, guestptr_t iocb_p,
+    aio_request &req) {
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  int err = Elkvm::copy_from_guest(pager, &req.cb, iocb_p, sizeof(req.cb));
+  if(err) {
+    return err;
+  }
+  req.guest_iocb = iocb_p;
+
+  auto &overlay = vmi->image_overlay();
+  if(overlay != nullptr && overlay->owns(req.cb.aio_fildes)) {
+    return -EINVAL;
+  }
+
+  ssize_t len = 0;
+  switch(req.cb.aio_lio_opcode) {
+    case IOCB_CMD_PREAD:
+    case IOCB_CMD_PWRITE:
+      len = Elkvm::guest_to_host_iov(pager, req.cb.aio_buf, req.cb.aio_nbytes,
+          req.iov);
+      if(len < 0) {
+        return len;
+      }
+      if(req.iov.size() <= 1) {
+        req.cb.aio_buf = req.iov.empty() ? 0
+          : reinterpret_cast<__u64>(req.iov[0].iov_base);
+        req.cb.aio_nbytes = len;
+        return 0;
+      }
+      req.cb.aio_lio_opcode = req.cb.aio_lio_opcode == IOCB_CMD_PREAD
+        ? IOCB_CMD_PREADV : IOCB_CMD_PWRITEV;
+      break;
+    case IOCB_CMD_PREADV:
+    case IOCB_CMD_PWRITEV:
+      len = Elkvm::guest_iov_to_host_iov(pager, req.cb.aio_buf,
+          req.cb.aio_nbytes, req.iov);
+      if(len < 0) {
+        return len;
+      }
+      break;
+    default:
+      /* no buffers, or an opcode the host rejects */
+      return 0;
+  }
+
+  /* the kernel copies the vector during submission */
+  req.cb.aio_buf = reinterpret_cast<__u64>(req.iov.data());
+  req.cb.aio_nbytes = req.iov.size();
+  return 0;
+}
+
+/* replace the host iocbs of completed requests with the guest's */
+static void complete_events(const aio_key &key, struct io_event *events,
+    long count) {
+  std::lock_guard<std::mutex> lock(aio_lock);
+  auto ctx = aio_contexts.find(key);
+  if(ctx == aio_contexts.end()) {
+    return;
+  }
+  auto &requests = ctx->second.requests;
+  for(long i = 0; i < count; i++) {
+    auto it = requests.find(reinterpret_cast<const struct iocb *>(events[i].obj));
+    if(it == requests.end()) {
+      continue;
+    }
+    events[i].obj = it->second->guest_iocb;
+    requests.erase(it);
+  }
+}
+
+long elkvm_do_io_setup(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->io_setup == nullptr) {
+    ERROR() << "IO SETUP handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype nr_events = 0x0;
+  guestptr_t ctxp = 0x0;
+
+  vmi->unpack_syscall(&nr_events, &ctxp);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  aio_context_t guest_ctx = 0;
+  int err = Elkvm::copy_from_guest(pager, &guest_ctx, ctxp, sizeof(guest_ctx));
+  if(err) {
+    return err;
+  }
+  if(guest_ctx != 0) {
+    return -EINVAL;
+  }
+
+  aio_context_t host_ctx = 0;
+  long result = vmi->get_handlers()->io_setup(nr_events, &host_ctx);
+  if(vmi->debug_mode()) {
+    DBG() << "IO SETUP with " << nr_events << " events, host context 0x"
+      << std::hex << host_ctx << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+
+  auto r = vmi->get_region_manager()->allocate_region(ELKVM_PAGESIZE,
+      aio_region_name);
+  memset(r->base_address(), 0, ELKVM_PAGESIZE);
+  *static_cast<aio_context_t *>(r->base_address()) = host_ctx;
+
+  auto &hm = vmi->get_heap_manager();
+  std::lock_guard<std::recursive_mutex> lock(hm.get_writer_lock());
+  Elkvm::Mapping &mapping = hm.create_mapping(0x0, ELKVM_PAGESIZE, PROT_READ,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0, r);
+  guest_ctx = mapping.guest_address();
+
+  err = Elkvm::copy_to_guest(pager, ctxp, &guest_ctx, sizeof(guest_ctx));
+  if(err) {
+    hm.unmap(mapping);
+    vmi->get_handlers()->io_destroy(host_ctx);
+    return err;
+  }
+
+  std::lock_guard<std::mutex> aio(aio_lock);
+  aio_context &c = aio_contexts[aio_key(vmi, guest_ctx)];
+  c.host = host_ctx;
+  c.region = r;
+  c.requests.clear();
+  return 0;
+}
+
+long elkvm_do_io_destroy(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->io_destroy == nullptr) {
+    ERROR() << "IO DESTROY handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  guestptr_t ctx = 0x0;
+  vmi->unpack_syscall(&ctx);
+
+  aio_context_t host_ctx = 0;
+  int err = host_context(vmi, ctx, &host_ctx);
+  if(err) {
+    return err;
+  }
+
+  /* waits for all requests in flight */
+  long result = vmi->get_handlers()->io_destroy(host_ctx);
+  if(vmi->debug_mode()) {
+    DBG() << "IO DESTROY with context 0x" << std::hex << ctx
+      << " host context 0x" << host_ctx << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(aio_lock);
+    aio_contexts.erase(aio_key(vmi, ctx));
+  }
+
+  auto &hm = vmi->get_heap_manager();
+  std::lock_guard<std::recursive_mutex> lock(hm.get_writer_lock());
+  hm.unmap(hm.find_mapping(ctx));
+  return 0;
+}
+
+long elkvm_do_submit(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->io_submit == nullptr) {
+    ERROR() << "IO SUBMIT handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  guestptr_t ctx = 0x0;
+  CURRENT_ABI::paramtype nr = 0x0;
+  guestptr_t iocbpp = 0x0;
+
+  vmi->unpack_syscall(&ctx, &nr, &iocbpp);
+
+  aio_context_t host_ctx = 0;
+  int err = host_context(vmi, ctx, &host_ctx);
+  if(err) {
+    return err;
+  }
+  if(static_cast<long>(nr) < 0) {
+    return -EINVAL;
+  }
+
+  /* as the kernel does, an iocb that cannot be read or translated ends the
+   * batch, an error is only returned if it is the first one */
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  std::vector<std::unique_ptr<aio_request>> reqs;
+  std::vector<struct iocb *> cbs;
+  for(CURRENT_ABI::paramtype i = 0; i < nr; i++) {
+    guestptr_t iocb_p = 0x0;
+    err = Elkvm::copy_from_guest(pager, &iocb_p,
+        iocbpp + i * sizeof(guestptr_t), sizeof(iocb_p));
+    if(!err) {
+      std::unique_ptr<aio_request> req(new aio_request());
+      err = translate_iocb(vmi, iocb_p, *req);
+      if(!err) {
+        cbs.push_back(&req->cb);
+        reqs.push_back(std::move(req));
+      }
+    }
+    if(err) {
+      break;
+    }
+  }
+  if(cbs.empty()) {
+    return err;
+  }
+
+  /* completions may be reaped as soon as the requests are submitted */
+  const aio_key key(vmi, ctx);
+  {
+    std::lock_guard<std::mutex> lock(aio_lock);
+    auto &requests = aio_contexts[key].requests;
+    for(auto &req : reqs) {
+      requests[&req->cb] = std::move(req);
+    }
+  }
+
+  long result = vmi->get_handlers()->io_submit(host_ctx, cbs.size(),
+      cbs.data());
+  const int saved_errno = errno;
+  if(vmi->debug_mode()) {
+    DBG() << "IO SUBMIT with context 0x" << std::hex << ctx << std::dec
+      << " " << cbs.size() << " of " << nr << " iocbs";
+    Elkvm::dbg_log_result<int>(result);
+  }
+
+  const size_t submitted = result < 0 ? 0 : result;
+  {
+    std::lock_guard<std::mutex> lock(aio_lock);
+    auto &requests = aio_contexts[key].requests;
+    for(size_t i = submitted; i < cbs.size(); i++) {
+      requests.erase(cbs[i]);
+    }
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
+  return result;
+}
+
+long elkvm_do_getevents(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->io_getevents == nullptr) {
+    ERROR() << "IO GETEVENTS handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  guestptr_t ctx = 0x0;
+  CURRENT_ABI::paramtype min_nr = 0x0;
+  CURRENT_ABI::paramtype nr = 0x0;
+  guestptr_t events_p = 0x0;
+  guestptr_t timeout_p = 0x0;
+
+  vmi->unpack_syscall(&ctx, &min_nr, &nr, &events_p, &timeout_p);
+
+  aio_context_t host_ctx = 0;
+  int err = host_context(vmi, ctx, &host_ctx);
+  if(err) {
+    return err;
+  }
+  if(static_cast<long>(min_nr) < 0 || static_cast<long>(nr) < 0
+      || min_nr > nr) {
+    return -EINVAL;
+  }
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  struct timespec timeout;
+  if(timeout_p != 0x0) {
+    err = Elkvm::copy_from_guest(pager, &timeout, timeout_p, sizeof(timeout));
+    if(err) {
+      return err;
+    }
+  }
+
+  /* the kernel writes the events straight into the guest array, unless it
+   * is split up in host memory */
+  const size_t size = nr * sizeof(struct io_event);
+  std::vector<struct iovec> iov;
+  ssize_t len = Elkvm::guest_to_host_iov(pager, events_p, size, iov);
+  if(size > 0 && (len < 0 || static_cast<size_t>(len) != size)) {
+    return -EFAULT;
+  }
+  std::vector<struct io_event> bounce;
+  struct io_event *events = nullptr;
+  if(iov.size() == 1) {
+    events = static_cast<struct io_event *>(iov[0].iov_base);
+  } else if(size > 0) {
+    bounce.resize(nr);
+    events = bounce.data();
+  }
+
+  long result = vmi->get_handlers()->io_getevents(host_ctx, min_nr, nr,
+      events, timeout_p == 0x0 ? nullptr : &timeout);
+  if(vmi->debug_mode()) {
+    DBG() << "IO GETEVENTS with context 0x" << std::hex << ctx << std::dec
+      << " min " << min_nr << " max " << nr << " events @ "
+      << LOG_GUEST_HOST(events_p, events);
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+
+  complete_events(aio_key(vmi, ctx), events, result);
+  if(!bounce.empty() && result > 0) {
+    err = Elkvm::copy_to_guest(pager, events_p, bounce.data(),
+        result * sizeof(struct io_event));
+    if(err) {
+      return err;
+    }
+  }
+  return result;
+}
+
+long elkvm_do_cancel(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->io_cancel == nullptr) {
+    ERROR() << "IO CANCEL handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  guestptr_t ctx = 0x0;
+  guestptr_t iocb_p = 0x0;
+  guestptr_t result_p = 0x0;
+
+  vmi->unpack_syscall(&ctx, &iocb_p, &result_p);
+
+  aio_context_t host_ctx = 0;
+  int err = host_context(vmi, ctx, &host_ctx);
+  if(err) {
+    return err;
+  }
+
+  struct iocb *cb = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(aio_lock);
+    for(auto &req : aio_contexts[aio_key(vmi, ctx)].requests) {
+      if(req.second->guest_iocb == iocb_p) {
+        cb = &req.second->cb;
+        break;
+      }
+    }
+  }
+  if(cb == nullptr) {
+    return -EINVAL;
+  }
+
+  /* newer kernels always deliver the completion through io_getevents */
+  struct io_event event;
+  memset(&event, 0, sizeof(event));
+  long result = vmi->get_handlers()->io_cancel(host_ctx, cb, &event);
+  if(vmi->debug_mode()) {
+    DBG() << "IO CANCEL with context 0x" << std::hex << ctx
+      << " iocb 0x" << iocb_p << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+
+  complete_events(aio_key(vmi, ctx), &event, 1);
+  return Elkvm::copy_to_guest(vmi->get_region_manager()->get_pager(),
+      result_p, &event, sizeof(event));
+}
+
+namespace Elkvm {
+
+void release_aio_contexts(const VM *vm) {
+  std::vector<aio_context_t> contexts;
+  {
+    std::lock_guard<std::mutex> lock(aio_lock);
+    for(auto it = aio_contexts.lower_bound(aio_key(vm, 0x0));
+        it != aio_contexts.end() && it->first.first == vm;) {
+      contexts.push_back(it->second.host);
+      it = aio_contexts.erase(it);
+    }
+  }
+
+  /* waits for all requests in flight */
+  for(const auto host_ctx : contexts) {
+    if(vm->get_handlers()->io_destroy != nullptr) {
+      vm->get_handlers()->io_destroy(host_ctx);
+    }
+  }
+}
+
+//namespace Elkvm
+}
@@ -0,0 +1,307 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <vector>
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/iov.h>
+#include <elkvm/syscall.h>
+
+/*
+ * Event loop primitives, i.e. eventfd, timerfd, signalfd and epoll. The
+ * file descriptors are host descriptors, reading from and writing to them is
+ * handled by read and write.
+ */
+
+long elkvm_do_epoll_pwait(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->epoll_pwait == nullptr) {
+    ERROR() << "EPOLL PWAIT handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype epfd = 0x0;
+  guestptr_t events_p = 0x0;
+  CURRENT_ABI::paramtype maxevents = 0x0;
+  CURRENT_ABI::paramtype timeout = 0x0;
+  guestptr_t sigmask_p = 0x0;
+  CURRENT_ABI::paramtype sigsetsize = 0x0;
+
+  vmi->unpack_syscall(&epfd, &events_p, &maxevents, &timeout, &sigmask_p,
+      &sigsetsize);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  sigset_t sigmask;
+  sigset_t *mask = nullptr;
+  if(sigmask_p != 0x0) {
+    int err = Elkvm::copy_sigset_from_guest(pager, &sigmask, sigmask_p,
+        sigsetsize);
+    if(err) {
+      return err;
+    }
+    mask = &sigmask;
+  }
+
+  /* the ready list is written in place unless it crosses a chunk */
+  const int max = static_cast<int>(maxevents);
+  struct epoll_event *events = nullptr;
+  std::vector<struct epoll_event> bounce;
+  if(max > 0) {
+    const size_t len = max * sizeof(struct epoll_event);
+    std::vector<struct iovec> iov;
+    ssize_t mapped = Elkvm::guest_to_host_iov(pager, events_p, len, iov);
+    if(mapped < 0 || static_cast<size_t>(mapped) != len) {
+      return -EFAULT;
+    }
+    if(iov.size() == 1) {
+      events = static_cast<struct epoll_event *>(iov[0].iov_base);
+    } else {
+      bounce.resize(max);
+      events = bounce.data();
+    }
+  }
+
+  long result = vmi->get_handlers()->epoll_pwait(epfd, events, max,
+      static_cast<int>(timeout), mask);
+  const int saved_errno = errno;
+  if(vmi->debug_mode()) {
+    DBG() << "EPOLL PWAIT on epfd " << epfd << " events @ "
+          << LOG_GUEST_HOST(events_p, events) << " max " << max
+          << " timeout " << static_cast<int>(timeout)
+          << (bounce.empty() ? "" : " (bounced)");
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
+
+  if(result > 0 && !bounce.empty()) {
+    int err = Elkvm::copy_to_guest(pager, events_p, bounce.data(),
+        result * sizeof(struct epoll_event));
+    if(err) {
+      return err;
+    }
+  }
+  return result;
+}
+
+static long do_signalfd(Elkvm::VM * vmi, const char *name, int fd,
+    guestptr_t mask_p, size_t sizemask, int flags) {
+  if(vmi->get_handlers()->signalfd == nullptr) {
+    ERROR() << name << " handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  sigset_t mask;
+  int err = Elkvm::copy_sigset_from_guest(
+      vmi->get_region_manager()->get_pager(), &mask, mask_p, sizemask);
+  if(err) {
+    return err;
+  }
+
+  long result = vmi->get_handlers()->signalfd(fd, &mask, flags);
+  if(vmi->debug_mode()) {
+    DBG() << name << " with fd " << fd << " mask @ 0x" << std::hex << mask_p
+          << " flags 0x" << flags << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
+}
+
+long elkvm_do_signalfd(Elkvm::VM * vmi) {
+  CURRENT_ABI::paramtype fd = 0x0;
+  guestptr_t mask_p = 0x0;
+  CURRENT_ABI::paramtype sizemask = 0x0;
+
+  vmi->unpack_syscall(&fd, &mask_p, &sizemask);
+  return do_signalfd(vmi, "SIGNALFD", fd, mask_p, sizemask, 0);
+}
+
+long elkvm_do_signalfd4(Elkvm::VM * vmi) {
+  CURRENT_ABI::paramtype fd = 0x0;
+  guestptr_t mask_p = 0x0;
+  CURRENT_ABI::paramtype sizemask = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&fd, &mask_p, &sizemask, &flags);
+  return do_signalfd(vmi, "SIGNALFD4", fd, mask_p, sizemask, flags);
+}
+
+long elkvm_do_timerfd_create(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->timerfd_create == nullptr) {
+    ERROR() << "TIMERFD CREATE handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype clockid = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&clockid, &flags);
+
+  long result = vmi->get_handlers()->timerfd_create(clockid, flags);
+  if(vmi->debug_mode()) {
+    DBG() << "TIMERFD CREATE with clock " << clockid << " flags 0x"
+          << std::hex << flags << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
+}
+
+static long do_eventfd(Elkvm::VM * vmi, const char *name, unsigned initval,
+    int flags) {
+  if(vmi->get_handlers()->eventfd == nullptr) {
+    ERROR() << name << " handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  long result = vmi->get_handlers()->eventfd(initval, flags);
+  if(vmi->debug_mode()) {
+    DBG() << name << " with initval " << initval << " flags 0x" << std::hex
+          << flags << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
+}
+
+long elkvm_do_eventfd(Elkvm::VM * vmi) {
+  CURRENT_ABI::paramtype initval = 0x0;
+
+  vmi->unpack_syscall(&initval);
+  return do_eventfd(vmi, "EVENTFD", initval, 0);
+}
+
+long elkvm_do_eventfd2(Elkvm::VM * vmi) {
+  CURRENT_ABI::paramtype initval = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&initval, &flags);
+  return do_eventfd(vmi, "EVENTFD2", initval, flags);
+}
+
+long elkvm_do_timerfd_settime(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->timerfd_settime == nullptr) {
+    ERROR() << "TIMERFD SETTIME handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype fd = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+  guestptr_t new_value_p = 0x0;
+  guestptr_t old_value_p = 0x0;
+
+  vmi->unpack_syscall(&fd, &flags, &new_value_p, &old_value_p);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  struct itimerspec new_value;
+  int err = Elkvm::copy_from_guest(pager, &new_value, new_value_p,
+      sizeof(new_value));
+  if(err) {
+    return err;
+  }
+  struct itimerspec old_value;
+
+  long result = vmi->get_handlers()->timerfd_settime(fd, flags, &new_value,
+      old_value_p != 0x0 ? &old_value : nullptr);
+  const int saved_errno = errno;
+  if(vmi->debug_mode()) {
+    DBG() << "TIMERFD SETTIME fd " << fd << " flags 0x" << std::hex << flags
+          << std::dec << " value " << new_value.it_value.tv_sec << "s "
+          << new_value.it_value.tv_nsec << "ns interval "
+          << new_value.it_interval.tv_sec << "s "
+          << new_value.it_interval.tv_nsec << "ns";
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
+
+  if(old_value_p != 0x0) {
+    err = Elkvm::copy_to_guest(pager, old_value_p, &old_value,
+        sizeof(old_value));
+  }
+  return err ? err : result;
+}
+
+long elkvm_do_timerfd_gettime(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->timerfd_gettime == nullptr) {
+    ERROR() << "TIMERFD GETTIME handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype fd = 0x0;
+  guestptr_t curr_value_p = 0x0;
+
+  vmi->unpack_syscall(&fd, &curr_value_p);
+
+  struct itimerspec curr_value;
+  long result = vmi->get_handlers()->timerfd_gettime(fd, &curr_value);
+  const int saved_errno = errno;
+  if(vmi->debug_mode()) {
+    DBG() << "TIMERFD GETTIME fd " << fd << " value @ 0x" << std::hex
+          << curr_value_p << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
+
+  int err = Elkvm::copy_to_guest(vmi->get_region_manager()->get_pager(),
+      curr_value_p, &curr_value, sizeof(curr_value));
+  return err ? err : result;
+}
+
+long elkvm_do_epoll_create1(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->epoll_create1 == nullptr) {
+    ERROR() << "EPOLL CREATE1 handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&flags);
+
+  long result = vmi->get_handlers()->epoll_create1(flags);
+  if(vmi->debug_mode()) {
+    DBG() << "EPOLL CREATE1 with flags 0x" << std::hex << flags << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
+}
@@ -0,0 +1,93 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <string>
+#include <vector>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/syscall.h>
+
+/*
+ * Copy a NULL terminated array of guest strings, such as argv, to the host.
+ */
+static int copy_string_array(Elkvm::VM *vm, guestptr_t array_p,
+    std::vector<std::string> &strings) {
+  if(array_p == 0x0) {
+    return 0;
+  }
+
+  for(guestptr_t p = array_p; ; p += sizeof(guestptr_t)) {
+    guestptr_t *entry = static_cast<guestptr_t *>(vm->host_p(p));
+    if(entry == nullptr) {
+      return -EFAULT;
+    }
+    if(*entry == 0x0) {
+      return 0;
+    }
+
+    char *str = static_cast<char *>(vm->host_p(*entry));
+    if(str == nullptr) {
+      return -EFAULT;
+    }
+    strings.emplace_back(str);
+  }
+}
+
+long elkvm_do_execve(Elkvm::VM * vm) {
+  guestptr_t path_p = 0x0;
+  guestptr_t argv_p = 0x0;
+  guestptr_t envp_p = 0x0;
+
+  vm->unpack_syscall(&path_p, &argv_p, &envp_p);
+
+  char *path = nullptr;
+  if(path_p != 0x0) {
+    path = static_cast<char *>(vm->host_p(path_p));
+  }
+  if(path == nullptr) {
+    return -EFAULT;
+  }
+  /* execve frees the guest memory path points into */
+  const std::string binary(path);
+
+  std::vector<std::string> argv;
+  std::vector<std::string> env;
+  int err = copy_string_array(vm, argv_p, argv);
+  if(err == 0) {
+    err = copy_string_array(vm, envp_p, env);
+  }
+  if(err == 0) {
+    err = vm->execve(binary, argv, env);
+  }
+
+  if(vm->debug_mode()) {
+    DBG() << "EXECVE path: " << LOG_GUEST_HOST(path_p, path)
+          << " [" << binary << "]"
+          << " argv: " << (void*)argv_p
+          << " (" << std::dec << argv.size() << ")"
+          << " envp: " << (void*)envp_p
+          << " (" << std::dec << env.size() << ")";
+    Elkvm::dbg_log_result(err);
+  }
+  return err;
+}
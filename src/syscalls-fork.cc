@@ -0,0 +1,242 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <memory>
+
+#include <linux/sched.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/iov.h>
+#include <elkvm/syscall.h>
+#include <elkvm/vcpu.h>
+
+/*
+ * The child is a forked host process, see VM::fork. Everything it would
+ * share with its parent beyond what fork shares cannot be provided.
+ */
+static const unsigned long clone_unsupported = CLONE_VM | CLONE_FS
+  | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD | CLONE_SYSVSEM;
+
+long elkvm_do_fork(Elkvm::VM * vmi) {
+  long result = vmi->fork();
+  if(vmi->debug_mode()) {
+    DBG() << "FORK";
+    Elkvm::dbg_log_result<int>(result);
+  }
+  return result;
+}
+
+long elkvm_do_vfork(Elkvm::VM * vmi) {
+  /* the parent does not have to wait, the child never writes to its memory */
+  long result = vmi->fork();
+  if(vmi->debug_mode()) {
+    DBG() << "VFORK";
+    Elkvm::dbg_log_result<int>(result);
+  }
+  return result;
+}
+
+static int set_child_tls(Elkvm::VM * vmi, guestptr_t tls) {
+  auto &vcpu = vmi->get_vcpu(0);
+  int err = vcpu->get_sregs();
+  if(err) {
+    return err;
+  }
+  Elkvm::Segment fs = vcpu->get_reg(Elkvm::Seg_t::fs);
+  fs.set_base(tls);
+  vcpu->set_reg(Elkvm::Seg_t::fs, fs);
+  return vcpu->set_sregs();
+}
+
+static long do_clone(Elkvm::VM * vmi, const char *name, uint64_t flags,
+    guestptr_t child_stack, guestptr_t ptid_p, guestptr_t ctid_p,
+    guestptr_t tls) {
+  int *ptid = nullptr;
+  if(flags & CLONE_PARENT_SETTID) {
+    ptid = static_cast<int *>(vmi->host_p(ptid_p));
+    if(ptid == nullptr) {
+      return -EFAULT;
+    }
+  }
+  int *ctid = nullptr;
+  if(flags & (CLONE_CHILD_SETTID | CLONE_CHILD_CLEARTID)) {
+    ctid = static_cast<int *>(vmi->host_p(ctid_p));
+    if(ctid == nullptr) {
+      return -EFAULT;
+    }
+  }
+
+  long result = vmi->fork();
+  if(result > 0 && ptid != nullptr) {
+    *ptid = result;
+  }
+
+  if(result == 0) {
+    /* the child sees its own copy of the parent's memory */
+    pid_t pid = getpid();
+    if(ptid != nullptr) {
+      *ptid = pid;
+    }
+    if(flags & CLONE_CHILD_SETTID) {
+      *ctid = pid;
+    }
+    if((flags & CLONE_CHILD_CLEARTID)
+        && vmi->get_handlers()->set_tid_address != nullptr) {
+      vmi->get_handlers()->set_tid_address(ctid);
+    }
+    if(child_stack != 0x0) {
+      vmi->get_vcpu(0)->set_reg(Elkvm::Reg_t::rsp, child_stack);
+    }
+    if(flags & CLONE_SETTLS) {
+      int err = set_child_tls(vmi, tls);
+      assert(err == 0 && "error setting tls of the child");
+    }
+  }
+
+  if(vmi->debug_mode()) {
+    DBG() << name << " with flags 0x" << std::hex << flags
+      << " child stack 0x" << child_stack << std::dec;
+    DBG() << "\tparent tid at: " << LOG_GUEST_HOST(ptid_p, ptid);
+    DBG() << "\tchild tid at: " << LOG_GUEST_HOST(ctid_p, ctid);
+    Elkvm::dbg_log_result<int>(result);
+  }
+  return result;
+}
+
+long elkvm_do_wait4(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->wait4 == nullptr) {
+    ERROR() << "WAIT4 handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype pid = 0x0;
+  CURRENT_ABI::paramtype wstatus_p = 0x0;
+  CURRENT_ABI::paramtype options = 0x0;
+  CURRENT_ABI::paramtype rusage_p = 0x0;
+
+  vmi->unpack_syscall(&pid, &wstatus_p, &options, &rusage_p);
+
+  /* fail before the child is reaped, its status would be lost otherwise */
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  Elkvm::guest_buffer status_buf;
+  int err = Elkvm::map_guest_buffer(pager, wstatus_p, sizeof(int), status_buf);
+  if(err) {
+    return err;
+  }
+  Elkvm::guest_buffer rusage_buf;
+  err = Elkvm::map_guest_buffer(pager, rusage_p, sizeof(struct rusage),
+      rusage_buf);
+  if(err) {
+    return err;
+  }
+  int *wstatus = static_cast<int *>(status_buf.host);
+  struct rusage *rusage = static_cast<struct rusage *>(rusage_buf.host);
+
+  long result = vmi->get_handlers()->wait4(static_cast<pid_t>(pid), wstatus,
+      static_cast<int>(options), rusage);
+  const int saved_errno = errno;
+  if(vmi->debug_mode()) {
+    DBG() << "WAIT4 for pid " << static_cast<pid_t>(pid)
+      << " options 0x" << std::hex << options << std::dec;
+    DBG() << "\tstatus at: " << LOG_GUEST_HOST(wstatus_p, wstatus);
+    DBG() << "\trusage at: " << LOG_GUEST_HOST(rusage_p, rusage);
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
+
+  err = Elkvm::unmap_guest_buffer(pager, status_buf, sizeof(int));
+  if(err == 0) {
+    err = Elkvm::unmap_guest_buffer(pager, rusage_buf, sizeof(struct rusage));
+  }
+  return err ? err : result;
+}
+
+long elkvm_do_clone(Elkvm::VM * vmi) {
+  CURRENT_ABI::paramtype flags = 0x0;
+  CURRENT_ABI::paramtype child_stack = 0x0;
+  CURRENT_ABI::paramtype ptid_p = 0x0;
+  CURRENT_ABI::paramtype ctid_p = 0x0;
+  CURRENT_ABI::paramtype tls = 0x0;
+
+  vmi->unpack_syscall(&flags, &child_stack, &ptid_p, &ctid_p, &tls);
+
+  if((flags & clone_unsupported) || (flags & CSIGNAL) != SIGCHLD) {
+    if(vmi->debug_mode()) {
+      DBG() << "CLONE with unsupported flags 0x" << std::hex << flags;
+    }
+    return -ENOSYS;
+  }
+
+  return do_clone(vmi, "CLONE", flags, child_stack, ptid_p, ctid_p, tls);
+}
+
+/*
+ * clone3 takes the same arguments as clone in a struct, with the exit signal
+ * split from the flags and the stack given as base and size. Whatever clone
+ * cannot do fails with ENOSYS, which makes the C library fall back to clone.
+ */
+static const uint64_t clone3_unsupported = clone_unsupported | CLONE_PIDFD
+  | CLONE_CLEAR_SIGHAND | CLONE_INTO_CGROUP;
+
+long elkvm_do_clone3(Elkvm::VM * vmi) {
+  guestptr_t args_p = 0x0;
+  CURRENT_ABI::paramtype size = 0x0;
+
+  vmi->unpack_syscall(&args_p, &size);
+
+  struct clone_args args = {};
+  if(size < CLONE_ARGS_SIZE_VER0) {
+    return -EINVAL;
+  }
+  int err = Elkvm::copy_from_guest(vmi->get_region_manager()->get_pager(),
+      &args, args_p, std::min<size_t>(size, sizeof(args)));
+  if(err) {
+    return err;
+  }
+
+  if(args.flags & CSIGNAL) {
+    return -EINVAL;
+  }
+  if((args.flags & clone3_unsupported) || args.exit_signal != SIGCHLD
+      || args.set_tid_size != 0) {
+    if(vmi->debug_mode()) {
+      DBG() << "CLONE3 with unsupported flags 0x" << std::hex << args.flags
+            << " exit signal " << std::dec << args.exit_signal;
+    }
+    return -ENOSYS;
+  }
+
+  guestptr_t child_stack = args.stack;
+  if(child_stack != 0x0) {
+    child_stack += args.stack_size;
+  }
+  return do_clone(vmi, "CLONE3", args.flags | args.exit_signal, child_stack,
+      args.parent_tid, args.child_tid, args.tls);
+}
@@ -0,0 +1,212 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <elkvm/dircache.h>
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/iov.h>
+#include <elkvm/overlay.h>
+#include <elkvm/syscall.h>
+#include <elkvm/types.h>
+
+/* no record is longer than one with a name of NAME_MAX characters */
+static const size_t max_reclen =
+  (offsetof(struct linux_dirent64, d_name) + NAME_MAX + 1 + 7) & ~7UL;
+
+/*
+ * Fills buf with as many whole records as fit into len bytes, returns the
+ * number of bytes used, -EINVAL if not even the next record fits, 0 at the
+ * end of the directory or another -errno.
+ */
+typedef std::function<long(void *buf, size_t len)> dirent_source;
+
+/*
+ * Fill the guest buffer described by iov, which may be split up in host
+ * memory, without a copy: every host part is filled on its own and the last
+ * record of a part is stretched to its end, so the guest sees one list of
+ * records. Returns the number of bytes used in the guest buffer.
+ */
+static long fill_dirents(const std::vector<struct iovec> &iov,
+    const dirent_source &next) {
+  long total = 0;
+  size_t start = 0;
+  struct linux_dirent64 *last = nullptr;
+
+  for(const auto &part : iov) {
+    long res = next(part.iov_base, part.iov_len);
+    if(res <= 0) {
+      return total > 0 ? total : res;
+    }
+
+    if(last != nullptr) {
+      last->d_reclen += start - total;
+    }
+    char *p = static_cast<char *>(part.iov_base);
+    char *end = p + res;
+    while(p < end) {
+      last = reinterpret_cast<struct linux_dirent64 *>(p);
+      p += last->d_reclen;
+    }
+    total = start + res;
+    start += part.iov_len;
+
+    /* another record would have fit, the directory has been read */
+    if(part.iov_len - res >= max_reclen) {
+      break;
+    }
+  }
+  return total;
+}
+
+/*
+ * Hands out the records of a cached listing from the directory position of
+ * fd on and moves that position along, so lseek, telldir and later passed
+ * through calls still see the same position as without the cache.
+ */
+class cached_dirents {
+  private:
+    int fd;
+    std::shared_ptr<const Elkvm::DirListing> listing;
+    size_t off;
+    int64_t pos;
+
+  public:
+    cached_dirents(int f, std::shared_ptr<const Elkvm::DirListing> l) :
+      fd(f), listing(l), off(Elkvm::DirListing::npos), pos(0) {
+      pos = lseek(fd, 0, SEEK_CUR);
+      if(pos >= 0) {
+        off = listing->find(pos);
+      }
+    }
+
+    bool valid() const { return off != Elkvm::DirListing::npos; }
+
+    long operator()(void *buf, size_t len) {
+      size_t n = 0;
+      int64_t next_pos = pos;
+      while(off + n < listing->size()) {
+        const struct linux_dirent64 *d =
+          reinterpret_cast<const struct linux_dirent64 *>(
+              listing->data() + off + n);
+        if(n + d->d_reclen > len) {
+          break;
+        }
+        n += d->d_reclen;
+        next_pos = d->d_off;
+      }
+      if(n == 0) {
+        return off < listing->size() ? -EINVAL : 0;
+      }
+
+      if(lseek(fd, next_pos, SEEK_SET) < 0) {
+        return -errno;
+      }
+      memcpy(buf, listing->data() + off, n);
+      off += n;
+      pos = next_pos;
+      return n;
+    }
+};
+
+long elkvm_do_getdents64(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->getdents64 == nullptr) {
+    ERROR() << "GETDENTS64 handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype fd = 0x0;
+  guestptr_t dirp_p = 0x0;
+  CURRENT_ABI::paramtype count = 0x0;
+
+  vmi->unpack_syscall(&fd, &dirp_p, &count);
+  count = std::min<CURRENT_ABI::paramtype>(count, INT_MAX);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  std::vector<struct iovec> iov;
+  ssize_t len = Elkvm::guest_to_host_iov(pager, dirp_p, count, iov);
+  if(len < 0) {
+    return len;
+  }
+
+  dirent_source source = [vmi, fd](void *buf, size_t size) -> long {
+    long res = vmi->get_handlers()->getdents64(fd,
+        static_cast<struct linux_dirent64 *>(buf), size);
+    return res < 0 ? -errno : res;
+  };
+  bool cached = false;
+  bool from_image = false;
+  std::shared_ptr<Elkvm::ImageOverlay> overlay = vmi->image_overlay();
+  if(overlay != nullptr && overlay->owns(fd)) {
+    source = [overlay, fd](void *buf, size_t size) -> long {
+      long res = 0;
+      overlay->getdents64(fd, buf, size, &res);
+      return res;
+    };
+    from_image = true;
+  } else if(vmi->dir_cache() != nullptr) {
+    auto listing = vmi->dir_cache()->get(fd);
+    if(listing != nullptr) {
+      cached_dirents c(fd, listing);
+      if(c.valid()) {
+        source = c;
+        cached = true;
+      }
+    }
+  }
+
+  long result = iov.empty() ? source(nullptr, 0) : fill_dirents(iov, source);
+  /* the first host part is too small for a record, but the buffer is not */
+  std::vector<char> bounce;
+  if(result == -EINVAL && iov.size() > 1) {
+    bounce.resize(len);
+    result = source(bounce.data(), len);
+    if(result > 0) {
+      int err = Elkvm::copy_to_guest(pager, dirp_p, bounce.data(), result);
+      if(err) {
+        result = err;
+      }
+    }
+  }
+
+  if(vmi->debug_mode()) {
+    DBG() << "GETDENTS64 with fd: " << fd << " dirp 0x" << std::hex << dirp_p
+          << std::dec << " count " << count << " in " << iov.size()
+          << " host buffer(s)" << (cached ? " from cache" : "")
+          << (from_image ? " from image" : "")
+          << (bounce.empty() ? "" : " (bounced)");
+    Elkvm::dbg_log_result<int>(result);
+  }
+  return result;
+}
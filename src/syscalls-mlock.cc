@@ -0,0 +1,136 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <errno.h>
+#include <sys/mman.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/iov.h>
+#include <elkvm/pager.h>
+#include <elkvm/region_manager.h>
+#include <elkvm/syscall.h>
+
+namespace Elkvm {
+
+/*
+ * Lock or unlock the host memory behind the guest range [addr, addr + len).
+ * Like on Linux the range is extended to page boundaries and all of it
+ * has to be mapped, otherwise -ENOMEM is returned.
+ */
+static long lock_guest_range(VM *vmi, guestptr_t addr, size_t len, bool lock) {
+  auto &pager = vmi->get_region_manager()->get_pager();
+
+  guestptr_t start = page_begin(addr);
+  if(addr + len < addr) {
+    return -EINVAL;
+  }
+  size_t remain = pagesize_align(addr + len - start);
+
+  while(remain > 0) {
+    std::vector<struct iovec> iov;
+    ssize_t bytes = guest_to_host_iov(pager, start, remain, iov);
+    if(bytes <= 0) {
+      return -ENOMEM;
+    }
+
+    for(const auto &v : iov) {
+      int err = lock
+        ? pager.populate_host_memory(v.iov_base, v.iov_len, ELKVM_MEM_LOCK)
+        : pager.unlock_host_memory(v.iov_base, v.iov_len);
+      if(err) {
+        return err;
+      }
+    }
+
+    start += bytes;
+    remain -= bytes;
+  }
+
+  return 0;
+}
+
+//namespace Elkvm
+}
+
+long elkvm_do_mlock(Elkvm::VM * vmi) {
+  guestptr_t addr = 0;
+  CURRENT_ABI::paramtype len = 0;
+  vmi->unpack_syscall(&addr, &len);
+
+  long result = Elkvm::lock_guest_range(vmi, addr, len, true);
+  if(vmi->debug_mode()) {
+    DBG() << "MLOCK addr: " << LOG_GUEST_HOST(addr, vmi->host_p(addr))
+          << " len: " << LOG_DEC_HEX(len);
+    Elkvm::dbg_log_result<int>(result);
+  }
+  return result;
+}
+
+long elkvm_do_munlock(Elkvm::VM * vmi) {
+  guestptr_t addr = 0;
+  CURRENT_ABI::paramtype len = 0;
+  vmi->unpack_syscall(&addr, &len);
+
+  long result = Elkvm::lock_guest_range(vmi, addr, len, false);
+  if(vmi->debug_mode()) {
+    DBG() << "MUNLOCK addr: " << LOG_GUEST_HOST(addr, vmi->host_p(addr))
+          << " len: " << LOG_DEC_HEX(len);
+    Elkvm::dbg_log_result<int>(result);
+  }
+  return result;
+}
+
+long elkvm_do_mlockall(Elkvm::VM * vmi) {
+  CURRENT_ABI::paramtype flags = 0;
+  vmi->unpack_syscall(&flags);
+
+  auto &pager = vmi->get_region_manager()->get_pager();
+  long result = 0;
+  if(flags == 0 || (flags & ~(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT))
+      || flags == MCL_ONFAULT) {
+    result = -EINVAL;
+  } else if(flags & MCL_FUTURE) {
+    /* new chunks get locked as well, this covers all future mappings */
+    result = pager.set_memory_policy(pager.memory_policy() | ELKVM_MEM_LOCK);
+  } else {
+    result = pager.apply_memory_policy(ELKVM_MEM_LOCK);
+  }
+
+  if(vmi->debug_mode()) {
+    DBG() << "MLOCKALL flags: 0x" << std::hex << flags;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  return result;
+}
+
+long elkvm_do_munlockall(Elkvm::VM * vmi) {
+  auto &pager = vmi->get_region_manager()->get_pager();
+  long result = pager.set_memory_policy(pager.memory_policy() & ~ELKVM_MEM_LOCK);
+
+  if(vmi->debug_mode()) {
+    DBG() << "MUNLOCKALL";
+    Elkvm::dbg_log_result<int>(result);
+  }
+  return result;
+}
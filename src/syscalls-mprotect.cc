@@ -24,6 +24,7 @@
 #include <elkvm/elkvm.h>
 #include <elkvm/elkvm-log.h>
 #include <elkvm/mapping.h>
+#include <elkvm/region.h>
 #include <elkvm/syscall.h>
 
 namespace Elkvm {
@@ -45,6 +46,8 @@ long elkvm_do_mprotect(Elkvm::VM * vmi) {
   CURRENT_ABI::paramtype len = 0;
   CURRENT_ABI::paramtype prot = 0;
   vmi->unpack_syscall(&addr, &len, &prot);
+  std::lock_guard<std::recursive_mutex> lock(
+      vmi->get_heap_manager().get_writer_lock());
 
   assert(page_aligned<guestptr_t>(addr) && "mprotect address must be page aligned");
   if(!vmi->get_heap_manager().address_mapped(addr)) {
@@ -59,7 +62,22 @@ long elkvm_do_mprotect(Elkvm::VM * vmi) {
   int err = 0;
 
   assert(mapping.get_length() >= len);
-  if(mapping.get_length() != len) {
+  if(mapping.get_length() != len && mapping.get_region()->is_shared()) {
+    /* shared memory cannot be split up, only the range's page table
+     * entries change */
+    auto &pager = vmi->get_region_manager()->get_pager();
+    void *host_p = static_cast<char *>(mapping.base_address())
+      + (addr - mapping.guest_address());
+    ptopt_t opts = (prot & PROT_WRITE) ? PT_OPT_WRITE : 0;
+    if(prot & PROT_EXEC) {
+      opts |= PT_OPT_EXEC;
+    }
+    if(prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) {
+      err = pager.map_region(host_p, addr, pages_from_size(len), opts);
+    } else {
+      err = pager.unmap_region(addr, pages_from_size(len));
+    }
+  } else if(mapping.get_length() != len) {
     /* this will invalidate the mapping ref! */
     slice_and_recreate(vmi, mapping, addr, len, prot);
   } else {
@@ -25,9 +25,48 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#include <string>
+
 #include <elkvm/elkvm.h>
+#include <elkvm/metacache.h>
+#include <elkvm/overlay.h>
 #include <elkvm/syscall.h>
 
+/*
+ * Opens of files in the image overlay are answered by it, opens of missing
+ * files can be answered by the metadata cache. pathname is replaced by the
+ * host path if it leads out of the image again.
+ */
+static bool open_in_monitor(Elkvm::VM *vm, int dirfd, const char **pathname,
+    int flags, long *result, std::string *host_path) {
+  auto &overlay = vm->image_overlay();
+  if(overlay != nullptr) {
+    if(overlay->open(dirfd, *pathname, flags, result, host_path)) {
+      return true;
+    }
+    if(!host_path->empty()) {
+      *pathname = host_path->c_str();
+    }
+  }
+
+  auto &cache = vm->metadata_cache();
+  return cache != nullptr && !(flags & (O_CREAT | O_NOFOLLOW))
+    && cache->lookup(Elkvm::MD_OPEN, *pathname, 0, result, nullptr, 0);
+}
+
+static void cache_open(Elkvm::VM *vm, const char *pathname, int flags,
+    long result) {
+  auto &cache = vm->metadata_cache();
+  if(cache == nullptr) {
+    return;
+  }
+  cache->opened(result, pathname, flags);
+  /* ENOTDIR from O_DIRECTORY is no failure stat would see */
+  if(!(flags & (O_CREAT | O_NOFOLLOW | O_DIRECTORY))) {
+    cache->insert(Elkvm::MD_OPEN, pathname, 0, result, nullptr, 0);
+  }
+}
+
 long elkvm_do_open(Elkvm::VM * vm) {
   if(vm->get_handlers()->open == nullptr) {
     ERROR() << "OPEN handler not found";
@@ -35,7 +74,7 @@ long elkvm_do_open(Elkvm::VM * vm) {
   }
 
   CURRENT_ABI::paramtype pathname_p = 0x0;
-  char *pathname = nullptr;
+  const char *pathname = nullptr;
   CURRENT_ABI::paramtype flags = 0x0;
   CURRENT_ABI::paramtype mode = 0x0;
 
@@ -44,8 +83,16 @@ long elkvm_do_open(Elkvm::VM * vm) {
 
   pathname = static_cast<char *>(vm->host_p(pathname_p));
 
-  long result = vm->get_handlers()->open(pathname,
-      static_cast<int>(flags), static_cast<mode_t>(mode));
+  std::string host_path;
+  long result;
+  if(!open_in_monitor(vm, AT_FDCWD, &pathname, flags, &result, &host_path)) {
+    result = vm->get_handlers()->open(pathname,
+        static_cast<int>(flags), static_cast<mode_t>(mode));
+    if(result < 0) {
+      result = -errno;
+    }
+    cache_open(vm, pathname, flags, result);
+  }
 
   if(vm->debug_mode()) {
     DBG() << "OPEN file " << LOG_GUEST_HOST(pathname_p, pathname)
@@ -70,13 +117,22 @@ long elkvm_do_openat(Elkvm::VM * vm) {
 
   vm->unpack_syscall(&dirfd, &pathname_p, &flags);
 
-  char *pathname = nullptr;
+  const char *pathname = nullptr;
   if(pathname_p != 0x0) {
     pathname = static_cast<char *>(vm->host_p(pathname_p));
   }
 
-  int res = vm->get_handlers()->openat(static_cast<int>(dirfd),
-      pathname, static_cast<int>(flags));
+  std::string host_path;
+  long res;
+  if(!open_in_monitor(vm, static_cast<int>(dirfd), &pathname, flags, &res,
+        &host_path)) {
+    res = vm->get_handlers()->openat(static_cast<int>(dirfd),
+        pathname, static_cast<int>(flags));
+    if(res < 0) {
+      res = -errno;
+    }
+    cache_open(vm, pathname, flags, res);
+  }
   if(vm->debug_mode()) {
     DBG() << "OPENAT with dirfd " << static_cast<int>(dirfd)
           << " pathname " << LOG_GUEST_HOST(pathname_p, pathname)
@@ -85,11 +141,7 @@ long elkvm_do_openat(Elkvm::VM * vm) {
     if(dirfd == AT_FDCWD) {
       DBG() << "-> AT_FDCWD";
     }
-    Elkvm::dbg_log_result(res);
-  }
-
-  if(res < 0) {
-    return -errno;
+    Elkvm::dbg_log_result<int>(res);
   }
 
   return res;
@@ -0,0 +1,352 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <time.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/iov.h>
+#include <elkvm/syscall.h>
+
+/*
+ * poll, ppoll, select and pselect6 wait on the guest's pollfd arrays and
+ * fd_sets in place, only arrays that are split up in host memory are
+ * copied. All of them wait with the signals the guest handles blocked
+ * until the host system call atomically unblocks them, so a signal for the
+ * guest either is seen before going to sleep or interrupts the wait. The
+ * sigmask of ppoll and pselect6 only applies to those signals, the host's
+ * own signals keep the mask of the calling thread.
+ */
+
+/* the fd_sets passed to the kernel only hold nfds bits */
+static size_t fd_set_bytes(int nfds) {
+  const size_t bits = 8 * sizeof(unsigned long);
+  return (nfds + bits - 1) / bits * sizeof(unsigned long);
+}
+
+static int read_timespec(const Elkvm::PagerX86_64 &pager, guestptr_t ts_p,
+    struct timespec *ts) {
+  int err = Elkvm::copy_from_guest(pager, ts, ts_p, sizeof(*ts));
+  if(err) {
+    return err;
+  }
+  if(ts->tv_sec < 0 || ts->tv_nsec < 0 || ts->tv_nsec >= 1000000000L) {
+    return -EINVAL;
+  }
+  return 0;
+}
+
+static long do_ppoll(Elkvm::VM * vmi, const char *name, guestptr_t fds_p,
+    nfds_t nfds, struct timespec *timeout, const sigset_t *sigmask) {
+  const Elkvm::elkvm_handlers *handlers = vmi->get_handlers();
+  if(handlers->ppoll == nullptr && handlers->poll == nullptr) {
+    ERROR() << name << " handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+  if(nfds > vmi->get_rlimit(RLIMIT_NOFILE)->rlim_cur) {
+    return -EINVAL;
+  }
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  const size_t len = nfds * sizeof(struct pollfd);
+  Elkvm::guest_buffer fds;
+  int err = Elkvm::map_guest_buffer(pager, fds_p, len, fds);
+  if(err) {
+    return err;
+  }
+
+  sigset_t oldset;
+  err = vmi->signal_block(&oldset);
+  assert(err == 0 && "error blocking signals");
+
+  sigset_t waitset = oldset;
+  if(sigmask != nullptr) {
+    vmi->signal_wait_mask(&oldset, sigmask, &waitset);
+  }
+
+  long result = -1;
+  if(vmi->signal_pending()) {
+    errno = EINTR;
+  } else if(handlers->ppoll != nullptr) {
+    result = handlers->ppoll(static_cast<struct pollfd *>(fds.host), nfds,
+        timeout, &waitset);
+  } else {
+    /* without ppoll a signal arriving right now is seen after the timeout */
+    pthread_sigmask(SIG_SETMASK, &waitset, nullptr);
+    int ms = -1;
+    if(timeout != nullptr) {
+      ms = std::min<long>(timeout->tv_sec * 1000
+          + (timeout->tv_nsec + 999999) / 1000000, INT_MAX);
+    }
+    result = handlers->poll(static_cast<struct pollfd *>(fds.host), nfds, ms);
+  }
+  const int saved_errno = errno;
+  pthread_sigmask(SIG_SETMASK, &oldset, nullptr);
+
+  if(vmi->debug_mode()) {
+    DBG() << name << " on " << nfds << " fds @ "
+          << LOG_GUEST_HOST(fds_p, fds.host)
+          << (fds.bounce.empty() ? "" : " (bounced)");
+    if(timeout != nullptr) {
+      DBG() << "\ttimeout " << timeout->tv_sec << "s "
+            << timeout->tv_nsec << "ns";
+    }
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
+
+  err = Elkvm::unmap_guest_buffer(pager, fds, len);
+  return err ? err : result;
+}
+
+long elkvm_do_poll(Elkvm::VM * vmi) {
+  guestptr_t fds_p = 0x0;
+  CURRENT_ABI::paramtype nfds = 0x0;
+  CURRENT_ABI::paramtype timeout_ms = 0x0;
+
+  vmi->unpack_syscall(&fds_p, &nfds, &timeout_ms);
+
+  const int ms = static_cast<int>(timeout_ms);
+  struct timespec timeout = { ms / 1000, (ms % 1000) * 1000000L };
+  return do_ppoll(vmi, "POLL", fds_p, nfds, ms < 0 ? nullptr : &timeout,
+      nullptr);
+}
+
+long elkvm_do_ppoll(Elkvm::VM * vmi) {
+  guestptr_t fds_p = 0x0;
+  CURRENT_ABI::paramtype nfds = 0x0;
+  guestptr_t timeout_p = 0x0;
+  guestptr_t sigmask_p = 0x0;
+  CURRENT_ABI::paramtype sigsetsize = 0x0;
+
+  vmi->unpack_syscall(&fds_p, &nfds, &timeout_p, &sigmask_p, &sigsetsize);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  struct timespec timeout;
+  if(timeout_p != 0x0) {
+    int err = read_timespec(pager, timeout_p, &timeout);
+    if(err) {
+      return err;
+    }
+  }
+  sigset_t sigmask;
+  if(sigmask_p != 0x0) {
+    int err = Elkvm::copy_sigset_from_guest(pager, &sigmask, sigmask_p,
+        sigsetsize);
+    if(err) {
+      return err;
+    }
+  }
+
+  long result = do_ppoll(vmi, "PPOLL", fds_p, nfds,
+      timeout_p != 0x0 ? &timeout : nullptr,
+      sigmask_p != 0x0 ? &sigmask : nullptr);
+
+  /* the time left is reported even if the wait was interrupted */
+  if(timeout_p != 0x0 && (result >= 0 || result == -EINTR)) {
+    int err = Elkvm::copy_to_guest(pager, timeout_p, &timeout,
+        sizeof(timeout));
+    if(err) {
+      return err;
+    }
+  }
+  return result;
+}
+
+static long do_pselect(Elkvm::VM * vmi, const char *name,
+    CURRENT_ABI::paramtype nfds, guestptr_t readfds_p, guestptr_t writefds_p,
+    guestptr_t exceptfds_p, struct timespec *timeout,
+    const sigset_t *sigmask) {
+  if(vmi->get_handlers()->pselect6 == nullptr) {
+    ERROR() << name << " handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+  if(static_cast<int>(nfds) < 0) {
+    return -EINVAL;
+  }
+  /* the kernel ignores the bits above the largest possible fd as well */
+  const int n = std::min<rlim_t>(static_cast<int>(nfds),
+      vmi->get_rlimit(RLIMIT_NOFILE)->rlim_cur);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  const size_t len = fd_set_bytes(n);
+  Elkvm::guest_buffer sets[3];
+  const guestptr_t sets_p[3] = { readfds_p, writefds_p, exceptfds_p };
+  for(int i = 0; i < 3; i++) {
+    int err = Elkvm::map_guest_buffer(pager, sets_p[i], len, sets[i]);
+    if(err) {
+      return err;
+    }
+  }
+
+  sigset_t oldset;
+  int err = vmi->signal_block(&oldset);
+  assert(err == 0 && "error blocking signals");
+
+  sigset_t waitset = oldset;
+  if(sigmask != nullptr) {
+    vmi->signal_wait_mask(&oldset, sigmask, &waitset);
+  }
+
+  long result = -1;
+  if(vmi->signal_pending()) {
+    errno = EINTR;
+  } else {
+    result = vmi->get_handlers()->pselect6(n,
+        static_cast<fd_set *>(sets[0].host),
+        static_cast<fd_set *>(sets[1].host),
+        static_cast<fd_set *>(sets[2].host), timeout, &waitset);
+  }
+  const int saved_errno = errno;
+  pthread_sigmask(SIG_SETMASK, &oldset, nullptr);
+
+  if(vmi->debug_mode()) {
+    DBG() << name << " with nfds " << n
+          << " readfds " << LOG_GUEST_HOST(readfds_p, sets[0].host)
+          << " writefds " << LOG_GUEST_HOST(writefds_p, sets[1].host)
+          << " exceptfds " << LOG_GUEST_HOST(exceptfds_p, sets[2].host);
+    if(timeout != nullptr) {
+      DBG() << "\ttimeout " << timeout->tv_sec << "s "
+            << timeout->tv_nsec << "ns";
+    }
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
+
+  for(int i = 0; i < 3; i++) {
+    err = Elkvm::unmap_guest_buffer(pager, sets[i], len);
+    if(err) {
+      return err;
+    }
+  }
+  return result;
+}
+
+long elkvm_do_select(Elkvm::VM * vmi) {
+  CURRENT_ABI::paramtype nfds = 0x0;
+  guestptr_t readfds_p = 0x0;
+  guestptr_t writefds_p = 0x0;
+  guestptr_t exceptfds_p = 0x0;
+  guestptr_t timeout_p = 0x0;
+
+  vmi->unpack_syscall(&nfds, &readfds_p, &writefds_p, &exceptfds_p,
+      &timeout_p);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  struct timeval tv;
+  struct timespec timeout;
+  if(timeout_p != 0x0) {
+    int err = Elkvm::copy_from_guest(pager, &tv, timeout_p, sizeof(tv));
+    if(err) {
+      return err;
+    }
+    if(tv.tv_sec < 0 || tv.tv_usec < 0) {
+      return -EINVAL;
+    }
+    /* like the kernel, accept more than a second's worth of microseconds */
+    timeout.tv_sec = tv.tv_sec + tv.tv_usec / 1000000;
+    timeout.tv_nsec = (tv.tv_usec % 1000000) * 1000;
+  }
+
+  long result = do_pselect(vmi, "SELECT", nfds, readfds_p, writefds_p,
+      exceptfds_p, timeout_p != 0x0 ? &timeout : nullptr, nullptr);
+
+  if(timeout_p != 0x0 && (result >= 0 || result == -EINTR)) {
+    tv.tv_sec = timeout.tv_sec;
+    tv.tv_usec = timeout.tv_nsec / 1000;
+    int err = Elkvm::copy_to_guest(pager, timeout_p, &tv, sizeof(tv));
+    if(err) {
+      return err;
+    }
+  }
+  return result;
+}
+
+long elkvm_do_pselect6(Elkvm::VM * vmi) {
+  CURRENT_ABI::paramtype nfds = 0x0;
+  guestptr_t readfds_p = 0x0;
+  guestptr_t writefds_p = 0x0;
+  guestptr_t exceptfds_p = 0x0;
+  guestptr_t timeout_p = 0x0;
+  guestptr_t sigmask_data_p = 0x0;
+
+  vmi->unpack_syscall(&nfds, &readfds_p, &writefds_p, &exceptfds_p,
+      &timeout_p, &sigmask_data_p);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  struct timespec timeout;
+  if(timeout_p != 0x0) {
+    int err = read_timespec(pager, timeout_p, &timeout);
+    if(err) {
+      return err;
+    }
+  }
+
+  /* the sigmask comes with its size, as there is no seventh argument */
+  sigset_t sigmask;
+  const sigset_t *mask = nullptr;
+  if(sigmask_data_p != 0x0) {
+    struct {
+      guestptr_t ss;
+      CURRENT_ABI::paramtype ss_len;
+    } data;
+    int err = Elkvm::copy_from_guest(pager, &data, sigmask_data_p,
+        sizeof(data));
+    if(err) {
+      return err;
+    }
+    if(data.ss != 0x0) {
+      err = Elkvm::copy_sigset_from_guest(pager, &sigmask, data.ss,
+          data.ss_len);
+      if(err) {
+        return err;
+      }
+      mask = &sigmask;
+    }
+  }
+
+  long result = do_pselect(vmi, "PSELECT6", nfds, readfds_p, writefds_p,
+      exceptfds_p, timeout_p != 0x0 ? &timeout : nullptr, mask);
+
+  if(timeout_p != 0x0 && (result >= 0 || result == -EINTR)) {
+    int err = Elkvm::copy_to_guest(pager, timeout_p, &timeout,
+        sizeof(timeout));
+    if(err) {
+      return err;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,228 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <vector>
+
+#include <sys/uio.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/iov.h>
+#include <elkvm/overlay.h>
+#include <elkvm/syscall.h>
+
+/*
+ * Positional I/O: guest buffers are translated into host buffers region by
+ * region, a buffer that is split up in host memory is read or written with
+ * a single preadv or pwritev at the same offset.
+ */
+
+/*
+ * Without a preadv or pwritev handler, a split up buffer is read or written
+ * one host buffer after the other, stopping at the first short transfer. As
+ * with the kernel, an error after some bytes were transferred returns their
+ * count.
+ */
+static long pread_pwrite_each(const Elkvm::elkvm_handlers *handlers, int fd,
+    const std::vector<struct iovec> &iov, off_t offset, bool write) {
+  long done = 0;
+  for(const auto &v : iov) {
+    long result = write
+      ? handlers->pwrite64(fd, v.iov_base, v.iov_len, offset + done)
+      : handlers->pread64(fd, v.iov_base, v.iov_len, offset + done);
+    if(result < 0) {
+      return done > 0 ? done : result;
+    }
+    done += result;
+    if(static_cast<size_t>(result) < v.iov_len) {
+      break;
+    }
+  }
+  return done;
+}
+
+static long do_pread_pwrite(Elkvm::VM * vmi, bool write) {
+  CURRENT_ABI::paramtype fd = 0x0;
+  guestptr_t buf_p = 0x0;
+  CURRENT_ABI::paramtype count = 0x0;
+  CURRENT_ABI::paramtype offset = 0x0;
+
+  vmi->unpack_syscall(&fd, &buf_p, &count, &offset);
+
+  std::vector<struct iovec> iov;
+  ssize_t len = Elkvm::guest_to_host_iov(vmi->get_region_manager()->get_pager(),
+      buf_p, count, iov);
+  if(len < 0) {
+    return len;
+  }
+  void *buf = iov.empty() ? nullptr : iov[0].iov_base;
+
+  long result;
+  auto &overlay = vmi->image_overlay();
+  if(!write && static_cast<off_t>(offset) >= 0 && overlay != nullptr
+      && overlay->readv(static_cast<int>(fd), iov.data(), iov.size(),
+        static_cast<off_t>(offset), &result)) {
+    return result;
+  }
+
+  const Elkvm::elkvm_handlers *handlers = vmi->get_handlers();
+  if(iov.size() <= 1) {
+    if(write) {
+      result = handlers->pwrite64(static_cast<int>(fd), buf, len, offset);
+    } else {
+      result = handlers->pread64(static_cast<int>(fd), buf, len, offset);
+    }
+  } else if(write && handlers->pwritev != nullptr) {
+    result = handlers->pwritev(static_cast<int>(fd), iov.data(), iov.size(),
+        offset);
+  } else if(!write && handlers->preadv != nullptr) {
+    result = handlers->preadv(static_cast<int>(fd), iov.data(), iov.size(),
+        offset);
+  } else {
+    result = pread_pwrite_each(handlers, static_cast<int>(fd), iov,
+        static_cast<off_t>(offset), write);
+  }
+
+  if(vmi->debug_mode()) {
+    DBG() << (write ? "PWRITE64 to fd: " : "PREAD64 from fd: ") << fd
+          << " with size " << LOG_DEC_HEX(len) << " of " << LOG_DEC_HEX(count)
+          << " at offset " << LOG_DEC_HEX(offset)
+          << " buf @ " << LOG_GUEST_HOST(buf_p, buf)
+          << " in " << iov.size() << " host buffer(s)";
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
+}
+
+long elkvm_do_pread64(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->pread64 == nullptr) {
+    ERROR() << "PREAD64 handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+  return do_pread_pwrite(vmi, false);
+}
+
+long elkvm_do_pwrite64(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->pwrite64 == nullptr) {
+    ERROR() << "PWRITE64 handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+  return do_pread_pwrite(vmi, true);
+}
+
+/*
+ * preadv and pwritev take the offset split up into a low and a high word,
+ * on x86_64 the low word holds all of it. The v2 variants add flags, where
+ * an offset of -1 uses and moves the file position.
+ */
+static long do_preadv_pwritev(Elkvm::VM * vmi, bool write, bool v2) {
+  CURRENT_ABI::paramtype fd = 0x0;
+  guestptr_t iov_p = 0x0;
+  CURRENT_ABI::paramtype iovcnt = 0x0;
+  CURRENT_ABI::paramtype pos_l = 0x0;
+  CURRENT_ABI::paramtype pos_h = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&fd, &iov_p, &iovcnt, &pos_l, &pos_h, &flags);
+  const off_t offset = static_cast<off_t>(pos_l);
+
+  std::vector<struct iovec> host_iov;
+  ssize_t len = Elkvm::guest_iov_to_host_iov(
+      vmi->get_region_manager()->get_pager(), iov_p, iovcnt, host_iov);
+  if(len < 0) {
+    return len;
+  }
+
+  long result;
+  auto &overlay = vmi->image_overlay();
+  if(!write && offset >= (v2 ? -1 : 0) && overlay != nullptr
+      && overlay->readv(static_cast<int>(fd), host_iov.data(),
+        host_iov.size(), offset, &result)) {
+    return result;
+  }
+
+  const Elkvm::elkvm_handlers *handlers = vmi->get_handlers();
+  if(v2 && write) {
+    result = handlers->pwritev2(static_cast<int>(fd), host_iov.data(),
+        host_iov.size(), offset, static_cast<int>(flags));
+  } else if(v2) {
+    result = handlers->preadv2(static_cast<int>(fd), host_iov.data(),
+        host_iov.size(), offset, static_cast<int>(flags));
+  } else if(write) {
+    result = handlers->pwritev(static_cast<int>(fd), host_iov.data(),
+        host_iov.size(), offset);
+  } else {
+    result = handlers->preadv(static_cast<int>(fd), host_iov.data(),
+        host_iov.size(), offset);
+  }
+
+  if(vmi->debug_mode()) {
+    DBG() << (write ? "PWRITEV" : "PREADV") << (v2 ? "2" : "")
+          << " with fd " << fd << " iov @ " << (void*)iov_p
+          << " count: " << iovcnt << " host count: " << host_iov.size()
+          << " offset: " << offset;
+    if(v2) {
+      DBG() << "\tflags: 0x" << std::hex << flags << std::dec;
+    }
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
+}
+
+long elkvm_do_preadv(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->preadv == nullptr) {
+    ERROR() << "PREADV handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+  return do_preadv_pwritev(vmi, false, false);
+}
+
+long elkvm_do_pwritev(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->pwritev == nullptr) {
+    ERROR() << "PWRITEV handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+  return do_preadv_pwritev(vmi, true, false);
+}
+
+long elkvm_do_preadv2(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->preadv2 == nullptr) {
+    ERROR() << "PREADV2 handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+  return do_preadv_pwritev(vmi, false, true);
+}
+
+long elkvm_do_pwritev2(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->pwritev2 == nullptr) {
+    ERROR() << "PWRITEV2 handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+  return do_preadv_pwritev(vmi, true, true);
+}
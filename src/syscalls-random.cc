@@ -0,0 +1,77 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <vector>
+
+#include <errno.h>
+#include <sys/uio.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/iov.h>
+#include <elkvm/syscall.h>
+
+long elkvm_do_getrandom(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->getrandom == nullptr) {
+    ERROR() << "GETRANDOM handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  guestptr_t buf_p = 0x0;
+  CURRENT_ABI::paramtype buflen = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&buf_p, &buflen, &flags);
+
+  std::vector<struct iovec> iov;
+  ssize_t count = Elkvm::guest_to_host_iov(
+      vmi->get_region_manager()->get_pager(), buf_p, buflen, iov);
+  if(count < 0) {
+    return count;
+  }
+
+  /* the random bytes are written straight into the guest's chunks */
+  long result = 0;
+  for(const auto &seg : iov) {
+    long res = vmi->get_handlers()->getrandom(seg.iov_base, seg.iov_len,
+        flags);
+    if(res < 0) {
+      if(result == 0) {
+        result = -errno;
+      }
+      break;
+    }
+    result += res;
+    if(static_cast<size_t>(res) < seg.iov_len) {
+      break;
+    }
+  }
+
+  if(vmi->debug_mode()) {
+    DBG() << "GETRANDOM " << LOG_DEC_HEX(buflen) << " bytes to 0x" << std::hex
+          << buf_p << " flags 0x" << flags << std::dec << " in " << iov.size()
+          << " host buffer(s)";
+    Elkvm::dbg_log_result<int>(result);
+  }
+  return result;
+}
@@ -22,9 +22,11 @@
 //
 
 #include <elkvm/elkvm.h>
+#include <elkvm/iov.h>
 
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <unistd.h>
 
 long elkvm_do_getrlimit(Elkvm::VM *vm) {
   CURRENT_ABI::paramtype resource = 0x0;
@@ -71,3 +73,57 @@ long elkvm_do_setrlimit(Elkvm::VM * vm) {
   }
   return err;
 }
+
+long elkvm_do_prlimit64(Elkvm::VM * vm) {
+  CURRENT_ABI::paramtype pid = 0x0;
+  CURRENT_ABI::paramtype resource = 0x0;
+  guestptr_t new_limit_p = 0x0;
+  guestptr_t old_limit_p = 0x0;
+
+  vm->unpack_syscall(&pid, &resource, &new_limit_p, &old_limit_p);
+
+  /* the limits of other processes are none of the guest's business */
+  if(pid != 0 && static_cast<pid_t>(pid) != getpid()) {
+    return -EPERM;
+  }
+  if(resource >= RLIMIT_NLIMITS) {
+    return -EINVAL;
+  }
+
+  const Elkvm::PagerX86_64 &pager = vm->get_region_manager()->get_pager();
+  struct rlimit new_limit;
+  if(new_limit_p != 0x0) {
+    int err = Elkvm::copy_from_guest(pager, &new_limit, new_limit_p,
+        sizeof(new_limit));
+    if(err) {
+      return err;
+    }
+    if(new_limit.rlim_cur > new_limit.rlim_max) {
+      return -EINVAL;
+    }
+  }
+
+  const struct rlimit old_limit = *vm->get_rlimit(resource);
+  if(new_limit_p != 0x0) {
+    if(vm->get_handlers()->setrlimit == nullptr) {
+      return -ENOSYS;
+    }
+    long result = vm->get_handlers()->setrlimit(resource, &new_limit);
+    if(result < 0) {
+      return -errno;
+    }
+    vm->set_rlimit(resource, &new_limit);
+  }
+
+  if(vm->debug_mode()) {
+    DBG() << "PRLIMIT64 with pid: " << std::dec << pid << " resource: "
+          << resource << " new limit @ 0x" << std::hex << new_limit_p
+          << " old limit @ 0x" << old_limit_p << std::dec;
+  }
+
+  if(old_limit_p != 0x0) {
+    return Elkvm::copy_to_guest(pager, old_limit_p, &old_limit,
+        sizeof(old_limit));
+  }
+  return 0;
+}
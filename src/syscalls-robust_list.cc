@@ -49,3 +49,15 @@ long elkvm_do_set_robust_list(Elkvm::VM *vm __attribute__((unused))) {
   return result;
 }
 
+
+/*
+ * The host C library already registered its own rseq area for this thread
+ * and the kernel would only ever restart host code anyway. Failing with
+ * ENOSYS makes the guest C library run without restartable sequences.
+ */
+long elkvm_do_rseq(Elkvm::VM *vm) {
+  if(vm->debug_mode()) {
+    DBG() << "RSEQ not supported";
+  }
+  return -ENOSYS;
+}
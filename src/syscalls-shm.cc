@@ -0,0 +1,174 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <mutex>
+#include <string>
+
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-internal.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/heap.h>
+#include <elkvm/region.h>
+#include <elkvm/region_manager.h>
+#include <elkvm/syscall.h>
+
+/*
+ * System V segments are attached to the host process, each into a memory
+ * slot of its own, see PagerX86_64::attach_shared_memory. Guests in other
+ * VMs and processes that attach the same segment share its pages.
+ */
+static const std::string shm_region_name = "System V shared memory";
+
+long elkvm_do_shmget(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->shmget == nullptr) {
+    ERROR() << "SHMGET handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype key = 0x0;
+  CURRENT_ABI::paramtype size = 0x0;
+  CURRENT_ABI::paramtype shmflg = 0x0;
+
+  vmi->unpack_syscall(&key, &size, &shmflg);
+
+  long result = vmi->get_handlers()->shmget(static_cast<key_t>(key), size,
+      static_cast<int>(shmflg));
+  if(vmi->debug_mode()) {
+    DBG() << "SHMGET with key 0x" << std::hex << key
+      << " size 0x" << size << " flags 0x" << shmflg << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
+}
+
+long elkvm_do_shmat(Elkvm::VM * vmi) {
+  CURRENT_ABI::paramtype shmid = 0x0;
+  guestptr_t shmaddr = 0x0;
+  CURRENT_ABI::paramtype shmflg = 0x0;
+
+  vmi->unpack_syscall(&shmid, &shmaddr, &shmflg);
+
+  if(vmi->get_handlers()->shmctl == nullptr) {
+    ERROR() << "SHMCTL handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+  struct shmid_ds ds;
+  if(vmi->get_handlers()->shmctl(static_cast<int>(shmid), IPC_STAT, &ds) < 0) {
+    return -errno;
+  }
+  const size_t size = pagesize_align(ds.shm_segsz);
+
+  if(shmflg & SHM_RND) {
+    shmaddr &= ~(static_cast<guestptr_t>(SHMLBA) - 1);
+  }
+  if(!page_aligned<guestptr_t>(shmaddr)) {
+    return -EINVAL;
+  }
+
+  auto &hm = vmi->get_heap_manager();
+  std::lock_guard<std::recursive_mutex> lock(hm.get_writer_lock());
+  if(shmaddr != 0x0 && hm.address_mapped(shmaddr)) {
+    return -EINVAL;
+  }
+
+  const bool readonly = shmflg & SHM_RDONLY;
+  auto r = vmi->get_region_manager()->attach_shared(static_cast<int>(shmid),
+      size, readonly, shm_region_name);
+  if(r == nullptr) {
+    return -errno;
+  }
+
+  int prot = readonly ? PROT_READ : PROT_READ | PROT_WRITE;
+  if(shmflg & SHM_EXEC) {
+    prot |= PROT_EXEC;
+  }
+  Elkvm::Mapping &mapping = hm.create_mapping(shmaddr, size, prot,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0, r);
+  hm.add_segment(mapping.guest_address(), r);
+
+  if(vmi->debug_mode()) {
+    DBG() << "SHMAT with shmid " << shmid << " addr 0x" << std::hex << shmaddr
+      << " flags 0x" << shmflg << std::dec;
+    print(std::cout, mapping);
+  }
+  return mapping.guest_address();
+}
+
+long elkvm_do_shmdt(Elkvm::VM * vmi) {
+  guestptr_t shmaddr = 0x0;
+  vmi->unpack_syscall(&shmaddr);
+
+  auto &hm = vmi->get_heap_manager();
+  std::lock_guard<std::recursive_mutex> lock(hm.get_writer_lock());
+  Elkvm::Mapping *segment = hm.find_segment(shmaddr);
+  if(segment == nullptr) {
+    return -EINVAL;
+  }
+  Elkvm::Mapping &mapping = *segment;
+
+  if(vmi->debug_mode()) {
+    DBG() << "SHMDT with addr 0x" << std::hex << shmaddr << std::dec;
+    print(std::cout, mapping);
+  }
+
+  /* the segment is detached with the last page of the mapping */
+  hm.unmap(mapping);
+  return 0;
+}
+
+long elkvm_do_shmctl(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->shmctl == nullptr) {
+    ERROR() << "SHMCTL handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype shmid = 0x0;
+  CURRENT_ABI::paramtype cmd = 0x0;
+  CURRENT_ABI::paramtype buf_p = 0x0;
+
+  vmi->unpack_syscall(&shmid, &cmd, &buf_p);
+
+  struct shmid_ds *buf = nullptr;
+  if(buf_p != 0x0) {
+    buf = static_cast<struct shmid_ds *>(vmi->host_p(buf_p));
+  }
+
+  long result = vmi->get_handlers()->shmctl(static_cast<int>(shmid),
+      static_cast<int>(cmd), buf);
+  if(vmi->debug_mode()) {
+    DBG() << "SHMCTL with shmid " << shmid << " cmd " << cmd;
+    DBG() << "\tbuf at: " << LOG_GUEST_HOST(buf_p, buf);
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
+}
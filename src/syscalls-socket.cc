@@ -23,14 +23,89 @@
 
 #include <elkvm/elkvm.h>
 #include <elkvm/elkvm-log.h>
+#include <elkvm/iov.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
 
 #include <errno.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*
+ * A guest struct msghdr with its name, data and control messages
+ * translated to host memory.
+ */
+struct host_msghdr {
+  struct msghdr msg;
+  std::vector<struct iovec> iov;
+  Elkvm::guest_buffer name;
+  Elkvm::guest_buffer control;
+
+  host_msghdr() : msg(), iov(), name(), control() {}
+};
+
+static int to_host_msghdr(const Elkvm::PagerX86_64 &pager, guestptr_t msg_p,
+    host_msghdr &h) {
+  struct msghdr g;
+  int err = Elkvm::copy_from_guest(pager, &g, msg_p, sizeof(g));
+  if(err) {
+    return err;
+  }
 
-long elkvm_do_sendfile(Elkvm::VM * vmi __attribute__((unused))) {
-  ERROR() << "unimplemented"; exit(1);
-  return -ENOSYS;
+  err = Elkvm::map_guest_buffer(pager,
+      reinterpret_cast<guestptr_t>(g.msg_name), g.msg_namelen, h.name);
+  if(err) {
+    return err;
+  }
+  err = Elkvm::map_guest_buffer(pager,
+      reinterpret_cast<guestptr_t>(g.msg_control), g.msg_controllen,
+      h.control);
+  if(err) {
+    return err;
+  }
+  if(g.msg_iovlen > 0) {
+    ssize_t len = Elkvm::guest_iov_to_host_iov(pager,
+        reinterpret_cast<guestptr_t>(g.msg_iov), g.msg_iovlen, h.iov);
+    if(len < 0) {
+      return len;
+    }
+  }
+
+  h.msg = g;
+  h.msg.msg_name = h.name.host;
+  h.msg.msg_iov = h.iov.data();
+  h.msg.msg_iovlen = h.iov.size();
+  h.msg.msg_control = h.control.host;
+  return 0;
+}
+
+/* hand the name, control messages and flags the kernel returned to the
+ * guest, for received messages */
+static int to_guest_msghdr(const Elkvm::PagerX86_64 &pager, guestptr_t msg_p,
+    const host_msghdr &h) {
+  int err = Elkvm::unmap_guest_buffer(pager, h.name, h.msg.msg_namelen);
+  if(!err) {
+    err = Elkvm::unmap_guest_buffer(pager, h.control, h.msg.msg_controllen);
+  }
+  if(!err) {
+    err = Elkvm::copy_to_guest(pager, msg_p + offsetof(struct msghdr, msg_namelen),
+        &h.msg.msg_namelen, sizeof(h.msg.msg_namelen));
+  }
+  if(!err) {
+    err = Elkvm::copy_to_guest(pager,
+        msg_p + offsetof(struct msghdr, msg_controllen),
+        &h.msg.msg_controllen, sizeof(h.msg.msg_controllen));
+  }
+  if(!err) {
+    err = Elkvm::copy_to_guest(pager, msg_p + offsetof(struct msghdr, msg_flags),
+        &h.msg.msg_flags, sizeof(h.msg.msg_flags));
+  }
+  return err;
 }
 
 long elkvm_do_socket(Elkvm::VM * vmi __attribute__((unused))) {
@@ -42,9 +117,36 @@ long elkvm_do_socket(Elkvm::VM * vmi __attribute__((unused))) {
   return vmi->get_handlers()->socket(domain, type, protocol);
 }
 
-long elkvm_do_connect(Elkvm::VM * vmi __attribute__((unused))) {
-  ERROR() << "unimplemented"; exit(1);
-  return -ENOSYS;
+long elkvm_do_connect(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->connect == nullptr) {
+    ERROR() << "CONNECT handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype sock = 0x0;
+  guestptr_t addr_p = 0x0;
+  CURRENT_ABI::paramtype addrlen = 0x0;
+
+  vmi->unpack_syscall(&sock, &addr_p, &addrlen);
+
+  Elkvm::guest_buffer addr;
+  int err = Elkvm::map_guest_buffer(vmi->get_region_manager()->get_pager(),
+      addr_p, addrlen, addr);
+  if(err) {
+    return err;
+  }
+
+  long result = vmi->get_handlers()->connect(sock,
+      static_cast<const struct sockaddr *>(addr.host), addrlen);
+  if(vmi->debug_mode()) {
+    DBG() << "CONNECT socket " << sock << " to "
+          << LOG_GUEST_HOST(addr_p, addr.host) << " len " << addrlen;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
 }
 
 long elkvm_do_accept(Elkvm::VM * vmi __attribute__((unused))) {
@@ -66,29 +168,285 @@ long elkvm_do_accept(Elkvm::VM * vmi __attribute__((unused))) {
   return vmi->get_handlers()->accept(sock, local_addr, local_len);
 }
 
-long elkvm_do_sendto(Elkvm::VM * vmi __attribute__((unused))) {
-  ERROR() << "unimplemented"; exit(1);
-  return -ENOSYS;
+long elkvm_do_accept4(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->accept4 == nullptr) {
+    ERROR() << "ACCEPT4 handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype sock = 0x0;
+  guestptr_t addr_p = 0x0;
+  guestptr_t addrlen_p = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&sock, &addr_p, &addrlen_p, &flags);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  socklen_t addrlen = 0;
+  Elkvm::guest_buffer addr;
+  if(addr_p != 0x0 && addrlen_p != 0x0) {
+    int err = Elkvm::copy_from_guest(pager, &addrlen, addrlen_p,
+        sizeof(addrlen));
+    if(!err) {
+      err = Elkvm::map_guest_buffer(pager, addr_p, addrlen, addr);
+    }
+    if(err) {
+      return err;
+    }
+  } else {
+    Elkvm::map_guest_buffer(pager, 0x0, 0, addr);
+  }
+
+  long result = vmi->get_handlers()->accept4(sock,
+      static_cast<struct sockaddr *>(addr.host),
+      addr.host == nullptr ? nullptr : &addrlen, flags);
+  const int saved_errno = errno;
+  if(vmi->debug_mode()) {
+    DBG() << "ACCEPT4 on socket " << sock << " flags 0x" << std::hex << flags
+          << std::dec << " peer " << LOG_GUEST_HOST(addr_p, addr.host);
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
+
+  if(addr.host != nullptr) {
+    int err = Elkvm::unmap_guest_buffer(pager, addr, addrlen);
+    if(!err) {
+      err = Elkvm::copy_to_guest(pager, addrlen_p, &addrlen, sizeof(addrlen));
+    }
+    if(err) {
+      close(result);
+      return err;
+    }
+  }
+  return result;
 }
 
-long elkvm_do_recvfrom(Elkvm::VM * vmi __attribute__((unused))) {
-  ERROR() << "unimplemented"; exit(1);
-  return -ENOSYS;
+/*
+ * Data buffers which are split up in host memory are sent and received
+ * with a single sendmsg or recvmsg, just like read and readv.
+ */
+long elkvm_do_sendto(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->sendto == nullptr) {
+    ERROR() << "SENDTO handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype sock = 0x0;
+  guestptr_t buf_p = 0x0;
+  CURRENT_ABI::paramtype len = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+  guestptr_t addr_p = 0x0;
+  CURRENT_ABI::paramtype addrlen = 0x0;
+
+  vmi->unpack_syscall(&sock, &buf_p, &len, &flags, &addr_p, &addrlen);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  Elkvm::guest_buffer addr;
+  int err = Elkvm::map_guest_buffer(pager, addr_p, addrlen, addr);
+  if(err) {
+    return err;
+  }
+  std::vector<struct iovec> iov;
+  ssize_t count = Elkvm::guest_to_host_iov(pager, buf_p, len, iov);
+  if(count < 0) {
+    return count;
+  }
+
+  long result;
+  if(iov.size() <= 1) {
+    result = vmi->get_handlers()->sendto(sock,
+        iov.empty() ? nullptr : iov[0].iov_base, count, flags,
+        static_cast<const struct sockaddr *>(addr.host), addrlen);
+  } else {
+    if(vmi->get_handlers()->sendmsg == nullptr) {
+      ERROR() << "SENDMSG handler not found" << LOG_RESET << "\n";
+      return -ENOSYS;
+    }
+    struct msghdr msg = {};
+    msg.msg_name = addr.host;
+    msg.msg_namelen = addrlen;
+    msg.msg_iov = iov.data();
+    msg.msg_iovlen = iov.size();
+    result = vmi->get_handlers()->sendmsg(sock, &msg, flags);
+  }
+
+  if(vmi->debug_mode()) {
+    DBG() << "SENDTO socket " << sock << " with size " << LOG_DEC_HEX(count)
+          << " of " << LOG_DEC_HEX(len) << " in " << iov.size()
+          << " host buffer(s) to " << LOG_GUEST_HOST(addr_p, addr.host);
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
 }
 
-long elkvm_do_sendmsg(Elkvm::VM * vmi __attribute__((unused))) {
-  ERROR() << "unimplemented"; exit(1);
-  return -ENOSYS;
+long elkvm_do_recvfrom(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->recvfrom == nullptr) {
+    ERROR() << "RECVFROM handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype sock = 0x0;
+  guestptr_t buf_p = 0x0;
+  CURRENT_ABI::paramtype len = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+  guestptr_t addr_p = 0x0;
+  guestptr_t addrlen_p = 0x0;
+
+  vmi->unpack_syscall(&sock, &buf_p, &len, &flags, &addr_p, &addrlen_p);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  socklen_t addrlen = 0;
+  Elkvm::guest_buffer addr;
+  if(addr_p != 0x0 && addrlen_p != 0x0) {
+    int err = Elkvm::copy_from_guest(pager, &addrlen, addrlen_p,
+        sizeof(addrlen));
+    if(!err) {
+      err = Elkvm::map_guest_buffer(pager, addr_p, addrlen, addr);
+    }
+    if(err) {
+      return err;
+    }
+  } else {
+    Elkvm::map_guest_buffer(pager, 0x0, 0, addr);
+  }
+  std::vector<struct iovec> iov;
+  ssize_t count = Elkvm::guest_to_host_iov(pager, buf_p, len, iov);
+  if(count < 0) {
+    return count;
+  }
+
+  long result;
+  if(iov.size() <= 1) {
+    result = vmi->get_handlers()->recvfrom(sock,
+        iov.empty() ? nullptr : iov[0].iov_base, count, flags,
+        static_cast<struct sockaddr *>(addr.host),
+        addr.host == nullptr ? nullptr : &addrlen);
+  } else {
+    if(vmi->get_handlers()->recvmsg == nullptr) {
+      ERROR() << "RECVMSG handler not found" << LOG_RESET << "\n";
+      return -ENOSYS;
+    }
+    struct msghdr msg = {};
+    msg.msg_name = addr.host;
+    msg.msg_namelen = addrlen;
+    msg.msg_iov = iov.data();
+    msg.msg_iovlen = iov.size();
+    result = vmi->get_handlers()->recvmsg(sock, &msg, flags);
+    addrlen = msg.msg_namelen;
+  }
+  const int saved_errno = errno;
+
+  if(vmi->debug_mode()) {
+    DBG() << "RECVFROM socket " << sock << " with size " << LOG_DEC_HEX(count)
+          << " of " << LOG_DEC_HEX(len) << " in " << iov.size()
+          << " host buffer(s) from " << LOG_GUEST_HOST(addr_p, addr.host);
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
+
+  if(addr.host != nullptr) {
+    int err = Elkvm::unmap_guest_buffer(pager, addr, addrlen);
+    if(!err) {
+      err = Elkvm::copy_to_guest(pager, addrlen_p, &addrlen, sizeof(addrlen));
+    }
+    if(err) {
+      return err;
+    }
+  }
+  return result;
 }
 
-long elkvm_do_recvmsg(Elkvm::VM * vmi __attribute__((unused))) {
-  ERROR() << "unimplemented"; exit(1);
-  return -ENOSYS;
+long elkvm_do_sendmsg(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->sendmsg == nullptr) {
+    ERROR() << "SENDMSG handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype sock = 0x0;
+  guestptr_t msg_p = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&sock, &msg_p, &flags);
+
+  host_msghdr h;
+  int err = to_host_msghdr(vmi->get_region_manager()->get_pager(), msg_p, h);
+  if(err) {
+    return err;
+  }
+
+  long result = vmi->get_handlers()->sendmsg(sock, &h.msg, flags);
+  if(vmi->debug_mode()) {
+    DBG() << "SENDMSG socket " << sock << " msg @ 0x" << std::hex << msg_p
+          << std::dec << " in " << h.iov.size() << " host buffer(s)";
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
 }
 
-long elkvm_do_shutdown(Elkvm::VM * vmi __attribute__((unused))) {
-  ERROR() << "unimplemented"; exit(1);
-  return -ENOSYS;
+long elkvm_do_recvmsg(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->recvmsg == nullptr) {
+    ERROR() << "RECVMSG handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype sock = 0x0;
+  guestptr_t msg_p = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&sock, &msg_p, &flags);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  host_msghdr h;
+  int err = to_host_msghdr(pager, msg_p, h);
+  if(err) {
+    return err;
+  }
+
+  long result = vmi->get_handlers()->recvmsg(sock, &h.msg, flags);
+  const int saved_errno = errno;
+  if(vmi->debug_mode()) {
+    DBG() << "RECVMSG socket " << sock << " msg @ 0x" << std::hex << msg_p
+          << std::dec << " in " << h.iov.size() << " host buffer(s)";
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
+
+  err = to_guest_msghdr(pager, msg_p, h);
+  return err ? err : result;
+}
+
+long elkvm_do_shutdown(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->shutdown == nullptr) {
+    ERROR() << "SHUTDOWN handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype sock = 0x0;
+  CURRENT_ABI::paramtype how = 0x0;
+
+  vmi->unpack_syscall(&sock, &how);
+
+  long result = vmi->get_handlers()->shutdown(sock, how);
+  if(vmi->debug_mode()) {
+    DBG() << "SHUTDOWN socket " << sock << " how " << how;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
 }
 
 long elkvm_do_bind(Elkvm::VM * vmi __attribute__((unused))) {
@@ -164,3 +522,132 @@ long elkvm_do_getsockopt(Elkvm::VM * vmi __attribute__((unused))) {
   return -ENOSYS;
 }
 
+/*
+ * Batched messages: all headers of the batch are translated up front and
+ * go to the host with a single recvmmsg or sendmmsg, so many datagrams
+ * only cost a single VM exit. The kernel handles at most UIO_MAXIOV
+ * messages per call.
+ */
+static int to_host_mmsghdrs(const Elkvm::PagerX86_64 &pager, guestptr_t vec_p,
+    unsigned vlen, std::vector<host_msghdr> &hs,
+    std::vector<struct mmsghdr> &msgs) {
+  hs.resize(vlen);
+  msgs.resize(vlen);
+  for(unsigned i = 0; i < vlen; i++) {
+    int err = to_host_msghdr(pager, vec_p + i * sizeof(struct mmsghdr), hs[i]);
+    if(err) {
+      return err;
+    }
+    msgs[i].msg_hdr = hs[i].msg;
+    msgs[i].msg_len = 0;
+  }
+  return 0;
+}
+
+long elkvm_do_recvmmsg(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->recvmmsg == nullptr) {
+    ERROR() << "RECVMMSG handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype sock = 0x0;
+  guestptr_t vec_p = 0x0;
+  CURRENT_ABI::paramtype vlen = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+  guestptr_t timeout_p = 0x0;
+
+  vmi->unpack_syscall(&sock, &vec_p, &vlen, &flags, &timeout_p);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  struct timespec timeout;
+  if(timeout_p != 0x0) {
+    int err = Elkvm::copy_from_guest(pager, &timeout, timeout_p,
+        sizeof(timeout));
+    if(err) {
+      return err;
+    }
+  }
+
+  std::vector<host_msghdr> hs;
+  std::vector<struct mmsghdr> msgs;
+  int err = to_host_mmsghdrs(pager, vec_p,
+      std::min<CURRENT_ABI::paramtype>(vlen, UIO_MAXIOV), hs, msgs);
+  if(err) {
+    return err;
+  }
+
+  long result = vmi->get_handlers()->recvmmsg(sock, msgs.data(), msgs.size(),
+      flags, timeout_p == 0x0 ? nullptr : &timeout);
+  const int saved_errno = errno;
+  if(vmi->debug_mode()) {
+    DBG() << "RECVMMSG socket " << sock << " " << msgs.size()
+          << " messages @ 0x" << std::hex << vec_p << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
+
+  for(long i = 0; i < result; i++) {
+    const guestptr_t msg_p = vec_p + i * sizeof(struct mmsghdr);
+    hs[i].msg = msgs[i].msg_hdr;
+    err = to_guest_msghdr(pager, msg_p, hs[i]);
+    if(!err) {
+      err = Elkvm::copy_to_guest(pager,
+          msg_p + offsetof(struct mmsghdr, msg_len), &msgs[i].msg_len,
+          sizeof(msgs[i].msg_len));
+    }
+    if(err) {
+      return err;
+    }
+  }
+  if(timeout_p != 0x0) {
+    err = Elkvm::copy_to_guest(pager, timeout_p, &timeout, sizeof(timeout));
+  }
+  return err ? err : result;
+}
+
+long elkvm_do_sendmmsg(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->sendmmsg == nullptr) {
+    ERROR() << "SENDMMSG handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype sock = 0x0;
+  guestptr_t vec_p = 0x0;
+  CURRENT_ABI::paramtype vlen = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&sock, &vec_p, &vlen, &flags);
+
+  const Elkvm::PagerX86_64 &pager = vmi->get_region_manager()->get_pager();
+  std::vector<host_msghdr> hs;
+  std::vector<struct mmsghdr> msgs;
+  int err = to_host_mmsghdrs(pager, vec_p,
+      std::min<CURRENT_ABI::paramtype>(vlen, UIO_MAXIOV), hs, msgs);
+  if(err) {
+    return err;
+  }
+
+  long result = vmi->get_handlers()->sendmmsg(sock, msgs.data(), msgs.size(),
+      flags);
+  const int saved_errno = errno;
+  if(vmi->debug_mode()) {
+    DBG() << "SENDMMSG socket " << sock << " " << msgs.size()
+          << " messages @ 0x" << std::hex << vec_p << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
+
+  for(long i = 0; i < result; i++) {
+    err = Elkvm::copy_to_guest(pager, vec_p + i * sizeof(struct mmsghdr)
+        + offsetof(struct mmsghdr, msg_len), &msgs[i].msg_len,
+        sizeof(msgs[i].msg_len));
+    if(err) {
+      return err;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,319 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/iov.h>
+#include <elkvm/overlay.h>
+#include <elkvm/syscall.h>
+
+/*
+ * sendfile, splice, tee and copy_file_range move data between host file
+ * descriptors of the guest without touching guest memory, only the offsets
+ * are read from and written back to the guest. vmsplice hands the host pages
+ * behind the guest buffers to the pipe. Files of the image overlay only have
+ * /dev/null behind their host fd, their contents are written to the other fd
+ * from the image instead.
+ */
+static int read_offset(Elkvm::VM * vmi, guestptr_t off_p, loff_t *off,
+    loff_t **host_off) {
+  *host_off = nullptr;
+  if(off_p == 0x0) {
+    return 0;
+  }
+  *host_off = off;
+  return Elkvm::copy_from_guest(vmi->get_region_manager()->get_pager(), off,
+      off_p, sizeof(*off));
+}
+
+static int write_offset(Elkvm::VM * vmi, guestptr_t off_p, loff_t off) {
+  if(off_p == 0x0) {
+    return 0;
+  }
+  return Elkvm::copy_to_guest(vmi->get_region_manager()->get_pager(), off_p,
+      &off, sizeof(off));
+}
+
+static long write_out(Elkvm::VM * vmi, int fd, loff_t *off, const void *buf,
+    size_t len) {
+  long result = off == nullptr
+    ? vmi->get_handlers()->write(fd, const_cast<void *>(buf), len)
+    : vmi->get_handlers()->pwrite64(fd, buf, len, *off);
+  if(result < 0) {
+    return -errno;
+  }
+  if(off != nullptr) {
+    *off += result;
+  }
+  return result;
+}
+
+static bool send_from_image(Elkvm::VM * vmi, const char *name, int fd_in,
+    loff_t *off_in, int fd_out, loff_t *off_out, size_t len, long *result) {
+  std::shared_ptr<Elkvm::ImageOverlay> overlay = vmi->image_overlay();
+  if(overlay == nullptr || !overlay->owns(fd_in)) {
+    return false;
+  }
+  if(vmi->get_handlers()->write == nullptr
+      || vmi->get_handlers()->pwrite64 == nullptr) {
+    ERROR() << "WRITE or PWRITE64 handler not found" << LOG_RESET << "\n";
+    *result = -ENOSYS;
+    return true;
+  }
+
+  auto out = [vmi, fd_out, off_out](const void *buf, size_t n) -> long {
+    return write_out(vmi, fd_out, off_out, buf, n);
+  };
+  if(!overlay->send(fd_in, off_in == nullptr ? -1 : *off_in, len, out,
+        result)) {
+    return false;
+  }
+  if(off_in != nullptr && *result > 0) {
+    *off_in += *result;
+  }
+  if(vmi->debug_mode()) {
+    DBG() << name << " from image fd " << fd_in << " to fd " << fd_out
+          << " len " << LOG_DEC_HEX(len) << " result: " << std::dec << *result;
+  }
+  return true;
+}
+
+long elkvm_do_sendfile(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->sendfile == nullptr) {
+    ERROR() << "SENDFILE handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype out_fd = 0x0;
+  CURRENT_ABI::paramtype in_fd = 0x0;
+  guestptr_t offset_p = 0x0;
+  CURRENT_ABI::paramtype count = 0x0;
+
+  vmi->unpack_syscall(&out_fd, &in_fd, &offset_p, &count);
+
+  loff_t offset = 0;
+  loff_t *host_offset = nullptr;
+  int err = read_offset(vmi, offset_p, &offset, &host_offset);
+  if(err) {
+    return err;
+  }
+
+  long result;
+  if(send_from_image(vmi, "SENDFILE", in_fd, host_offset, out_fd, nullptr,
+        count, &result)) {
+    if(result < 0) {
+      return result;
+    }
+  } else {
+    result = vmi->get_handlers()->sendfile(out_fd, in_fd, host_offset, count);
+    const int saved_errno = errno;
+    if(vmi->debug_mode()) {
+      DBG() << "SENDFILE from fd " << in_fd << " to fd " << out_fd
+            << " count " << LOG_DEC_HEX(count) << " offset @ 0x" << std::hex
+            << offset_p << std::dec;
+      Elkvm::dbg_log_result<int>(result);
+    }
+    if(result < 0) {
+      return -saved_errno;
+    }
+  }
+
+  err = write_offset(vmi, offset_p, offset);
+  return err ? err : result;
+}
+
+long elkvm_do_splice(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->splice == nullptr) {
+    ERROR() << "SPLICE handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype fd_in = 0x0;
+  guestptr_t off_in_p = 0x0;
+  CURRENT_ABI::paramtype fd_out = 0x0;
+  guestptr_t off_out_p = 0x0;
+  CURRENT_ABI::paramtype len = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&fd_in, &off_in_p, &fd_out, &off_out_p, &len, &flags);
+
+  loff_t off_in = 0;
+  loff_t off_out = 0;
+  loff_t *host_off_in = nullptr;
+  loff_t *host_off_out = nullptr;
+  int err = read_offset(vmi, off_in_p, &off_in, &host_off_in);
+  if(!err) {
+    err = read_offset(vmi, off_out_p, &off_out, &host_off_out);
+  }
+  if(err) {
+    return err;
+  }
+
+  long result;
+  if(send_from_image(vmi, "SPLICE", fd_in, host_off_in, fd_out, host_off_out,
+        len, &result)) {
+    if(result < 0) {
+      return result;
+    }
+  } else {
+    result = vmi->get_handlers()->splice(fd_in, host_off_in, fd_out,
+        host_off_out, len, flags);
+    const int saved_errno = errno;
+    if(vmi->debug_mode()) {
+      DBG() << "SPLICE from fd " << fd_in << " to fd " << fd_out
+            << " len " << LOG_DEC_HEX(len) << " flags 0x" << std::hex << flags
+            << std::dec;
+      Elkvm::dbg_log_result<int>(result);
+    }
+    if(result < 0) {
+      return -saved_errno;
+    }
+  }
+
+  err = write_offset(vmi, off_in_p, off_in);
+  if(!err) {
+    err = write_offset(vmi, off_out_p, off_out);
+  }
+  return err ? err : result;
+}
+
+long elkvm_do_tee(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->tee == nullptr) {
+    ERROR() << "TEE handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype fd_in = 0x0;
+  CURRENT_ABI::paramtype fd_out = 0x0;
+  CURRENT_ABI::paramtype len = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&fd_in, &fd_out, &len, &flags);
+
+  long result = vmi->get_handlers()->tee(fd_in, fd_out, len, flags);
+  if(vmi->debug_mode()) {
+    DBG() << "TEE from fd " << fd_in << " to fd " << fd_out
+          << " len " << LOG_DEC_HEX(len);
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
+}
+
+long elkvm_do_vmsplice(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->vmsplice == nullptr) {
+    ERROR() << "VMSPLICE handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype fd = 0x0;
+  guestptr_t iov_p = 0x0;
+  CURRENT_ABI::paramtype nr_segs = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&fd, &iov_p, &nr_segs, &flags);
+
+  /* the segments point into the chunks, so the pipe references guest
+   * pages rather than copies */
+  std::vector<struct iovec> iov;
+  ssize_t len = Elkvm::guest_iov_to_host_iov(
+      vmi->get_region_manager()->get_pager(), iov_p, nr_segs, iov);
+  if(len < 0) {
+    return len;
+  }
+
+  long result = vmi->get_handlers()->vmsplice(fd, iov.data(), iov.size(),
+      flags);
+  if(vmi->debug_mode()) {
+    DBG() << "VMSPLICE fd " << fd << " iov @ 0x" << std::hex << iov_p
+          << std::dec << " " << nr_segs << " segments in " << iov.size()
+          << " host segment(s)";
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -errno;
+  }
+  return result;
+}
+
+long elkvm_do_copy_file_range(Elkvm::VM * vmi) {
+  if(vmi->get_handlers()->copy_file_range == nullptr) {
+    ERROR() << "COPY FILE RANGE handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype fd_in = 0x0;
+  guestptr_t off_in_p = 0x0;
+  CURRENT_ABI::paramtype fd_out = 0x0;
+  guestptr_t off_out_p = 0x0;
+  CURRENT_ABI::paramtype len = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vmi->unpack_syscall(&fd_in, &off_in_p, &fd_out, &off_out_p, &len, &flags);
+
+  loff_t off_in = 0;
+  loff_t off_out = 0;
+  loff_t *host_off_in = nullptr;
+  loff_t *host_off_out = nullptr;
+  int err = read_offset(vmi, off_in_p, &off_in, &host_off_in);
+  if(!err) {
+    err = read_offset(vmi, off_out_p, &off_out, &host_off_out);
+  }
+  if(err) {
+    return err;
+  }
+
+  long result;
+  if(send_from_image(vmi, "COPY FILE RANGE", fd_in, host_off_in, fd_out,
+        host_off_out, len, &result)) {
+    if(result < 0) {
+      return result;
+    }
+  } else {
+    result = vmi->get_handlers()->copy_file_range(fd_in, host_off_in,
+        fd_out, host_off_out, len, flags);
+    const int saved_errno = errno;
+    if(vmi->debug_mode()) {
+      DBG() << "COPY FILE RANGE from fd " << fd_in << " to fd " << fd_out
+            << " len " << LOG_DEC_HEX(len);
+      Elkvm::dbg_log_result<int>(result);
+    }
+    if(result < 0) {
+      return -saved_errno;
+    }
+  }
+
+  err = write_offset(vmi, off_in_p, off_in);
+  if(!err) {
+    err = write_offset(vmi, off_out_p, off_out);
+  }
+  return err ? err : result;
+}
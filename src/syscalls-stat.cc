@@ -0,0 +1,184 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cstring>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/elkvm-log.h>
+#include <elkvm/iov.h>
+#include <elkvm/metacache.h>
+#include <elkvm/overlay.h>
+#include <elkvm/syscall.h>
+
+/* the image overlay answers with a struct stat, which has all basic fields */
+static void stat_to_statx(const struct stat &st, struct statx *buf) {
+  memset(buf, 0, sizeof(*buf));
+  buf->stx_mask = STATX_BASIC_STATS;
+  buf->stx_blksize = st.st_blksize;
+  buf->stx_nlink = st.st_nlink;
+  buf->stx_uid = st.st_uid;
+  buf->stx_gid = st.st_gid;
+  buf->stx_mode = st.st_mode;
+  buf->stx_ino = st.st_ino;
+  buf->stx_size = st.st_size;
+  buf->stx_blocks = st.st_blocks;
+  buf->stx_atime.tv_sec = st.st_atim.tv_sec;
+  buf->stx_atime.tv_nsec = st.st_atim.tv_nsec;
+  buf->stx_mtime.tv_sec = st.st_mtim.tv_sec;
+  buf->stx_mtime.tv_nsec = st.st_mtim.tv_nsec;
+  buf->stx_ctime.tv_sec = st.st_ctim.tv_sec;
+  buf->stx_ctime.tv_nsec = st.st_ctim.tv_nsec;
+  buf->stx_rdev_major = major(st.st_rdev);
+  buf->stx_rdev_minor = minor(st.st_rdev);
+  buf->stx_dev_major = major(st.st_dev);
+  buf->stx_dev_minor = minor(st.st_dev);
+}
+
+long elkvm_do_statx(Elkvm::VM * vm) {
+  if(vm->get_handlers()->statx == nullptr) {
+    ERROR() << "STATX handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype dirfd = 0x0;
+  guestptr_t pathname_p = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+  CURRENT_ABI::paramtype mask = 0x0;
+  guestptr_t buf_p = 0x0;
+
+  vm->unpack_syscall(&dirfd, &pathname_p, &flags, &mask, &buf_p);
+
+  const char *pathname = nullptr;
+  if(pathname_p != 0x0) {
+    pathname = static_cast<char *>(vm->host_p(pathname_p));
+    if(pathname == nullptr) {
+      return -EFAULT;
+    }
+  }
+
+  struct statx buf;
+  struct stat st;
+  auto &overlay = vm->image_overlay();
+  std::string host_path;
+  long result;
+  int saved_errno = 0;
+  if(overlay != nullptr && overlay->stat(static_cast<int>(dirfd), pathname,
+        flags & (AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH), &st, &result,
+        &host_path)) {
+    if(result < 0) {
+      saved_errno = -result;
+    } else {
+      stat_to_statx(st, &buf);
+    }
+  } else {
+    if(!host_path.empty()) {
+      pathname = host_path.c_str();
+    }
+    result = vm->get_handlers()->statx(static_cast<int>(dirfd), pathname,
+        flags, mask, &buf);
+    saved_errno = errno;
+  }
+  if(vm->debug_mode()) {
+    DBG() << "STATX with dirfd " << static_cast<int>(dirfd)
+          << " pathname " << LOG_GUEST_HOST(pathname_p, pathname)
+          << " [" << (pathname != nullptr ? pathname : "") << "]"
+          << " flags 0x" << std::hex << flags << " mask 0x" << mask
+          << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return -saved_errno;
+  }
+
+  return Elkvm::copy_to_guest(vm->get_region_manager()->get_pager(), buf_p,
+      &buf, sizeof(buf));
+}
+
+long elkvm_do_newfstatat(Elkvm::VM * vm) {
+  if(vm->get_handlers()->newfstatat == nullptr) {
+    ERROR() << "NEWFSTATAT handler not found" << LOG_RESET << "\n";
+    return -ENOSYS;
+  }
+
+  CURRENT_ABI::paramtype dirfd = 0x0;
+  guestptr_t pathname_p = 0x0;
+  guestptr_t buf_p = 0x0;
+  CURRENT_ABI::paramtype flags = 0x0;
+
+  vm->unpack_syscall(&dirfd, &pathname_p, &buf_p, &flags);
+
+  const char *pathname = nullptr;
+  if(pathname_p != 0x0) {
+    pathname = static_cast<char *>(vm->host_p(pathname_p));
+    if(pathname == nullptr) {
+      return -EFAULT;
+    }
+  }
+
+  /* this is how stat and lstat are called nowadays, the cache knows both
+   * for absolute paths */
+  auto cache = (flags & ~AT_SYMLINK_NOFOLLOW) == 0 ? vm->metadata_cache()
+    : nullptr;
+  Elkvm::metadata_op op = (flags & AT_SYMLINK_NOFOLLOW) ? Elkvm::MD_LSTAT
+    : Elkvm::MD_STAT;
+  auto &overlay = vm->image_overlay();
+  std::string host_path;
+  struct stat buf;
+  long result;
+  if(overlay == nullptr || !overlay->stat(static_cast<int>(dirfd), pathname,
+        flags, &buf, &result, &host_path)) {
+    if(!host_path.empty()) {
+      pathname = host_path.c_str();
+    }
+    if(cache == nullptr
+        || !cache->lookup(op, pathname, 0, &result, &buf, sizeof(buf))) {
+      result = vm->get_handlers()->newfstatat(static_cast<int>(dirfd),
+          pathname, &buf, flags);
+      if(result < 0) {
+        result = -errno;
+      }
+      if(cache != nullptr) {
+        cache->insert(op, pathname, 0, result, &buf, sizeof(buf));
+      }
+    }
+  }
+  if(vm->debug_mode()) {
+    DBG() << "NEWFSTATAT with dirfd " << static_cast<int>(dirfd)
+          << " pathname " << LOG_GUEST_HOST(pathname_p, pathname)
+          << " [" << (pathname != nullptr ? pathname : "") << "]"
+          << " flags 0x" << std::hex << flags << std::dec;
+    Elkvm::dbg_log_result<int>(result);
+  }
+  if(result < 0) {
+    return result;
+  }
+
+  return Elkvm::copy_to_guest(vm->get_region_manager()->get_pager(), buf_p,
+      &buf, sizeof(buf));
+}
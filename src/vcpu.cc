@@ -34,6 +34,7 @@
 #include <stropts.h>
 #include <unistd.h>
 
+#include <elkvm/checkpoint.h>
 #include <elkvm/debug.h>
 #include <elkvm/elkvm.h>
 #include <elkvm/elkvm-log.h>
@@ -56,11 +57,60 @@ namespace Elkvm {
           unsigned cpu_num) :
       is_singlestepping(false),
       _kvm_vcpu(vmfd, cpu_num),
-      stack(rm) {
+      stack(rm),
+      clone_err(0) {
+    assert(_kvm_vcpu.init_error() == 0 && "error creating vcpu");
     initialize_regs();
     init_rsp();
   }
 
+  VCPU::VCPU(std::shared_ptr<Elkvm::RegionManager> rm,
+          int vmfd,
+          unsigned cpu_num,
+          const VCPU &orig,
+          const RegionMap &regions) :
+      is_singlestepping(false),
+      _kvm_vcpu(vmfd, cpu_num),
+      stack(rm, orig.stack, regions),
+      clone_err(_kvm_vcpu.init_error()) {
+    if(clone_err == 0) {
+      clone_err = _kvm_vcpu.copy_state(orig._kvm_vcpu);
+    }
+  }
+
+  int VCPU::reset(const VCPU &orig, const RegionMap &regions) {
+    stack.reset(orig.stack, regions);
+    return _kvm_vcpu.copy_state(orig._kvm_vcpu);
+  }
+
+  int VCPU::get_state(KVM::vcpu_state *state) const {
+    return _kvm_vcpu.get_state(state);
+  }
+
+  int VCPU::move_to(int vmfd, unsigned cpu_num, const KVM::vcpu_state &state) {
+    return _kvm_vcpu.move_to(vmfd, cpu_num, &state);
+  }
+
+  int VCPU::save_state(CheckpointWriter &w) const {
+    struct KVM::vcpu_state state;
+    int err = _kvm_vcpu.get_state(&state);
+    if(err) {
+      return err;
+    }
+    w.put(state);
+    stack.save_state(w);
+    return 0;
+  }
+
+  int VCPU::restore_state(CheckpointReader &r) {
+    auto state = r.get<struct KVM::vcpu_state>();
+    int err = stack.restore_state(r);
+    if(err) {
+      return err;
+    }
+    return _kvm_vcpu.set_state(&state);
+  }
+
 int VCPU::handle_stack_expansion(uint32_t err __attribute__((unused)),
     bool debug __attribute__((unused))) {
   stack.expand();
@@ -108,6 +158,14 @@ void VCPU::set_msr(uint32_t idx, CURRENT_ABI::paramtype data) {
   _kvm_vcpu.set_msr(idx, data);
 }
 
+int VCPU::queue_msr(uint32_t idx, CURRENT_ABI::paramtype data) {
+  return _kvm_vcpu.queue_msr(idx, data);
+}
+
+int VCPU::flush_msrs() {
+  return _kvm_vcpu.flush_msrs();
+}
+
 Segment VCPU::get_reg(Elkvm::Seg_t segtype) const {
   return _kvm_vcpu.get_reg(segtype);
 }
@@ -184,6 +242,23 @@ void VCPU::init_rsp() {
   _kvm_vcpu.set_reg(Elkvm::Reg_t::rsp, stack.user_base());
 }
 
+int VCPU::reset_user() {
+  int err = stack.reset_user();
+  if(err) {
+    return err;
+  }
+
+  for(int reg = Elkvm::Reg_t::rax; reg <= Elkvm::Reg_t::r15; reg++) {
+    _kvm_vcpu.set_reg(static_cast<Elkvm::Reg_t>(reg), 0x0);
+  }
+  init_rsp();
+
+  Segment fs = _kvm_vcpu.get_reg(Elkvm::Seg_t::fs);
+  fs.set_base(0x0);
+  _kvm_vcpu.set_reg(Elkvm::Seg_t::fs, fs);
+  return 0;
+}
+
 int VCPU::run() {
   return _kvm_vcpu.run();
 }
@@ -22,6 +22,8 @@
 //
 
 #include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <memory>
 #include <string>
@@ -30,6 +32,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stropts.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -49,12 +52,24 @@
 #include <elkvm/pager.h>
 #include <elkvm/vcpu.h>
 
+/* the proxy OS flat binaries, embedded by flats.S */
+extern "C" const char elkvm_flat_isr[], elkvm_flat_isr_end[];
+extern "C" const char elkvm_flat_entry[], elkvm_flat_entry_end[];
+extern "C" const char elkvm_flat_signal[], elkvm_flat_signal_end[];
+
 namespace Elkvm {
 
 std::list<std::shared_ptr<Elkvm::VM> > vmi;
 
 
 int VM::run() {
+  /* checkpoint() refuses to save the VM until run() returns */
+  struct running_guard {
+    std::atomic<bool> &running;
+    ~running_guard() { running = false; }
+  } guard = { _running };
+  _running = true;
+
   bool is_running = 1;
   auto& vcpu = get_vcpu(0);
   while(is_running) {
@@ -82,6 +97,12 @@ int VM::run() {
     } else {
       is_running = vcpu->handle_vm_exit();
     }
+
+    if(_stop) {
+      /* registers stay cached in the vcpu until run() is called again */
+      _stop = false;
+      break;
+    }
   }
   return 0;
 }
@@ -118,6 +139,183 @@ int load_elf_binary(const std::shared_ptr<VM>& vm,
   return 0;
 }
 
+/*
+ * Check what would make ElfBinary fail, so that execve can return an
+ * error before the old program is dropped.
+ */
+static int check_executable(const std::string &binary) {
+  if(access(binary.c_str(), X_OK)) {
+    return -errno;
+  }
+
+  int fd = open(binary.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {
+    return -errno;
+  }
+
+  unsigned char ident[EI_NIDENT];
+  ssize_t bytes = read(fd, ident, sizeof(ident));
+  close(fd);
+  if(bytes != sizeof(ident)
+      || memcmp(ident, ELFMAG, SELFMAG) != 0
+      || ident[EI_CLASS] != ELFCLASS64) {
+    return -ENOEXEC;
+  }
+  return 0;
+}
+
+int VM::execve(const std::string &binary,
+    const std::vector<std::string> &argv,
+    const std::vector<std::string> &env) {
+  /* only vcpu 0 is set up for the new program, other VCPUs would go on
+   * running the old one in memory that is gone */
+  if(cpus.size() != 1) {
+    return -EBUSY;
+  }
+
+  int err = check_executable(binary);
+  if(err) {
+    return err;
+  }
+
+  /* all strings have to fit into the environment region, which the auxv
+   * strings of the host need some room in as well */
+  constexpr auto env_pages = 12;
+  size_t bytes = 0;
+  for(const auto &arg : argv) {
+    bytes += arg.size() + 1;
+  }
+  for(const auto &var : env) {
+    bytes += var.size() + 1;
+  }
+  if(bytes > (env_pages - 1) * ELKVM_PAGESIZE) {
+    return -E2BIG;
+  }
+
+  /* the auxv of the host follows the environment ELKVM was started with */
+  char **host_env = _environ;
+  while(*host_env != nullptr) {
+    host_env++;
+  }
+  Elf64_auxv_t *auxv = reinterpret_cast<Elf64_auxv_t *>(host_env + 1);
+
+  /* from here on the old program is gone, drop everything in the user half
+   * of the address space, but keep the proxy OS in the kernel half */
+  auto &pager = _rm->get_pager();
+  hm.clear();
+  std::vector<std::shared_ptr<Region>> program(_elf_regions);
+  if(_env_region != nullptr) {
+    program.push_back(_env_region);
+  }
+  for(const auto &r : program) {
+    for(int i = 0; i < pages_from_size(r->size()); i++) {
+      pager.free_page(r->guest_address() + i * ELKVM_PAGESIZE);
+    }
+    _rm->free_region(r);
+  }
+  set_program_regions({}, nullptr);
+
+  auto &vcpu = get_vcpu(0);
+  err = vcpu->reset_user();
+  if(err) {
+    return err;
+  }
+  err = vcpu->set_regs();
+  assert(err == 0 && "error setting registers");
+
+  /* handled signals are reset to their default, ignored ones stay ignored */
+  for(int signum = 1; signum < _NSIG; signum++) {
+    struct sigaction &sa = sigs.signals[signum];
+    if(sa.sa_handler == SIG_DFL || sa.sa_handler == SIG_IGN) {
+      continue;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    signal(signum, SIG_DFL);
+  }
+
+  Elkvm::ElfBinary bin(binary, _rm, hm);
+
+  std::vector<char *> host_argv;
+  for(const auto &arg : argv) {
+    host_argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  host_argv.push_back(nullptr);
+  std::vector<char *> host_envp;
+  for(const auto &var : env) {
+    host_envp.push_back(const_cast<char *>(var.c_str()));
+  }
+  host_envp.push_back(nullptr);
+
+  auto r = _rm->allocate_region(env_pages * ELKVM_PAGESIZE, "ELKVM Environment");
+  assert(r != nullptr && "error getting memory for env");
+  set_program_regions(bin.get_regions(), r);
+
+  Elkvm::Environment environment(bin, r, argv.size(), host_argv.data(),
+      host_envp.data(), auxv);
+  err = pager.map_region(r->base_address(), r->guest_address(), env_pages,
+      PT_OPT_WRITE);
+  assert(err == 0 && "error mapping env region");
+
+  /* gets and sets the registers, the stack pointer is the new one */
+  err = environment.create(*vcpu);
+  assert(err == 0 && "error creating environment");
+
+  /* the syscall returns with sysret, which continues at rcx with the
+   * flags from r11 */
+  vcpu->set_reg(Elkvm::Reg_t::rcx, bin.get_entry_point());
+  vcpu->set_reg(Elkvm::Reg_t::r11, 0x2);
+  err = vcpu->set_regs();
+  assert(err == 0 && "error setting registers");
+
+  /* drops fs and makes KVM flush the guest TLB, as cr3 is set again */
+  err = vcpu->set_sregs();
+  assert(err == 0 && "error setting segment registers");
+  return 0;
+}
+
+int VM::fork() {
+  /* the KVM VM cannot be used by the child, take the VCPU state here */
+  std::vector<KVM::vcpu_state> states(cpus.size());
+  for(unsigned i = 0; i < cpus.size(); i++) {
+    int err = cpus[i]->get_state(&states[i]);
+    if(err) {
+      return err;
+    }
+  }
+
+  pid_t pid = ::fork();
+  if(pid != 0) {
+    return pid < 0 ? -errno : pid;
+  }
+
+  /* the host forks guest memory copy-on-write along with the rest of the
+   * process, all that is left is to register it with a KVM VM of our own */
+  int err = 0;
+  int kvmfd = open(KVM_DEV_PATH, O_RDWR | O_CLOEXEC);
+  int vmfd = kvmfd < 0 ? -1 : ioctl(kvmfd, KVM_CREATE_VM, 0);
+  if(vmfd < 0) {
+    err = -errno;
+  }
+  if(kvmfd >= 0) {
+    close(kvmfd);
+  }
+  if(err == 0) {
+    err = _rm->get_pager().move_to(vmfd);
+  }
+  for(unsigned i = 0; err == 0 && i < cpus.size(); i++) {
+    err = cpus[i]->move_to(vmfd, i, states[i]);
+  }
+  if(err) {
+    ERROR() << "could not set up the VM of a forked child: " << strerror(-err);
+    _exit(EXIT_FAILURE);
+  }
+
+  close(_vmfd);
+  _vmfd = vmfd;
+  return 0;
+}
+
 int setup_proxy_os(const std::shared_ptr<VM>& vm) {
   auto& vcpu = vm->get_vcpu(0);
 
@@ -133,6 +331,13 @@ int setup_proxy_os(const std::shared_ptr<VM>& vm) {
   err = create_sighandler(vm);
   assert(err == 0 && "error loading signal handler");
 
+  /* the setup above only touched the register cache and queued the MSRs */
+  err = vcpu->set_sregs();
+  assert(err == 0 && "error setting segment registers");
+
+  err = vcpu->flush_msrs();
+  assert(err == 0 && "error setting msrs");
+
   return 0;
 }
 
@@ -151,8 +356,8 @@ int create_idt(const std::shared_ptr<VM>& vm,
     const std::shared_ptr<VCPU> vcpu) {
   Elkvm::elkvm_flat idth;
 
-  std::string isr_path(RES_PATH "/isr");
-  int err = vm->load_flat(idth, isr_path, 1);
+  int err = vm->load_flat(idth, "isr", elkvm_flat_isr,
+      elkvm_flat_isr_end - elkvm_flat_isr, 1);
   if(err) {
     return err;
   }
@@ -163,8 +368,8 @@ int create_idt(const std::shared_ptr<VM>& vm,
 int create_sysenter(const std::shared_ptr<VM>& vm,
     const std::shared_ptr<VCPU> vcpu) {
   Elkvm::elkvm_flat sysenter;
-  std::string sysenter_path(RES_PATH "/entry");
-  int err = vm->load_flat(sysenter, sysenter_path, 1);
+  int err = vm->load_flat(sysenter, "entry", elkvm_flat_entry,
+      elkvm_flat_entry_end - elkvm_flat_entry, 1);
   if(err) {
     return err;
   }
@@ -172,14 +377,13 @@ int create_sysenter(const std::shared_ptr<VM>& vm,
   /*
    * setup the lstar register with the syscall handler
    */
-  vcpu->set_msr(VCPU_MSR_LSTAR, sysenter.region->guest_address());
-  return 0;
+  return vcpu->queue_msr(VCPU_MSR_LSTAR, sysenter.region->guest_address());
 }
 
 int create_sighandler(const std::shared_ptr<VM>& vm) {
-  std::string sighandler_path(RES_PATH "/signal");
   auto& sigclean = vm->get_cleanup_flat();
-  int err = vm->load_flat(sigclean, sighandler_path, 0);
+  int err = vm->load_flat(sigclean, "signal", elkvm_flat_signal,
+      elkvm_flat_signal_end - elkvm_flat_signal, 0);
   return err;
 }
 
@@ -246,25 +450,35 @@ std::shared_ptr<VM> create_vm_object(const elkvm_opts * const opts,
     return NULL;
   }
 
-  int run_struct_size = ioctl(opts->fd, KVM_GET_VCPU_MMAP_SIZE, 0);
-  if(run_struct_size < 0) {
-    return NULL;
-  }
-
   std::shared_ptr<Elkvm::VM> vmi = std::make_shared<Elkvm::VM>(
         vmfd,
         opts->argc,
         opts->argv,
         opts->environ,
-        run_struct_size,
+        opts->run_struct_size,
         hyp,
         handlers,
         opts->debug);
+
+  /* before the binary is loaded, so the ELF image, stack and heap are
+   * all created according to the policy */
+  if(opts->mem_flags) {
+    int err = vmi->get_region_manager()->get_pager()
+      .set_memory_policy(opts->mem_flags);
+    if(err) {
+      errno = -err;
+      return NULL;
+    }
+  }
   Elkvm::vmi.push_back(vmi);
 
   return vmi;
 }
 
+void forget_vm(const std::shared_ptr<VM>& vm) {
+  Elkvm::vmi.remove(vm);
+}
+
 int create_and_setup_environment(const ElfBinary &bin,
     const std::shared_ptr<VM>& vm,
     elkvm_opts * opts,
@@ -275,6 +489,7 @@ int create_and_setup_environment(const ElfBinary &bin,
   constexpr auto env_pages = 12;
   auto r = rm.allocate_region(env_pages * ELKVM_PAGESIZE, "ELKVM Environment");
   assert(r != nullptr && "error getting memory for env");
+  vm->set_program_regions(bin.get_regions(), r);
 
   Elkvm::Environment env(bin, r, opts->argc, opts->argv, opts->environ);
 
@@ -289,6 +504,54 @@ int create_and_setup_environment(const ElfBinary &bin,
 //namespace Elkvm
 }
 
+typedef std::chrono::steady_clock create_clock;
+
+/* nanoseconds since since, which is moved on to now */
+static uint64_t elapsed_ns(create_clock::time_point &since) {
+  auto now = create_clock::now();
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - since);
+  since = now;
+  return ns.count();
+}
+
+/* binary is nullptr for a raw VM */
+static std::shared_ptr<Elkvm::VM>
+create_vm(Elkvm::elkvm_opts *opts,
+          const char *binary,
+          unsigned cpus,
+          const Elkvm::hypercall_handlers * const hyp,
+          const Elkvm::elkvm_handlers * const handlers,
+          bool debug) {
+  Elkvm::elkvm_create_stats stats;
+  memset(&stats, 0, sizeof(stats));
+  auto start = create_clock::now();
+  auto phase = start;
+
+  opts->debug = debug;
+
+  auto vmi = Elkvm::create_vm_object(opts, hyp, handlers);
+  assert(vmi != nullptr && "error creating vm object");
+  stats.vm = elapsed_ns(phase);
+
+  int err = Elkvm::create_vcpus(vmi, cpus);
+  assert(err == 0 && "error creating vcpus");
+  stats.vcpus = elapsed_ns(phase);
+
+  if(binary != nullptr) {
+    err = Elkvm::load_elf_binary(vmi, opts, binary);
+    assert(err == 0 && "error loading elf binary");
+    stats.binary = elapsed_ns(phase);
+  }
+
+  err = Elkvm::setup_proxy_os(vmi);
+  assert(err == 0 && "error setting up proxy os");
+  stats.proxy_os = elapsed_ns(phase);
+
+  stats.total = elapsed_ns(start);
+  vmi->set_create_stats(stats);
+  return vmi;
+}
+
 std::shared_ptr<Elkvm::VM>
 elkvm_vm_create_raw(Elkvm::elkvm_opts *opts,
                     unsigned cpus,
@@ -297,16 +560,8 @@ elkvm_vm_create_raw(Elkvm::elkvm_opts *opts,
                     int mode,
                     bool debug)
 {
-  int err = 0;
-  opts->debug = debug;
-
-  auto vmi = Elkvm::create_virtual_hardware(opts, hyp, handlers, cpus, mode);
-  assert(vmi != nullptr && "error creating virtual hardware");
-
-  err = Elkvm::setup_proxy_os(vmi);
-  assert(err == 0 && "error setting up proxy os");
-
-  return vmi;
+  (void)mode; // unused warning...
+  return create_vm(opts, nullptr, cpus, hyp, handlers, debug);
 }
 
 
@@ -318,36 +573,49 @@ elkvm_vm_create(Elkvm::elkvm_opts *opts,
                 const Elkvm::elkvm_handlers * const handlers,
                 int mode,
                 bool debug) {
-
-  int err = 0;
-  opts->debug = debug;
-
-  auto vmi = Elkvm::create_virtual_hardware(opts, hyp, handlers, cpus, mode);
-  assert(vmi != nullptr && "error creating virtual hardware");
-
-  err = Elkvm::load_elf_binary(vmi, opts, binary);
-  assert(err == 0 && "error loading elf binary");
-
-  err = Elkvm::setup_proxy_os(vmi);
-  assert(err == 0 && "error setting up proxy os");
-
-  return vmi;
+  (void)mode; // unused warning...
+  return create_vm(opts, binary, cpus, hyp, handlers, debug);
 }
 
 int Elkvm::VM::chunk_remap(int num, size_t newsize) {
+  auto &pager = get_region_manager()->get_pager();
+  return pager.resize_chunk(pager.get_chunk(num), newsize);
+}
 
-  auto chunk = get_region_manager()->get_pager().get_chunk(num);
-  chunk->memory_size = 0;
-
-  int err = ioctl(get_vmfd(), KVM_SET_USER_MEMORY_REGION, chunk.get());
-  assert(err == 0);
-  free((void *)chunk->userspace_addr);
-  chunk->memory_size = newsize;
-  err = posix_memalign(((void **)&chunk->userspace_addr), ELKVM_PAGESIZE, chunk->memory_size);
-  assert(err == 0);
-  err = ioctl(get_vmfd(), KVM_SET_USER_MEMORY_REGION, chunk.get());
-  assert(err == 0);
-  return 0;
+Elkvm::elkvm_memory_stats Elkvm::VM::memory_stats() {
+  auto &pager = get_region_manager()->get_pager();
+  elkvm_memory_stats stats;
+  memset(&stats, 0, sizeof(stats));
+
+  stats.total = pager.chunk_memory_size();
+  if(pager.resident_size(&stats.resident)) {
+    stats.resident = 0;
+  }
+  stats.page_tables = pager.page_table_size();
+
+  /* the program, the stacks and the page tables are tracked, the rest is
+   * heap or system memory */
+  size_t used = 0;
+  for(const auto &r : get_region_manager()->used_regions()) {
+    used += r->size();
+  }
+  for(const auto &r : _elf_regions) {
+    if(!r->is_free()) {
+      stats.elf += r->size();
+    }
+  }
+  for(const auto &vcpu : cpus) {
+    stats.stack += vcpu->stack_size();
+  }
+  auto pager_region = get_region_manager()->find_region(pager.pml4_address());
+  const size_t pager_size = pager_region == nullptr ? 0 : pager_region->size();
+  const size_t other = used - std::min(used, stats.elf + stats.stack + pager_size);
+
+  /* the pager memory is reserved as a whole, only the used tables count */
+  stats.heap = std::min(hm.heap_size(), other);
+  stats.system = other - stats.heap;
+  stats.slack = stats.total - used + (ELKVM_PAGER_MEMSIZE - stats.page_tables);
+  return stats;
 }
 
 const struct ::rlimit *Elkvm::VM::get_rlimit(int i) const {
@@ -29,6 +29,7 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <elkvm/elkvm.h>
 #include <elkvm/elkvm-log.h>
@@ -58,10 +59,69 @@ namespace Elkvm {
     _rlimit(),
     sigs(),
     sighandler_cleanup(),
+    _elf_regions(),
+    _env_region(),
     hypercall_handlers(hyp_handlers),
-    syscall_handlers(handlers)
+    syscall_handlers(handlers),
+    _stop(false),
+    _running(false),
+    _create_stats(),
+    _dir_cache(),
+    _metadata_cache(),
+    _image_overlay(),
+    _clone_err(0)
   {}
 
+  VM::VM(int vmfd, const VM &orig, int fd, int map_flags, RegionMap &regions) :
+    cpus(),
+    _debug(orig._debug),
+    _rm(std::make_shared<RegionManager>(vmfd, *orig._rm, fd, map_flags,
+          regions)),
+    _gdt(cloned_region(regions, orig._gdt)),
+    hm(_rm, orig.hm, regions),
+    _vmfd(vmfd),
+    _argc(orig._argc),
+    _argv(orig._argv),
+    _environ(orig._environ),
+    _run_struct_size(orig._run_struct_size),
+    _rlimit(orig._rlimit),
+    sigs(orig.sigs),
+    sighandler_cleanup(orig.sighandler_cleanup),
+    _elf_regions(),
+    _env_region(cloned_region(regions, orig._env_region)),
+    hypercall_handlers(orig.hypercall_handlers),
+    syscall_handlers(orig.syscall_handlers),
+    _stop(false),
+    _running(false),
+    _create_stats(),
+    _dir_cache(orig._dir_cache),
+    _metadata_cache(orig._metadata_cache),
+    _image_overlay(orig._image_overlay),
+    _clone_err(_rm->clone_error())
+  {
+    sighandler_cleanup.region =
+      cloned_region(regions, orig.sighandler_cleanup.region);
+    for(const auto &r : orig._elf_regions) {
+      _elf_regions.push_back(cloned_region(regions, r));
+    }
+
+    for(unsigned i = 0; i < orig.cpus.size() && _clone_err == 0; i++) {
+      auto vcpu =
+        std::make_shared<VCPU>(_rm, _vmfd, i, *orig.cpus[i], regions);
+      _clone_err = vcpu->clone_error();
+      cpus.push_back(vcpu);
+    }
+  }
+
+  VM::~VM() {
+    /* requests in flight write into guest memory */
+    release_aio_contexts(this);
+
+    /* the vcpus have to go before the VM they belong to */
+    cpus.clear();
+    close(_vmfd);
+  }
+
   int VM::add_cpu() {
     std::shared_ptr<VCPU> vcpu =
       std::make_shared<VCPU>(_rm, _vmfd, cpus.size());
@@ -89,44 +149,55 @@ namespace Elkvm {
   }
 
 
-  int VM::load_flat(Elkvm::elkvm_flat &flat, const std::string path,
+  int VM::map_flat(Elkvm::elkvm_flat &flat, size_t size, const char *name,
       bool kernel) {
-    int fd = open(path.c_str(), O_RDONLY);
-    if(fd < 0) {
-      ERROR() << "Could not find flat binary at: " << path << std::endl;
-      return -errno;
-    }
-
-    struct stat stbuf;
-    int err = fstat(fd, &stbuf);
-    if(err) {
-      close(fd);
-      return -errno;
-    }
-
-    flat.size = stbuf.st_size;
-    std::shared_ptr<Elkvm::Region> region = _rm->allocate_region(stbuf.st_size,path.c_str());
+    flat.size = size;
+    std::shared_ptr<Elkvm::Region> region = _rm->allocate_region(size, name);
 
     if(kernel) {
       guestptr_t addr = _rm->get_pager().map_kernel_page(
           region->base_address(),
           PT_OPT_EXEC);
       if(addr == 0x0) {
-        close(fd);
         return -ENOMEM;
       }
       region->set_guest_addr(addr);
     } else {
       /* XXX this will break! */
       region->set_guest_addr(0x1000);
-      err = _rm->get_pager().map_user_page(
+      int err = _rm->get_pager().map_user_page(
           region->base_address(),
           region->guest_address(),
           PT_OPT_EXEC);
       assert(err == 0);
     }
 
-    char *buf = reinterpret_cast<char *>(region->base_address());
+    flat.region = region;
+    return 0;
+  }
+
+  int VM::load_flat(Elkvm::elkvm_flat &flat, const std::string path,
+      bool kernel) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+      ERROR() << "Could not find flat binary at: " << path << std::endl;
+      return -errno;
+    }
+
+    struct stat stbuf;
+    int err = fstat(fd, &stbuf);
+    if(err) {
+      close(fd);
+      return -errno;
+    }
+
+    err = map_flat(flat, stbuf.st_size, path.c_str(), kernel);
+    if(err) {
+      close(fd);
+      return err;
+    }
+
+    char *buf = reinterpret_cast<char *>(flat.region->base_address());
     int bufsize = ELKVM_PAGESIZE;
     int bytes = 0;
     while((bytes = read(fd, buf, bufsize)) > 0) {
@@ -134,8 +205,17 @@ namespace Elkvm {
     }
 
     close(fd);
-    flat.region = region;
+    return 0;
+  }
 
+  int VM::load_flat(Elkvm::elkvm_flat &flat, const char *name,
+      const void *data, size_t size, bool kernel) {
+    int err = map_flat(flat, size, name, kernel);
+    if(err) {
+      return err;
+    }
+
+    memcpy(flat.region->base_address(), data, size);
     return 0;
   }
 
@@ -147,6 +227,12 @@ namespace Elkvm {
     return sighandler_cleanup;
   }
 
+  void VM::set_program_regions(const std::vector<std::shared_ptr<Region>> &elf,
+      const std::shared_ptr<Region> &env) {
+    _elf_regions = elf;
+    _env_region = env;
+  }
+
   const struct sigaction* VM::get_sig_ptr(unsigned sig) const {
     return &sigs.signals[sig];
   }
@@ -0,0 +1,155 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <cerrno>
+#include <chrono>
+#include <memory>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/snapshot.h>
+#include <elkvm/vmpool.h>
+
+namespace Elkvm {
+
+  VMPool::VMPool(std::shared_ptr<Snapshot> snapshot, unsigned sz)
+    : snap(snapshot),
+      size(sz),
+      lock(),
+      wakeup(),
+      ready(),
+      returned(),
+      stopping(false),
+      refiller()
+  {
+    refiller = std::thread(&VMPool::refill, this);
+  }
+
+  VMPool::~VMPool() {
+    {
+      std::lock_guard<std::mutex> l(lock);
+      stopping = true;
+    }
+    wakeup.notify_all();
+    refiller.join();
+
+    /* the VMs have to go before the snapshot they are cloned from */
+    ready.clear();
+    returned.clear();
+    snap = nullptr;
+  }
+
+  std::shared_ptr<VMPool> VMPool::create(elkvm_opts *opts,
+      unsigned size,
+      const char *binary,
+      const hypercall_handlers * const hyp,
+      const elkvm_handlers * const handlers,
+      unsigned cpus) {
+    std::shared_ptr<VM> vm = binary != nullptr
+      ? elkvm_vm_create(opts, binary, cpus, hyp, handlers)
+      : elkvm_vm_create_raw(opts, cpus, hyp, handlers);
+    if(vm == nullptr) {
+      return nullptr;
+    }
+
+    /* the snapshot has its own copy, the pool never runs this VM */
+    std::shared_ptr<Snapshot> snap = vm->snapshot();
+    int err = errno;
+    forget_vm(vm);
+    vm = nullptr;
+    if(snap == nullptr) {
+      errno = err;
+      return nullptr;
+    }
+    return std::make_shared<VMPool>(snap, size);
+  }
+
+  std::shared_ptr<VM> VMPool::acquire() {
+    {
+      std::lock_guard<std::mutex> l(lock);
+      if(!ready.empty()) {
+        std::shared_ptr<VM> vm = ready.front();
+        ready.pop_front();
+        wakeup.notify_one();
+        return vm;
+      }
+    }
+
+    /* the refiller is behind, don't wait for it */
+    wakeup.notify_one();
+    return snap->clone();
+  }
+
+  void VMPool::release(std::shared_ptr<VM> vm) {
+    {
+      std::lock_guard<std::mutex> l(lock);
+      returned.push_back(vm);
+    }
+    wakeup.notify_one();
+  }
+
+  unsigned VMPool::available() {
+    std::lock_guard<std::mutex> l(lock);
+    return ready.size();
+  }
+
+  void VMPool::refill() {
+    std::unique_lock<std::mutex> l(lock);
+    while(!stopping) {
+      std::shared_ptr<VM> vm = nullptr;
+      if(!returned.empty()) {
+        vm = returned.front();
+        returned.pop_front();
+
+        l.unlock();
+        int err = vm->reset(*snap);
+        if(err) {
+          vm = nullptr;
+        }
+        l.lock();
+      } else if(ready.size() < size) {
+        l.unlock();
+        vm = snap->clone();
+        l.lock();
+
+        if(vm == nullptr) {
+          /* e.g. out of memory, try again later instead of spinning */
+          wakeup.wait_for(l, std::chrono::milliseconds(100));
+          continue;
+        }
+      } else {
+        wakeup.wait(l);
+        continue;
+      }
+
+      if(vm != nullptr && ready.size() < size) {
+        ready.push_back(vm);
+      } else if(vm != nullptr) {
+        /* more VMs were given back than the pool keeps */
+        l.unlock();
+        vm = nullptr;
+        l.lock();
+      }
+    }
+  }
+
+//namespace Elkvm
+}
@@ -0,0 +1,106 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <elkvm/checkpoint.h>
+#include <elkvm/region.h>
+
+namespace testing {
+
+class Checkpoint : public Test {
+  protected:
+    Elkvm::CheckpointWriter w;
+
+    Checkpoint() : w() {}
+    ~Checkpoint() {}
+};
+
+TEST_F(Checkpoint, ReadsBackValuesInOrder) {
+  w.put<uint64_t>(0xC0FFEE);
+  w.put<int32_t>(-1);
+  w.put_string("ELKVM stack");
+  w.put<uint8_t>(1);
+
+  Elkvm::CheckpointReader r(w.data());
+  ASSERT_EQ(r.get<uint64_t>(), 0xC0FFEE);
+  ASSERT_EQ(r.get<int32_t>(), -1);
+  ASSERT_EQ(r.get_string(), "ELKVM stack");
+  ASSERT_EQ(r.get<uint8_t>(), 1);
+  ASSERT_TRUE(r.ok());
+}
+
+TEST_F(Checkpoint, FailsOnTruncatedData) {
+  w.put<uint32_t>(42);
+
+  Elkvm::CheckpointReader r(w.data());
+  ASSERT_EQ(r.get<uint64_t>(), 0);
+  ASSERT_FALSE(r.ok());
+}
+
+TEST_F(Checkpoint, FailsOnTooLongString) {
+  w.put<uint64_t>(100);
+  w.put<uint32_t>(0);
+
+  Elkvm::CheckpointReader r(w.data());
+  ASSERT_EQ(r.get_string(), "");
+  ASSERT_FALSE(r.ok());
+}
+
+TEST_F(Checkpoint, RefersToRegionsByTheirIndex) {
+  auto r1 = std::make_shared<Elkvm::Region>(nullptr, 0x1000);
+  auto r2 = std::make_shared<Elkvm::Region>(nullptr, 0x2000);
+  w.add_region(r1);
+  w.add_region(r2);
+  w.put_region(r2);
+  w.put_region(nullptr);
+  w.put_region(r1);
+
+  auto c1 = std::make_shared<Elkvm::Region>(nullptr, 0x1000);
+  auto c2 = std::make_shared<Elkvm::Region>(nullptr, 0x2000);
+  Elkvm::CheckpointReader r(w.data());
+  r.add_region(c1);
+  r.add_region(c2);
+  ASSERT_EQ(r.get_region(), c2);
+  ASSERT_EQ(r.get_region(), nullptr);
+  ASSERT_EQ(r.get_region(), c1);
+  ASSERT_TRUE(r.ok());
+}
+
+TEST_F(Checkpoint, FailsOnUnknownRegion) {
+  w.put<int64_t>(3);
+
+  Elkvm::CheckpointReader r(w.data());
+  ASSERT_EQ(r.get_region(), nullptr);
+  ASSERT_FALSE(r.ok());
+}
+
+//namespace testing
+}
@@ -0,0 +1,132 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <set>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <elkvm/dircache.h>
+#include <elkvm/types.h>
+
+namespace testing {
+
+class TheDirCache : public Test {
+  protected:
+    char dir[32];
+    int fd;
+    Elkvm::DirCache cache;
+
+    TheDirCache() : dir(), fd(-1), cache() {}
+
+    void SetUp() {
+      strcpy(dir, "/tmp/elkvm-dircache-XXXXXX");
+      ASSERT_NE(mkdtemp(dir), nullptr);
+      touch("a");
+      touch("b");
+      fd = open(dir, O_RDONLY | O_DIRECTORY);
+      ASSERT_GE(fd, 0);
+    }
+
+    void TearDown() {
+      close(fd);
+      unlink(path("a").c_str());
+      unlink(path("b").c_str());
+      unlink(path("c").c_str());
+      rmdir(dir);
+    }
+
+    std::string path(const char *name) {
+      return std::string(dir) + "/" + name;
+    }
+
+    void touch(const char *name) {
+      int f = open(path(name).c_str(), O_CREAT | O_WRONLY, 0600);
+      ASSERT_GE(f, 0);
+      close(f);
+    }
+
+    std::set<std::string> names(const Elkvm::DirListing &listing) {
+      std::set<std::string> result;
+      for(size_t off = 0; off < listing.size();) {
+        const struct linux_dirent64 *d =
+          reinterpret_cast<const struct linux_dirent64 *>(
+              listing.data() + off);
+        result.insert(d->d_name);
+        off += d->d_reclen;
+      }
+      return result;
+    }
+};
+
+TEST_F(TheDirCache, ListsAllEntriesOfADirectory) {
+  auto listing = cache.get(fd);
+  ASSERT_NE(listing, nullptr);
+  ASSERT_EQ(names(*listing), std::set<std::string>({ ".", "..", "a", "b" }));
+  ASSERT_EQ(listing->find(0), 0);
+  ASSERT_EQ(listing->find(-2), Elkvm::DirListing::npos);
+}
+
+TEST_F(TheDirCache, DoesNotMoveTheDirectoryPosition) {
+  ASSERT_NE(cache.get(fd), nullptr);
+  ASSERT_EQ(lseek(fd, 0, SEEK_CUR), 0);
+}
+
+TEST_F(TheDirCache, AnswersFromCacheUntilTheDirectoryChanges) {
+  auto first = cache.get(fd);
+  ASSERT_EQ(cache.get(fd), first);
+  ASSERT_EQ(cache.get_stats().hits, 1);
+  ASSERT_EQ(cache.get_stats().misses, 1);
+  ASSERT_EQ(cache.get_stats().listings, 1);
+
+  touch("c");
+  auto second = cache.get(fd);
+  ASSERT_NE(second, first);
+  ASSERT_EQ(names(*second).count("c"), 1);
+  ASSERT_EQ(cache.get_stats().misses, 2);
+  ASSERT_EQ(cache.get_stats().listings, 1);
+}
+
+TEST_F(TheDirCache, RefusesFilesThatAreNoDirectories) {
+  int f = open(path("a").c_str(), O_RDONLY);
+  ASSERT_GE(f, 0);
+  ASSERT_EQ(cache.get(f), nullptr);
+  ASSERT_EQ(errno, ENOTDIR);
+  close(f);
+}
+
+TEST_F(TheDirCache, DropsListingsBeyondItsSize) {
+  Elkvm::DirCache tiny(16);
+  ASSERT_NE(tiny.get(fd), nullptr);
+  ASSERT_EQ(tiny.get_stats().listings, 0);
+  ASSERT_EQ(tiny.get_stats().bytes, 0);
+}
+
+//namespace testing
+}
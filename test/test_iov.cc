@@ -0,0 +1,241 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <memory>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/kvm.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/iov.h>
+#include <elkvm/pager.h>
+#include <elkvm/region_manager.h>
+
+namespace testing {
+
+class GuestIov : public Test {
+  protected:
+    Elkvm::PagerX86_64 pager;
+    std::vector<struct iovec> iov;
+
+    GuestIov() : pager(5), iov() {}
+    ~GuestIov() {}
+};
+
+TEST_F(GuestIov, TranslatesAnEmptyBufferToNoEntries) {
+  ASSERT_EQ(Elkvm::guest_to_host_iov(pager, 0x0, 0, iov), 0);
+  ASSERT_TRUE(iov.empty());
+}
+
+TEST_F(GuestIov, RejectsTooManyGuestIovecs) {
+  ASSERT_EQ(Elkvm::guest_iov_to_host_iov(pager, 0x400000, IOV_MAX + 1, iov),
+      -EINVAL);
+}
+
+TEST_F(GuestIov, MapsAnEmptyGuestBufferToNothing) {
+  Elkvm::guest_buffer buf;
+  ASSERT_EQ(Elkvm::map_guest_buffer(pager, 0x0, 0x100, buf), 0);
+  ASSERT_EQ(buf.host, nullptr);
+  ASSERT_EQ(Elkvm::map_guest_buffer(pager, 0x400000, 0, buf), 0);
+  ASSERT_EQ(buf.host, nullptr);
+  ASSERT_EQ(Elkvm::unmap_guest_buffer(pager, buf, 0x100), 0);
+}
+
+TEST_F(GuestIov, RejectsASigsetOfTheWrongSize) {
+  sigset_t set;
+  ASSERT_EQ(Elkvm::copy_sigset_from_guest(pager, &set, 0x400000,
+        sizeof(set)), -EINVAL);
+}
+
+/*
+ * Guest memory needs a KVM VM for its slots, so these tests only run on
+ * hosts with /dev/kvm.
+ */
+class MappedGuestIov : public Test {
+  protected:
+    int kvm_fd;
+    int vmfd;
+    std::shared_ptr<Elkvm::RegionManager> rm;
+    std::vector<struct iovec> iov;
+
+    MappedGuestIov() : kvm_fd(-1), vmfd(-1), rm(), iov() {}
+    ~MappedGuestIov() {}
+
+    virtual void SetUp() {
+      kvm_fd = open("/dev/kvm", O_RDWR | O_CLOEXEC);
+      ASSERT_GE(kvm_fd, 0);
+      vmfd = ioctl(kvm_fd, KVM_CREATE_VM, 0);
+      ASSERT_GE(vmfd, 0);
+      rm = std::make_shared<Elkvm::RegionManager>(vmfd);
+    }
+
+    virtual void TearDown() {
+      rm = nullptr;
+      close(vmfd);
+      close(kvm_fd);
+    }
+
+    char *map(guestptr_t addr, unsigned pages) {
+      auto r = rm->allocate_region(pages * ELKVM_PAGESIZE);
+      char *host = static_cast<char *>(r->base_address());
+      map(host, addr, pages);
+      return host;
+    }
+
+    void map(char *host, guestptr_t addr, unsigned pages) {
+      EXPECT_EQ(rm->get_pager().map_region(host, addr, pages, PT_OPT_WRITE), 0);
+    }
+
+    /*
+     * Map two pages that are apart in host memory to 0x400000 and 0x401000,
+     * as if they came from different regions, and return their host
+     * addresses.
+     */
+    void map_split(char **first, char **second) {
+      char *host = map(0x600000, 3);
+      *first = host + 2 * ELKVM_PAGESIZE;
+      *second = host;
+      map(*first, 0x400000, 1);
+      map(*second, 0x401000, 1);
+    }
+};
+
+TEST_F(MappedGuestIov, DISABLED_ReturnsEFaultForAnUnmappedBuffer) {
+  ASSERT_EQ(Elkvm::guest_to_host_iov(rm->get_pager(), 0x0, 0x100, iov),
+      -EFAULT);
+  ASSERT_EQ(Elkvm::guest_to_host_iov(rm->get_pager(), 0x400000, 0x100, iov),
+      -EFAULT);
+  ASSERT_TRUE(iov.empty());
+}
+
+TEST_F(MappedGuestIov, DISABLED_ReturnsEFaultForAnUnmappedGuestIovecArray) {
+  ASSERT_EQ(Elkvm::guest_iov_to_host_iov(rm->get_pager(), 0x400000, 2, iov),
+      -EFAULT);
+  ASSERT_TRUE(iov.empty());
+}
+
+TEST_F(MappedGuestIov, DISABLED_DoesNotCopyFromUnmappedMemory) {
+  char buf[16];
+  ASSERT_EQ(Elkvm::copy_from_guest(rm->get_pager(), buf, 0x400000,
+        sizeof buf), -EFAULT);
+  ASSERT_EQ(Elkvm::copy_to_guest(rm->get_pager(), 0x400000, buf,
+        sizeof buf), -EFAULT);
+}
+
+TEST_F(MappedGuestIov, DISABLED_DoesNotMapAnUnmappedGuestBuffer) {
+  Elkvm::guest_buffer buf;
+  ASSERT_EQ(Elkvm::map_guest_buffer(rm->get_pager(), 0x400000, 0x100, buf),
+      -EFAULT);
+}
+
+TEST_F(MappedGuestIov, DISABLED_DoesNotReadAnUnmappedSigset) {
+  sigset_t set;
+  ASSERT_EQ(Elkvm::copy_sigset_from_guest(rm->get_pager(), &set, 0x400000,
+        sizeof(unsigned long)), -EFAULT);
+}
+
+TEST_F(MappedGuestIov, DISABLED_MergesPagesThatAreAdjacentInHostMemory) {
+  char *host = map(0x400000, 3);
+
+  ASSERT_EQ(Elkvm::guest_to_host_iov(rm->get_pager(), 0x400100,
+        2 * ELKVM_PAGESIZE, iov), 2 * ELKVM_PAGESIZE);
+  ASSERT_EQ(iov.size(), 1);
+  ASSERT_EQ(iov[0].iov_base, host + 0x100);
+  ASSERT_EQ(iov[0].iov_len, 2 * ELKVM_PAGESIZE);
+}
+
+TEST_F(MappedGuestIov, DISABLED_SplitsABufferAcrossRegions) {
+  char *first, *second;
+  map_split(&first, &second);
+
+  ASSERT_EQ(Elkvm::guest_to_host_iov(rm->get_pager(), 0x400F00, 0x200, iov),
+      0x200);
+  ASSERT_EQ(iov.size(), 2);
+  ASSERT_EQ(iov[0].iov_base, first + 0xF00);
+  ASSERT_EQ(iov[0].iov_len, 0x100);
+  ASSERT_EQ(iov[1].iov_base, second);
+  ASSERT_EQ(iov[1].iov_len, 0x100);
+}
+
+TEST_F(MappedGuestIov, DISABLED_StopsAtTheFirstUnmappedPage) {
+  char *host = map(0x400000, 1);
+
+  ASSERT_EQ(Elkvm::guest_to_host_iov(rm->get_pager(), 0x400800,
+        ELKVM_PAGESIZE, iov), 0x800);
+  ASSERT_EQ(iov.size(), 1);
+  ASSERT_EQ(iov[0].iov_base, host + 0x800);
+}
+
+TEST_F(MappedGuestIov, DISABLED_TranslatesEachGuestIovec) {
+  char *first, *second;
+  map_split(&first, &second);
+  struct iovec guest[2] = {
+    { reinterpret_cast<void *>(0x400010), 0x10 },
+    { reinterpret_cast<void *>(0x401020), 0x20 },
+  };
+  memcpy(first, guest, sizeof(guest));
+
+  ASSERT_EQ(Elkvm::guest_iov_to_host_iov(rm->get_pager(), 0x400000, 2, iov),
+      0x30);
+  ASSERT_EQ(iov.size(), 2);
+  ASSERT_EQ(iov[0].iov_base, first + 0x10);
+  ASSERT_EQ(iov[1].iov_base, second + 0x20);
+  ASSERT_EQ(iov[1].iov_len, 0x20);
+}
+
+TEST_F(MappedGuestIov, DISABLED_BouncesASplitBufferAndCopiesItBack) {
+  char *first, *second;
+  map_split(&first, &second);
+  memset(first + 0xFFE, 'a', 2);
+  memset(second, 'b', 2);
+
+  Elkvm::guest_buffer buf;
+  ASSERT_EQ(Elkvm::map_guest_buffer(rm->get_pager(), 0x400FFE, 4, buf), 0);
+  ASSERT_FALSE(buf.bounce.empty());
+  ASSERT_EQ(memcmp(buf.host, "aabb", 4), 0);
+
+  memcpy(buf.host, "wxyz", 4);
+  ASSERT_EQ(Elkvm::unmap_guest_buffer(rm->get_pager(), buf, 3), 0);
+  ASSERT_EQ(memcmp(first + 0xFFE, "wx", 2), 0);
+  ASSERT_EQ(memcmp(second, "yb", 2), 0);
+}
+
+TEST_F(MappedGuestIov, DISABLED_MapsAContiguousBufferInPlace) {
+  char *host = map(0x400000, 2);
+
+  Elkvm::guest_buffer buf;
+  ASSERT_EQ(Elkvm::map_guest_buffer(rm->get_pager(), 0x400FF0, 0x20, buf), 0);
+  ASSERT_TRUE(buf.bounce.empty());
+  ASSERT_EQ(buf.host, host + 0xFF0);
+}
+
+//namespace testing
+}
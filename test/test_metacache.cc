@@ -0,0 +1,201 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <elkvm/metacache.h>
+
+namespace testing {
+
+class TheMetadataCache : public Test {
+  protected:
+    char dir[32];
+    Elkvm::metadata_cache_opts opts;
+
+    TheMetadataCache() : dir(), opts() {}
+
+    void SetUp() {
+      strcpy(dir, "/tmp/elkvm-metacache-XXXXXX");
+      ASSERT_NE(mkdtemp(dir), nullptr);
+    }
+
+    void TearDown() {
+      unlink(path("a").c_str());
+      rmdir(dir);
+    }
+
+    std::string path(const char *name) {
+      return std::string(dir) + "/" + name;
+    }
+
+    /* stat through cache as elkvm_do_stat does */
+    long cached_stat(Elkvm::MetadataCache &cache, const std::string &p,
+        struct stat *buf) {
+      long res;
+      if(!cache.lookup(Elkvm::MD_STAT, p.c_str(), 0, &res, buf,
+            sizeof(*buf))) {
+        res = stat(p.c_str(), buf) < 0 ? -errno : 0;
+        cache.insert(Elkvm::MD_STAT, p.c_str(), 0, res, buf, sizeof(*buf));
+      }
+      return res;
+    }
+};
+
+TEST_F(TheMetadataCache, OnlyCachesCanonicalAbsolutePaths) {
+  opts.prefixes.push_back("/usr/lib/");
+  Elkvm::MetadataCache cache(opts);
+  ASSERT_TRUE(cache.cacheable("/usr/lib"));
+  ASSERT_TRUE(cache.cacheable("/usr/lib/libc.so.6"));
+  ASSERT_FALSE(cache.cacheable("/usr/libexec/ld"));
+  ASSERT_FALSE(cache.cacheable("/usr/lib//libc.so.6"));
+  ASSERT_FALSE(cache.cacheable("/usr/lib/../bin"));
+  ASSERT_FALSE(cache.cacheable("/usr/lib/."));
+  ASSERT_FALSE(cache.cacheable("/usr/lib/"));
+  ASSERT_FALSE(cache.cacheable("lib/libc.so.6"));
+  ASSERT_FALSE(cache.cacheable(nullptr));
+}
+
+TEST_F(TheMetadataCache, AnswersRepeatedLookups) {
+  Elkvm::MetadataCache cache(opts);
+  struct stat first, second;
+  ASSERT_EQ(cached_stat(cache, dir, &first), 0);
+  ASSERT_EQ(cached_stat(cache, dir, &second), 0);
+  ASSERT_EQ(memcmp(&first, &second, sizeof(first)), 0);
+
+  auto stats = cache.get_stats();
+  ASSERT_EQ(stats.hits[Elkvm::MD_STAT], 1);
+  ASSERT_EQ(stats.misses[Elkvm::MD_STAT], 1);
+  ASSERT_EQ(stats.entries, 1);
+  ASSERT_DOUBLE_EQ(Elkvm::hit_rate(stats), 0.5);
+}
+
+TEST_F(TheMetadataCache, AnswersOpensOfMissingFiles) {
+  Elkvm::MetadataCache cache(opts);
+  struct stat buf;
+  ASSERT_EQ(cached_stat(cache, path("a"), &buf), -ENOENT);
+
+  long res;
+  ASSERT_TRUE(cache.lookup(Elkvm::MD_OPEN, path("a").c_str(), 0, &res,
+        nullptr, 0));
+  ASSERT_EQ(res, -ENOENT);
+  ASSERT_EQ(cache.get_stats().negative_hits, 1);
+
+  /* creating the file invalidates the entry */
+  int fd = open(path("a").c_str(), O_CREAT | O_WRONLY, 0600);
+  ASSERT_GE(fd, 0);
+  cache.opened(fd, path("a").c_str(), O_CREAT | O_WRONLY);
+  ASSERT_FALSE(cache.lookup(Elkvm::MD_OPEN, path("a").c_str(), 0, &res,
+        nullptr, 0));
+  ASSERT_EQ(cached_stat(cache, path("a"), &buf), 0);
+
+  /* the file is not cached while it is open for writing */
+  ASSERT_FALSE(cache.lookup(Elkvm::MD_STAT, path("a").c_str(), 0, &res,
+        &buf, sizeof(buf)));
+  cache.closed(fd);
+  close(fd);
+  ASSERT_EQ(cached_stat(cache, path("a"), &buf), 0);
+  ASSERT_TRUE(cache.lookup(Elkvm::MD_STAT, path("a").c_str(), 0, &res,
+        &buf, sizeof(buf)));
+}
+
+TEST_F(TheMetadataCache, KeepsFstatResultsUntilTheFdIsClosed) {
+  Elkvm::MetadataCache cache(opts);
+  int fd = open(dir, O_RDONLY);
+  ASSERT_GE(fd, 0);
+  cache.opened(fd, dir, O_RDONLY);
+
+  struct stat buf, cached;
+  ASSERT_FALSE(cache.lookup_fd(fd, &cached));
+  ASSERT_EQ(fstat(fd, &buf), 0);
+  cache.insert_fd(fd, &buf);
+  ASSERT_TRUE(cache.lookup_fd(fd, &cached));
+  ASSERT_EQ(cached.st_ino, buf.st_ino);
+
+  cache.closed(fd);
+  close(fd);
+  ASSERT_FALSE(cache.lookup_fd(fd, &cached));
+  ASSERT_EQ(cache.get_stats().entries, 0);
+}
+
+TEST_F(TheMetadataCache, CutsLinkTargetsToTheBuffer) {
+  Elkvm::MetadataCache cache(opts);
+  const char target[] = "/some/target";
+  cache.insert(Elkvm::MD_READLINK, path("a").c_str(), 0, strlen(target),
+      target, strlen(target));
+
+  char buf[5];
+  long res;
+  ASSERT_TRUE(cache.lookup(Elkvm::MD_READLINK, path("a").c_str(), 0, &res,
+        buf, sizeof(buf)));
+  ASSERT_EQ(res, sizeof(buf));
+  ASSERT_EQ(std::string(buf, res), "/some");
+}
+
+TEST_F(TheMetadataCache, DoesNotCacheTransientErrors) {
+  Elkvm::MetadataCache cache(opts);
+  cache.insert(Elkvm::MD_STAT, path("a").c_str(), 0, -ENOMEM, nullptr, 0);
+  ASSERT_EQ(cache.get_stats().entries, 0);
+}
+
+TEST_F(TheMetadataCache, ExpiresEntriesAfterTheTtl) {
+  opts.ttl_ns = 1;
+  Elkvm::MetadataCache cache(opts);
+  struct stat buf;
+  ASSERT_EQ(cached_stat(cache, dir, &buf), 0);
+  usleep(50000);
+  long res;
+  ASSERT_FALSE(cache.lookup(Elkvm::MD_STAT, dir, 0, &res, &buf,
+        sizeof(buf)));
+}
+
+TEST_F(TheMetadataCache, DropsEntriesInotifyReportsAsChanged) {
+  opts.inotify = true;
+  Elkvm::MetadataCache cache(opts);
+  struct stat buf;
+  ASSERT_EQ(cached_stat(cache, path("a"), &buf), -ENOENT);
+  ASSERT_EQ(cache.get_stats().entries, 1);
+
+  /* created behind the cache's back */
+  int fd = open(path("a").c_str(), O_CREAT | O_WRONLY, 0600);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  for(int i = 0; i < 100 && cache.get_stats().entries > 0; i++) {
+    usleep(10000);
+  }
+  ASSERT_EQ(cache.get_stats().entries, 0);
+  ASSERT_EQ(cached_stat(cache, path("a"), &buf), 0);
+}
+
+//namespace testing
+}
@@ -0,0 +1,305 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <elkvm/overlay.h>
+#include <elkvm/types.h>
+
+namespace testing {
+
+class TheImageOverlay : public Test {
+  protected:
+    char image[32];
+    std::string tar;
+    std::shared_ptr<Elkvm::ImageOverlay> overlay;
+    std::string host_path;
+
+    TheImageOverlay() : image(), tar(), overlay(), host_path() {}
+
+    void add(const std::string &name, char type, const std::string &data,
+        const std::string &link = "") {
+      char h[512] = {};
+      strncpy(h, name.c_str(), 100);
+      snprintf(h + 100, 8, "%07o", type == '5' ? 0755 : 0644);
+      snprintf(h + 108, 8, "%07o", 1000);
+      snprintf(h + 116, 8, "%07o", 1000);
+      snprintf(h + 124, 12, "%011zo", data.size());
+      snprintf(h + 136, 12, "%011o", 1234567);
+      h[156] = type;
+      strncpy(h + 157, link.c_str(), 100);
+      memcpy(h + 257, "ustar", 6);
+      memcpy(h + 263, "00", 2);
+      memset(h + 148, ' ', 8);
+      unsigned sum = 0;
+      for(unsigned char c : h) {
+        sum += c;
+      }
+      snprintf(h + 148, 8, "%06o", sum);
+      tar.append(h, sizeof(h));
+      tar.append(data);
+      tar.append((512 - data.size() % 512) % 512, '\0');
+    }
+
+    void SetUp() {
+      add("./", '5', "");
+      add("./lib/", '5', "");
+      add("./lib/libfoo.so", '0', "foo contents");
+      add("./lib/libfoo.so.1", '2', "", "libfoo.so");
+      add("./lib/up", '2', "", "../..");
+      add("./lib/abs", '2', "", "/assets/lib/libfoo.so");
+      add("./lib/hard", '1', "", "./lib/libfoo.so");
+      /* share/ is only implied by its contents */
+      add("./share/data.bin", '0', std::string(5000, 'x'));
+      tar.append(1024, '\0');
+
+      strcpy(image, "/tmp/elkvm-overlay-XXXXXX");
+      int fd = mkstemp(image);
+      ASSERT_GE(fd, 0);
+      ASSERT_EQ(write(fd, tar.data(), tar.size()),
+          static_cast<ssize_t>(tar.size()));
+      close(fd);
+      overlay = Elkvm::ImageOverlay::load(image, "/assets/");
+      ASSERT_NE(overlay, nullptr);
+    }
+
+    void TearDown() {
+      unlink(image);
+    }
+
+    int open(const char *path, int flags = O_RDONLY, int dirfd = AT_FDCWD) {
+      long res = 0;
+      EXPECT_TRUE(overlay->open(dirfd, path, flags, &res, &host_path));
+      return res;
+    }
+};
+
+TEST_F(TheImageOverlay, LeavesOtherPathsAlone) {
+  long res;
+  struct stat buf;
+  ASSERT_EQ(overlay->mount_point(), "/assets");
+  ASSERT_FALSE(overlay->stat(AT_FDCWD, "/assetsx", 0, &buf, &res,
+        &host_path));
+  ASSERT_FALSE(overlay->stat(AT_FDCWD, "assets/lib", 0, &buf, &res,
+        &host_path));
+  ASSERT_TRUE(host_path.empty());
+  ASSERT_FALSE(overlay->fstat(0, &buf, &res));
+}
+
+TEST_F(TheImageOverlay, StatsEntriesOfTheArchive) {
+  long res;
+  struct stat buf;
+  ASSERT_TRUE(overlay->stat(AT_FDCWD, "/assets/lib/libfoo.so.1", 0, &buf,
+        &res, &host_path));
+  ASSERT_EQ(res, 0);
+  ASSERT_TRUE(S_ISREG(buf.st_mode));
+  ASSERT_EQ(buf.st_size, 12);
+  ASSERT_EQ(buf.st_uid, 1000);
+  ASSERT_EQ(buf.st_mtime, 1234567);
+  ASSERT_EQ(buf.st_nlink, 2);
+  const ino_t ino = buf.st_ino;
+
+  ASSERT_TRUE(overlay->stat(AT_FDCWD, "/assets/lib/libfoo.so.1",
+        AT_SYMLINK_NOFOLLOW, &buf, &res, &host_path));
+  ASSERT_TRUE(S_ISLNK(buf.st_mode));
+  ASSERT_TRUE(overlay->stat(AT_FDCWD, "/assets/lib/abs", 0, &buf, &res,
+        &host_path));
+  ASSERT_EQ(buf.st_ino, ino);
+  ASSERT_TRUE(overlay->stat(AT_FDCWD, "/assets/lib/hard", 0, &buf, &res,
+        &host_path));
+  ASSERT_EQ(buf.st_ino, ino);
+
+  ASSERT_TRUE(overlay->stat(AT_FDCWD, "/assets/share", 0, &buf, &res,
+        &host_path));
+  ASSERT_TRUE(S_ISDIR(buf.st_mode));
+  ASSERT_TRUE(overlay->stat(AT_FDCWD, "/assets/lib/./../lib/missing", 0,
+        &buf, &res, &host_path));
+  ASSERT_EQ(res, -ENOENT);
+  ASSERT_TRUE(overlay->stat(AT_FDCWD, "/assets/lib/libfoo.so/", 0, &buf,
+        &res, &host_path));
+  ASSERT_EQ(res, -ENOTDIR);
+}
+
+TEST_F(TheImageOverlay, HandsPathsLeavingTheImageBack) {
+  long res;
+  struct stat buf;
+  ASSERT_FALSE(overlay->stat(AT_FDCWD, "/assets/lib/up/etc/passwd", 0, &buf,
+        &res, &host_path));
+  ASSERT_EQ(host_path, "/etc/passwd");
+}
+
+TEST_F(TheImageOverlay, ReadsFilesAndRefusesToWrite) {
+  int fd = open("/assets/lib/libfoo.so.1");
+  ASSERT_GE(fd, 0);
+  ASSERT_TRUE(overlay->owns(fd));
+
+  char a[4], b[32];
+  struct iovec iov[2] = { { a, sizeof(a) }, { b, sizeof(b) } };
+  long res;
+  ASSERT_TRUE(overlay->readv(fd, iov, 2, -1, &res));
+  ASSERT_EQ(res, 12);
+  ASSERT_EQ(std::string(a, 4) + std::string(b, 8), "foo contents");
+  ASSERT_TRUE(overlay->readv(fd, iov, 1, -1, &res));
+  ASSERT_EQ(res, 0);
+  ASSERT_TRUE(overlay->readv(fd, iov, 1, 4, &res));
+  ASSERT_EQ(std::string(a, res), "cont");
+  ASSERT_TRUE(overlay->lseek(fd, -8, SEEK_END, &res));
+  ASSERT_EQ(res, 4);
+
+  char page[4096];
+  ASSERT_TRUE(overlay->mmap(fd, page, sizeof(page), 0, &res));
+  ASSERT_EQ(res, 0);
+  ASSERT_EQ(std::string(page, 13), std::string("foo contents", 13));
+
+  overlay->dup(fd, 100);
+  ASSERT_TRUE(overlay->lseek(100, 0, SEEK_CUR, &res));
+  ASSERT_EQ(res, 4);
+  overlay->close(100);
+  overlay->close(fd);
+  close(fd);
+  ASSERT_FALSE(overlay->owns(fd));
+
+  ASSERT_EQ(open("/assets/lib/libfoo.so", O_RDWR), -EROFS);
+  ASSERT_EQ(open("/assets/lib/new", O_CREAT | O_WRONLY), -EROFS);
+  ASSERT_EQ(open("/assets/lib/libfoo.so.1", O_NOFOLLOW), -ELOOP);
+  ASSERT_EQ(open("/assets/lib/libfoo.so", O_DIRECTORY), -ENOTDIR);
+}
+
+TEST_F(TheImageOverlay, SendsFilesLikeSendfile) {
+  int fd = open("/assets/lib/libfoo.so");
+  ASSERT_GE(fd, 0);
+  int pipefd[2];
+  ASSERT_EQ(pipe(pipefd), 0);
+  auto out = [&pipefd](const void *buf, size_t len) -> long {
+    long res = write(pipefd[1], buf, len);
+    return res < 0 ? -errno : res;
+  };
+  auto refuse = [](const void *, size_t) -> long { return -EPIPE; };
+
+  char buf[32];
+  long res;
+  ASSERT_TRUE(overlay->send(fd, -1, 3, out, &res));
+  ASSERT_EQ(res, 3);
+  ASSERT_EQ(read(pipefd[0], buf, sizeof(buf)), 3);
+  ASSERT_EQ(std::string(buf, 3), "foo");
+  ASSERT_TRUE(overlay->lseek(fd, 0, SEEK_CUR, &res));
+  ASSERT_EQ(res, 3);
+
+  ASSERT_TRUE(overlay->send(fd, 4, 100, out, &res));
+  ASSERT_EQ(res, 8);
+  ASSERT_EQ(read(pipefd[0], buf, sizeof(buf)), 8);
+  ASSERT_EQ(std::string(buf, 8), "contents");
+  ASSERT_TRUE(overlay->lseek(fd, 0, SEEK_CUR, &res));
+  ASSERT_EQ(res, 3);
+
+  ASSERT_TRUE(overlay->send(fd, -1, 100, refuse, &res));
+  ASSERT_EQ(res, -EPIPE);
+  ASSERT_TRUE(overlay->send(fd, -1, 100, out, &res));
+  ASSERT_EQ(res, 9);
+  ASSERT_TRUE(overlay->send(fd, -1, 100, out, &res));
+  ASSERT_EQ(res, 0);
+
+  ASSERT_FALSE(overlay->send(pipefd[0], -1, 1, out, &res));
+  close(pipefd[0]);
+  close(pipefd[1]);
+  overlay->close(fd);
+  close(fd);
+}
+
+TEST_F(TheImageOverlay, ListsDirectories) {
+  int fd = open("/assets/lib", O_RDONLY | O_DIRECTORY);
+  ASSERT_GE(fd, 0);
+
+  /* one record at a time */
+  std::set<std::string> names;
+  char buf[32];
+  long res;
+  while(overlay->getdents64(fd, buf, sizeof(buf), &res) && res > 0) {
+    const struct linux_dirent64 *d =
+      reinterpret_cast<const struct linux_dirent64 *>(buf);
+    ASSERT_EQ(d->d_reclen, res);
+    names.insert(d->d_name);
+  }
+  ASSERT_EQ(res, 0);
+  ASSERT_EQ(names, std::set<std::string>({ ".", "..", "abs", "hard",
+        "libfoo.so", "libfoo.so.1", "up" }));
+
+  /* relative to the directory */
+  int file = open("libfoo.so", O_RDONLY, fd);
+  ASSERT_GE(file, 0);
+  overlay->close(file);
+  close(file);
+
+  ASSERT_TRUE(overlay->lseek(fd, 0, SEEK_SET, &res));
+  char small[8];
+  ASSERT_TRUE(overlay->getdents64(fd, small, sizeof(small), &res));
+  ASSERT_EQ(res, -EINVAL);
+  overlay->close(fd);
+  close(fd);
+}
+
+TEST_F(TheImageOverlay, ChecksAccessAndLinks) {
+  long res;
+  ASSERT_TRUE(overlay->access("/assets/lib/libfoo.so", R_OK, &res,
+        &host_path));
+  ASSERT_EQ(res, 0);
+  ASSERT_TRUE(overlay->access("/assets/lib/libfoo.so", W_OK, &res,
+        &host_path));
+  ASSERT_EQ(res, -EROFS);
+
+  char buf[64];
+  ASSERT_TRUE(overlay->readlink("/assets/lib/libfoo.so.1", buf, sizeof(buf),
+        &res, &host_path));
+  ASSERT_EQ(std::string(buf, res), "libfoo.so");
+  ASSERT_TRUE(overlay->readlink("/assets/lib/libfoo.so", buf, sizeof(buf),
+        &res, &host_path));
+  ASSERT_EQ(res, -EINVAL);
+}
+
+TEST_F(TheImageOverlay, RefusesBrokenArchives) {
+  tar[148] ^= 1;
+  int fd = ::open(image, O_WRONLY | O_TRUNC);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(write(fd, tar.data(), tar.size()),
+      static_cast<ssize_t>(tar.size()));
+  close(fd);
+  ASSERT_EQ(Elkvm::ImageOverlay::load(image, "/assets"), nullptr);
+  ASSERT_EQ(errno, EINVAL);
+  ASSERT_EQ(Elkvm::ImageOverlay::load(image, "/"), nullptr);
+}
+
+//namespace testing
+}
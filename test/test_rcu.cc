@@ -0,0 +1,120 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include <elkvm/rcu.h>
+
+namespace testing {
+
+class Rcu : public Test {
+  protected:
+    Elkvm::Rcu<std::vector<int>> rcu;
+
+    Rcu() : rcu() {}
+    ~Rcu() {}
+};
+
+TEST_F(Rcu, StartsWithAnEmptyObject) {
+  ASSERT_TRUE(rcu.read()->empty());
+}
+
+TEST_F(Rcu, PublishesUpdates) {
+  rcu.update([](std::vector<int> &v) { v.push_back(42); });
+  auto snap = rcu.read();
+  ASSERT_EQ(snap->size(), 1);
+  ASSERT_EQ((*snap)[0], 42);
+}
+
+TEST_F(Rcu, KeepsTheSnapshotOfAnActiveReader) {
+  rcu.update([](std::vector<int> &v) { v.push_back(1); });
+  auto snap = rcu.read();
+  rcu.update([](std::vector<int> &v) { v.clear(); });
+
+  ASSERT_EQ(snap->size(), 1);
+  ASSERT_EQ((*snap)[0], 1);
+  ASSERT_TRUE(rcu.read()->empty());
+}
+
+TEST_F(Rcu, ReadersSeeConsistentVersionsDuringUpdates) {
+  bool consistent = true;
+  std::thread reader([this, &consistent]() {
+      for(int i = 0; i < 100000; i++) {
+        auto snap = rcu.read();
+        for(unsigned j = 0; j < snap->size(); j++) {
+          if((*snap)[j] != static_cast<int>(j)) {
+            consistent = false;
+          }
+        }
+      }
+  });
+  for(int i = 0; i < 1000; i++) {
+    rcu.update([](std::vector<int> &v) { v.push_back(v.size()); });
+  }
+  reader.join();
+  ASSERT_TRUE(consistent);
+  ASSERT_EQ(rcu.read()->size(), 1000);
+}
+
+TEST_F(Rcu, ReplacesTheObject) {
+  rcu.update([](std::vector<int> &v) { v.push_back(1); });
+  rcu.replace(std::vector<int>(3, 7));
+  auto snap = rcu.read();
+  ASSERT_EQ(snap->size(), 3);
+  ASSERT_EQ((*snap)[0], 7);
+}
+
+struct Tracked {
+  static int live;
+  int value;
+
+  Tracked() : value(0) { live++; }
+  Tracked(const Tracked &o) : value(o.value) { live++; }
+  Tracked &operator=(const Tracked &o) { value = o.value; return *this; }
+  ~Tracked() { live--; }
+};
+int Tracked::live = 0;
+
+TEST(RcuReclaim, FreesVersionsWhileReadersOverlap) {
+  typedef Elkvm::Rcu<Tracked>::ReadGuard Guard;
+  {
+    Elkvm::Rcu<Tracked> rcu;
+    /* there is always a reader, each one enters before the last one leaves */
+    std::unique_ptr<Guard> held(new Guard(rcu.read()));
+    for(int i = 1; i <= 100; i++) {
+      rcu.update([i](Tracked &t) { t.value = i; });
+      std::unique_ptr<Guard> next(new Guard(rcu.read()));
+      ASSERT_EQ((*next)->value, i);
+      held = std::move(next);
+    }
+    ASSERT_LE(Tracked::live, 4);
+  }
+}
+
+//namespace testing
+}
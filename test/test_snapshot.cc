@@ -0,0 +1,147 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/kvm.h>
+#include <elkvm/pager.h>
+#include <elkvm/region_manager.h>
+#include <elkvm/snapshot.h>
+
+namespace testing {
+
+/* all of these need /dev/kvm */
+class TheSnapshot : public Test {
+  protected:
+    Elkvm::elkvm_opts opts;
+    std::shared_ptr<Elkvm::VM> vm;
+    static const guestptr_t addr = 0x400000;
+
+    TheSnapshot() : opts(), vm() {}
+    ~TheSnapshot() {}
+
+    virtual void SetUp() {
+      ASSERT_EQ(elkvm_init(&opts, 0, nullptr, nullptr), 0);
+      vm = elkvm_vm_create_raw(&opts);
+
+      /* one page of guest memory to tell the VMs apart by */
+      auto rm = vm->get_region_manager();
+      auto r = rm->allocate_region(ELKVM_PAGESIZE);
+      ASSERT_EQ(rm->get_pager().map_region(r->base_address(), addr, 1,
+            PT_OPT_WRITE), 0);
+      *static_cast<char *>(vm->host_p(addr)) = 'a';
+    }
+
+    virtual void TearDown() {
+      vm = nullptr;
+      elkvm_cleanup(&opts);
+    }
+
+    static char &at(const std::shared_ptr<Elkvm::VM> &v) {
+      return *static_cast<char *>(v->host_p(addr));
+    }
+};
+
+TEST_F(TheSnapshot, DISABLED_ClonesTheGuestMemory) {
+  auto snap = vm->snapshot();
+  ASSERT_NE(snap, nullptr);
+
+  auto clone = snap->clone();
+  ASSERT_NE(clone, nullptr);
+  ASSERT_NE(clone->host_p(addr), vm->host_p(addr));
+  ASSERT_EQ(at(clone), 'a');
+}
+
+TEST_F(TheSnapshot, DISABLED_KeepsWritesOfACloneToItself) {
+  auto snap = vm->snapshot();
+  ASSERT_NE(snap, nullptr);
+  auto first = snap->clone();
+  auto second = snap->clone();
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+
+  at(first) = 'b';
+  ASSERT_EQ(at(second), 'a');
+  ASSERT_EQ(at(vm), 'a');
+  ASSERT_EQ(at(snap->clone()), 'a');
+}
+
+TEST_F(TheSnapshot, DISABLED_IsNotChangedByTheOriginalVM) {
+  auto snap = vm->snapshot();
+  ASSERT_NE(snap, nullptr);
+
+  at(vm) = 'b';
+  auto clone = snap->clone();
+  ASSERT_NE(clone, nullptr);
+  ASSERT_EQ(at(clone), 'a');
+}
+
+TEST_F(TheSnapshot, DISABLED_ResetsACloneToItsState) {
+  auto snap = vm->snapshot();
+  ASSERT_NE(snap, nullptr);
+  auto clone = snap->clone();
+  ASSERT_NE(clone, nullptr);
+
+  at(clone) = 'b';
+  ASSERT_EQ(clone->reset(*snap), 0);
+  ASSERT_EQ(at(clone), 'a');
+}
+
+TEST_F(TheSnapshot, DISABLED_ReportsFailedClones) {
+  auto snap = vm->snapshot();
+  ASSERT_NE(snap, nullptr);
+
+  /* leave room for the KVM VM of the clone, but not for its VCPU */
+  int fd = open("/dev/null", O_RDONLY);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  struct rlimit old;
+  ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &old), 0);
+  struct rlimit lim = old;
+  lim.rlim_cur = fd + 1;
+  ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &lim), 0);
+
+  errno = 0;
+  auto clone = snap->clone();
+  const int err = errno;
+  ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &old), 0);
+  ASSERT_EQ(clone, nullptr);
+  ASSERT_EQ(err, EMFILE);
+
+  ASSERT_NE(snap->clone(), nullptr);
+}
+
+//namespace testing
+}
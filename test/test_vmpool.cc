@@ -0,0 +1,78 @@
+//
+// libelkvm - A library that allows execution of an ELF binary inside a virtual
+// machine without a full-scale operating system
+// Copyright (C) 2013-2015 Florian Pester <fpester@os.inf.tu-dresden.de>, Björn
+// Döbel <doebel@os.inf.tu-dresden.de>,   economic rights: Technische Universitaet
+// Dresden (Germany)
+//
+// This file is part of libelkvm.
+//
+// libelkvm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libelkvm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libelkvm.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <list>
+#include <memory>
+#include <stdexcept>
+
+#include <elkvm/elkvm.h>
+#include <elkvm/kvm.h>
+#include <elkvm/vmpool.h>
+
+namespace Elkvm {
+  extern std::list<std::shared_ptr<VM> > vmi;
+}
+
+namespace testing {
+
+class TheVMPool : public Test {
+  protected:
+    Elkvm::elkvm_opts opts;
+
+    TheVMPool() : opts() {}
+    ~TheVMPool() {}
+
+    virtual void SetUp() {
+      ASSERT_EQ(elkvm_init(&opts, 0, nullptr, nullptr), 0);
+    }
+    virtual void TearDown() {
+      elkvm_cleanup(&opts);
+    }
+};
+
+TEST_F(TheVMPool, DISABLED_DoesNotKeepTheVMItWasCreatedFrom) {
+  auto vms = Elkvm::vmi.size();
+  auto pool = Elkvm::VMPool::create(&opts, 1);
+  ASSERT_NE(pool, nullptr);
+  ASSERT_EQ(Elkvm::vmi.size(), vms);
+}
+
+TEST_F(TheVMPool, DISABLED_HandsOutVMsWithTheGivenNumberOfVCPUs) {
+  auto pool = Elkvm::VMPool::create(&opts, 1, nullptr, &Elkvm::hypercall_null,
+      &Elkvm::default_handlers, 2);
+  ASSERT_NE(pool, nullptr);
+
+  auto vm = pool->acquire();
+  ASSERT_NE(vm, nullptr);
+  ASSERT_NE(vm->get_vcpu(1), nullptr);
+  ASSERT_THROW(vm->get_vcpu(2), std::out_of_range);
+}
+
+//namespace testing
+}